@@ -0,0 +1,98 @@
+#!/usr/bin/perl -w
+
+# Answers HTTP requests on the given addresses as a backend whose health
+# is taken from a state file, which is read again on each request, so
+# the backend may be made to fail and recover while it runs.  A line of
+# the file is an address and its state, one of:
+#
+#     ok       200 with "OK" in the body, the default
+#     null     200 with null bytes before "OK" in the body
+#     body     200 without "OK" in the body
+#     NNN      the status NNN with "OK" in the body
+#     close    the connection is closed without a response
+#     hang     the connection is kept without a response
+#
+#     check-stub.pl state 127.0.0.1:8081 127.0.0.2:8081 127.0.0.3:8081
+#
+# with lines such as "127.0.0.2:8081 404" in the state file.
+
+use warnings;
+use strict;
+
+use IO::Select;
+use IO::Socket::INET;
+
+my ($state, @addrs) = @ARGV;
+
+die "usage: $0 state address ...\n" unless @addrs;
+
+$SIG{CHLD} = 'IGNORE';
+
+my $select = IO::Select->new();
+
+for my $addr (@addrs) {
+	my $s = IO::Socket::INET->new(LocalAddr => $addr, Listen => 128,
+			ReuseAddr => 1)
+		or die "listen $addr: $!\n";
+
+	$select->add($s);
+}
+
+while (1) {
+	for my $s ($select->can_read()) {
+		my $c = $s->accept() or next;
+
+		my $pid = fork();
+
+		die "fork: $!\n" unless defined $pid;
+
+		if ($pid == 0) {
+			answer($c, $s->sockhost() . ':' . $s->sockport());
+			exit;
+		}
+
+		close($c);
+	}
+}
+
+sub answer {
+	my ($c, $addr) = @_;
+
+	my $request = '';
+
+	local $SIG{ALRM} = sub { exit };
+	alarm(5);
+
+	while ($request !~ /\r\n\r\n/) {
+		$c->sysread($request, 4096, length($request)) or exit;
+	}
+
+	alarm(0);
+
+	my $mode = 'ok';
+
+	if (open(my $fh, '<', $state)) {
+		while (<$fh>) {
+			s/#.*//;
+			my ($a, $m) = split;
+			$mode = $m if defined $m && $a eq $addr;
+		}
+
+		close($fh);
+	}
+
+	return if $mode eq 'close';
+
+	if ($mode eq 'hang') {
+		sleep(60);
+		return;
+	}
+
+	my $status = $mode =~ /^\d{3}$/ ? $mode : 200;
+	my $body = $mode eq 'body' ? "FAIL $addr\n"
+		: $mode eq 'null' ? "\0\0OK $addr\n" : "OK $addr\n";
+
+	$c->syswrite("HTTP/1.0 $status Stub\r\n"
+		. "Content-Type: text/plain\r\n"
+		. "Content-Length: " . length($body) . "\r\n\r\n" . $body);
+}
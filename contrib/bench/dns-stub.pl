@@ -0,0 +1,83 @@
+#!/usr/bin/perl -w
+
+# Answers A queries on the given UDP address from a hosts file, which
+# is read again on each query, so the answers may be changed while
+# it runs; names not in the file are answered with NXDOMAIN, and
+# other queries with no records.  The answers live for the given TTL.
+#
+#     dns-stub.pl 127.0.0.1:5353 hosts 2
+#
+# with lines such as "127.0.0.2 backend.test" in the hosts file.
+
+use warnings;
+use strict;
+
+use IO::Socket::INET;
+
+my ($addr, $hosts, $ttl) = @ARGV;
+
+die "usage: $0 address hosts [ttl]\n" unless defined $hosts;
+
+$ttl = 5 unless defined $ttl;
+
+my $s = IO::Socket::INET->new(LocalAddr => $addr, Proto => 'udp')
+	or die "bind: $!\n";
+
+while (1) {
+	my $query;
+
+	$s->recv($query, 512) or next;
+
+	next if length($query) < 12;
+
+	my ($id, $flags) = unpack('nn', $query);
+
+	my ($name, $pos) = ('', 12);
+
+	while ($pos < length($query)) {
+		my $len = ord(substr($query, $pos++, 1));
+		last if $len == 0;
+
+		$name .= '.' if length($name);
+		$name .= lc(substr($query, $pos, $len));
+		$pos += $len;
+	}
+
+	next if $pos + 4 > length($query);
+
+	my $question = substr($query, 12, $pos + 4 - 12);
+	my ($type) = unpack('n', substr($query, $pos, 2));
+
+	my (@addrs, $known);
+
+	if (open(my $fh, '<', $hosts)) {
+		while (<$fh>) {
+			s/#.*//;
+			my ($ip, @names) = split;
+			next unless defined $ip;
+			next unless grep { lc($_) eq $name } @names;
+
+			$known = 1;
+			push @addrs, $ip if $ip =~ /^\d+\.\d+\.\d+\.\d+$/;
+		}
+
+		close($fh);
+	}
+
+	@addrs = () if $type != 1;
+
+	my $answer = '';
+
+	for my $ip (@addrs) {
+		$answer .= pack('nnnNn', 0xc00c, 1, 1, $ttl, 4)
+			. pack('C4', split(/\./, $ip));
+	}
+
+	my $rcode = $known ? 0 : 3;
+
+	my $reply = pack('nnnnnn', $id, 0x8180 | ($flags & 0x0100) | $rcode,
+			1, scalar(@addrs), 0, 0)
+		. $question . $answer;
+
+	$s->send($reply);
+}
@@ -0,0 +1,109 @@
+#!/usr/bin/perl -w
+
+# Opens the given number of keepalive connections and for the given time
+# sends a request on each of them in turn, so that every epoll_wait()
+# returns events spread over the whole connection array.  With the worker
+# pid given, counts the cache misses of the worker with "perf stat" and
+# prints them per request, that is per read event.
+#
+#     event-misses.pl http://127.0.0.1/ 60000 10 <worker pid>
+
+use warnings;
+use strict;
+
+use IO::Socket::INET;
+use Time::HiRes qw/ time /;
+
+my ($url, $n, $seconds, $pid) = @ARGV;
+
+die "usage: $0 url connections seconds [pid]\n" unless defined $seconds;
+
+my ($host, $port, $uri) = $url =~ m!^http://([^:/]+)(?::(\d+))?(/.*)$!
+	or die "$url: unsupported url\n";
+
+$port ||= 80;
+
+my $request = "GET $uri HTTP/1.1\r\nHost: $host\r\n\r\n";
+my @socks;
+
+for (1 .. $n) {
+	my $s = IO::Socket::INET->new(PeerAddr => $host, PeerPort => $port)
+		or die "connect: $!\n";
+
+	push @socks, $s;
+}
+
+my ($perf, $stats);
+
+if (defined $pid) {
+	$stats = "/tmp/event-misses.$$";
+
+	$perf = fork();
+	die "fork: $!\n" unless defined $perf;
+
+	if ($perf == 0) {
+		exec('perf', 'stat', '-x', ',', '-o', $stats,
+			'-e', 'cache-misses,cache-references,instructions',
+			'-p', $pid)
+			or die "perf: $!\n";
+	}
+
+	sleep(1);
+}
+
+my $requests = 0;
+my $start = time();
+
+while (time() - $start < $seconds) {
+
+	# send a batch of requests first, then read the responses, so that
+	# the worker finds many ready connections in one epoll_wait() call
+
+	for (my $i = 0; $i < @socks; $i += 512) {
+		my $last = $i + 511 < $#socks ? $i + 511 : $#socks;
+
+		$socks[$_]->syswrite($request) for $i .. $last;
+		response($socks[$_]) for $i .. $last;
+
+		$requests += $last - $i + 1;
+	}
+}
+
+my $elapsed = time() - $start;
+
+printf("%d requests, %.0f requests per second\n",
+	$requests, $requests / $elapsed);
+
+exit unless defined $perf;
+
+kill('INT', $perf);
+waitpid($perf, 0);
+
+open(my $fh, '<', $stats) or die "$stats: $!\n";
+
+while (<$fh>) {
+	my ($count, undef, $event) = split(/,/);
+
+	next unless defined $event && $count =~ /^\d+$/;
+
+	printf("%s: %d, %.1f per request\n", $event, $count, $count / $requests);
+}
+
+close($fh);
+unlink($stats);
+
+sub response {
+	my ($s) = @_;
+	my ($buf, $length) = ('');
+
+	while (1) {
+		$s->sysread($buf, 4096, length($buf)) or die "read: $!\n";
+
+		if (!defined $length && $buf =~ /\r\n\r\n/) {
+			($length) = $buf =~ /^Content-Length: (\d+)/mi;
+			$length = length($`) + 4 + $length;
+		}
+
+		return if defined $length && length($buf) >= $length;
+	}
+}
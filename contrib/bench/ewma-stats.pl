@@ -0,0 +1,46 @@
+#!/usr/bin/perl -w
+
+# Summarizes logs written with the "upstream" log format of ewma.conf:
+# the share of requests each peer got, and the median and 99th
+# percentile of the response header time, overall and per peer.
+#
+#     ewma-stats.pl logs/rr.log logs/lc.log logs/ewma.log
+
+use warnings;
+use strict;
+
+for my $log (@ARGV) {
+	my (%times, @all);
+
+	open(my $fh, '<', $log) or die "$log: $!\n";
+
+	while (<$fh>) {
+		my ($addr, $time) = split;
+
+		next unless defined $time && $time =~ /^[\d.]+$/;
+
+		push @{$times{$addr}}, $time;
+		push @all, $time;
+	}
+
+	close($fh);
+
+	next unless @all;
+
+	printf("%s: %d requests, p50 %.3f, p99 %.3f\n",
+		$log, scalar @all, pct(\@all, 50), pct(\@all, 99));
+
+	for my $addr (sort keys %times) {
+		my $t = $times{$addr};
+
+		printf("    %-20s %5.1f%%  p50 %.3f  p99 %.3f\n",
+			$addr, 100 * @$t / @all, pct($t, 50), pct($t, 99));
+	}
+}
+
+sub pct {
+	my ($t, $p) = @_;
+	my @s = sort { $a <=> $b } @$t;
+
+	return $s[int($#s * $p / 100)];
+}
@@ -0,0 +1,83 @@
+#!/usr/bin/perl -w
+
+# Generates a geo module include with a prefix length distribution close
+# to that of the global routing table: mostly /24 for IPv4 and /48 for
+# IPv6, clustered in a number of allocated blocks.
+#
+#     geo-prefixes.pl [ipv4 prefixes [ipv6 prefixes]] > geo-prefixes.conf
+#
+# The defaults are 900000 IPv4 and 300000 IPv6 prefixes.
+
+use warnings;
+use strict;
+
+my $n4 = $ARGV[0] // 900000;
+my $n6 = $ARGV[1] // 300000;
+
+srand(1);
+
+my @blocks4 = map { 1 + int(rand(223)) } 1 .. 200;
+my @blocks6 = map { 0x2000 + int(rand(0x2000)) } 1 .. 64;
+
+my %seen;
+
+for (my $i = 0; $i < $n4; ) {
+	my $len = len4();
+	my $addr = ($blocks4[rand @blocks4] << 24) | int(rand(0x1000000));
+
+	$addr &= (0xffffffff << (32 - $len)) & 0xffffffff;
+
+	my $net = join('.', unpack('C4', pack('N', $addr))) . "/$len";
+
+	next if $seen{$net}++;
+
+	print "$net\t", value(), ";\n";
+	$i++;
+}
+
+for (my $i = 0; $i < $n6; ) {
+	my $len = len6();
+	my @w = ($blocks6[rand @blocks6], map { int(rand(0x10000)) } 1 .. 7);
+
+	for my $k (0 .. 7) {
+		my $bits = $len - 16 * $k;
+		$w[$k] &= $bits >= 16 ? 0xffff
+			: $bits <= 0 ? 0 : (0xffff << (16 - $bits)) & 0xffff;
+	}
+
+	my $net = join(':', map { sprintf('%x', $_) } @w) . "/$len";
+
+	next if $seen{$net}++;
+
+	print "$net\t", value(), ";\n";
+	$i++;
+}
+
+sub len4 {
+	my $r = rand(100);
+
+	return 24 if $r < 58;
+	return 23 if $r < 70;
+	return 22 if $r < 80;
+	return 21 if $r < 86;
+	return 20 if $r < 90;
+	return 16 + int(rand(4)) if $r < 95;
+	return 8 + int(rand(8));
+}
+
+sub len6 {
+	my $r = rand(100);
+
+	return 48 if $r < 45;
+	return 32 if $r < 60;
+	return 44 if $r < 70;
+	return 40 if $r < 78;
+	return 36 if $r < 85;
+	return 29 if $r < 90;
+	return 56 + int(rand(9)) if $r < 95;
+	return 64;
+}
+
+sub value {
+	return chr(65 + int(rand(26))) . chr(65 + int(rand(26)));
+}
@@ -0,0 +1,412 @@
+
+/*
+ * Measures the lookup of static locations: builds a level of the given
+ * number of prefix and exact locations with the code of ngx_http.c,
+ * looks up random URIs with ngx_http_core_find_static_location(), and
+ * checks each result against a lookup over the sorted names.  The URIs
+ * are hits, misses, longer URIs, and URIs without the trailing slash
+ * of a location with an auto redirect.
+ *
+ * It is built in a configured and built tree, with the objects of
+ * nginx but those it includes, and the libraries of the link command
+ * in objs/Makefile, e.g.
+ *
+ *     cc -O2 -o objs/locations -I src/core -I src/event \
+ *         -I src/event/modules -I src/os/unix -I objs -I src/http \
+ *         -I src/http/modules -I src/http/v2 contrib/bench/locations.c \
+ *         $(sed -n '/^objs.nginx:/,/^$/p' objs/Makefile \
+ *           | grep -o 'objs/.*\.o' \
+ *           | grep -v -e /nginx.o -e /ngx_http.o -e /ngx_http_core_module.o) \
+ *         -lpthread -lcrypt -lssl -lcrypto -lz
+ *
+ *     objs/locations 5000 200000
+ *
+ * The arguments are the numbers of locations and URIs, 5000 and 200000
+ * by default.  The same program may be built in trees of different
+ * versions to compare them.
+ */
+
+
+#define main  ngx_nginx_main
+
+#include "../../src/core/nginx.c"
+
+#undef main
+
+#include "../../src/http/ngx_http.c"
+#include "../../src/http/ngx_http_core_module.c"
+
+
+typedef struct {
+    ngx_str_t                  name;
+    ngx_http_core_loc_conf_t  *clcf;
+} ngx_bench_location_t;
+
+
+static ngx_int_t ngx_bench_find(ngx_str_t *uri, ngx_bench_location_t *exact,
+    ngx_uint_t nexact, ngx_bench_location_t *prefix, ngx_uint_t nprefix,
+    void ***loc_conf);
+static ngx_bench_location_t *ngx_bench_search(ngx_bench_location_t *locs,
+    ngx_uint_t n, u_char *name, size_t len);
+static ngx_uint_t ngx_bench_unique(ngx_bench_location_t *locs, ngx_uint_t n);
+static int ngx_libc_cdecl ngx_bench_cmp(const void *one, const void *two);
+static u_char *ngx_bench_name(u_char *p);
+
+
+static char  *ngx_bench_segments[] = {
+    "api", "v1", "v2", "users", "static", "img", "css", "js", "product",
+    "catalog", "admin", "search", "blog", "post", "media", "files",
+    "download", "account", "cart", "checkout"
+};
+
+
+int ngx_cdecl
+main(int argc, char *const *argv)
+{
+    u_char                     buf[256], *p;
+    double                     ns, best;
+    ngx_int_t                  rc, expected;
+    ngx_log_t                  log;
+    ngx_str_t                 *uris;
+    ngx_uint_t                 i, n, nuris, nexact, nprefix, mismatches,
+                               run;
+    ngx_pool_t                *pool;
+    ngx_conf_t                 conf;
+    ngx_conf_file_t            conf_file;
+    ngx_open_file_t            file;
+    ngx_connection_t           c;
+    ngx_http_request_t         r;
+    ngx_bench_location_t      *exact, *prefix, *loc;
+    ngx_http_core_srv_conf_t   cscf;
+    ngx_http_core_loc_conf_t  *pclcf, *clcf;
+    volatile ngx_int_t         sink;
+    void                     **loc_conf;
+    struct timespec            ts, te;
+
+    n = (argc > 1) ? (ngx_uint_t) atoi(argv[1]) : 5000;
+    nuris = (argc > 2) ? (ngx_uint_t) atoi(argv[2]) : 200000;
+
+    if (n == 0 || nuris == 0) {
+        fprintf(stderr, "usage: %s [locations [uris]]\n", argv[0]);
+        return 1;
+    }
+
+    ngx_pagesize = getpagesize();
+    ngx_cacheline_size = NGX_CPU_CACHE_LINE;
+
+    ngx_time_init();
+
+    ngx_memzero(&file, sizeof(ngx_open_file_t));
+    ngx_memzero(&log, sizeof(ngx_log_t));
+
+    file.fd = ngx_stderr;
+    log.file = &file;
+    log.log_level = NGX_LOG_CRIT;
+
+    pool = ngx_create_pool(NGX_DEFAULT_POOL_SIZE, &log);
+    if (pool == NULL) {
+        return 1;
+    }
+
+    ngx_memzero(&conf, sizeof(ngx_conf_t));
+    ngx_memzero(&conf_file, sizeof(ngx_conf_file_t));
+    ngx_str_set(&conf_file.file.name, "locations");
+
+    conf.pool = pool;
+    conf.temp_pool = pool;
+    conf.log = &log;
+    conf.conf_file = &conf_file;
+
+    pclcf = ngx_pcalloc(pool, sizeof(ngx_http_core_loc_conf_t));
+    exact = ngx_palloc(pool, n * sizeof(ngx_bench_location_t));
+    prefix = ngx_palloc(pool, n * sizeof(ngx_bench_location_t));
+    uris = ngx_palloc(pool, nuris * sizeof(ngx_str_t));
+
+    if (pclcf == NULL || exact == NULL || prefix == NULL || uris == NULL) {
+        return 1;
+    }
+
+    srandom(1);
+
+    nexact = 0;
+    nprefix = 0;
+
+    for (i = 0; i < n; i++) {
+
+        p = ngx_bench_name(buf);
+
+        if (random() % 3 == 0) {
+            *p++ = '/';
+        }
+
+        clcf = ngx_pcalloc(pool, sizeof(ngx_http_core_loc_conf_t));
+        if (clcf == NULL) {
+            return 1;
+        }
+
+        /* the names are null-terminated as in the configuration */
+
+        clcf->name.len = p - buf;
+        clcf->name.data = ngx_pnalloc(pool, p - buf + 1);
+        if (clcf->name.data == NULL) {
+            return 1;
+        }
+
+        ngx_cpystrn(clcf->name.data, buf, p - buf + 1);
+
+        clcf->loc_conf = (void **) clcf;
+        clcf->exact_match = (random() % 4 == 0);
+        clcf->auto_redirect = (p[-1] == '/' && random() % 2 == 0);
+
+        loc = clcf->exact_match ? &exact[nexact++] : &prefix[nprefix++];
+
+        loc->name = clcf->name;
+        loc->clcf = clcf;
+    }
+
+    nexact = ngx_bench_unique(exact, nexact);
+    nprefix = ngx_bench_unique(prefix, nprefix);
+
+    for (i = 0; i < nexact + nprefix; i++) {
+        loc = (i < nexact) ? &exact[i] : &prefix[i - nexact];
+
+        if (ngx_http_add_location(&conf, &pclcf->locations, loc->clcf)
+            != NGX_OK)
+        {
+            return 1;
+        }
+    }
+
+    ngx_memzero(&cscf, sizeof(ngx_http_core_srv_conf_t));
+
+    if (ngx_http_init_locations(&conf, &cscf, pclcf) != NGX_OK) {
+        return 1;
+    }
+
+    if (ngx_http_init_static_location_trees(&conf, pclcf) != NGX_OK) {
+        return 1;
+    }
+
+    for (i = 0; i < nuris; i++) {
+
+        loc = (random() % 2) ? &prefix[random() % nprefix]
+                             : &exact[random() % nexact];
+
+        p = ngx_cpymem(buf, loc->name.data, loc->name.len);
+
+        switch (random() % 4) {
+
+        case 0:
+            break;
+
+        case 1:
+            p = ngx_sprintf(p, "/item/%d.html", (int) (random() % 100));
+            break;
+
+        case 2:
+            p = ngx_bench_name(buf);
+            break;
+
+        default:
+            if (p[-1] == '/') {
+                p--;
+
+            } else {
+                p = ngx_cpymem(p, "/x", 2);
+            }
+        }
+
+        uris[i].len = p - buf;
+        uris[i].data = ngx_pnalloc(pool, p - buf);
+        if (uris[i].data == NULL) {
+            return 1;
+        }
+
+        ngx_memcpy(uris[i].data, buf, p - buf);
+    }
+
+    ngx_memzero(&c, sizeof(ngx_connection_t));
+    ngx_memzero(&r, sizeof(ngx_http_request_t));
+
+    c.log = &log;
+    r.connection = &c;
+
+    mismatches = 0;
+
+    for (i = 0; i < nuris; i++) {
+        r.uri = uris[i];
+        r.loc_conf = NULL;
+
+        rc = ngx_http_core_find_static_location(&r, pclcf->static_locations);
+
+        expected = ngx_bench_find(&uris[i], exact, nexact, prefix, nprefix,
+                                  &loc_conf);
+
+        if (rc != expected || (rc != NGX_DECLINED && r.loc_conf != loc_conf)) {
+            if (mismatches++ < 10) {
+                fprintf(stderr, "mismatch: \"%.*s\" %d, expected %d\n",
+                        (int) uris[i].len, uris[i].data, (int) rc,
+                        (int) expected);
+            }
+        }
+    }
+
+    sink = 0;
+    best = 0;
+
+    for (run = 0; run < 5; run++) {
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+
+        for (i = 0; i < nuris; i++) {
+            r.uri = uris[i];
+            sink += ngx_http_core_find_static_location(&r,
+                                                     pclcf->static_locations);
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &te);
+
+        ns = ((te.tv_sec - ts.tv_sec) * 1e9 + (te.tv_nsec - ts.tv_nsec))
+             / nuris;
+
+        if (run == 0 || ns < best) {
+            best = ns;
+        }
+    }
+
+    (void) sink;
+
+    printf("locations: %lu exact, %lu prefix; uris: %lu; mismatches: %lu; "
+           "lookup: %.1f ns\n", (unsigned long) nexact,
+           (unsigned long) nprefix, (unsigned long) nuris,
+           (unsigned long) mismatches, best);
+
+    return mismatches ? 1 : 0;
+}
+
+
+/*
+ * the exact location named as the URI, an auto redirect to the location
+ * named as the URI with the trailing slash, or the longest prefix
+ */
+
+static ngx_int_t
+ngx_bench_find(ngx_str_t *uri, ngx_bench_location_t *exact,
+    ngx_uint_t nexact, ngx_bench_location_t *prefix, ngx_uint_t nprefix,
+    void ***loc_conf)
+{
+    u_char                 name[257];
+    size_t                 len;
+    ngx_bench_location_t  *e, *i;
+
+    e = ngx_bench_search(exact, nexact, uri->data, uri->len);
+
+    if (e) {
+        *loc_conf = e->clcf->loc_conf;
+        return NGX_OK;
+    }
+
+    i = ngx_bench_search(prefix, nprefix, uri->data, uri->len);
+
+    if (i) {
+        *loc_conf = i->clcf->loc_conf;
+        return NGX_AGAIN;
+    }
+
+    ngx_memcpy(name, uri->data, uri->len);
+    name[uri->len] = '/';
+
+    e = ngx_bench_search(exact, nexact, name, uri->len + 1);
+    i = ngx_bench_search(prefix, nprefix, name, uri->len + 1);
+
+    if (e && e->clcf->auto_redirect) {
+        *loc_conf = e->clcf->loc_conf;
+        return NGX_DONE;
+    }
+
+    if (i && i->clcf->auto_redirect) {
+        *loc_conf = (e ? e : i)->clcf->loc_conf;
+        return NGX_DONE;
+    }
+
+    for (len = uri->len; len; len--) {
+        i = ngx_bench_search(prefix, nprefix, uri->data, len);
+
+        if (i) {
+            *loc_conf = i->clcf->loc_conf;
+            return NGX_AGAIN;
+        }
+    }
+
+    return NGX_DECLINED;
+}
+
+
+static ngx_bench_location_t *
+ngx_bench_search(ngx_bench_location_t *locs, ngx_uint_t n, u_char *name,
+    size_t len)
+{
+    ngx_bench_location_t  key;
+
+    key.name.len = len;
+    key.name.data = name;
+
+    return bsearch(&key, locs, n, sizeof(ngx_bench_location_t),
+                   ngx_bench_cmp);
+}
+
+
+static ngx_uint_t
+ngx_bench_unique(ngx_bench_location_t *locs, ngx_uint_t n)
+{
+    ngx_uint_t  i, k;
+
+    if (n == 0) {
+        return 0;
+    }
+
+    ngx_qsort(locs, n, sizeof(ngx_bench_location_t), ngx_bench_cmp);
+
+    for (i = 1, k = 1; i < n; i++) {
+        if (ngx_bench_cmp(&locs[k - 1], &locs[i]) != 0) {
+            locs[k++] = locs[i];
+        }
+    }
+
+    return k;
+}
+
+
+static int ngx_libc_cdecl
+ngx_bench_cmp(const void *one, const void *two)
+{
+    ngx_int_t              rc;
+    ngx_bench_location_t  *first, *second;
+
+    first = (ngx_bench_location_t *) one;
+    second = (ngx_bench_location_t *) two;
+
+    rc = ngx_filename_cmp(first->name.data, second->name.data,
+                          ngx_min(first->name.len, second->name.len));
+
+    if (rc != 0) {
+        return (int) rc;
+    }
+
+    return (int) first->name.len - (int) second->name.len;
+}
+
+
+static u_char *
+ngx_bench_name(u_char *p)
+{
+    ngx_uint_t  i, n;
+
+    n = 1 + random() % 4;
+
+    for (i = 0; i < n; i++) {
+        p = ngx_sprintf(p, "/%s", ngx_bench_segments[random() % 20]);
+    }
+
+    return ngx_sprintf(p, "/%d", (int) (random() % 2000));
+}
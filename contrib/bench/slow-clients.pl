@@ -0,0 +1,56 @@
+#!/usr/bin/perl -w
+
+# Opens the given number of connections, requests the URL on each and
+# reads a few kilobytes a second from them for the given time, then
+# prints the current and peak resident memory of the given process.
+#
+#     slow-clients.pl http://127.0.0.1/spill/4m.bin 200 6 <worker pid>
+
+use warnings;
+use strict;
+
+use IO::Socket::INET;
+use Time::HiRes qw/ sleep time /;
+
+my ($url, $n, $seconds, $pid) = @ARGV;
+
+die "usage: $0 url connections seconds [pid]\n" unless defined $seconds;
+
+my ($host, $port, $uri) = $url =~ m!^http://([^:/]+)(?::(\d+))?(/.*)$!
+	or die "$url: unsupported url\n";
+
+$port ||= 80;
+
+my @socks;
+
+for (1 .. $n) {
+	my $s = IO::Socket::INET->new(PeerAddr => $host, PeerPort => $port)
+		or die "connect: $!\n";
+
+	$s->sockopt(SO_RCVBUF, 4096);
+	$s->blocking(0);
+	$s->syswrite("GET $uri HTTP/1.0\r\nHost: $host\r\n\r\n");
+
+	push @socks, $s;
+}
+
+my $start = time();
+
+while (time() - $start < $seconds) {
+	for my $s (@socks) {
+		my $buf;
+		$s->sysread($buf, 4096);
+	}
+
+	sleep(0.2);
+}
+
+exit unless defined $pid;
+
+open(my $fh, '<', "/proc/$pid/status") or die "$pid: $!\n";
+
+while (<$fh>) {
+	print if /^Vm(RSS|HWM):/;
+}
+
+close($fh);
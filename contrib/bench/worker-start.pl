@@ -0,0 +1,63 @@
+#!/usr/bin/perl -w
+
+# Starts nginx with the given prefix and configuration, waits for the
+# first response to the URL and prints the time it took, then prints
+# the current and peak resident memory of the worker and stops nginx.
+#
+#     worker-start.pl objs/nginx `pwd` contrib/bench/connections.conf \
+#         http://127.0.0.1/
+
+use warnings;
+use strict;
+
+use IO::Socket::INET;
+use Time::HiRes qw/ sleep time /;
+
+my ($nginx, $prefix, $conf, $url) = @ARGV;
+
+die "usage: $0 nginx prefix conf url\n" unless defined $url;
+
+my ($host, $port, $uri) = $url =~ m!^http://([^:/]+)(?::(\d+))?(/.*)$!
+	or die "$url: unsupported url\n";
+
+$port ||= 80;
+
+my $start = time();
+
+system($nginx, '-p', $prefix, '-c', $conf) == 0
+	or die "$nginx: failed to start\n";
+
+until (request()) {
+	die "$url: no response\n" if time() - $start > 30;
+	sleep(0.001);
+}
+
+printf("started in %.1f ms\n", (time() - $start) * 1000);
+
+open(my $fh, '<', "$prefix/logs/nginx.pid") or die "nginx.pid: $!\n";
+chomp(my $master = <$fh>);
+close($fh);
+
+for my $pid (split(' ', `pgrep -P $master`)) {
+	open($fh, '<', "/proc/$pid/status") or die "$pid: $!\n";
+
+	while (<$fh>) {
+		print "worker $pid $_" if /^Vm(RSS|HWM):/;
+	}
+
+	close($fh);
+}
+
+system($nginx, '-p', $prefix, '-c', $conf, '-s', 'stop');
+
+sub request {
+	my $s = IO::Socket::INET->new(PeerAddr => $host, PeerPort => $port)
+		or return 0;
+
+	$s->syswrite("GET $uri HTTP/1.0\r\nHost: $host\r\n\r\n");
+
+	my $buf = '';
+	1 while $s->sysread($buf, 4096, length($buf));
+
+	return $buf =~ m!^HTTP/1\.\d 200 !;
+}
@@ -121,6 +121,13 @@ typedef uintptr_t	ngx_vaddr_t;
 #endif
 
 
+#if __has_builtin(__builtin_prefetch)
+#define ngx_prefetch(p)     __builtin_prefetch(p)
+#else
+#define ngx_prefetch(p)
+#endif
+
+
 #define ngx_abort       abort
 
 
@@ -10,9 +10,13 @@
 #include <ngx_event.h>
 
 
+#define NGX_CONNECTIONS_CHUNK  512
+
+
 ngx_os_io_t  ngx_io;
 
 
+static void ngx_init_connections(ngx_cycle_t *cycle);
 static void ngx_drain_connections(ngx_cycle_t *cycle);
 
 
@@ -1049,6 +1053,20 @@ ngx_get_connection(ngx_socket_t s, ngx_log_t *log)
 
     c = ngx_cycle->free_connections;
 
+    /*
+     * the connections are reserved by the event module in a worker,
+     * the cycle created on reconfiguration in the single process mode
+     * has none
+     */
+
+    if (c == NULL
+        && ngx_cycle->connections
+        && ngx_cycle->init_connection_n < ngx_cycle->connection_n)
+    {
+        ngx_init_connections((ngx_cycle_t *) ngx_cycle);
+        c = ngx_cycle->free_connections;
+    }
+
     if (c == NULL) {
         ngx_drain_connections((ngx_cycle_t *) ngx_cycle);
         c = ngx_cycle->free_connections;
@@ -1099,6 +1117,53 @@ ngx_get_connection(ngx_socket_t s, ngx_log_t *log)
 }
 
 
+static void
+ngx_init_connections(ngx_cycle_t *cycle)
+{
+    ngx_uint_t         i, n;
+    ngx_event_t       *rev, *wev;
+    ngx_connection_t  *c, *next;
+
+    /*
+     * the next chunk of the reserved connections is linked into
+     * the free list in the ascending order, so the connections in use
+     * are kept dense at the start of the arrays
+     */
+
+    n = ngx_min(cycle->connection_n - cycle->init_connection_n,
+                NGX_CONNECTIONS_CHUNK);
+
+    c = cycle->connections;
+    rev = cycle->read_events;
+    wev = cycle->write_events;
+
+    i = cycle->init_connection_n + n;
+    next = cycle->free_connections;
+
+    do {
+        i--;
+
+        rev[i].closed = 1;
+        rev[i].instance = 1;
+        wev[i].closed = 1;
+
+        c[i].data = next;
+        c[i].read = &rev[i];
+        c[i].write = &wev[i];
+        c[i].fd = (ngx_socket_t) -1;
+
+        next = &c[i];
+    } while (i > cycle->init_connection_n);
+
+    cycle->free_connections = next;
+    cycle->init_connection_n += n;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_CORE, cycle->log, 0,
+                   "init connections: %ui of %ui",
+                   cycle->init_connection_n, cycle->connection_n);
+}
+
+
 void
 ngx_free_connection(ngx_connection_t *c)
 {
@@ -1265,7 +1330,7 @@ ngx_close_idle_connections(ngx_cycle_t *cycle)
 
     c = cycle->connections;
 
-    for (i = 0; i < cycle->connection_n; i++) {
+    for (i = 0; i < cycle->init_connection_n; i++) {
 
         /* THREAD: lock */
 
@@ -119,49 +119,20 @@ typedef enum {
 
 
 struct ngx_connection_s {
+
+    /*
+     * the fields used for every ready descriptor by the event loop and
+     * the protocol handlers, up to the pool, take the first 64 bytes on
+     * 64-bit platforms; the addresses and other fields used only on
+     * accept, logging or close are kept at the end
+     */
+
     void               *data;
     ngx_event_t        *read;
     ngx_event_t        *write;
 
     ngx_socket_t        fd;
 
-    ngx_recv_pt         recv;
-    ngx_send_pt         send;
-    ngx_recv_chain_pt   recv_chain;
-    ngx_send_chain_pt   send_chain;
-
-    ngx_listening_t    *listening;
-
-    off_t               sent;
-
-    ngx_log_t          *log;
-
-    ngx_pool_t         *pool;
-
-    int                 type;
-
-    struct sockaddr    *sockaddr;
-    socklen_t           socklen;
-    ngx_str_t           addr_text;
-
-    ngx_str_t           proxy_protocol_addr;
-    in_port_t           proxy_protocol_port;
-
-#if (NGX_SSL || NGX_COMPAT)
-    ngx_ssl_connection_t  *ssl;
-#endif
-
-    struct sockaddr    *local_sockaddr;
-    socklen_t           local_socklen;
-
-    ngx_buf_t          *buffer;
-
-    ngx_queue_t         queue;
-
-    ngx_atomic_uint_t   number;
-
-    ngx_uint_t          requests;
-
     unsigned            buffered:8;
 
     unsigned            log_error:3;     /* ngx_connection_log_error_e */
@@ -186,6 +157,44 @@ struct ngx_connection_s {
     unsigned            busy_count:2;
 #endif
 
+    ngx_recv_pt         recv;
+    ngx_send_pt         send;
+
+    ngx_log_t          *log;
+
+    ngx_pool_t         *pool;
+
+    ngx_buf_t          *buffer;
+
+#if (NGX_SSL || NGX_COMPAT)
+    ngx_ssl_connection_t  *ssl;
+#endif
+
+    ngx_recv_chain_pt   recv_chain;
+    ngx_send_chain_pt   send_chain;
+
+    off_t               sent;
+
+    ngx_uint_t          requests;
+
+    ngx_queue_t         queue;
+
+    ngx_listening_t    *listening;
+
+    ngx_atomic_uint_t   number;
+
+    int                 type;
+
+    struct sockaddr    *sockaddr;
+    socklen_t           socklen;
+    ngx_str_t           addr_text;
+
+    ngx_str_t           proxy_protocol_addr;
+    in_port_t           proxy_protocol_port;
+
+    struct sockaddr    *local_sockaddr;
+    socklen_t           local_socklen;
+
 #if (NGX_THREADS || NGX_COMPAT)
     ngx_thread_task_t  *sendfile_task;
 #endif
@@ -1307,7 +1307,7 @@ ngx_clean_old_cycles(ngx_event_t *ev)
 
         found = 0;
 
-        for (n = 0; n < cycle[i]->connection_n; n++) {
+        for (n = 0; n < cycle[i]->init_connection_n; n++) {
             if (cycle[i]->connections[n].fd != (ngx_socket_t) -1) {
                 found = 1;
 
@@ -1370,7 +1370,7 @@ ngx_shutdown_timer_handler(ngx_event_t *ev)
 
     c = cycle->connections;
 
-    for (i = 0; i < cycle->connection_n; i++) {
+    for (i = 0; i < cycle->init_connection_n; i++) {
 
         if (c[i].fd == (ngx_socket_t) -1
             || c[i].read == NULL
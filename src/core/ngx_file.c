@@ -131,6 +131,15 @@ ngx_write_chain_to_temp_file(ngx_temp_file_t *tf, ngx_chain_t *chain)
                                               tf->pool);
     }
 
+#endif
+
+#if (NGX_HAVE_IO_URING)
+
+    if (tf->io_uring_write) {
+        return ngx_file_io_uring_write_chain(&tf->file, chain, tf->offset,
+                                             tf->pool);
+    }
+
 #endif
 
     return ngx_write_chain_to_file(&tf->file, chain, tf->offset, tf->pool);
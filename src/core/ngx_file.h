@@ -34,6 +34,12 @@ struct ngx_file_s {
     ngx_event_aio_t           *aio;
 #endif
 
+#if (NGX_HAVE_IO_URING)
+    void                     (*write_aio_handler)(ngx_file_t *file);
+    void                      *write_aio_ctx;
+    ngx_event_aio_t           *write_aio;
+#endif
+
     unsigned                   valid_info:1;
     unsigned                   directio:1;
 };
@@ -81,6 +87,7 @@ typedef struct {
     unsigned                   persistent:1;
     unsigned                   clean:1;
     unsigned                   thread_write:1;
+    unsigned                   io_uring_write:1;
 } ngx_temp_file_t;
 
 
@@ -556,6 +556,132 @@ ngx_cidr_match(struct sockaddr *sa, ngx_array_t *cidrs)
 }
 
 
+ngx_cidr_tree_t *
+ngx_cidr_tree_create(ngx_pool_t *pool, ngx_array_t *cidrs)
+{
+    ngx_int_t         rc;
+    ngx_uint_t        i;
+    ngx_cidr_t       *cidr;
+    ngx_cidr_tree_t  *tree;
+
+    tree = ngx_pcalloc(pool, sizeof(ngx_cidr_tree_t));
+    if (tree == NULL) {
+        return NULL;
+    }
+
+    tree->tree = ngx_radix_tree_create(pool, 0);
+    if (tree->tree == NULL) {
+        return NULL;
+    }
+
+#if (NGX_HAVE_INET6)
+    tree->tree6 = ngx_radix_tree_create(pool, 0);
+    if (tree->tree6 == NULL) {
+        return NULL;
+    }
+#endif
+
+    cidr = cidrs->elts;
+
+    for (i = 0; i < cidrs->nelts; i++) {
+
+        switch (cidr[i].family) {
+
+#if (NGX_HAVE_INET6)
+        case AF_INET6:
+            rc = ngx_radix128tree_insert(tree->tree6,
+                                         cidr[i].u.in6.addr.s6_addr,
+                                         cidr[i].u.in6.mask.s6_addr, 1);
+            break;
+#endif
+
+#if (NGX_HAVE_UNIX_DOMAIN)
+        case AF_UNIX:
+            tree->unix_domain = 1;
+            rc = NGX_OK;
+            break;
+#endif
+
+        default: /* AF_INET */
+            rc = ngx_radix32tree_insert(tree->tree,
+                                        ntohl(cidr[i].u.in.addr),
+                                        ntohl(cidr[i].u.in.mask), 1);
+            break;
+        }
+
+        /* NGX_BUSY is okay, the network is already there */
+
+        if (rc == NGX_ERROR) {
+            return NULL;
+        }
+    }
+
+    if (ngx_radix_tree_compile(tree->tree) != NGX_OK) {
+        return NULL;
+    }
+
+#if (NGX_HAVE_INET6)
+    if (ngx_radix_tree_compile(tree->tree6) != NGX_OK) {
+        return NULL;
+    }
+#endif
+
+    return tree;
+}
+
+
+ngx_int_t
+ngx_cidr_tree_match(struct sockaddr *sa, ngx_cidr_tree_t *tree)
+{
+#if (NGX_HAVE_INET6)
+    u_char               *p;
+#endif
+    in_addr_t             inaddr;
+    uintptr_t             value;
+#if (NGX_HAVE_INET6)
+    struct sockaddr_in6  *sin6;
+#endif
+
+    switch (sa->sa_family) {
+
+    case AF_INET:
+        inaddr = ((struct sockaddr_in *) sa)->sin_addr.s_addr;
+        value = ngx_radix32tree_find(tree->tree, ntohl(inaddr));
+        break;
+
+#if (NGX_HAVE_INET6)
+    case AF_INET6:
+        sin6 = (struct sockaddr_in6 *) sa;
+        p = sin6->sin6_addr.s6_addr;
+
+        if (IN6_IS_ADDR_V4MAPPED(&sin6->sin6_addr)) {
+            inaddr = p[12] << 24;
+            inaddr += p[13] << 16;
+            inaddr += p[14] << 8;
+            inaddr += p[15];
+
+            value = ngx_radix32tree_find(tree->tree, inaddr);
+
+        } else {
+            value = ngx_radix128tree_find(tree->tree6, p);
+        }
+
+        break;
+#endif
+
+#if (NGX_HAVE_UNIX_DOMAIN)
+    case AF_UNIX:
+        return tree->unix_domain ? NGX_OK : NGX_DECLINED;
+#endif
+
+    default:
+        return NGX_DECLINED;
+    }
+
+    return (value == NGX_RADIX_NO_VALUE) ? NGX_DECLINED : NGX_OK;
+}
+
+
 ngx_int_t
 ngx_parse_addr(ngx_pool_t *pool, ngx_addr_t *addr, u_char *text, size_t len)
 {
@@ -71,6 +71,15 @@ typedef struct {
 } ngx_cidr_t;
 
 
+typedef struct {
+    ngx_radix_tree_t         *tree;
+#if (NGX_HAVE_INET6)
+    ngx_radix_tree_t         *tree6;
+#endif
+    ngx_uint_t                unix_domain;   /* unsigned  unix_domain:1; */
+} ngx_cidr_tree_t;
+
+
 typedef struct {
     struct sockaddr          *sockaddr;
     socklen_t                 socklen;
@@ -115,6 +124,8 @@ size_t ngx_sock_ntop(struct sockaddr *sa, socklen_t socklen, u_char *text,
 size_t ngx_inet_ntop(int family, void *addr, u_char *text, size_t len);
 ngx_int_t ngx_ptocidr(ngx_str_t *text, ngx_cidr_t *cidr);
 ngx_int_t ngx_cidr_match(struct sockaddr *sa, ngx_array_t *cidrs);
+ngx_cidr_tree_t *ngx_cidr_tree_create(ngx_pool_t *pool, ngx_array_t *cidrs);
+ngx_int_t ngx_cidr_tree_match(struct sockaddr *sa, ngx_cidr_tree_t *tree);
 ngx_int_t ngx_parse_addr(ngx_pool_t *pool, ngx_addr_t *addr, u_char *text,
     size_t len);
 ngx_int_t ngx_parse_addr_port(ngx_pool_t *pool, ngx_addr_t *addr,
@@ -21,7 +21,79 @@
 #define NGX_MIN_READ_AHEAD  (128 * 1024)
 
 
+/*
+ * shared open file cache keeps stat() info and errors of files and
+ * directories in a shared memory zone, so a file tested by one worker
+ * need not be retested by others; workers still keep their own file
+ * descriptors.  On Linux, parent directories of the cached files, and
+ * directories holding symlinks in their paths, are watched with inotify,
+ * and the watched entries are valid much longer.
+ */
+
+typedef struct {
+    ngx_rbtree_node_t        node;
+    ngx_queue_t              queue;
+
+    ngx_file_uniq_t          uniq;
+    time_t                   mtime;
+    off_t                    size;
+    ngx_err_t                err;
+
+    time_t                   created;
+    ngx_uint_t               generation;
+
+#if (NGX_HAVE_OPENAT)
+    size_t                   disable_symlinks_from;
+    unsigned                 disable_symlinks:2;
+#endif
+
+    unsigned                 watched:1;
+
+    unsigned                 is_dir:1;
+    unsigned                 is_file:1;
+    unsigned                 is_link:1;
+    unsigned                 is_exec:1;
+
+    size_t                   len;
+    u_char                   name[1];
+} ngx_open_file_shared_node_t;
+
+
+#if (NGX_HAVE_INOTIFY)
+
+#define NGX_OPEN_FILE_INOTIFY_MASK                                           \
+    (IN_ATTRIB|IN_MODIFY|IN_CLOSE_WRITE|IN_CREATE|IN_DELETE|IN_MOVED_FROM    \
+     |IN_MOVED_TO|IN_DELETE_SELF|IN_MOVE_SELF|IN_ONLYDIR)
+
+
+/*
+ * a directory seen by several names, e.g., via symlinks, has a single
+ * watch descriptor, and events on it are applied to all of the names
+ */
+
+typedef struct {
+    ngx_rbtree_node_t        node;         /* by watch descriptor */
+    ngx_queue_t              paths;
+
+    /* the directory holds symlinks in paths of watched directories */
+    unsigned                 links:1;
+} ngx_open_file_watch_t;
+
+
+typedef struct {
+    ngx_rbtree_node_t        node;         /* by directory name hash */
+    ngx_queue_t              queue;
+    ngx_open_file_watch_t   *watch;
+
+    size_t                   len;
+    u_char                   name[1];
+} ngx_open_file_watch_path_t;
+
+#endif
+
+
 static void ngx_open_file_cache_cleanup(void *data);
+static void ngx_open_file_cache_shared_cleanup(void *data);
 #if (NGX_HAVE_OPENAT)
 static ngx_fd_t ngx_openat_file_owner(ngx_fd_t at_fd, const u_char *name,
     ngx_int_t mode, ngx_int_t create, ngx_int_t access, ngx_log_t *log);
@@ -51,6 +123,39 @@ static ngx_cached_open_file_t *
     ngx_open_file_lookup(ngx_open_file_cache_t *cache, ngx_str_t *name,
     uint32_t hash);
 static void ngx_open_file_cache_remove(ngx_event_t *ev);
+static ngx_int_t ngx_open_file_shared_test(ngx_open_file_cache_t *cache,
+    ngx_str_t *name, uint32_t hash, ngx_cached_open_file_t *file,
+    ngx_open_file_info_t *of);
+static ngx_int_t ngx_open_file_shared_get(ngx_open_file_cache_t *cache,
+    ngx_str_t *name, uint32_t hash, ngx_open_file_info_t *of);
+static void ngx_open_file_shared_set(ngx_open_file_cache_t *cache,
+    ngx_str_t *name, uint32_t hash, ngx_open_file_info_t *of,
+    ngx_atomic_uint_t events, ngx_pool_t *pool);
+static ngx_open_file_shared_node_t *ngx_open_file_shared_lookup(
+    ngx_open_file_cache_sh_t *sh, ngx_str_t *name, uint32_t hash);
+static void ngx_open_file_shared_delete(ngx_open_file_cache_shared_t *shared,
+    ngx_open_file_shared_node_t *sn);
+static void ngx_open_file_shared_rbtree_insert_value(ngx_rbtree_node_t *temp,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel);
+#if (NGX_HAVE_INOTIFY)
+static ngx_uint_t ngx_open_file_watch(ngx_open_file_cache_shared_t *shared,
+    ngx_str_t *name, ngx_pool_t *pool);
+static ngx_int_t ngx_open_file_watch_dir(ngx_open_file_cache_shared_t *shared,
+    u_char *dir, size_t len, ngx_uint_t links, ngx_log_t *log);
+static void ngx_open_file_watch_links(ngx_open_file_cache_shared_t *shared,
+    u_char *dir, size_t len, ngx_log_t *log);
+static ngx_open_file_watch_path_t *ngx_open_file_watch_lookup(
+    ngx_open_file_cache_sh_t *sh, u_char *name, size_t len, uint32_t hash);
+static ngx_open_file_watch_t *ngx_open_file_watch_find(
+    ngx_open_file_cache_sh_t *sh, int wd);
+static void ngx_open_file_watch_rbtree_insert_value(ngx_rbtree_node_t *temp,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel);
+static void ngx_open_file_watch_add_event(ngx_open_file_cache_shared_t *shared,
+    ngx_log_t *log);
+static void ngx_open_file_watch_handler(ngx_event_t *ev);
+static void ngx_open_file_watch_process(ngx_open_file_cache_shared_t *shared,
+    struct inotify_event *ie, ngx_log_t *log);
+#endif
 
 
 ngx_open_file_cache_t *
@@ -72,6 +177,7 @@ ngx_open_file_cache_init(ngx_pool_t *pool, ngx_uint_t max, time_t inactive)
     cache->current = 0;
     cache->max = max;
     cache->inactive = inactive;
+    cache->shared = NULL;
 
     cln = ngx_pool_cleanup_add(pool, 0);
     if (cln == NULL) {
@@ -140,6 +246,56 @@ ngx_open_file_cache_cleanup(void *data)
 }
 
 
+ngx_open_file_cache_shared_t *
+ngx_open_file_cache_shared_init(ngx_pool_t *pool, time_t valid)
+{
+    ngx_pool_cleanup_t            *cln;
+    ngx_open_file_cache_shared_t  *shared;
+
+    shared = ngx_pcalloc(pool, sizeof(ngx_open_file_cache_shared_t));
+    if (shared == NULL) {
+        return NULL;
+    }
+
+    shared->valid = valid;
+
+#if (NGX_HAVE_INOTIFY)
+    shared->fd = NGX_INVALID_FILE;
+#endif
+
+    cln = ngx_pool_cleanup_add(pool, 0);
+    if (cln == NULL) {
+        return NULL;
+    }
+
+    cln->handler = ngx_open_file_cache_shared_cleanup;
+    cln->data = shared;
+
+    return shared;
+}
+
+
+static void
+ngx_open_file_cache_shared_cleanup(void *data)
+{
+#if (NGX_HAVE_INOTIFY)
+
+    ngx_open_file_cache_shared_t  *shared = data;
+
+    if (shared->connection) {
+        (void) ngx_del_event(shared->connection->read, NGX_READ_EVENT, 0);
+        ngx_free(shared->connection);
+    }
+
+    if (shared->fd != NGX_INVALID_FILE && close(shared->fd) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, ngx_cycle->log, ngx_errno,
+                      "close() inotify failed");
+    }
+
+#endif
+}
+
+
 ngx_int_t
 ngx_open_cached_file(ngx_open_file_cache_t *cache, ngx_str_t *name,
     ngx_open_file_info_t *of, ngx_pool_t *pool)
@@ -147,11 +303,14 @@ ngx_open_cached_file(ngx_open_file_cache_t *cache, ngx_str_t *name,
     time_t                          now;
     uint32_t                        hash;
     ngx_int_t                       rc;
+    ngx_uint_t                      cached;
     ngx_file_info_t                 fi;
+    ngx_atomic_uint_t               events;
     ngx_pool_cleanup_t             *cln;
     ngx_cached_open_file_t         *file;
     ngx_pool_cleanup_file_t        *clnf;
     ngx_open_file_cache_cleanup_t  *ofcln;
+    ngx_open_file_cache_shared_t   *shared;
 
     of->fd = NGX_INVALID_FILE;
     of->err = 0;
@@ -206,6 +365,23 @@ ngx_open_cached_file(ngx_open_file_cache_t *cache, ngx_str_t *name,
 
     hash = ngx_crc32_long(name->data, name->len);
 
+    cached = 0;
+    events = 0;
+
+    if (cache->shared) {
+        shared = cache->shared->data;
+
+#if (NGX_HAVE_INOTIFY)
+        if (shared->connection == NULL) {
+            ngx_open_file_watch_add_event(shared, pool->log);
+        }
+#endif
+
+        /* any change seen after this point makes the new info unwatched */
+
+        events = shared->sh->events;
+    }
+
     file = ngx_open_file_lookup(cache, name, hash);
 
     if (file) {
@@ -230,7 +406,8 @@ ngx_open_cached_file(ngx_open_file_cache_t *cache, ngx_str_t *name,
         if (file->use_event
             || (file->event == NULL
                 && (of->uniq == 0 || of->uniq == file->uniq)
-                && now - file->created < of->valid
+                && (now - file->created < of->valid
+                    || ngx_open_file_shared_test(cache, name, hash, file, of))
 #if (NGX_HAVE_OPENAT)
                 && of->disable_symlinks == file->disable_symlinks
                 && of->disable_symlinks_from == file->disable_symlinks_from
@@ -351,6 +528,11 @@ ngx_open_cached_file(ngx_open_file_cache_t *cache, ngx_str_t *name,
 
     /* not found */
 
+    if (ngx_open_file_shared_get(cache, name, hash, of) == NGX_OK) {
+        cached = 1;
+        goto create;
+    }
+
     rc = ngx_open_and_stat_file(name, of, pool->log);
 
     if (rc != NGX_OK && (of->err == 0 || !of->errors)) {
@@ -396,6 +578,10 @@ add_event:
 
 update:
 
+    if (cache->shared && !cached) {
+        ngx_open_file_shared_set(cache, name, hash, of, events, pool);
+    }
+
     file->fd = of->fd;
     file->err = of->err;
 #if (NGX_HAVE_OPENAT)
@@ -1251,3 +1437,982 @@ ngx_open_file_cache_remove(ngx_event_t *ev)
     ngx_free(ev->data);
     ngx_free(ev);
 }
+
+
+static ngx_int_t
+ngx_open_file_shared_test(ngx_open_file_cache_t *cache, ngx_str_t *name,
+    uint32_t hash, ngx_cached_open_file_t *file, ngx_open_file_info_t *of)
+{
+    time_t                         valid;
+    ngx_int_t                      rc;
+    ngx_open_file_shared_node_t   *sn;
+    ngx_open_file_cache_shared_t  *shared;
+
+    if (cache->shared == NULL) {
+        return 0;
+    }
+
+    shared = cache->shared->data;
+
+    rc = 0;
+
+    ngx_shmtx_lock(&shared->shpool->mutex);
+
+    sn = ngx_open_file_shared_lookup(shared->sh, name, hash);
+
+    if (sn == NULL || sn->generation != shared->sh->generation) {
+        goto done;
+    }
+
+    valid = (sn->watched && shared->connection) ? shared->valid : of->valid;
+
+    if (ngx_time() - sn->created >= valid
+        || sn->err != file->err
+        || sn->is_dir != file->is_dir
+#if (NGX_HAVE_OPENAT)
+        || sn->disable_symlinks != of->disable_symlinks
+        || sn->disable_symlinks_from != of->disable_symlinks_from
+#endif
+       )
+    {
+        goto done;
+    }
+
+    if (sn->err == 0
+        && (sn->uniq != file->uniq
+            || sn->mtime != file->mtime
+            || sn->size != file->size))
+    {
+        goto done;
+    }
+
+    /* the worker's own entry is retested in the shared cache only */
+
+    file->created = ngx_time();
+
+    rc = 1;
+
+done:
+
+    ngx_shmtx_unlock(&shared->shpool->mutex);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_CORE, ngx_cycle->log, 0,
+                   "shared open file: %s, valid:%i", file->name, rc);
+
+    return rc;
+}
+
+
+static ngx_int_t
+ngx_open_file_shared_get(ngx_open_file_cache_t *cache, ngx_str_t *name,
+    uint32_t hash, ngx_open_file_info_t *of)
+{
+    time_t                         valid;
+    ngx_int_t                      rc;
+    ngx_open_file_shared_node_t   *sn;
+    ngx_open_file_cache_shared_t  *shared;
+
+    /*
+     * regular files are opened anyway to get a descriptor,
+     * so only directories and errors are taken from the shared cache
+     */
+
+    if (cache->shared == NULL) {
+        return NGX_DECLINED;
+    }
+
+    shared = cache->shared->data;
+
+    rc = NGX_DECLINED;
+
+    ngx_shmtx_lock(&shared->shpool->mutex);
+
+    sn = ngx_open_file_shared_lookup(shared->sh, name, hash);
+
+    if (sn == NULL
+        || sn->generation != shared->sh->generation
+        || !(sn->is_dir || (sn->err && of->errors)))
+    {
+        goto done;
+    }
+
+    valid = (sn->watched && shared->connection) ? shared->valid : of->valid;
+
+    if (ngx_time() - sn->created >= valid
+#if (NGX_HAVE_OPENAT)
+        || sn->disable_symlinks != of->disable_symlinks
+        || sn->disable_symlinks_from != of->disable_symlinks_from
+#endif
+       )
+    {
+        goto done;
+    }
+
+    if (sn->err) {
+        of->err = sn->err;
+#if (NGX_HAVE_OPENAT)
+        of->failed = sn->disable_symlinks ? ngx_openat_file_n
+                                          : ngx_open_file_n;
+#else
+        of->failed = ngx_open_file_n;
+#endif
+
+    } else {
+        of->uniq = sn->uniq;
+        of->mtime = sn->mtime;
+        of->size = sn->size;
+        of->fs_size = 0;
+        of->is_dir = 1;
+        of->is_file = 0;
+        of->is_link = sn->is_link;
+        of->is_exec = sn->is_exec;
+    }
+
+    rc = NGX_OK;
+
+done:
+
+    ngx_shmtx_unlock(&shared->shpool->mutex);
+
+    return rc;
+}
+
+
+static void
+ngx_open_file_shared_set(ngx_open_file_cache_t *cache, ngx_str_t *name,
+    uint32_t hash, ngx_open_file_info_t *of, ngx_atomic_uint_t events,
+    ngx_pool_t *pool)
+{
+    size_t                         size;
+    ngx_uint_t                     watched;
+    ngx_queue_t                   *q;
+    ngx_open_file_shared_node_t   *sn;
+    ngx_open_file_cache_shared_t  *shared;
+
+    shared = cache->shared->data;
+
+#if (NGX_HAVE_INOTIFY)
+    watched = ngx_open_file_watch(shared, name, pool);
+#else
+    watched = 0;
+#endif
+
+    ngx_shmtx_lock(&shared->shpool->mutex);
+
+    /*
+     * the info is watched only if the directory watch was added before
+     * the file was tested, and no changes were seen since then
+     */
+
+    if (events != shared->sh->events) {
+        watched = 0;
+    }
+
+    sn = ngx_open_file_shared_lookup(shared->sh, name, hash);
+
+    if (sn) {
+        ngx_open_file_shared_delete(shared, sn);
+    }
+
+    size = offsetof(ngx_open_file_shared_node_t, name) + name->len;
+
+    for ( ;; ) {
+        sn = ngx_slab_alloc_locked(shared->shpool, size);
+
+        if (sn) {
+            break;
+        }
+
+        if (ngx_queue_empty(&shared->sh->queue)) {
+            ngx_shmtx_unlock(&shared->shpool->mutex);
+            return;
+        }
+
+        q = ngx_queue_last(&shared->sh->queue);
+
+        ngx_open_file_shared_delete(shared,
+                       ngx_queue_data(q, ngx_open_file_shared_node_t, queue));
+    }
+
+    sn->node.key = hash;
+
+    sn->uniq = of->uniq;
+    sn->mtime = of->mtime;
+    sn->size = of->size;
+    sn->err = of->err;
+
+    sn->created = ngx_time();
+    sn->generation = shared->sh->generation;
+
+#if (NGX_HAVE_OPENAT)
+    sn->disable_symlinks = of->disable_symlinks;
+    sn->disable_symlinks_from = of->disable_symlinks_from;
+#endif
+
+    sn->watched = watched;
+
+    sn->is_dir = of->err ? 0 : of->is_dir;
+    sn->is_file = of->err ? 0 : of->is_file;
+    sn->is_link = of->err ? 0 : of->is_link;
+    sn->is_exec = of->err ? 0 : of->is_exec;
+
+    sn->len = name->len;
+    ngx_memcpy(sn->name, name->data, name->len);
+
+    ngx_rbtree_insert(&shared->sh->rbtree, &sn->node);
+    ngx_queue_insert_head(&shared->sh->queue, &sn->queue);
+
+    ngx_shmtx_unlock(&shared->shpool->mutex);
+
+    ngx_log_debug3(NGX_LOG_DEBUG_CORE, pool->log, 0,
+                   "shared open file set: %V, e:%d, w:%ui",
+                   name, of->err, watched);
+}
+
+
+static ngx_open_file_shared_node_t *
+ngx_open_file_shared_lookup(ngx_open_file_cache_sh_t *sh, ngx_str_t *name,
+    uint32_t hash)
+{
+    ngx_int_t                     rc;
+    ngx_rbtree_node_t            *node, *sentinel;
+    ngx_open_file_shared_node_t  *sn;
+
+    node = sh->rbtree.root;
+    sentinel = sh->rbtree.sentinel;
+
+    while (node != sentinel) {
+
+        if (hash < node->key) {
+            node = node->left;
+            continue;
+        }
+
+        if (hash > node->key) {
+            node = node->right;
+            continue;
+        }
+
+        /* hash == node->key */
+
+        sn = (ngx_open_file_shared_node_t *) node;
+
+        rc = ngx_memn2cmp(name->data, sn->name, name->len, sn->len);
+
+        if (rc == 0) {
+            return sn;
+        }
+
+        node = (rc < 0) ? node->left : node->right;
+    }
+
+    return NULL;
+}
+
+
+static void
+ngx_open_file_shared_delete(ngx_open_file_cache_shared_t *shared,
+    ngx_open_file_shared_node_t *sn)
+{
+    ngx_queue_remove(&sn->queue);
+    ngx_rbtree_delete(&shared->sh->rbtree, &sn->node);
+    ngx_slab_free_locked(shared->shpool, sn);
+}
+
+
+static void
+ngx_open_file_shared_rbtree_insert_value(ngx_rbtree_node_t *temp,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel)
+{
+    ngx_rbtree_node_t            **p;
+    ngx_open_file_shared_node_t   *sn, *snt;
+
+    for ( ;; ) {
+
+        if (node->key < temp->key) {
+
+            p = &temp->left;
+
+        } else if (node->key > temp->key) {
+
+            p = &temp->right;
+
+        } else { /* node->key == temp->key */
+
+            sn = (ngx_open_file_shared_node_t *) node;
+            snt = (ngx_open_file_shared_node_t *) temp;
+
+            p = (ngx_memn2cmp(sn->name, snt->name, sn->len, snt->len) < 0)
+                ? &temp->left : &temp->right;
+        }
+
+        if (*p == sentinel) {
+            break;
+        }
+
+        temp = *p;
+    }
+
+    *p = node;
+    node->parent = temp;
+    node->left = sentinel;
+    node->right = sentinel;
+    ngx_rbt_red(node);
+}
+
+
+#if (NGX_HAVE_INOTIFY)
+
+static ngx_uint_t
+ngx_open_file_watch(ngx_open_file_cache_shared_t *shared, ngx_str_t *name,
+    ngx_pool_t *pool)
+{
+    u_char                      *p, *dir;
+    size_t                       len;
+    uint32_t                     hash;
+    ngx_open_file_watch_path_t  *wp;
+
+    if (shared->connection == NULL) {
+        return 0;
+    }
+
+    for (p = name->data + name->len; p > name->data; p--) {
+        if (*(p - 1) == '/') {
+            break;
+        }
+    }
+
+    if (p == name->data) {
+        return 0;
+    }
+
+    /* the parent directory, "/" for files in the root directory */
+
+    len = (p - 1 == name->data) ? 1 : (size_t) (p - 1 - name->data);
+
+    hash = ngx_crc32_long(name->data, len);
+
+    ngx_shmtx_lock(&shared->shpool->mutex);
+
+    wp = ngx_open_file_watch_lookup(shared->sh, name->data, len, hash);
+
+    ngx_shmtx_unlock(&shared->shpool->mutex);
+
+    if (wp) {
+        return 1;
+    }
+
+    dir = ngx_pnalloc(pool, len + 1);
+    if (dir == NULL) {
+        return 0;
+    }
+
+    ngx_cpystrn(dir, name->data, len + 1);
+
+    if (ngx_open_file_watch_dir(shared, dir, len, 0, pool->log) == NGX_OK) {
+        ngx_open_file_watch_links(shared, dir, len, pool->log);
+    }
+
+    return 0;
+}
+
+
+static ngx_int_t
+ngx_open_file_watch_dir(ngx_open_file_cache_shared_t *shared, u_char *dir,
+    size_t len, ngx_uint_t links, ngx_log_t *log)
+{
+    int                          wd;
+    uint32_t                     hash;
+    ngx_open_file_watch_t       *w;
+    ngx_open_file_watch_path_t  *wp;
+
+    hash = ngx_crc32_long(dir, len);
+
+    ngx_shmtx_lock(&shared->shpool->mutex);
+
+    wp = ngx_open_file_watch_lookup(shared->sh, dir, len, hash);
+
+    if (wp) {
+        wp->watch->links |= links;
+        ngx_shmtx_unlock(&shared->shpool->mutex);
+        return NGX_DECLINED;
+    }
+
+    ngx_shmtx_unlock(&shared->shpool->mutex);
+
+    wd = inotify_add_watch(shared->fd, (char *) dir,
+                           NGX_OPEN_FILE_INOTIFY_MASK);
+
+    if (wd == -1) {
+        ngx_log_error(NGX_LOG_INFO, log, ngx_errno,
+                      "inotify_add_watch(\"%s\") failed", dir);
+        return NGX_ERROR;
+    }
+
+    ngx_shmtx_lock(&shared->shpool->mutex);
+
+    /* the directory may be watched by another worker meanwhile */
+
+    wp = ngx_open_file_watch_lookup(shared->sh, dir, len, hash);
+
+    if (wp) {
+        wp->watch->links |= links;
+        ngx_shmtx_unlock(&shared->shpool->mutex);
+        return NGX_DECLINED;
+    }
+
+    /* the same directory may be already watched by another name */
+
+    w = ngx_open_file_watch_find(shared->sh, wd);
+
+    if (w == NULL) {
+        w = ngx_slab_alloc_locked(shared->shpool,
+                                  sizeof(ngx_open_file_watch_t));
+        if (w == NULL) {
+            goto failed;
+        }
+
+        w->node.key = wd;
+        w->links = 0;
+        ngx_queue_init(&w->paths);
+
+        ngx_rbtree_insert(&shared->sh->watches, &w->node);
+    }
+
+    wp = ngx_slab_alloc_locked(shared->shpool,
+                               offsetof(ngx_open_file_watch_path_t, name)
+                               + len);
+    if (wp == NULL) {
+        if (ngx_queue_empty(&w->paths)) {
+            ngx_rbtree_delete(&shared->sh->watches, &w->node);
+            ngx_slab_free_locked(shared->shpool, w);
+        }
+
+        goto failed;
+    }
+
+    wp->node.key = hash;
+    wp->watch = w;
+    wp->len = len;
+    ngx_memcpy(wp->name, dir, len);
+
+    ngx_rbtree_insert(&shared->sh->paths, &wp->node);
+    ngx_queue_insert_tail(&w->paths, &wp->queue);
+
+    w->links |= links;
+
+    /* the file could be changed before the watch was added */
+
+    shared->sh->events++;
+
+    ngx_shmtx_unlock(&shared->shpool->mutex);
+
+    ngx_log_debug3(NGX_LOG_DEBUG_CORE, log, 0,
+                   "open file watch: \"%s\", wd:%d, links:%ui",
+                   dir, wd, links);
+
+    return NGX_OK;
+
+failed:
+
+    ngx_shmtx_unlock(&shared->shpool->mutex);
+
+    return NGX_ERROR;
+}
+
+
+static void
+ngx_open_file_watch_links(ngx_open_file_cache_shared_t *shared, u_char *dir,
+    size_t len, ngx_log_t *log)
+{
+    u_char           *p, *q, *last, c;
+    size_t            n;
+    ngx_file_info_t   fi;
+
+    /*
+     * inotify follows symlinks, so a replaced symlink in the path,
+     * e.g., a switched release directory, is only seen in the directory
+     * which holds the symlink; such directories are watched as well,
+     * and changes of names there make all entries stale
+     */
+
+    last = dir + len;
+
+    for (p = dir + 1; p <= last; p++) {
+
+        if (p < last && *p != '/') {
+            continue;
+        }
+
+        c = *p;
+        *p = '\0';
+
+        if (ngx_link_info(dir, &fi) == NGX_FILE_ERROR || !ngx_is_link(&fi)) {
+            *p = c;
+            continue;
+        }
+
+        *p = c;
+
+        for (q = p - 1; q > dir && *q != '/'; q--) { /* void */ }
+
+        if (*q != '/') {
+            continue;
+        }
+
+        n = (q == dir) ? 1 : (size_t) (q - dir);
+
+        c = dir[n];
+        dir[n] = '\0';
+
+        (void) ngx_open_file_watch_dir(shared, dir, n, 1, log);
+
+        dir[n] = c;
+    }
+}
+
+
+static ngx_open_file_watch_path_t *
+ngx_open_file_watch_lookup(ngx_open_file_cache_sh_t *sh, u_char *name,
+    size_t len, uint32_t hash)
+{
+    ngx_int_t                    rc;
+    ngx_rbtree_node_t           *node, *sentinel;
+    ngx_open_file_watch_path_t  *wp;
+
+    node = sh->paths.root;
+    sentinel = sh->paths.sentinel;
+
+    while (node != sentinel) {
+
+        if (hash < node->key) {
+            node = node->left;
+            continue;
+        }
+
+        if (hash > node->key) {
+            node = node->right;
+            continue;
+        }
+
+        /* hash == node->key */
+
+        wp = (ngx_open_file_watch_path_t *) node;
+
+        rc = ngx_memn2cmp(name, wp->name, len, wp->len);
+
+        if (rc == 0) {
+            return wp;
+        }
+
+        node = (rc < 0) ? node->left : node->right;
+    }
+
+    return NULL;
+}
+
+
+static ngx_open_file_watch_t *
+ngx_open_file_watch_find(ngx_open_file_cache_sh_t *sh, int wd)
+{
+    ngx_rbtree_node_t  *node, *sentinel;
+
+    node = sh->watches.root;
+    sentinel = sh->watches.sentinel;
+
+    while (node != sentinel) {
+
+        if ((ngx_rbtree_key_t) wd < node->key) {
+            node = node->left;
+            continue;
+        }
+
+        if ((ngx_rbtree_key_t) wd > node->key) {
+            node = node->right;
+            continue;
+        }
+
+        return (ngx_open_file_watch_t *) node;
+    }
+
+    return NULL;
+}
+
+
+static void
+ngx_open_file_watch_rbtree_insert_value(ngx_rbtree_node_t *temp,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel)
+{
+    ngx_rbtree_node_t           **p;
+    ngx_open_file_watch_path_t   *wp, *wpt;
+
+    for ( ;; ) {
+
+        if (node->key < temp->key) {
+
+            p = &temp->left;
+
+        } else if (node->key > temp->key) {
+
+            p = &temp->right;
+
+        } else { /* node->key == temp->key */
+
+            wp = (ngx_open_file_watch_path_t *) node;
+            wpt = (ngx_open_file_watch_path_t *) temp;
+
+            p = (ngx_memn2cmp(wp->name, wpt->name, wp->len, wpt->len) < 0)
+                ? &temp->left : &temp->right;
+        }
+
+        if (*p == sentinel) {
+            break;
+        }
+
+        temp = *p;
+    }
+
+    *p = node;
+    node->parent = temp;
+    node->left = sentinel;
+    node->right = sentinel;
+    ngx_rbt_red(node);
+}
+
+
+static void
+ngx_open_file_watch_add_event(ngx_open_file_cache_shared_t *shared,
+    ngx_log_t *log)
+{
+    ngx_uint_t         flags;
+    ngx_event_t       *rev, *wev;
+    ngx_connection_t  *c;
+
+    if (shared->fd == NGX_INVALID_FILE
+        || (ngx_process != NGX_PROCESS_WORKER
+            && ngx_process != NGX_PROCESS_SINGLE))
+    {
+        return;
+    }
+
+    /*
+     * the inotify descriptor is inherited from the master process,
+     * and events are read by any worker which is woken up first;
+     * with epoll only one of the workers is woken up
+     */
+
+    c = ngx_calloc(sizeof(ngx_connection_t) + 2 * sizeof(ngx_event_t), log);
+    if (c == NULL) {
+        goto failed;
+    }
+
+    rev = (ngx_event_t *) (c + 1);
+    wev = rev + 1;
+
+    rev->data = c;
+    rev->handler = ngx_open_file_watch_handler;
+    rev->log = ngx_cycle->log;
+
+    wev->data = c;
+    wev->write = 1;
+    wev->log = ngx_cycle->log;
+
+    c->fd = shared->fd;
+    c->read = rev;
+    c->write = wev;
+    c->data = shared;
+    c->log = ngx_cycle->log;
+
+    flags = NGX_CLEAR_EVENT;
+
+#if (NGX_HAVE_EPOLLEXCLUSIVE)
+    if (ngx_event_flags & NGX_USE_EPOLL_EVENT) {
+        flags |= NGX_EXCLUSIVE_EVENT;
+    }
+#endif
+
+    if (ngx_add_event(rev, NGX_READ_EVENT, flags) != NGX_OK) {
+        ngx_free(c);
+        goto failed;
+    }
+
+    shared->connection = c;
+
+    return;
+
+failed:
+
+    /*
+     * the worker does not watch directories then, and tests
+     * the shared entries as unwatched ones
+     */
+
+    if (close(shared->fd) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno, "close() inotify failed");
+    }
+
+    shared->fd = NGX_INVALID_FILE;
+}
+
+
+static void
+ngx_open_file_watch_handler(ngx_event_t *ev)
+{
+    u_char                        *p, *last;
+    ssize_t                        n;
+    ngx_err_t                      err;
+    ngx_connection_t              *c;
+    struct inotify_event          *ie;
+    ngx_open_file_cache_shared_t  *shared;
+
+    union {
+        struct inotify_event       event;
+        u_char                     buf[4096];
+    } u;
+
+    c = ev->data;
+    shared = c->data;
+
+    for ( ;; ) {
+        n = read(c->fd, u.buf, sizeof(u.buf));
+
+        if (n == -1) {
+            err = ngx_errno;
+
+            if (err == NGX_EAGAIN) {
+                return;
+            }
+
+            if (err == NGX_EINTR) {
+                continue;
+            }
+
+            ngx_log_error(NGX_LOG_ALERT, ev->log, err,
+                          "read() from inotify failed");
+            return;
+        }
+
+        if (n == 0) {
+            return;
+        }
+
+        ngx_shmtx_lock(&shared->shpool->mutex);
+
+        last = u.buf + n;
+
+        for (p = u.buf; p < last; p += sizeof(struct inotify_event) + ie->len) {
+            ie = (struct inotify_event *) p;
+            ngx_open_file_watch_process(shared, ie, ev->log);
+        }
+
+        shared->sh->events++;
+
+        ngx_shmtx_unlock(&shared->shpool->mutex);
+    }
+}
+
+
+static void
+ngx_open_file_watch_process(ngx_open_file_cache_shared_t *shared,
+    struct inotify_event *ie, ngx_log_t *log)
+{
+    u_char                        *p;
+    uint32_t                       hash;
+    ngx_str_t                      name;
+    ngx_queue_t                   *q;
+    ngx_open_file_watch_t         *w;
+    ngx_open_file_watch_path_t    *wp;
+    ngx_open_file_shared_node_t   *sn;
+    u_char                         path[NGX_MAX_PATH];
+
+    ngx_log_debug3(NGX_LOG_DEBUG_CORE, log, 0,
+                   "inotify event: wd:%d, mask:%xD, len:%uD",
+                   ie->wd, ie->mask, ie->len);
+
+    if (ie->mask & IN_Q_OVERFLOW) {
+        shared->sh->generation++;
+        return;
+    }
+
+    w = ngx_open_file_watch_find(shared->sh, ie->wd);
+
+    if (w == NULL) {
+        return;
+    }
+
+    if (ie->mask & (IN_IGNORED|IN_DELETE_SELF|IN_MOVE_SELF|IN_UNMOUNT)) {
+
+        /* the directory itself is gone, any path below it may be stale */
+
+        shared->sh->generation++;
+
+        if (ie->mask & IN_IGNORED) {
+
+            while (!ngx_queue_empty(&w->paths)) {
+                q = ngx_queue_head(&w->paths);
+                wp = ngx_queue_data(q, ngx_open_file_watch_path_t, queue);
+
+                ngx_queue_remove(q);
+                ngx_rbtree_delete(&shared->sh->paths, &wp->node);
+                ngx_slab_free_locked(shared->shpool, wp);
+            }
+
+            ngx_rbtree_delete(&shared->sh->watches, &w->node);
+            ngx_slab_free_locked(shared->shpool, w);
+        }
+
+        return;
+    }
+
+    if (ie->len == 0) {
+
+        /* directory attributes, e.g., permissions, were changed */
+
+        shared->sh->generation++;
+        return;
+    }
+
+    if (w->links
+        && (ie->mask & (IN_CREATE|IN_DELETE|IN_MOVED_FROM|IN_MOVED_TO)))
+    {
+        /* a symlink in paths of watched directories may be replaced */
+
+        shared->sh->generation++;
+    }
+
+    for (q = ngx_queue_head(&w->paths);
+         q != ngx_queue_sentinel(&w->paths);
+         q = ngx_queue_next(q))
+    {
+        wp = ngx_queue_data(q, ngx_open_file_watch_path_t, queue);
+
+        name.len = ngx_strlen(ie->name);
+
+        if (wp->len + 1 + name.len > NGX_MAX_PATH) {
+            shared->sh->generation++;
+            return;
+        }
+
+        p = ngx_cpymem(path, wp->name, wp->len);
+
+        if (wp->len != 1 || wp->name[0] != '/') {
+            *p++ = '/';
+        }
+
+        p = ngx_cpymem(p, ie->name, name.len);
+
+        name.data = path;
+        name.len = p - path;
+
+        hash = ngx_crc32_long(name.data, name.len);
+
+        sn = ngx_open_file_shared_lookup(shared->sh, &name, hash);
+
+        if (sn) {
+            ngx_log_debug1(NGX_LOG_DEBUG_CORE, log, 0,
+                           "shared open file invalidate: %V", &name);
+
+            ngx_open_file_shared_delete(shared, sn);
+        }
+    }
+}
+
+#endif
+
+
+ngx_int_t
+ngx_open_file_cache_init_zone(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_open_file_cache_shared_t  *oshared = data;
+
+    size_t                         len;
+    ngx_open_file_cache_shared_t  *shared;
+
+    shared = shm_zone->data;
+
+    if (oshared) {
+        shared->sh = oshared->sh;
+        shared->shpool = oshared->shpool;
+
+#if (NGX_HAVE_INOTIFY)
+
+        /*
+         * each cycle using the zone keeps its own duplicate of the
+         * descriptor and closes it with the cycle pool, so the descriptor
+         * is closed with the last cycle using the zone
+         */
+
+        if (oshared->fd != NGX_INVALID_FILE) {
+            shared->fd = fcntl(oshared->fd, F_DUPFD_CLOEXEC, 0);
+
+            if (shared->fd == NGX_INVALID_FILE) {
+                ngx_log_error(NGX_LOG_ALERT, shm_zone->shm.log, ngx_errno,
+                              "fcntl(F_DUPFD_CLOEXEC) inotify failed");
+                return NGX_ERROR;
+            }
+        }
+
+#endif
+
+        return NGX_OK;
+    }
+
+    shared->shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    if (shm_zone->shm.exists) {
+        shared->sh = shared->shpool->data;
+        return NGX_OK;
+    }
+
+    shared->sh = ngx_slab_alloc(shared->shpool,
+                                sizeof(ngx_open_file_cache_sh_t));
+    if (shared->sh == NULL) {
+        return NGX_ERROR;
+    }
+
+    shared->shpool->data = shared->sh;
+
+    ngx_rbtree_init(&shared->sh->rbtree, &shared->sh->sentinel,
+                    ngx_open_file_shared_rbtree_insert_value);
+
+    ngx_queue_init(&shared->sh->queue);
+
+    shared->sh->generation = 0;
+    shared->sh->events = 0;
+
+#if (NGX_HAVE_INOTIFY)
+
+    ngx_rbtree_init(&shared->sh->watches, &shared->sh->watches_sentinel,
+                    ngx_rbtree_insert_value);
+    ngx_rbtree_init(&shared->sh->paths, &shared->sh->paths_sentinel,
+                    ngx_open_file_watch_rbtree_insert_value);
+
+    /*
+     * the descriptor is created once in the master process and
+     * is kept open while the zone exists, including reconfigurations
+     */
+
+    shared->fd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+
+    if (shared->fd == NGX_INVALID_FILE) {
+        ngx_log_error(NGX_LOG_WARN, shm_zone->shm.log, ngx_errno,
+                      "inotify_init1() failed, shared open file cache "
+                      "entries will be retested");
+    }
+
+#endif
+
+    len = sizeof(" in open file cache zone \"\"") + shm_zone->shm.name.len;
+
+    shared->shpool->log_ctx = ngx_slab_alloc(shared->shpool, len);
+    if (shared->shpool->log_ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_sprintf(shared->shpool->log_ctx, " in open file cache zone \"%V\"%Z",
+                &shm_zone->shm.name);
+
+    shared->shpool->log_nomem = 0;
+
+    return NGX_OK;
+}
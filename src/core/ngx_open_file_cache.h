@@ -96,9 +96,39 @@ typedef struct {
     ngx_uint_t               current;
     ngx_uint_t               max;
     time_t                   inactive;
+
+    ngx_shm_zone_t          *shared;
 } ngx_open_file_cache_t;
 
 
+typedef struct {
+    ngx_rbtree_t             rbtree;
+    ngx_rbtree_node_t        sentinel;
+    ngx_queue_t              queue;
+
+    ngx_uint_t               generation;
+    ngx_atomic_t             events;
+
+#if (NGX_HAVE_INOTIFY)
+    ngx_rbtree_t             watches;
+    ngx_rbtree_node_t        watches_sentinel;
+    ngx_rbtree_t             paths;
+    ngx_rbtree_node_t        paths_sentinel;
+#endif
+} ngx_open_file_cache_sh_t;
+
+
+typedef struct {
+    ngx_open_file_cache_sh_t  *sh;
+    ngx_slab_pool_t           *shpool;
+    time_t                     valid;
+#if (NGX_HAVE_INOTIFY)
+    ngx_fd_t                   fd;
+    ngx_connection_t          *connection;
+#endif
+} ngx_open_file_cache_shared_t;
+
+
 typedef struct {
     ngx_open_file_cache_t   *cache;
     ngx_cached_open_file_t  *file;
@@ -124,6 +154,9 @@ ngx_open_file_cache_t *ngx_open_file_cache_init(ngx_pool_t *pool,
     ngx_uint_t max, time_t inactive);
 ngx_int_t ngx_open_cached_file(ngx_open_file_cache_t *cache, ngx_str_t *name,
     ngx_open_file_info_t *of, ngx_pool_t *pool);
+ngx_open_file_cache_shared_t *ngx_open_file_cache_shared_init(
+    ngx_pool_t *pool, time_t valid);
+ngx_int_t ngx_open_file_cache_init_zone(ngx_shm_zone_t *shm_zone, void *data);
 
 
 #endif /* _NGX_OPEN_FILE_CACHE_H_INCLUDED_ */
@@ -567,6 +567,12 @@ ngx_output_chain_copy_buf(ngx_output_chain_ctx_t *ctx)
 
 #if (NGX_HAVE_FILE_AIO)
         if (ctx->aio_handler) {
+#if (NGX_HAVE_IO_URING)
+            if (ctx->io_uring) {
+                n = ngx_file_io_uring_read(src->file, dst->pos, (size_t) size,
+                                           src->file_pos, ctx->pool);
+            } else
+#endif
             n = ngx_file_aio_read(src->file, dst->pos, (size_t) size,
                                   src->file_pos, ctx->pool);
             if (n == NGX_AGAIN) {
@@ -230,21 +230,34 @@ ngx_palloc_block(ngx_pool_t *pool, size_t size)
 static void *
 ngx_palloc_large(ngx_pool_t *pool, size_t size)
 {
-    void              *p;
-    ngx_uint_t         n;
-    ngx_pool_large_t  *large;
+    void  *p;
 
     p = ngx_alloc(size, pool->log);
     if (p == NULL) {
         return NULL;
     }
 
+    if (ngx_pool_attach(pool, p) != NGX_OK) {
+        ngx_free(p);
+        return NULL;
+    }
+
+    return p;
+}
+
+
+ngx_int_t
+ngx_pool_attach(ngx_pool_t *pool, void *p)
+{
+    ngx_uint_t         n;
+    ngx_pool_large_t  *large;
+
     n = 0;
 
     for (large = pool->large; large; large = large->next) {
         if (large->alloc == NULL) {
             large->alloc = p;
-            return p;
+            return NGX_OK;
         }
 
         if (n++ > 3) {
@@ -254,15 +267,14 @@ ngx_palloc_large(ngx_pool_t *pool, size_t size)
 
     large = ngx_palloc_small(pool, sizeof(ngx_pool_large_t), 1);
     if (large == NULL) {
-        ngx_free(p);
-        return NULL;
+        return NGX_ERROR;
     }
 
     large->alloc = p;
     large->next = pool->large;
     pool->large = large;
 
-    return p;
+    return NGX_OK;
 }
 
 
@@ -311,6 +323,38 @@ ngx_pfree(ngx_pool_t *pool, void *p)
 }
 
 
+ngx_int_t
+ngx_pool_detach(ngx_pool_t *pool, void *p)
+{
+    ngx_pool_large_t  *l;
+
+    for (l = pool->large; l; l = l->next) {
+        if (p == l->alloc) {
+            l->alloc = NULL;
+            return NGX_OK;
+        }
+    }
+
+    return NGX_DECLINED;
+}
+
+
+size_t
+ngx_pool_size(ngx_pool_t *pool)
+{
+    size_t       size;
+    ngx_pool_t  *p;
+
+    size = 0;
+
+    for (p = pool; p; p = p->d.next) {
+        size += p->d.end - (u_char *) p;
+    }
+
+    return size;
+}
+
+
 void *
 ngx_pcalloc(ngx_pool_t *pool, size_t size)
 {
@@ -81,6 +81,9 @@ void *ngx_pnalloc(ngx_pool_t *pool, size_t size) __attribute__((alloc_size(2)));
 void *ngx_pcalloc(ngx_pool_t *pool, size_t size) __attribute__((alloc_size(2)));
 void *ngx_pmemalign(ngx_pool_t *pool, size_t size, size_t alignment) __attribute__((alloc_size(2)));
 ngx_int_t ngx_pfree(ngx_pool_t *pool, void *p);
+ngx_int_t ngx_pool_attach(ngx_pool_t *pool, void *p);
+ngx_int_t ngx_pool_detach(ngx_pool_t *pool, void *p);
+size_t ngx_pool_size(ngx_pool_t *pool);
 
 
 ngx_pool_cleanup_t *ngx_pool_cleanup_add(ngx_pool_t *p, size_t size);
@@ -9,7 +9,39 @@
 #include <ngx_core.h>
 
 
+typedef struct {
+    ngx_array_t        nodes;
+    ngx_array_t        leaves;
+} ngx_radix_trie_ctx_t;
+
+
 static ngx_radix_node_t *ngx_radix_alloc(ngx_radix_tree_t *tree);
+static ngx_int_t ngx_radix_trie_add_node(ngx_radix_trie_ctx_t *ctx,
+    ngx_uint_t n, ngx_radix_node_t *node, uintptr_t value);
+static void ngx_radix_trie_slots(ngx_radix_node_t *node, ngx_uint_t depth,
+    ngx_uint_t slot, uintptr_t value, uintptr_t *values,
+    ngx_radix_node_t **children);
+static ngx_inline uintptr_t ngx_radix_trie_find(ngx_radix_trie_t *trie,
+    uint64_t hi, uint64_t lo);
+
+
+#if (NGX_HAVE_GCC_POPCOUNT)
+
+#define ngx_radix_popcount(x)  __builtin_popcountll(x)
+
+#else
+
+static ngx_inline ngx_uint_t
+ngx_radix_popcount(uint64_t x)
+{
+    x -= (x >> 1) & 0x5555555555555555ULL;
+    x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+    x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+
+    return (ngx_uint_t) ((x * 0x0101010101010101ULL) >> 56);
+}
+
+#endif
 
 
 ngx_radix_tree_t *
@@ -27,6 +59,7 @@ ngx_radix_tree_create(ngx_pool_t *pool, ngx_int_t preallocate)
     tree->free = NULL;
     tree->start = NULL;
     tree->size = 0;
+    tree->trie = NULL;
 
     tree->root = ngx_radix_alloc(tree);
     if (tree->root == NULL) {
@@ -112,6 +145,8 @@ ngx_radix32tree_insert(ngx_radix_tree_t *tree, uint32_t key, uint32_t mask,
     uint32_t           bit;
     ngx_radix_node_t  *node, *next;
 
+    tree->trie = NULL;
+
     bit = 0x80000000;
 
     node = tree->root;
@@ -176,6 +211,8 @@ ngx_radix32tree_delete(ngx_radix_tree_t *tree, uint32_t key, uint32_t mask)
     uint32_t           bit;
     ngx_radix_node_t  *node;
 
+    tree->trie = NULL;
+
     bit = 0x80000000;
     node = tree->root;
 
@@ -240,6 +277,10 @@ ngx_radix32tree_find(ngx_radix_tree_t *tree, uint32_t key)
     uintptr_t          value;
     ngx_radix_node_t  *node;
 
+    if (tree->trie) {
+        return ngx_radix_trie_find(tree->trie, (uint64_t) key << 32, 0);
+    }
+
     bit = 0x80000000;
     value = NGX_RADIX_NO_VALUE;
     node = tree->root;
@@ -263,6 +304,47 @@ ngx_radix32tree_find(ngx_radix_tree_t *tree, uint32_t key)
 }
 
 
+
+/*
+ * ngx_radix32tree_find_cover() returns the value of the longest prefix
+ * that covers the whole key/mask network, that is, it does not look
+ * at prefixes longer than the mask
+ */
+
+uintptr_t
+ngx_radix32tree_find_cover(ngx_radix_tree_t *tree, uint32_t key,
+    uint32_t mask)
+{
+    uint32_t           bit;
+    uintptr_t          value;
+    ngx_radix_node_t  *node;
+
+    bit = 0x80000000;
+    value = NGX_RADIX_NO_VALUE;
+    node = tree->root;
+
+    while (node) {
+        if (node->value != NGX_RADIX_NO_VALUE) {
+            value = node->value;
+        }
+
+        if ((bit & mask) == 0) {
+            break;
+        }
+
+        if (key & bit) {
+            node = node->right;
+
+        } else {
+            node = node->left;
+        }
+
+        bit >>= 1;
+    }
+
+    return value;
+}
+
 #if (NGX_HAVE_INET6)
 
 ngx_int_t
@@ -273,6 +355,8 @@ ngx_radix128tree_insert(ngx_radix_tree_t *tree, u_char *key, u_char *mask,
     ngx_uint_t         i;
     ngx_radix_node_t  *node, *next;
 
+    tree->trie = NULL;
+
     i = 0;
     bit = 0x80;
 
@@ -355,6 +439,8 @@ ngx_radix128tree_delete(ngx_radix_tree_t *tree, u_char *key, u_char *mask)
     ngx_uint_t         i;
     ngx_radix_node_t  *node;
 
+    tree->trie = NULL;
+
     i = 0;
     bit = 0x80;
     node = tree->root;
@@ -425,10 +511,23 @@ uintptr_t
 ngx_radix128tree_find(ngx_radix_tree_t *tree, u_char *key)
 {
     u_char             bit;
+    uint64_t           hi, lo;
     uintptr_t          value;
     ngx_uint_t         i;
     ngx_radix_node_t  *node;
 
+    if (tree->trie) {
+        hi = 0;
+        lo = 0;
+
+        for (i = 0; i < 8; i++) {
+            hi = (hi << 8) | key[i];
+            lo = (lo << 8) | key[i + 8];
+        }
+
+        return ngx_radix_trie_find(tree->trie, hi, lo);
+    }
+
     i = 0;
     bit = 0x80;
     value = NGX_RADIX_NO_VALUE;
@@ -457,9 +556,261 @@ ngx_radix128tree_find(ngx_radix_tree_t *tree, u_char *key)
     return value;
 }
 
+
+uintptr_t
+ngx_radix128tree_find_cover(ngx_radix_tree_t *tree, u_char *key,
+    u_char *mask)
+{
+    u_char             bit;
+    uintptr_t          value;
+    ngx_uint_t         i;
+    ngx_radix_node_t  *node;
+
+    i = 0;
+    bit = 0x80;
+    value = NGX_RADIX_NO_VALUE;
+    node = tree->root;
+
+    while (node) {
+        if (node->value != NGX_RADIX_NO_VALUE) {
+            value = node->value;
+        }
+
+        if (i == 16 || (bit & mask[i]) == 0) {
+            break;
+        }
+
+        if (key[i] & bit) {
+            node = node->right;
+
+        } else {
+            node = node->left;
+        }
+
+        bit >>= 1;
+
+        if (bit == 0) {
+            i++;
+            bit = 0x80;
+        }
+    }
+
+    return value;
+}
+
 #endif
 
 
+ngx_int_t
+ngx_radix_tree_compile(ngx_radix_tree_t *tree)
+{
+    size_t                  size;
+    ngx_int_t               rc;
+    ngx_pool_t             *pool;
+    ngx_radix_trie_t       *trie;
+    ngx_radix_trie_ctx_t    ctx;
+    ngx_radix_trie_node_t  *root;
+
+    tree->trie = NULL;
+
+    pool = ngx_create_pool(NGX_DEFAULT_POOL_SIZE, tree->pool->log);
+    if (pool == NULL) {
+        return NGX_ERROR;
+    }
+
+    rc = NGX_ERROR;
+
+    if (ngx_array_init(&ctx.nodes, pool, 64, sizeof(ngx_radix_trie_node_t))
+        != NGX_OK)
+    {
+        goto done;
+    }
+
+    if (ngx_array_init(&ctx.leaves, pool, 256, sizeof(uintptr_t)) != NGX_OK) {
+        goto done;
+    }
+
+    root = ngx_array_push(&ctx.nodes);
+    if (root == NULL) {
+        goto done;
+    }
+
+    if (ngx_radix_trie_add_node(&ctx, 0, tree->root, tree->root->value)
+        != NGX_OK)
+    {
+        goto done;
+    }
+
+    trie = ngx_palloc(tree->pool, sizeof(ngx_radix_trie_t));
+    if (trie == NULL) {
+        goto done;
+    }
+
+    size = ctx.nodes.nelts * sizeof(ngx_radix_trie_node_t);
+
+    trie->nodes = ngx_pmemalign(tree->pool, size, ngx_cacheline_size);
+    if (trie->nodes == NULL) {
+        goto done;
+    }
+
+    ngx_memcpy(trie->nodes, ctx.nodes.elts, size);
+
+    size = ctx.leaves.nelts * sizeof(uintptr_t);
+
+    trie->leaves = ngx_palloc(tree->pool, size);
+    if (trie->leaves == NULL) {
+        goto done;
+    }
+
+    ngx_memcpy(trie->leaves, ctx.leaves.elts, size);
+
+    tree->trie = trie;
+
+    rc = NGX_OK;
+
+done:
+
+    ngx_destroy_pool(pool);
+
+    return rc;
+}
+
+
+static ngx_int_t
+ngx_radix_trie_add_node(ngx_radix_trie_ctx_t *ctx, ngx_uint_t n,
+    ngx_radix_node_t *node, uintptr_t value)
+{
+    uint64_t                bit, vector, leafvec;
+    uintptr_t               values[64], *leaf;
+    ngx_uint_t              i, k, nchildren, base0, base1;
+    ngx_radix_node_t       *children[64];
+    ngx_radix_trie_node_t  *tn;
+
+    ngx_radix_trie_slots(node, 0, 0, value, values, children);
+
+    vector = 0;
+    leafvec = 0;
+    nchildren = 0;
+    base0 = ctx->leaves.nelts;
+    leaf = NULL;
+
+    for (i = 0; i < 64; i++) {
+        bit = (uint64_t) 1 << i;
+
+        if (children[i]) {
+            vector |= bit;
+            nchildren++;
+            continue;
+        }
+
+        if (leafvec && values[i] == *leaf) {
+            continue;
+        }
+
+        leaf = ngx_array_push(&ctx->leaves);
+        if (leaf == NULL) {
+            return NGX_ERROR;
+        }
+
+        *leaf = values[i];
+        leafvec |= bit;
+    }
+
+    base1 = ctx->nodes.nelts;
+
+    if (nchildren) {
+        if (ngx_array_push_n(&ctx->nodes, nchildren) == NULL) {
+            return NGX_ERROR;
+        }
+    }
+
+    tn = (ngx_radix_trie_node_t *) ctx->nodes.elts + n;
+
+    tn->vector = vector;
+    tn->leafvec = leafvec;
+    tn->base0 = (uint32_t) base0;
+    tn->base1 = (uint32_t) base1;
+
+    k = base1;
+
+    for (i = 0; i < 64; i++) {
+        if (children[i]) {
+            if (ngx_radix_trie_add_node(ctx, k++, children[i], values[i])
+                != NGX_OK)
+            {
+                return NGX_ERROR;
+            }
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_radix_trie_slots(ngx_radix_node_t *node, ngx_uint_t depth,
+    ngx_uint_t slot, uintptr_t value, uintptr_t *values,
+    ngx_radix_node_t **children)
+{
+    ngx_uint_t         i, n, s;
+    ngx_radix_node_t  *next;
+
+    if (node->value != NGX_RADIX_NO_VALUE) {
+        value = node->value;
+    }
+
+    if (depth == 6) {
+        values[slot] = value;
+        children[slot] = (node->left || node->right) ? node : NULL;
+        return;
+    }
+
+    for (i = 0; i < 2; i++) {
+        next = i ? node->right : node->left;
+        s = (slot << 1) | i;
+
+        if (next) {
+            ngx_radix_trie_slots(next, depth + 1, s, value, values, children);
+            continue;
+        }
+
+        n = (ngx_uint_t) 1 << (5 - depth);
+
+        for (s *= n; n; s++, n--) {
+            values[s] = value;
+            children[s] = NULL;
+        }
+    }
+}
+
+
+static ngx_inline uintptr_t
+ngx_radix_trie_find(ngx_radix_trie_t *trie, uint64_t hi, uint64_t lo)
+{
+    uint64_t                bit;
+    ngx_radix_trie_node_t  *node;
+
+    node = trie->nodes;
+
+    for ( ;; ) {
+        bit = (uint64_t) 1 << (hi >> 58);
+
+        if ((node->vector & bit) == 0) {
+            return trie->leaves[node->base0
+                                + ngx_radix_popcount(node->leafvec
+                                                     & ((bit << 1) - 1))
+                                - 1];
+        }
+
+        node = &trie->nodes[node->base1
+                            + ngx_radix_popcount(node->vector & (bit - 1))];
+
+        hi = (hi << 6) | (lo >> 58);
+        lo <<= 6;
+    }
+}
+
+
 static ngx_radix_node_t *
 ngx_radix_alloc(ngx_radix_tree_t *tree)
 {
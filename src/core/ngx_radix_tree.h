@@ -25,23 +25,48 @@ struct ngx_radix_node_s {
 };
 
 
+/*
+ * A compiled tree is a multibit trie with 6 bits per node.  The "vector"
+ * bitmap marks slots pointing to child nodes, and the "leafvec" bitmap
+ * marks slots starting runs of equal values in the rest of slots, so
+ * both children and values are found by popcount.
+ */
+
+typedef struct {
+    uint64_t           vector;
+    uint64_t           leafvec;
+    uint32_t           base0;
+    uint32_t           base1;
+} ngx_radix_trie_node_t;
+
+
+typedef struct {
+    ngx_radix_trie_node_t  *nodes;
+    uintptr_t              *leaves;
+} ngx_radix_trie_t;
+
+
 typedef struct {
     ngx_radix_node_t  *root;
     ngx_pool_t        *pool;
     ngx_radix_node_t  *free;
     char              *start;
     size_t             size;
+    ngx_radix_trie_t  *trie;
 } ngx_radix_tree_t;
 
 
 ngx_radix_tree_t *ngx_radix_tree_create(ngx_pool_t *pool,
     ngx_int_t preallocate);
+ngx_int_t ngx_radix_tree_compile(ngx_radix_tree_t *tree);
 
 ngx_int_t ngx_radix32tree_insert(ngx_radix_tree_t *tree,
     uint32_t key, uint32_t mask, uintptr_t value);
 ngx_int_t ngx_radix32tree_delete(ngx_radix_tree_t *tree,
     uint32_t key, uint32_t mask);
 uintptr_t ngx_radix32tree_find(ngx_radix_tree_t *tree, uint32_t key);
+uintptr_t ngx_radix32tree_find_cover(ngx_radix_tree_t *tree, uint32_t key,
+    uint32_t mask);
 
 #if (NGX_HAVE_INET6)
 ngx_int_t ngx_radix128tree_insert(ngx_radix_tree_t *tree,
@@ -49,6 +74,8 @@ ngx_int_t ngx_radix128tree_insert(ngx_radix_tree_t *tree,
 ngx_int_t ngx_radix128tree_delete(ngx_radix_tree_t *tree,
     u_char *key, u_char *mask);
 uintptr_t ngx_radix128tree_find(ngx_radix_tree_t *tree, u_char *key);
+uintptr_t ngx_radix128tree_find_cover(ngx_radix_tree_t *tree, u_char *key,
+    u_char *mask);
 #endif
 
 
@@ -14,6 +14,12 @@ typedef struct {
 } ngx_regex_conf_t;
 
 
+#define ngx_regex_set_add(map, i)                                            \
+    (map)[(i) / (8 * sizeof(uintptr_t))]                                     \
+        |= (uintptr_t) 1 << ((i) % (8 * sizeof(uintptr_t)))
+
+
+static ngx_int_t ngx_regex_literal(ngx_regex_compile_t *rc);
 static void * ngx_libc_cdecl ngx_regex_malloc(size_t size);
 static void ngx_libc_cdecl ngx_regex_free(void *p);
 #if (NGX_HAVE_PCRE_JIT)
@@ -132,6 +138,10 @@ ngx_regex_compile(ngx_regex_compile_t *rc)
 
     rc->regex->code = re;
 
+    if (ngx_regex_literal(rc) != NGX_OK) {
+        goto nomem;
+    }
+
     /* do not study at runtime */
 
     if (ngx_pcre_studies != NULL) {
@@ -194,6 +204,556 @@ nomem:
 }
 
 
+static ngx_int_t
+ngx_regex_literal(ngx_regex_compile_t *rc)
+{
+    u_char     *p, *last, *buf, c;
+    size_t      n, start, best, len;
+    ngx_int_t   depth;
+    ngx_uint_t  prefix, anchored, caseless;
+
+    /*
+     * finds the longest literal string every match of the pattern
+     * contains, or the literal the match starts with, if the pattern
+     * is anchored; patterns with top-level alternatives, inline options,
+     * and escapes other than simple ones are not analyzed
+     */
+
+    if (rc->options & ~NGX_REGEX_CASELESS) {
+        return NGX_OK;
+    }
+
+    caseless = (rc->options & NGX_REGEX_CASELESS) ? 1 : 0;
+
+    p = rc->pattern.data;
+    last = p + rc->pattern.len;
+
+    buf = ngx_pnalloc(rc->pool, rc->pattern.len);
+    if (buf == NULL) {
+        return NGX_ERROR;
+    }
+
+    n = 0;
+    start = 0;
+    best = 0;
+    len = 0;
+    prefix = 0;
+
+    anchored = (p < last && *p == '^');
+
+    if (anchored) {
+        p++;
+    }
+
+    while (p < last) {
+
+        switch (*p) {
+
+        case '|':
+            return NGX_OK;
+
+        case '\\':
+
+            if (p + 1 == last) {
+                return NGX_OK;
+            }
+
+            c = p[1];
+            p += 2;
+
+            if (!(c >= '0' && c <= '9')
+                && !(c >= 'a' && c <= 'z')
+                && !(c >= 'A' && c <= 'Z'))
+            {
+                goto literal;
+            }
+
+            switch (c) {
+            case 'd': case 'D': case 'w': case 'W': case 's': case 'S':
+            case 'b': case 'B': case 'h': case 'H': case 'v': case 'V':
+            case 'A': case 'z': case 'Z': case 'G': case 'R':
+                goto end;
+
+            case 't':
+                c = '\t';
+                goto literal;
+
+            case 'n':
+                c = '\n';
+                goto literal;
+
+            case 'r':
+                c = '\r';
+                goto literal;
+
+            case 'f':
+                c = '\f';
+                goto literal;
+            }
+
+            return NGX_OK;
+
+        case '[':
+
+            p++;
+
+            if (p < last && *p == '^') {
+                p++;
+            }
+
+            if (p < last && *p == ']') {
+                p++;
+            }
+
+            while (p < last && *p != ']') {
+
+                if (*p == '\\') {
+                    p++;
+
+                } else if (*p == '[' && p + 1 < last && p[1] == ':') {
+                    for (p += 2; p + 1 < last; p++) {
+                        if (p[0] == ':' && p[1] == ']') {
+                            p++;
+                            break;
+                        }
+                    }
+                }
+
+                p++;
+            }
+
+            if (p >= last) {
+                return NGX_OK;
+            }
+
+            p++;
+            goto end;
+
+        case '(':
+
+            if (p + 1 < last && p[1] == '*') {
+                return NGX_OK;
+            }
+
+            if (p + 2 < last && p[1] == '?') {
+                c = p[2];
+
+                if (c != ':' && c != '=' && c != '!' && c != '<'
+                    && c != '>' && c != '#' && c != 'P' && c != '|')
+                {
+                    return NGX_OK;
+                }
+            }
+
+            for (depth = 0; p < last; p++) {
+
+                if (*p == '\\') {
+                    p++;
+
+                } else if (*p == '[') {
+
+                    /* a class inside of a group may contain parentheses */
+
+                    return NGX_OK;
+
+                } else if (*p == '(') {
+                    depth++;
+
+                } else if (*p == ')') {
+                    if (--depth == 0) {
+                        break;
+                    }
+                }
+            }
+
+            if (p >= last) {
+                return NGX_OK;
+            }
+
+            p++;
+            goto end;
+
+        case '*':
+        case '?':
+        case '{':
+
+            /* the preceding character, if any, may be absent */
+
+            if (n > start) {
+                n--;
+            }
+
+            if (*p == '{') {
+                p++;
+
+                while (p < last && ((*p >= '0' && *p <= '9') || *p == ',')) {
+                    p++;
+                }
+
+                if (p < last && *p == '}') {
+                    p++;
+                }
+
+            } else {
+                p++;
+            }
+
+            goto quantifier;
+
+        case '+':
+            p++;
+            goto quantifier;
+
+        case '.':
+        case '^':
+        case '$':
+        case ')':
+            p++;
+            goto end;
+
+        default:
+            c = *p++;
+            goto literal;
+        }
+
+    literal:
+
+        buf[n++] = caseless ? ngx_tolower(c) : c;
+        continue;
+
+    quantifier:
+
+        if (p < last && (*p == '?' || *p == '+')) {
+            p++;
+        }
+
+    end:
+
+        if (anchored) {
+            anchored = 0;
+
+            if (n > start) {
+                prefix = 1;
+                best = start;
+                len = n - start;
+            }
+
+        } else if (!prefix && n - start > len) {
+            best = start;
+            len = n - start;
+        }
+
+        start = n;
+    }
+
+    if (anchored) {
+        prefix = 1;
+        best = start;
+        len = n - start;
+
+    } else if (!prefix && n - start > len) {
+        best = start;
+        len = n - start;
+    }
+
+    if (len == 0) {
+        return NGX_OK;
+    }
+
+    rc->regex->literal.len = len;
+    rc->regex->literal.data = buf + best;
+    rc->regex->prefix = prefix;
+    rc->regex->caseless = caseless;
+
+    return NGX_OK;
+}
+
+
+ngx_int_t
+ngx_regex_literal_missing(ngx_regex_t *re, ngx_str_t *s)
+{
+    u_char  *p, *last, *lit;
+    size_t   n;
+
+    n = re->literal.len;
+    lit = re->literal.data;
+
+    if (s->len < n) {
+        return 1;
+    }
+
+    if (re->prefix) {
+
+        if (re->caseless) {
+            return ngx_strncasecmp(s->data, lit, n) != 0;
+        }
+
+        return ngx_memcmp(s->data, lit, n) != 0;
+    }
+
+    if (re->caseless) {
+        return ngx_strlcasestrn(s->data, s->data + s->len, lit, n - 1) == NULL;
+    }
+
+    last = s->data + s->len - n + 1;
+
+    for (p = s->data; p < last; p++) {
+        if (*p == lit[0] && ngx_memcmp(p + 1, lit + 1, n - 1) == 0) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+
+ngx_regex_set_t *
+ngx_regex_set_create(ngx_pool_t *pool, ngx_regex_t **regex, ngx_uint_t n)
+{
+    u_char           *lit;
+    size_t            len, total;
+    uint32_t          state, u, v, f, k, *next, *fail, *queue, *first, *link;
+    ngx_uint_t        i, j, c, nclasses, nstates, qh, qt, nmatches;
+    ngx_pool_t       *temp;
+    ngx_regex_set_t  *set;
+
+    set = ngx_pcalloc(pool, sizeof(ngx_regex_set_t));
+    if (set == NULL) {
+        return NULL;
+    }
+
+    set->regex = regex;
+    set->nelts = n;
+    set->size = (n + 8 * sizeof(uintptr_t) - 1) / (8 * sizeof(uintptr_t));
+
+    set->always = ngx_pcalloc(pool, set->size * sizeof(uintptr_t));
+    set->map = ngx_palloc(pool, set->size * sizeof(uintptr_t));
+
+    if (set->always == NULL || set->map == NULL) {
+        return NULL;
+    }
+
+    /*
+     * the automaton runs on case folded subjects, so caseless literals
+     * match directly, and others are compared once they are found
+     */
+
+    total = 0;
+    nclasses = 1;
+
+    for (i = 0; i < n; i++) {
+        len = regex[i]->literal.len;
+
+        if (len == 0) {
+            ngx_regex_set_add(set->always, i);
+            continue;
+        }
+
+        total += len;
+        lit = regex[i]->literal.data;
+
+        for (j = 0; j < len; j++) {
+            c = ngx_tolower(lit[j]);
+
+            if (set->classes[c] == 0) {
+                set->classes[c] = (u_char) nclasses++;
+            }
+        }
+    }
+
+    if (total == 0) {
+        return set;
+    }
+
+    for (c = 'a'; c <= 'z'; c++) {
+        set->classes[c - 'a' + 'A'] = set->classes[c];
+    }
+
+    temp = ngx_create_pool(NGX_DEFAULT_POOL_SIZE, pool->log);
+    if (temp == NULL) {
+        return NULL;
+    }
+
+    next = ngx_pcalloc(temp, (total + 1) * nclasses * sizeof(uint32_t));
+    fail = ngx_pcalloc(temp, (total + 1) * sizeof(uint32_t));
+    queue = ngx_palloc(temp, (total + 1) * sizeof(uint32_t));
+    first = ngx_pcalloc(temp, (total + 1) * sizeof(uint32_t));
+    link = ngx_pcalloc(temp, n * sizeof(uint32_t));
+
+    if (next == NULL || fail == NULL || queue == NULL || first == NULL
+        || link == NULL)
+    {
+        goto failed;
+    }
+
+    /* the trie of the literals, the root state is 0 */
+
+    nstates = 1;
+    nmatches = 0;
+
+    for (i = 0; i < n; i++) {
+        len = regex[i]->literal.len;
+
+        if (len == 0) {
+            continue;
+        }
+
+        lit = regex[i]->literal.data;
+        state = 0;
+
+        for (j = 0; j < len; j++) {
+            k = state * nclasses + set->classes[lit[j]];
+
+            if (next[k] == 0) {
+                next[k] = nstates++;
+            }
+
+            state = next[k];
+        }
+
+        link[i] = first[state];
+        first[state] = i + 1;
+        nmatches++;
+    }
+
+    /*
+     * failure links in the breadth-first order, the missing transitions
+     * are taken from the failure states, so the automaton is a DFA
+     */
+
+    qh = 0;
+    qt = 0;
+
+    for (c = 0; c < nclasses; c++) {
+        if (next[c]) {
+            queue[qt++] = next[c];
+        }
+    }
+
+    set->dict = ngx_pcalloc(pool, nstates * sizeof(uint32_t));
+    if (set->dict == NULL) {
+        goto failed;
+    }
+
+    while (qh < qt) {
+        u = queue[qh++];
+
+        f = fail[u];
+        set->dict[u] = first[f] ? f : set->dict[f];
+
+        for (c = 0; c < nclasses; c++) {
+            k = u * nclasses + c;
+            v = next[k];
+
+            if (v) {
+                fail[v] = next[f * nclasses + c];
+                queue[qt++] = v;
+
+            } else {
+                next[k] = next[f * nclasses + c];
+            }
+        }
+    }
+
+    set->next = ngx_palloc(pool, nstates * nclasses * sizeof(uint32_t));
+    set->output = ngx_palloc(pool, (nstates + 1) * sizeof(uint32_t));
+    set->matches = ngx_palloc(pool, nmatches * sizeof(uint32_t));
+
+    if (set->next == NULL || set->output == NULL || set->matches == NULL) {
+        goto failed;
+    }
+
+    ngx_memcpy(set->next, next, nstates * nclasses * sizeof(uint32_t));
+
+    k = 0;
+
+    for (state = 0; state < nstates; state++) {
+        set->output[state] = k;
+
+        for (i = first[state]; i; i = link[i - 1]) {
+            set->matches[k++] = i - 1;
+        }
+    }
+
+    set->output[nstates] = k;
+    set->nclasses = nclasses;
+
+    /* the literals are checked by the automaton, not by ngx_regex_exec() */
+
+    for (i = 0; i < n; i++) {
+        if (regex[i]->literal.len) {
+            regex[i]->set = 1;
+        }
+    }
+
+    ngx_destroy_pool(temp);
+
+    return set;
+
+failed:
+
+    ngx_destroy_pool(temp);
+
+    return NULL;
+}
+
+
+/*
+ * the candidates bitmap is preallocated in the set and is overwritten
+ * by the next match, so it is used before any other match of the set
+ */
+
+uintptr_t *
+ngx_regex_set_match(ngx_regex_set_t *set, ngx_str_t *s)
+{
+    u_char       *p, *last;
+    size_t        len;
+    uint32_t      state, v, k;
+    uintptr_t    *map;
+    ngx_uint_t    i;
+    ngx_regex_t  *re;
+
+    if (set->next == NULL) {
+        return NULL;
+    }
+
+    map = set->map;
+
+    ngx_memcpy(map, set->always, set->size * sizeof(uintptr_t));
+
+    state = 0;
+    last = s->data + s->len;
+
+    for (p = s->data; p < last; p++) {
+
+        state = set->next[state * set->nclasses + set->classes[*p]];
+
+        for (v = state; v; v = set->dict[v]) {
+
+            for (k = set->output[v]; k < set->output[v + 1]; k++) {
+                i = set->matches[k];
+                re = set->regex[i];
+                len = re->literal.len;
+
+                if (re->prefix && (size_t) (p + 1 - s->data) != len) {
+                    continue;
+                }
+
+                if (!re->caseless
+                    && ngx_memcmp(p + 1 - len, re->literal.data, len) != 0)
+                {
+                    continue;
+                }
+
+                ngx_regex_set_add(map, i);
+            }
+        }
+    }
+
+    return map;
+}
+
+
 ngx_int_t
 ngx_regex_exec_array(ngx_array_t *a, ngx_str_t *s, ngx_log_t *log)
 {
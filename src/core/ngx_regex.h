@@ -23,6 +23,15 @@
 typedef struct {
     pcre        *code;
     pcre_extra  *extra;
+
+    /* a literal every match contains, used to reject subjects early */
+    ngx_str_t    literal;
+
+    unsigned     prefix:1;
+    unsigned     caseless:1;
+
+    /* the literal is checked by the automaton of a set */
+    unsigned     set:1;
 } ngx_regex_t;
 
 
@@ -46,14 +55,50 @@ typedef struct {
 } ngx_regex_elt_t;
 
 
+/*
+ * an Aho-Corasick automaton over the literals of a set of patterns,
+ * which finds the patterns that may match a subject in one pass
+ */
+
+typedef struct {
+    ngx_regex_t  **regex;
+    ngx_uint_t     nelts;
+
+    ngx_uint_t     nclasses;
+    uint32_t      *next;       /* transitions, nclasses per state */
+    uint32_t      *output;     /* the first match of a state */
+    uint32_t      *dict;       /* the next state with matches */
+    uint32_t      *matches;    /* patterns whose literals end in a state */
+
+    uintptr_t     *always;     /* patterns without literals */
+    uintptr_t     *map;        /* candidates of the last match */
+    ngx_uint_t     size;
+
+    u_char         classes[256];
+} ngx_regex_set_t;
+
+
 void ngx_regex_init(void);
 ngx_int_t ngx_regex_compile(ngx_regex_compile_t *rc);
 
 #define ngx_regex_exec(re, s, captures, size)                                \
-    pcre_exec(re->code, re->extra, (const char *) (s)->data, (s)->len, 0, 0, \
-              captures, size)
+    (((re)->literal.len && !(re)->set && ngx_regex_literal_missing(re, s))   \
+     ? NGX_REGEX_NO_MATCHED                                                  \
+     : pcre_exec(re->code, re->extra, (const char *) (s)->data, (s)->len,    \
+                 0, 0, captures, size))
 #define ngx_regex_exec_n      "pcre_exec()"
 
+ngx_int_t ngx_regex_literal_missing(ngx_regex_t *re, ngx_str_t *s);
+
+ngx_regex_set_t *ngx_regex_set_create(ngx_pool_t *pool, ngx_regex_t **regex,
+    ngx_uint_t n);
+uintptr_t *ngx_regex_set_match(ngx_regex_set_t *set, ngx_str_t *s);
+
+#define ngx_regex_set_candidate(map, i)                                      \
+    ((map) == NULL                                                           \
+     || ((map)[(i) / (8 * sizeof(uintptr_t))]                                \
+         & ((uintptr_t) 1 << ((i) % (8 * sizeof(uintptr_t))))))
+
 ngx_int_t ngx_regex_exec_array(ngx_array_t *a, ngx_str_t *s, ngx_log_t *log);
 
 
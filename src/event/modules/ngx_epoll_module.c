@@ -786,11 +786,12 @@ ngx_epoll_process_events(ngx_cycle_t *cycle, ngx_msec_t timer, ngx_uint_t flags)
     int                events;
     uint32_t           revents;
     ngx_int_t          instance, i;
-    ngx_uint_t         level;
+    u_char            *p;
+    ngx_uint_t         n, level;
     ngx_err_t          err;
     ngx_event_t       *rev, *wev;
     ngx_queue_t       *queue;
-    ngx_connection_t  *c;
+    ngx_connection_t  *c, *next;
 
     /* NGX_TIMER_INFINITE == INFTIM */
 
@@ -836,6 +837,44 @@ ngx_epoll_process_events(ngx_cycle_t *cycle, ngx_msec_t timer, ngx_uint_t flags)
     for (i = 0; i < events; i++) {
         c = event_list[i].data.ptr;
 
+        /*
+         * prefetch the connection two events ahead and the events
+         * of the next connection, so their cache misses overlap
+         * with the handling of the current event; the 64 bytes of
+         * the hot connection fields may span two cache lines
+         */
+
+        if (i + 2 < events) {
+            p = (u_char *) ((uintptr_t) event_list[i + 2].data.ptr
+                            & (uintptr_t) ~1);
+            ngx_prefetch(p);
+            ngx_prefetch(p + 63);
+        }
+
+        if (i + 1 < events) {
+            next = (ngx_connection_t *) ((uintptr_t) event_list[i + 1].data.ptr
+                                         & (uintptr_t) ~1);
+
+            /*
+             * the events of a connection are found by its index
+             * without loading the connection, which may still be
+             * in flight; the connections of the notify and aio
+             * events are not in the array
+             */
+
+            if (next >= cycle->connections
+                && next < cycle->connections + cycle->connection_n)
+            {
+                n = next - cycle->connections;
+
+                ngx_prefetch(&cycle->read_events[n]);
+
+                if (event_list[i + 1].events & EPOLLOUT) {
+                    ngx_prefetch(&cycle->write_events[n]);
+                }
+            }
+        }
+
         instance = (uintptr_t) c & 1;
         c = (ngx_connection_t *) ((uintptr_t) c & (uintptr_t) ~1);
 
@@ -574,6 +574,13 @@ ngx_kqueue_process_events(ngx_cycle_t *cycle, ngx_msec_t timer,
 
     for (i = 0; i < events; i++) {
 
+        /* prefetch the next event while handling the current one */
+
+        if (i + 1 < events) {
+            ngx_prefetch((void *) cheri_clear_low_ptr_bits(
+                                      (uintptr_t) event_list[i + 1].udata, 1));
+        }
+
         ngx_kqueue_dump_event(cycle->log, &event_list[i]);
 
         if (event_list[i].flags & EV_ERROR) {
@@ -73,6 +73,29 @@ static ngx_atomic_t   ngx_stat_writing0;
 ngx_atomic_t         *ngx_stat_writing = &ngx_stat_writing0;
 static ngx_atomic_t   ngx_stat_waiting0;
 ngx_atomic_t         *ngx_stat_waiting = &ngx_stat_waiting0;
+static ngx_atomic_t   ngx_stat_io_uring_requests0;
+ngx_atomic_t         *ngx_stat_io_uring_requests = &ngx_stat_io_uring_requests0;
+static ngx_atomic_t   ngx_stat_io_uring_depth0;
+ngx_atomic_t         *ngx_stat_io_uring_depth = &ngx_stat_io_uring_depth0;
+static ngx_atomic_t   ngx_stat_io_uring_latency0;
+ngx_atomic_t         *ngx_stat_io_uring_latency = &ngx_stat_io_uring_latency0;
+static ngx_atomic_t   ngx_stat_idle_http0;
+ngx_atomic_t         *ngx_stat_idle_http = &ngx_stat_idle_http0;
+static ngx_atomic_t   ngx_stat_idle_http_size0;
+ngx_atomic_t         *ngx_stat_idle_http_size = &ngx_stat_idle_http_size0;
+static ngx_atomic_t   ngx_stat_idle_https0;
+ngx_atomic_t         *ngx_stat_idle_https = &ngx_stat_idle_https0;
+static ngx_atomic_t   ngx_stat_idle_https_size0;
+ngx_atomic_t         *ngx_stat_idle_https_size = &ngx_stat_idle_https_size0;
+static ngx_atomic_t   ngx_stat_idle_http2_0;
+ngx_atomic_t         *ngx_stat_idle_http2 = &ngx_stat_idle_http2_0;
+static ngx_atomic_t   ngx_stat_idle_http2_size0;
+ngx_atomic_t         *ngx_stat_idle_http2_size = &ngx_stat_idle_http2_size0;
+static ngx_atomic_t   ngx_stat_static_cache_hits0;
+ngx_atomic_t         *ngx_stat_static_cache_hits = &ngx_stat_static_cache_hits0;
+static ngx_atomic_t   ngx_stat_static_cache_misses0;
+ngx_atomic_t         *ngx_stat_static_cache_misses =
+                                                &ngx_stat_static_cache_misses0;
 
 #endif
 
@@ -495,7 +518,20 @@ ngx_event_module_init(ngx_cycle_t *cycle)
            + cl          /* ngx_stat_active */
            + cl          /* ngx_stat_reading */
            + cl          /* ngx_stat_writing */
-           + cl;         /* ngx_stat_waiting */
+           + cl          /* ngx_stat_waiting */
+           + cl          /* ngx_stat_file_inline */
+           + cl          /* ngx_stat_file_offloaded */
+           + cl          /* ngx_stat_io_uring_requests */
+           + cl          /* ngx_stat_io_uring_depth */
+           + cl          /* ngx_stat_io_uring_latency */
+           + cl          /* ngx_stat_idle_http */
+           + cl          /* ngx_stat_idle_http_size */
+           + cl          /* ngx_stat_idle_https */
+           + cl          /* ngx_stat_idle_https_size */
+           + cl          /* ngx_stat_idle_http2 */
+           + cl          /* ngx_stat_idle_http2_size */
+           + cl          /* ngx_stat_static_cache_hits */
+           + cl;         /* ngx_stat_static_cache_misses */
 
 #endif
 
@@ -542,6 +578,19 @@ ngx_event_module_init(ngx_cycle_t *cycle)
     ngx_stat_reading = (ngx_atomic_t *) (shared + 7 * cl);
     ngx_stat_writing = (ngx_atomic_t *) (shared + 8 * cl);
     ngx_stat_waiting = (ngx_atomic_t *) (shared + 9 * cl);
+    ngx_stat_file_inline = (ngx_atomic_t *) (shared + 10 * cl);
+    ngx_stat_file_offloaded = (ngx_atomic_t *) (shared + 11 * cl);
+    ngx_stat_io_uring_requests = (ngx_atomic_t *) (shared + 12 * cl);
+    ngx_stat_io_uring_depth = (ngx_atomic_t *) (shared + 13 * cl);
+    ngx_stat_io_uring_latency = (ngx_atomic_t *) (shared + 14 * cl);
+    ngx_stat_idle_http = (ngx_atomic_t *) (shared + 15 * cl);
+    ngx_stat_idle_http_size = (ngx_atomic_t *) (shared + 16 * cl);
+    ngx_stat_idle_https = (ngx_atomic_t *) (shared + 17 * cl);
+    ngx_stat_idle_https_size = (ngx_atomic_t *) (shared + 18 * cl);
+    ngx_stat_idle_http2 = (ngx_atomic_t *) (shared + 19 * cl);
+    ngx_stat_idle_http2_size = (ngx_atomic_t *) (shared + 20 * cl);
+    ngx_stat_static_cache_hits = (ngx_atomic_t *) (shared + 21 * cl);
+    ngx_stat_static_cache_misses = (ngx_atomic_t *) (shared + 22 * cl);
 
 #endif
 
@@ -568,9 +617,9 @@ static ngx_int_t
 ngx_event_process_init(ngx_cycle_t *cycle)
 {
     ngx_uint_t           m, i;
-    ngx_event_t         *rev, *wev;
+    ngx_event_t         *rev;
     ngx_listening_t     *ls;
-    ngx_connection_t    *c, *next, *old;
+    ngx_connection_t    *c, *old;
     ngx_core_conf_t     *ccf;
     ngx_event_conf_t    *ecf;
     ngx_event_module_t  *module;
@@ -680,53 +729,42 @@ ngx_event_process_init(ngx_cycle_t *cycle)
 
 #endif
 
-    cycle->connections =
-        ngx_alloc(sizeof(ngx_connection_t) * cycle->connection_n, cycle->log);
+    /*
+     * the arrays are aligned to a cache line; as the structures are not
+     * sized in cache lines, the hot fields at the start of an entry
+     * may still span two lines, so the event loop prefetches both;
+     * the arrays are only reserved here and set up in chunks on demand
+     * by ngx_get_connection(), so the pages of the unused connections
+     * are never touched
+     */
+
+    cycle->connections = ngx_memalign(ngx_cacheline_size,
+                                      sizeof(ngx_connection_t)
+                                      * cycle->connection_n,
+                                      cycle->log);
     if (cycle->connections == NULL) {
         return NGX_ERROR;
     }
 
-    c = cycle->connections;
-
-    cycle->read_events = ngx_alloc(sizeof(ngx_event_t) * cycle->connection_n,
-                                   cycle->log);
+    cycle->read_events = ngx_memalign(ngx_cacheline_size,
+                                      sizeof(ngx_event_t)
+                                      * cycle->connection_n,
+                                      cycle->log);
     if (cycle->read_events == NULL) {
         return NGX_ERROR;
     }
 
-    rev = cycle->read_events;
-    for (i = 0; i < cycle->connection_n; i++) {
-        rev[i].closed = 1;
-        rev[i].instance = 1;
-    }
-
-    cycle->write_events = ngx_alloc(sizeof(ngx_event_t) * cycle->connection_n,
-                                    cycle->log);
+    cycle->write_events = ngx_memalign(ngx_cacheline_size,
+                                       sizeof(ngx_event_t)
+                                       * cycle->connection_n,
+                                       cycle->log);
     if (cycle->write_events == NULL) {
         return NGX_ERROR;
     }
 
-    wev = cycle->write_events;
-    for (i = 0; i < cycle->connection_n; i++) {
-        wev[i].closed = 1;
-    }
-
-    i = cycle->connection_n;
-    next = NULL;
-
-    do {
-        i--;
-
-        c[i].data = next;
-        c[i].read = &cycle->read_events[i];
-        c[i].write = &cycle->write_events[i];
-        c[i].fd = (ngx_socket_t) -1;
-
-        next = &c[i];
-    } while (i);
-
-    cycle->free_connections = next;
+    cycle->free_connections = NULL;
     cycle->free_connection_n = cycle->connection_n;
+    cycle->init_connection_n = 0;
 
     /* for each listening socket */
 
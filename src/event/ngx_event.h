@@ -167,6 +167,12 @@ struct ngx_event_aio_s {
     size_t                     nbytes;
 #endif
 
+#if (NGX_HAVE_IO_URING)
+    ngx_msec_t                 start;
+    struct iovec              *iovs;
+    size_t                     size;     /* of the write in progress */
+#endif
+
     ngx_aiocb_t                aiocb;
     ngx_event_t                event;
 };
@@ -484,6 +490,17 @@ extern ngx_atomic_t  *ngx_stat_active;
 extern ngx_atomic_t  *ngx_stat_reading;
 extern ngx_atomic_t  *ngx_stat_writing;
 extern ngx_atomic_t  *ngx_stat_waiting;
+extern ngx_atomic_t  *ngx_stat_io_uring_requests;
+extern ngx_atomic_t  *ngx_stat_io_uring_depth;
+extern ngx_atomic_t  *ngx_stat_io_uring_latency;
+extern ngx_atomic_t  *ngx_stat_idle_http;
+extern ngx_atomic_t  *ngx_stat_idle_http_size;
+extern ngx_atomic_t  *ngx_stat_idle_https;
+extern ngx_atomic_t  *ngx_stat_idle_https_size;
+extern ngx_atomic_t  *ngx_stat_idle_http2;
+extern ngx_atomic_t  *ngx_stat_idle_http2_size;
+extern ngx_atomic_t  *ngx_stat_static_cache_hits;
+extern ngx_atomic_t  *ngx_stat_static_cache_misses;
 
 #endif
 
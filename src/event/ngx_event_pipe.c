@@ -11,7 +11,29 @@
 #include <ngx_event_pipe.h>
 
 
+#define NGX_EVENT_PIPE_BUF_ALIGN  1024
+
+
+typedef struct {
+    ngx_queue_t                    queue;
+    ngx_event_pipe_arena_class_t  *class;
+} ngx_event_pipe_block_t;
+
+
 static ngx_int_t ngx_event_pipe_read_upstream(ngx_event_pipe_t *p);
+static ngx_chain_t *ngx_event_pipe_alloc_bufs(ngx_event_pipe_t *p);
+static ngx_chain_t *ngx_event_pipe_alloc_buf(ngx_event_pipe_t *p);
+static size_t ngx_event_pipe_buf_size(ngx_event_pipe_t *p);
+static ngx_int_t ngx_event_pipe_arena_alloc(ngx_event_pipe_t *p, size_t size,
+    ngx_event_pipe_block_t **blkp);
+static void ngx_event_pipe_arena_free(ngx_event_pipe_arena_t *arena,
+    ngx_event_pipe_block_t *blk);
+static void ngx_event_pipe_arena_wakeup(ngx_event_pipe_arena_t *arena);
+static void ngx_event_pipe_release_bufs(ngx_event_pipe_t *p);
+static void ngx_event_pipe_arena_cleanup(void *data);
+#if !(NGX_WIN32)
+static void ngx_event_pipe_set_rcvlowat(ngx_event_pipe_t *p);
+#endif
 static ngx_int_t ngx_event_pipe_write_to_downstream(ngx_event_pipe_t *p);
 
 static ngx_int_t ngx_event_pipe_write_chain_to_temp_file(ngx_event_pipe_t *p);
@@ -26,6 +48,8 @@ ngx_event_pipe(ngx_event_pipe_t *p, ngx_int_t do_write)
     ngx_uint_t    flags;
     ngx_event_t  *rev, *wev;
 
+    p->arena_flushed = 0;
+
     for ( ;; ) {
         if (do_write) {
             p->log->action = "sending to client";
@@ -57,6 +81,16 @@ ngx_event_pipe(ngx_event_pipe_t *p, ngx_int_t do_write)
         do_write = 1;
     }
 
+    if (p->arena) {
+        ngx_event_pipe_release_bufs(p);
+
+        /* pass the free blocks on if the woken up pipe did not need them */
+
+        if (!p->arena_wait && p->arena->nfree) {
+            ngx_event_pipe_arena_wakeup(p->arena);
+        }
+    }
+
     if (p->upstream->fd != (ngx_socket_t) -1) {
         rev = p->upstream->read;
 
@@ -67,7 +101,18 @@ ngx_event_pipe(ngx_event_pipe_t *p, ngx_int_t do_write)
         }
 
         if (!rev->delayed) {
-            if (rev->active && !rev->ready) {
+
+            /*
+             * a pipe waiting for the arena does not read even if
+             * the upstream is ready, so it is timed out as well
+             */
+
+            if (p->arena_wait) {
+                if (!rev->timer_set) {
+                    ngx_add_timer(rev, p->read_timeout);
+                }
+
+            } else if (rev->active && !rev->ready) {
                 ngx_add_timer(rev, p->read_timeout);
 
             } else if (rev->timer_set) {
@@ -104,15 +149,16 @@ ngx_event_pipe_read_upstream(ngx_event_pipe_t *p)
     off_t         limit;
     ssize_t       n, size;
     ngx_int_t     rc;
-    ngx_buf_t    *b;
     ngx_msec_t    delay;
     ngx_chain_t  *chain, *cl, *ln;
 
+    ngx_event_pipe_arena_unwait(p);
+
     if (p->upstream_eof || p->upstream_error || p->upstream_done) {
         return NGX_OK;
     }
 
-#if (NGX_THREADS)
+#if (NGX_THREADS || NGX_HAVE_IO_URING)
 
     if (p->aio) {
         ngx_log_debug0(NGX_LOG_DEBUG_EVENT, p->log, 0,
@@ -225,24 +271,46 @@ ngx_event_pipe_read_upstream(ngx_event_pipe_t *p)
                     p->free_raw_bufs = NULL;
                 }
 
-            } else if (p->allocated < p->bufs.num) {
+            } else if (p->allocated < p->bufs.num
+                       && (chain = ngx_event_pipe_alloc_bufs(p)) != NULL)
+            {
 
-                /* allocate a new buf if it's still allowed */
+                /* allocate new bufs if it's still allowed */
 
-                b = ngx_create_temp_buf(p->pool, p->bufs.size);
-                if (b == NULL) {
+                if (chain == NGX_CHAIN_ERROR) {
                     return NGX_ABORT;
                 }
 
-                p->allocated++;
+            } else if (p->allocated < p->bufs.num && p->in == NULL) {
 
-                chain = ngx_alloc_chain_link(p->pool);
-                if (chain == NULL) {
-                    return NGX_ABORT;
+                /*
+                 * the arena is exhausted and there is nothing to write
+                 * or to save in a temporary file to free a buf, so stop
+                 * reading until another request returns a buf; the bufs
+                 * already sent to a client are reclaimed first, as no
+                 * event may come to do this
+                 */
+
+                if (p->busy
+                    && !p->arena_flushed
+                    && p->downstream->data == p->output_ctx
+                    && p->downstream->write->ready
+                    && !p->downstream->write->delayed)
+                {
+                    p->arena_flush = 1;
+                    p->arena_flushed = 1;
+                    p->upstream_blocked = 1;
+
+                    break;
                 }
 
-                chain->buf = b;
-                chain->next = NULL;
+                ngx_log_debug0(NGX_LOG_DEBUG_EVENT, p->log, 0,
+                               "pipe arena wait");
+
+                ngx_queue_insert_tail(&p->arena->waiters, &p->arena_queue);
+                p->arena_wait = 1;
+
+                break;
 
             } else if (!p->cacheable
                        && p->downstream->data == p->output_ctx
@@ -335,6 +403,13 @@ ngx_event_pipe_read_upstream(ngx_event_pipe_t *p)
         delay = p->limit_rate ? (ngx_msec_t) n * 1000 / p->limit_rate : 0;
 
         p->read_length += n;
+
+#if !(NGX_WIN32)
+        if (p->adaptive_bufs && p->expected_min) {
+            ngx_event_pipe_set_rcvlowat(p);
+        }
+#endif
+
         cl = chain;
         p->free_raw_bufs = NULL;
 
@@ -469,7 +544,7 @@ ngx_event_pipe_read_upstream(ngx_event_pipe_t *p)
 
         p->free_raw_bufs = p->free_raw_bufs->next;
 
-        if (p->free_bufs && p->buf_to_file == NULL) {
+        if (p->free_bufs && p->buf_to_file == NULL && p->arena == NULL) {
             for (cl = p->free_raw_bufs; cl; cl = cl->next) {
                 if (cl->buf->shadow == NULL) {
                     ngx_pfree(p->pool, cl->buf->start);
@@ -494,6 +569,480 @@ ngx_event_pipe_read_upstream(ngx_event_pipe_t *p)
 }
 
 
+/*
+ * with adaptive bufs, as many bufs are allocated at once as the data
+ * pending in the socket needs, so they are filled by one readv()
+ */
+
+static ngx_chain_t *
+ngx_event_pipe_alloc_bufs(ngx_event_pipe_t *p)
+{
+    ngx_chain_t  *chain;
+#if (NGX_HAVE_FIONREAD)
+    int           nread;
+    size_t        size;
+    ngx_chain_t  *cl, **ll;
+#endif
+
+    chain = ngx_event_pipe_alloc_buf(p);
+
+    if (chain == NULL || chain == NGX_CHAIN_ERROR) {
+        return chain;
+    }
+
+    p->allocated++;
+
+#if (NGX_HAVE_FIONREAD)
+
+    if (!p->adaptive_bufs || p->single_buf) {
+        return chain;
+    }
+
+    if (ngx_socket_nread(p->upstream->fd, &nread) == -1) {
+        ngx_log_debug0(NGX_LOG_DEBUG_EVENT, p->log, ngx_socket_errno,
+                       ngx_socket_nread_n " failed");
+        return chain;
+    }
+
+    size = chain->buf->end - chain->buf->last;
+    ll = &chain->next;
+
+    while ((size_t) nread > size && p->allocated < p->bufs.num) {
+
+        cl = ngx_event_pipe_alloc_buf(p);
+
+        if (cl == NULL) {
+            break;
+        }
+
+        if (cl == NGX_CHAIN_ERROR) {
+            return NGX_CHAIN_ERROR;
+        }
+
+        p->allocated++;
+
+        size += cl->buf->end - cl->buf->last;
+
+        *ll = cl;
+        ll = &cl->next;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, p->log, 0,
+                   "pipe alloc bufs: %uz, pending: %d", size, nread);
+
+#endif
+
+    return chain;
+}
+
+
+static ngx_chain_t *
+ngx_event_pipe_alloc_buf(ngx_event_pipe_t *p)
+{
+    size_t                   size;
+    ngx_int_t                rc;
+    ngx_buf_t               *b;
+    ngx_chain_t             *cl;
+    ngx_event_pipe_block_t  *blk;
+
+    size = ngx_event_pipe_buf_size(p);
+
+    if (p->arena) {
+        rc = ngx_event_pipe_arena_alloc(p, size, &blk);
+
+        if (rc == NGX_ERROR) {
+            return NGX_CHAIN_ERROR;
+        }
+
+        if (rc == NGX_OK) {
+
+            /* the block is returned to the arena by the pool cleanup */
+
+            ngx_queue_insert_tail(&p->arena_blocks, &blk->queue);
+
+            if (p->arena_bufs) {
+                cl = p->arena_bufs;
+                p->arena_bufs = cl->next;
+
+                b = cl->buf;
+                ngx_memzero(b, sizeof(ngx_buf_t));
+
+            } else {
+                b = ngx_calloc_buf(p->pool);
+                if (b == NULL) {
+                    return NGX_CHAIN_ERROR;
+                }
+
+                cl = ngx_alloc_chain_link(p->pool);
+                if (cl == NULL) {
+                    return NGX_CHAIN_ERROR;
+                }
+
+                cl->buf = b;
+            }
+
+            b->start = (u_char *) blk + sizeof(ngx_event_pipe_block_t);
+            b->pos = b->start;
+            b->last = b->start;
+            b->end = b->start + size;
+            b->temporary = 1;
+            b->tag = (ngx_buf_tag_t) p->arena;
+
+            cl->next = NULL;
+
+            return cl;
+        }
+
+        if (p->allocated) {
+            return NULL;
+        }
+
+        /*
+         * the arena is taken by other requests, and a pipe that holds
+         * no blocks may never be woken up by them, so it gets one buf
+         * from its pool to make progress
+         */
+
+        ngx_log_debug1(NGX_LOG_DEBUG_EVENT, p->log, 0,
+                       "pipe arena busy, pool buf: %uz", size);
+    }
+
+    b = ngx_create_temp_buf(p->pool, size);
+    if (b == NULL) {
+        return NGX_CHAIN_ERROR;
+    }
+
+    cl = ngx_alloc_chain_link(p->pool);
+    if (cl == NULL) {
+        return NGX_CHAIN_ERROR;
+    }
+
+    cl->buf = b;
+    cl->next = NULL;
+
+    return cl;
+}
+
+
+static size_t
+ngx_event_pipe_buf_size(ngx_event_pipe_t *p)
+{
+    off_t   rest;
+    size_t  size;
+#if (NGX_HAVE_FIONREAD)
+    int     nread;
+#endif
+
+    if (!p->adaptive_bufs || p->expected_length < 0) {
+        return p->bufs.size;
+    }
+
+    /*
+     * a buffer smaller than configured is allocated only for the tail
+     * of a response, the response larger than expected gets full bufs
+     */
+
+    rest = p->expected_length - p->read_length;
+
+    if (rest <= 0 || rest >= (off_t) p->bufs.size) {
+        return p->bufs.size;
+    }
+
+    size = (size_t) rest;
+
+#if (NGX_HAVE_FIONREAD)
+
+    if (ngx_socket_nread(p->upstream->fd, &nread) == -1) {
+        ngx_log_debug0(NGX_LOG_DEBUG_EVENT, p->log, ngx_socket_errno,
+                       ngx_socket_nread_n " failed");
+        return p->bufs.size;
+    }
+
+    if ((size_t) nread > size) {
+        size = nread;
+    }
+
+#endif
+
+    size = ngx_align(size, NGX_EVENT_PIPE_BUF_ALIGN);
+
+    if (size > p->bufs.size) {
+        size = p->bufs.size;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, p->log, 0,
+                   "pipe buf size: %uz, rest: %O", size, rest);
+
+    return size;
+}
+
+
+#if !(NGX_WIN32)
+
+static void
+ngx_event_pipe_set_rcvlowat(ngx_event_pipe_t *p)
+{
+    int    lowat;
+    off_t  rest;
+
+    /*
+     * while at least a whole buffer is still to come, do not wake up
+     * for less than a buffer; the low water mark is restored before
+     * the response tail, so the connection may be kept alive
+     */
+
+    rest = p->expected_length - p->read_length;
+
+    lowat = (rest >= (off_t) p->bufs.size) ? (int) p->bufs.size : 1;
+
+    if (lowat == p->rcvlowat || (lowat == 1 && p->rcvlowat == 0)) {
+        return;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, p->log, 0,
+                   "pipe rcvlowat: %d", lowat);
+
+    if (setsockopt(p->upstream->fd, SOL_SOCKET, SO_RCVLOWAT,
+                   (const void *) &lowat, sizeof(int))
+        == -1)
+    {
+        ngx_log_error(NGX_LOG_ALERT, p->log, ngx_socket_errno,
+                      "setsockopt(SO_RCVLOWAT, %d) failed, ignored", lowat);
+
+        p->expected_min = 0;
+        return;
+    }
+
+    p->rcvlowat = lowat;
+}
+
+#endif
+
+
+ngx_event_pipe_arena_t *
+ngx_event_pipe_create_arena(ngx_pool_t *pool, size_t size)
+{
+    ngx_event_pipe_arena_t  *arena;
+
+    arena = ngx_pcalloc(pool, sizeof(ngx_event_pipe_arena_t));
+    if (arena == NULL) {
+        return NULL;
+    }
+
+    arena->max_size = size;
+    arena->pool = pool;
+
+    ngx_queue_init(&arena->waiters);
+
+    return arena;
+}
+
+
+ngx_int_t
+ngx_event_pipe_use_arena(ngx_event_pipe_t *p, ngx_event_pipe_arena_t *arena)
+{
+    ngx_pool_cleanup_t  *cln;
+
+    cln = ngx_pool_cleanup_add(p->pool, 0);
+    if (cln == NULL) {
+        return NGX_ERROR;
+    }
+
+    cln->handler = ngx_event_pipe_arena_cleanup;
+    cln->data = p;
+
+    p->arena = arena;
+
+    ngx_queue_init(&p->arena_blocks);
+
+    return NGX_OK;
+}
+
+
+void
+ngx_event_pipe_arena_unwait(ngx_event_pipe_t *p)
+{
+    if (p->arena_wait) {
+        ngx_queue_remove(&p->arena_queue);
+        p->arena_wait = 0;
+    }
+}
+
+
+static ngx_int_t
+ngx_event_pipe_arena_alloc(ngx_event_pipe_t *p, size_t size,
+    ngx_event_pipe_block_t **blkp)
+{
+    ngx_queue_t                   *q;
+    ngx_event_pipe_block_t        *blk;
+    ngx_event_pipe_arena_t        *arena;
+    ngx_event_pipe_arena_class_t  *cls, *other;
+
+    arena = p->arena;
+
+    for (cls = arena->classes; cls; cls = cls->next) {
+        if (cls->size == size) {
+            break;
+        }
+    }
+
+    if (cls && !ngx_queue_empty(&cls->free)) {
+        q = ngx_queue_head(&cls->free);
+        ngx_queue_remove(q);
+
+        arena->nfree--;
+
+        *blkp = ngx_queue_data(q, ngx_event_pipe_block_t, queue);
+
+        return NGX_OK;
+    }
+
+    if (cls == NULL) {
+        cls = ngx_palloc(arena->pool, sizeof(ngx_event_pipe_arena_class_t));
+        if (cls == NULL) {
+            return NGX_ERROR;
+        }
+
+        cls->size = size;
+        ngx_queue_init(&cls->free);
+
+        cls->next = arena->classes;
+        arena->classes = cls;
+    }
+
+    /* free the least recently used blocks of other sizes to make room */
+
+    for (other = arena->classes;
+         other && arena->size + size > arena->max_size;
+         other = other->next)
+    {
+        while (!ngx_queue_empty(&other->free)
+               && arena->size + size > arena->max_size)
+        {
+            q = ngx_queue_last(&other->free);
+            ngx_queue_remove(q);
+
+            blk = ngx_queue_data(q, ngx_event_pipe_block_t, queue);
+            ngx_free(blk);
+
+            arena->size -= other->size;
+            arena->nfree--;
+        }
+    }
+
+    if (arena->size + size > arena->max_size) {
+        ngx_log_debug2(NGX_LOG_DEBUG_EVENT, p->log, 0,
+                       "pipe arena exhausted: %uz of %uz",
+                       arena->size, arena->max_size);
+        return NGX_BUSY;
+    }
+
+    blk = ngx_alloc(sizeof(ngx_event_pipe_block_t) + size, p->log);
+    if (blk == NULL) {
+        return NGX_ERROR;
+    }
+
+    blk->class = cls;
+    arena->size += size;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, p->log, 0,
+                   "pipe arena alloc: %uz, total: %uz", size, arena->size);
+
+    *blkp = blk;
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_event_pipe_arena_free(ngx_event_pipe_arena_t *arena,
+    ngx_event_pipe_block_t *blk)
+{
+    ngx_queue_insert_head(&blk->class->free, &blk->queue);
+    arena->nfree++;
+
+    ngx_event_pipe_arena_wakeup(arena);
+}
+
+
+static void
+ngx_event_pipe_arena_wakeup(ngx_event_pipe_arena_t *arena)
+{
+    ngx_queue_t       *q;
+    ngx_event_pipe_t  *p;
+
+    if (ngx_queue_empty(&arena->waiters)) {
+        return;
+    }
+
+    q = ngx_queue_head(&arena->waiters);
+    ngx_queue_remove(q);
+
+    p = ngx_queue_data(q, ngx_event_pipe_t, arena_queue);
+    p->arena_wait = 0;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_EVENT, p->log, 0, "pipe arena wake up");
+
+    ngx_post_event(p->upstream->read, &ngx_posted_events);
+}
+
+
+static void
+ngx_event_pipe_release_bufs(ngx_event_pipe_t *p)
+{
+    ngx_buf_t               *b;
+    ngx_chain_t             *cl, **ll;
+    ngx_event_pipe_block_t  *blk;
+
+    /* return the empty bufs, the first free buf may be partially filled */
+
+    ll = &p->free_raw_bufs;
+
+    while (*ll) {
+        cl = *ll;
+        b = cl->buf;
+
+        if (b->tag != (ngx_buf_tag_t) p->arena || b->pos != b->last) {
+            ll = &cl->next;
+            continue;
+        }
+
+        *ll = cl->next;
+
+        blk = (ngx_event_pipe_block_t *)
+                  (b->start - sizeof(ngx_event_pipe_block_t));
+
+        ngx_queue_remove(&blk->queue);
+        ngx_event_pipe_arena_free(p->arena, blk);
+
+        p->allocated--;
+
+        cl->next = p->arena_bufs;
+        p->arena_bufs = cl;
+    }
+}
+
+
+static void
+ngx_event_pipe_arena_cleanup(void *data)
+{
+    ngx_event_pipe_t  *p = data;
+
+    ngx_queue_t  *q;
+
+    ngx_event_pipe_arena_unwait(p);
+
+    while (!ngx_queue_empty(&p->arena_blocks)) {
+        q = ngx_queue_head(&p->arena_blocks);
+        ngx_queue_remove(q);
+
+        ngx_event_pipe_arena_free(p->arena,
+                                  ngx_queue_data(q, ngx_event_pipe_block_t,
+                                                 queue));
+    }
+}
+
+
 static ngx_int_t
 ngx_event_pipe_write_to_downstream(ngx_event_pipe_t *p)
 {
@@ -509,7 +1058,7 @@ ngx_event_pipe_write_to_downstream(ngx_event_pipe_t *p)
     ngx_log_debug1(NGX_LOG_DEBUG_EVENT, p->log, 0,
                    "pipe write downstream: %d", downstream->write->ready);
 
-#if (NGX_THREADS)
+#if (NGX_THREADS || NGX_HAVE_IO_URING)
 
     if (p->writing) {
         rc = ngx_event_pipe_write_chain_to_temp_file(p);
@@ -614,7 +1163,8 @@ ngx_event_pipe_write_to_downstream(ngx_event_pipe_t *p)
 
         out = NULL;
 
-        if (bsize >= (size_t) p->busy_size) {
+        if (bsize >= (size_t) p->busy_size || p->arena_flush) {
+            p->arena_flush = 0;
             flush = 1;
             goto flush;
         }
@@ -738,7 +1288,7 @@ ngx_event_pipe_write_chain_to_temp_file(ngx_event_pipe_t *p)
     ngx_uint_t    prev_last_shadow;
     ngx_chain_t  *cl, *tl, *next, *out, **ll, **last_out, **last_free;
 
-#if (NGX_THREADS)
+#if (NGX_THREADS || NGX_HAVE_IO_URING)
 
     if (p->writing) {
 
@@ -836,17 +1386,29 @@ ngx_event_pipe_write_chain_to_temp_file(ngx_event_pipe_t *p)
     }
 #endif
 
+#if (NGX_HAVE_IO_URING)
+    if (p->aio_handler) {
+        p->temp_file->io_uring_write = 1;
+        p->temp_file->file.write_aio_handler = p->aio_handler;
+        p->temp_file->file.write_aio_ctx = p->aio_ctx;
+    }
+#endif
+
     n = ngx_write_chain_to_temp_file(p->temp_file, out);
 
     if (n == NGX_ERROR) {
         return NGX_ABORT;
     }
 
-#if (NGX_THREADS)
+#if (NGX_THREADS || NGX_HAVE_IO_URING)
 
     if (n == NGX_AGAIN) {
         p->writing = out;
+
+#if (NGX_THREADS)
         p->thread_task = p->temp_file->file.thread_task;
+#endif
+
         return NGX_AGAIN;
     }
 
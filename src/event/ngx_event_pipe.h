@@ -20,6 +20,33 @@ typedef ngx_int_t (*ngx_event_pipe_input_filter_pt)(ngx_event_pipe_t *p,
                                                     ngx_buf_t *buf);
 typedef ngx_int_t (*ngx_event_pipe_output_filter_pt)(void *data,
                                                      ngx_chain_t *chain);
+typedef void (*ngx_event_pipe_aio_pt)(ngx_file_t *file);
+
+
+typedef struct ngx_event_pipe_arena_class_s  ngx_event_pipe_arena_class_t;
+
+struct ngx_event_pipe_arena_class_s {
+    size_t                         size;
+    ngx_queue_t                    free;
+    ngx_event_pipe_arena_class_t  *next;
+};
+
+
+/*
+ * the per-worker memory for the pipe bufs, the bufs are returned
+ * here as soon as they are empty and are reused by other requests
+ */
+
+typedef struct {
+    size_t                         max_size;
+    size_t                         size;
+    ngx_uint_t                     nfree;
+
+    ngx_event_pipe_arena_class_t  *classes;
+    ngx_queue_t                    waiters;
+
+    ngx_pool_t                    *pool;
+} ngx_event_pipe_arena_t;
 
 
 struct ngx_event_pipe_s {
@@ -54,6 +81,11 @@ struct ngx_event_pipe_s {
     ngx_thread_task_t                *thread_task;
 #endif
 
+#if (NGX_HAVE_IO_URING || NGX_COMPAT)
+    ngx_event_pipe_aio_pt             aio_handler;
+    void                             *aio_ctx;
+#endif
+
     unsigned           read:1;
     unsigned           cacheable:1;
     unsigned           single_buf:1;
@@ -66,6 +98,11 @@ struct ngx_event_pipe_s {
     unsigned           downstream_error:1;
     unsigned           cyclic_temp_file:1;
     unsigned           aio:1;
+    unsigned           adaptive_bufs:1;
+    unsigned           expected_min:1;
+    unsigned           arena_wait:1;
+    unsigned           arena_flush:1;
+    unsigned           arena_flushed:1;
 
     ngx_int_t          allocated;
     ngx_bufs_t         bufs;
@@ -76,6 +113,14 @@ struct ngx_event_pipe_s {
     off_t              read_length;
     off_t              length;
 
+    /*
+     * the expected number of bytes to read from upstream, -1 if unknown;
+     * if expected_min is set then at least this number of bytes will arrive
+     */
+
+    off_t              expected_length;
+    int                rcvlowat;
+
     off_t              max_temp_file_size;
     ssize_t            temp_file_write_size;
 
@@ -95,6 +140,13 @@ struct ngx_event_pipe_s {
 
     ngx_temp_file_t   *temp_file;
 
+    /* the arena blocks held, the waiters link, the bufs without memory */
+
+    ngx_event_pipe_arena_t           *arena;
+    ngx_queue_t                       arena_blocks;
+    ngx_queue_t                       arena_queue;
+    ngx_chain_t                      *arena_bufs;
+
     /* STUB */ int     num;
 };
 
@@ -102,6 +154,11 @@ struct ngx_event_pipe_s {
 ngx_int_t ngx_event_pipe(ngx_event_pipe_t *p, ngx_int_t do_write);
 ngx_int_t ngx_event_pipe_copy_input_filter(ngx_event_pipe_t *p, ngx_buf_t *buf);
 ngx_int_t ngx_event_pipe_add_free_buf(ngx_event_pipe_t *p, ngx_buf_t *b);
+ngx_event_pipe_arena_t *ngx_event_pipe_create_arena(ngx_pool_t *pool,
+    size_t size);
+ngx_int_t ngx_event_pipe_use_arena(ngx_event_pipe_t *p,
+    ngx_event_pipe_arena_t *arena);
+void ngx_event_pipe_arena_unwait(ngx_event_pipe_t *p);
 
 
 #endif /* _NGX_EVENT_PIPE_H_INCLUDED_ */
@@ -34,13 +34,21 @@ typedef struct {
 
 #endif
 
+/*
+ * The rules are compiled into radix trees with the deny flag as a value.
+ * A rule covered by a preceding rule never matches and is not added to
+ * a tree, so the longest match in a tree is the first matching rule.
+ */
+
 typedef struct {
-    ngx_array_t      *rules;     /* array of ngx_http_access_rule_t */
+    ngx_array_t       *rules;     /* array of ngx_http_access_rule_t */
+    ngx_radix_tree_t  *tree;
 #if (NGX_HAVE_INET6)
-    ngx_array_t      *rules6;    /* array of ngx_http_access_rule6_t */
+    ngx_array_t       *rules6;    /* array of ngx_http_access_rule6_t */
+    ngx_radix_tree_t  *tree6;
 #endif
 #if (NGX_HAVE_UNIX_DOMAIN)
-    ngx_array_t      *rules_un;  /* array of ngx_http_access_rule_un_t */
+    ngx_array_t       *rules_un;  /* array of ngx_http_access_rule_un_t */
 #endif
 } ngx_http_access_loc_conf_t;
 
@@ -57,6 +65,8 @@ static ngx_int_t ngx_http_access_unix(ngx_http_request_t *r,
     ngx_http_access_loc_conf_t *alcf);
 #endif
 static ngx_int_t ngx_http_access_found(ngx_http_request_t *r, ngx_uint_t deny);
+static ngx_int_t ngx_http_access_compile(ngx_conf_t *cf,
+    ngx_http_access_loc_conf_t *alcf);
 static char *ngx_http_access_rule(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 static void *ngx_http_access_create_loc_conf(ngx_conf_t *cf);
@@ -183,22 +193,19 @@ static ngx_int_t
 ngx_http_access_inet(ngx_http_request_t *r, ngx_http_access_loc_conf_t *alcf,
     in_addr_t addr)
 {
-    ngx_uint_t               i;
-    ngx_http_access_rule_t  *rule;
+    uintptr_t  deny;
 
-    rule = alcf->rules->elts;
-    for (i = 0; i < alcf->rules->nelts; i++) {
+    deny = ngx_radix32tree_find(alcf->tree, ntohl(addr));
 
-        ngx_log_debug3(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                       "access: %08XD %08XD %08XD",
-                       addr, rule[i].mask, rule[i].addr);
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "access: %08XD %i", addr,
+                   deny == NGX_RADIX_NO_VALUE ? -1 : (ngx_int_t) deny);
 
-        if ((addr & rule[i].mask) == rule[i].addr) {
-            return ngx_http_access_found(r, rule[i].deny);
-        }
+    if (deny == NGX_RADIX_NO_VALUE) {
+        return NGX_DECLINED;
     }
 
-    return NGX_DECLINED;
+    return ngx_http_access_found(r, deny);
 }
 
 
@@ -208,42 +215,28 @@ static ngx_int_t
 ngx_http_access_inet6(ngx_http_request_t *r, ngx_http_access_loc_conf_t *alcf,
     u_char *p)
 {
-    ngx_uint_t                n;
-    ngx_uint_t                i;
-    ngx_http_access_rule6_t  *rule6;
+    uintptr_t  deny;
 
-    rule6 = alcf->rules6->elts;
-    for (i = 0; i < alcf->rules6->nelts; i++) {
+    deny = ngx_radix128tree_find(alcf->tree6, p);
 
 #if (NGX_DEBUG)
-        {
-        size_t  cl, ml, al;
-        u_char  ct[NGX_INET6_ADDRSTRLEN];
-        u_char  mt[NGX_INET6_ADDRSTRLEN];
-        u_char  at[NGX_INET6_ADDRSTRLEN];
-
-        cl = ngx_inet6_ntop(p, ct, NGX_INET6_ADDRSTRLEN);
-        ml = ngx_inet6_ntop(rule6[i].mask.s6_addr, mt, NGX_INET6_ADDRSTRLEN);
-        al = ngx_inet6_ntop(rule6[i].addr.s6_addr, at, NGX_INET6_ADDRSTRLEN);
-
-        ngx_log_debug6(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                       "access: %*s %*s %*s", cl, ct, ml, mt, al, at);
-        }
-#endif
+    {
+    size_t  cl;
+    u_char  ct[NGX_INET6_ADDRSTRLEN];
 
-        for (n = 0; n < 16; n++) {
-            if ((p[n] & rule6[i].mask.s6_addr[n]) != rule6[i].addr.s6_addr[n]) {
-                goto next;
-            }
-        }
+    cl = ngx_inet6_ntop(p, ct, NGX_INET6_ADDRSTRLEN);
 
-        return ngx_http_access_found(r, rule6[i].deny);
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "access: %*s %i", cl, ct,
+                   deny == NGX_RADIX_NO_VALUE ? -1 : (ngx_int_t) deny);
+    }
+#endif
 
-    next:
-        continue;
+    if (deny == NGX_RADIX_NO_VALUE) {
+        return NGX_DECLINED;
     }
 
-    return NGX_DECLINED;
+    return ngx_http_access_found(r, deny);
 }
 
 #endif
@@ -431,19 +424,111 @@ ngx_http_access_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
         && conf->rules_un == NULL
 #endif
     ) {
+        /* the main level is not merged, so its trees are built here */
+
+        if (ngx_http_access_compile(cf, prev) != NGX_OK) {
+            return NGX_CONF_ERROR;
+        }
+
         conf->rules = prev->rules;
+        conf->tree = prev->tree;
 #if (NGX_HAVE_INET6)
         conf->rules6 = prev->rules6;
+        conf->tree6 = prev->tree6;
 #endif
 #if (NGX_HAVE_UNIX_DOMAIN)
         conf->rules_un = prev->rules_un;
 #endif
     }
 
+    if (ngx_http_access_compile(cf, conf) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
+
     return NGX_CONF_OK;
 }
 
 
+static ngx_int_t
+ngx_http_access_compile(ngx_conf_t *cf, ngx_http_access_loc_conf_t *alcf)
+{
+    ngx_int_t                 rc;
+    ngx_uint_t                i;
+    ngx_http_access_rule_t   *rule;
+#if (NGX_HAVE_INET6)
+    ngx_http_access_rule6_t  *rule6;
+#endif
+
+    if (alcf->rules && alcf->tree == NULL) {
+
+        alcf->tree = ngx_radix_tree_create(cf->pool, 0);
+        if (alcf->tree == NULL) {
+            return NGX_ERROR;
+        }
+
+        rule = alcf->rules->elts;
+
+        for (i = 0; i < alcf->rules->nelts; i++) {
+
+            if (ngx_radix32tree_find_cover(alcf->tree, ntohl(rule[i].addr),
+                                           ntohl(rule[i].mask))
+                != NGX_RADIX_NO_VALUE)
+            {
+                continue;
+            }
+
+            rc = ngx_radix32tree_insert(alcf->tree, ntohl(rule[i].addr),
+                                        ntohl(rule[i].mask), rule[i].deny);
+            if (rc != NGX_OK) {
+                return NGX_ERROR;
+            }
+        }
+
+        if (ngx_radix_tree_compile(alcf->tree) != NGX_OK) {
+            return NGX_ERROR;
+        }
+    }
+
+#if (NGX_HAVE_INET6)
+
+    if (alcf->rules6 && alcf->tree6 == NULL) {
+
+        alcf->tree6 = ngx_radix_tree_create(cf->pool, 0);
+        if (alcf->tree6 == NULL) {
+            return NGX_ERROR;
+        }
+
+        rule6 = alcf->rules6->elts;
+
+        for (i = 0; i < alcf->rules6->nelts; i++) {
+
+            if (ngx_radix128tree_find_cover(alcf->tree6,
+                                            rule6[i].addr.s6_addr,
+                                            rule6[i].mask.s6_addr)
+                != NGX_RADIX_NO_VALUE)
+            {
+                continue;
+            }
+
+            rc = ngx_radix128tree_insert(alcf->tree6, rule6[i].addr.s6_addr,
+                                         rule6[i].mask.s6_addr,
+                                         rule6[i].deny);
+            if (rc != NGX_OK) {
+                return NGX_ERROR;
+            }
+        }
+
+        if (ngx_radix_tree_compile(alcf->tree6) != NGX_OK) {
+            return NGX_ERROR;
+        }
+    }
+
+#endif
+
+    return NGX_OK;
+}
+
+
 static ngx_int_t
 ngx_http_access_init(ngx_conf_t *cf)
 {
@@ -10,19 +10,6 @@
 #include <ngx_http.h>
 
 
-#if 0
-
-typedef struct {
-    ngx_buf_t     *buf;
-    size_t         size;
-    ngx_pool_t    *pool;
-    size_t         alloc_size;
-    ngx_chain_t  **last_out;
-} ngx_http_autoindex_ctx_t;
-
-#endif
-
-
 typedef struct {
     ngx_str_t      name;
     size_t         utf_len;
@@ -38,10 +25,74 @@ typedef struct {
 
 
 typedef struct {
-    ngx_flag_t     enable;
-    ngx_uint_t     format;
-    ngx_flag_t     localtime;
-    ngx_flag_t     exact_size;
+    u_char                             color;
+    u_char                             dummy;
+    u_short                            len;
+    ngx_queue_t                        queue;
+    ngx_file_uniq_t                    uniq;
+    time_t                             mtime;
+    time_t                             valid;
+    size_t                             size;
+    unsigned                           utf8:1;
+    u_char                             data[1];
+} ngx_http_autoindex_cache_node_t;
+
+
+typedef struct {
+    ngx_rbtree_t                       rbtree;
+    ngx_rbtree_node_t                  sentinel;
+    ngx_queue_t                        queue;
+} ngx_http_autoindex_cache_shctx_t;
+
+
+typedef struct {
+    ngx_http_autoindex_cache_shctx_t  *sh;
+    ngx_slab_pool_t                   *shpool;
+    size_t                             max_size;
+    time_t                             valid;
+} ngx_http_autoindex_cache_t;
+
+
+typedef struct {
+    ngx_buf_t                   *buf;
+    ngx_pool_t                  *pool;
+    size_t                       alloc_size;
+    ngx_chain_t                **last_out;
+
+    ngx_chain_t                 *out;
+    ngx_chain_t                 *free;
+    ngx_chain_t                 *busy;
+
+    ngx_dir_t                    dir;
+    ngx_str_t                    path;
+    u_char                      *filename;
+    u_char                      *last;
+    size_t                       allocated;
+
+    ngx_uint_t                   format;
+    ngx_str_t                    callback;
+    ngx_uint_t                   count;
+
+    ngx_http_autoindex_cache_t  *cache;
+    ngx_buf_t                   *copy;
+    ngx_str_t                    key;
+    uint32_t                     hash;
+    ngx_file_uniq_t              uniq;
+    time_t                       mtime;
+
+    unsigned                     opened:1;
+    unsigned                     started:1;
+    unsigned                     done:1;
+} ngx_http_autoindex_ctx_t;
+
+
+typedef struct {
+    ngx_flag_t       enable;
+    ngx_uint_t       format;
+    ngx_flag_t       localtime;
+    ngx_flag_t       exact_size;
+    ngx_flag_t       sort;
+    ngx_shm_zone_t  *shm_zone;
 } ngx_http_autoindex_loc_conf_t;
 
 
@@ -54,25 +105,64 @@ typedef struct {
 
 #define NGX_HTTP_AUTOINDEX_NAME_LEN     50
 
-
-static ngx_buf_t *ngx_http_autoindex_html(ngx_http_request_t *r,
-    ngx_array_t *entries);
-static ngx_buf_t *ngx_http_autoindex_json(ngx_http_request_t *r,
-    ngx_array_t *entries, ngx_str_t *callback);
+#define NGX_HTTP_AUTOINDEX_BUFFER_SIZE  16384
+#define NGX_HTTP_AUTOINDEX_BATCH        1000
+
+
+static ngx_int_t ngx_http_autoindex_sorted(ngx_http_request_t *r,
+    ngx_http_autoindex_ctx_t *ctx);
+static ngx_int_t ngx_http_autoindex_process(ngx_http_request_t *r,
+    ngx_http_autoindex_ctx_t *ctx);
+static void ngx_http_autoindex_write_handler(ngx_http_request_t *r);
+static ngx_int_t ngx_http_autoindex_read(ngx_http_request_t *r,
+    ngx_http_autoindex_ctx_t *ctx, ngx_array_t *entries, ngx_pool_t *pool,
+    ngx_uint_t max);
+static ngx_int_t ngx_http_autoindex_render(ngx_http_request_t *r,
+    ngx_http_autoindex_ctx_t *ctx, ngx_array_t *entries);
+static ngx_int_t ngx_http_autoindex_send(ngx_http_request_t *r,
+    ngx_http_autoindex_ctx_t *ctx);
+static ngx_int_t ngx_http_autoindex_html(ngx_http_request_t *r,
+    ngx_http_autoindex_ctx_t *ctx, ngx_array_t *entries);
+static ngx_uint_t ngx_http_autoindex_utf8(ngx_http_request_t *r);
+static ngx_int_t ngx_http_autoindex_json(ngx_http_request_t *r,
+    ngx_http_autoindex_ctx_t *ctx, ngx_array_t *entries, ngx_str_t *callback);
 static ngx_int_t ngx_http_autoindex_jsonp_callback(ngx_http_request_t *r,
     ngx_str_t *callback);
-static ngx_buf_t *ngx_http_autoindex_xml(ngx_http_request_t *r,
-    ngx_array_t *entries);
+static ngx_int_t ngx_http_autoindex_xml(ngx_http_request_t *r,
+    ngx_http_autoindex_ctx_t *ctx, ngx_array_t *entries);
 
 static int ngx_libc_cdecl ngx_http_autoindex_cmp_entries(const void *one,
     const void *two);
-static ngx_int_t ngx_http_autoindex_error(ngx_http_request_t *r,
-    ngx_dir_t *dir, ngx_str_t *name);
+static ngx_buf_t *ngx_http_autoindex_alloc(ngx_http_autoindex_ctx_t *ctx,
+    size_t size);
+static void ngx_http_autoindex_close(ngx_http_request_t *r,
+    ngx_http_autoindex_ctx_t *ctx);
+static void ngx_http_autoindex_cleanup(void *data);
+
+static ngx_int_t ngx_http_autoindex_cache_key(ngx_http_request_t *r,
+    ngx_http_autoindex_ctx_t *ctx, ngx_http_autoindex_loc_conf_t *alcf);
+static ngx_int_t ngx_http_autoindex_cache_send(ngx_http_request_t *r,
+    ngx_http_autoindex_ctx_t *ctx);
+static ngx_int_t ngx_http_autoindex_cache_copy(ngx_http_request_t *r,
+    ngx_http_autoindex_ctx_t *ctx);
+static ngx_http_autoindex_cache_node_t *ngx_http_autoindex_cache_lookup(
+    ngx_http_autoindex_cache_t *cache, ngx_str_t *key, uint32_t hash);
+static void ngx_http_autoindex_cache_insert(ngx_http_request_t *r,
+    ngx_http_autoindex_ctx_t *ctx);
+static void ngx_http_autoindex_cache_rbtree_insert_value(
+    ngx_rbtree_node_t *temp, ngx_rbtree_node_t *node,
+    ngx_rbtree_node_t *sentinel);
+static ngx_int_t ngx_http_autoindex_cache_init_zone(ngx_shm_zone_t *shm_zone,
+    void *data);
 
 static ngx_int_t ngx_http_autoindex_init(ngx_conf_t *cf);
 static void *ngx_http_autoindex_create_loc_conf(ngx_conf_t *cf);
 static char *ngx_http_autoindex_merge_loc_conf(ngx_conf_t *cf,
     void *parent, void *child);
+static char *ngx_http_autoindex_cache_zone(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+static char *ngx_http_autoindex_cache(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
 
 
 static ngx_conf_enum_t  ngx_http_autoindex_format[] = {
@@ -114,6 +204,27 @@ static ngx_command_t  ngx_http_autoindex_commands[] = {
       offsetof(ngx_http_autoindex_loc_conf_t, exact_size),
       NULL },
 
+    { ngx_string("autoindex_sort"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_autoindex_loc_conf_t, sort),
+      NULL },
+
+    { ngx_string("autoindex_cache_zone"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_1MORE,
+      ngx_http_autoindex_cache_zone,
+      0,
+      0,
+      NULL },
+
+    { ngx_string("autoindex_cache"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_http_autoindex_cache,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
       ngx_null_command
 };
 
@@ -152,18 +263,15 @@ ngx_module_t  ngx_http_autoindex_module = {
 static ngx_int_t
 ngx_http_autoindex_handler(ngx_http_request_t *r)
 {
-    u_char                         *last, *filename;
-    size_t                          len, allocated, root;
+    u_char                         *last;
+    size_t                          allocated, root;
     ngx_err_t                       err;
-    ngx_buf_t                      *b;
     ngx_int_t                       rc;
     ngx_str_t                       path, callback;
     ngx_dir_t                       dir;
     ngx_uint_t                      level, format;
-    ngx_pool_t                     *pool;
-    ngx_chain_t                     out;
-    ngx_array_t                     entries;
-    ngx_http_autoindex_entry_t     *entry;
+    ngx_pool_cleanup_t             *cln;
+    ngx_http_autoindex_ctx_t       *ctx;
     ngx_http_autoindex_loc_conf_t  *alcf;
 
     if (r->uri.data[r->uri.len - 1] != '/') {
@@ -241,22 +349,58 @@ ngx_http_autoindex_handler(ngx_http_request_t *r)
         return rc;
     }
 
-#if (NGX_SUPPRESS_WARN)
-
-    /* MSVC thinks 'entries' may be used without having been initialized */
-    ngx_memzero(&entries, sizeof(ngx_array_t));
+    cln = ngx_pool_cleanup_add(r->pool, 0);
+    if (cln == NULL) {
+        if (ngx_close_dir(&dir) == NGX_ERROR) {
+            ngx_log_error(NGX_LOG_ALERT, r->connection->log, ngx_errno,
+                          ngx_close_dir_n " \"%V\" failed", &path);
+        }
 
-#endif
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
 
-    /* TODO: pool should be temporary pool */
-    pool = r->pool;
+    ctx = ngx_pcalloc(r->pool, sizeof(ngx_http_autoindex_ctx_t));
+    if (ctx == NULL) {
+        if (ngx_close_dir(&dir) == NGX_ERROR) {
+            ngx_log_error(NGX_LOG_ALERT, r->connection->log, ngx_errno,
+                          ngx_close_dir_n " \"%V\" failed", &path);
+        }
 
-    if (ngx_array_init(&entries, pool, 40, sizeof(ngx_http_autoindex_entry_t))
-        != NGX_OK)
-    {
-        return ngx_http_autoindex_error(r, &dir, &path);
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
     }
 
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     ctx->buf = NULL;
+     *     ctx->out = NULL;
+     *     ctx->free = NULL;
+     *     ctx->busy = NULL;
+     *     ctx->count = 0;
+     *     ctx->cache = NULL;
+     *     ctx->copy = NULL;
+     *     ctx->started = 0;
+     *     ctx->done = 0;
+     */
+
+    ctx->dir = dir;
+    ctx->opened = 1;
+    ctx->path = path;
+    ctx->filename = path.data;
+    ctx->last = last;
+    ctx->allocated = allocated;
+    ctx->format = format;
+    ctx->callback = callback;
+
+    ctx->pool = r->pool;
+    ctx->alloc_size = NGX_HTTP_AUTOINDEX_BUFFER_SIZE;
+    ctx->last_out = &ctx->out;
+
+    cln->handler = ngx_http_autoindex_cleanup;
+    cln->data = r;
+
+    ngx_http_set_ctx(r, ctx, ngx_http_autoindex_module);
+
     r->headers_out.status = NGX_HTTP_OK;
 
     switch (format) {
@@ -282,157 +426,442 @@ ngx_http_autoindex_handler(ngx_http_request_t *r)
     r->headers_out.content_type_len = r->headers_out.content_type.len;
     r->headers_out.content_type_lowcase = NULL;
 
-    rc = ngx_http_send_header(r);
+    /*
+     * JSONP listings are not cached, as they depend on the callback
+     * name sent by the client
+     */
 
-    if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
-        if (ngx_close_dir(&dir) == NGX_ERROR) {
-            ngx_log_error(NGX_LOG_ALERT, r->connection->log, ngx_errno,
-                          ngx_close_dir_n " \"%V\" failed", &path);
+    if (alcf->shm_zone && format != NGX_HTTP_AUTOINDEX_JSONP) {
+
+        rc = ngx_http_autoindex_cache_key(r, ctx, alcf);
+
+        if (rc == NGX_OK) {
+            rc = ngx_http_autoindex_cache_send(r, ctx);
+
+            if (rc != NGX_DECLINED && rc != NGX_AGAIN) {
+                return rc;
+            }
+
+        } else if (rc == NGX_ERROR) {
+            return NGX_HTTP_INTERNAL_SERVER_ERROR;
+        }
+    }
+
+    ctx->filename[ctx->path.len] = '/';
+
+    if (alcf->sort) {
+        return ngx_http_autoindex_sorted(r, ctx);
+    }
+
+    /* the header is already sent if a cached listing was not used */
+
+    if (!r->header_sent) {
+        rc = ngx_http_send_header(r);
+
+        if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+            return rc;
         }
+    }
 
+    rc = ngx_http_autoindex_process(r, ctx);
+
+    if (rc != NGX_DONE) {
         return rc;
     }
 
-    filename = path.data;
-    filename[path.len] = '/';
+    r->main->count++;
+    r->write_event_handler = ngx_http_autoindex_write_handler;
 
-    for ( ;; ) {
+    return NGX_DONE;
+}
+
+
+static ngx_int_t
+ngx_http_autoindex_sorted(ngx_http_request_t *r, ngx_http_autoindex_ctx_t *ctx)
+{
+    ngx_int_t    rc;
+    ngx_array_t  entries;
+
+    /*
+     * a sorted listing is read completely before the header is sent,
+     * so a directory read error results in an error response rather
+     * than in a truncated listing
+     */
+
+    /* TODO: pool should be temporary pool */
+
+    if (ngx_array_init(&entries, r->pool, 40,
+                       sizeof(ngx_http_autoindex_entry_t))
+        != NGX_OK)
+    {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    if (ngx_http_autoindex_read(r, ctx, &entries, r->pool, 0) != NGX_OK) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    if (entries.nelts > 1) {
+        ngx_qsort(entries.elts, (size_t) entries.nelts,
+                  sizeof(ngx_http_autoindex_entry_t),
+                  ngx_http_autoindex_cmp_entries);
+    }
+
+    if (!r->header_sent) {
+        rc = ngx_http_send_header(r);
+
+        if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+            return rc;
+        }
+    }
+
+    /* the listing is rendered after the charset is set by the header filter */
+
+    if (ngx_http_autoindex_render(r, ctx, &entries) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    return ngx_http_autoindex_send(r, ctx);
+}
+
+
+static ngx_int_t
+ngx_http_autoindex_process(ngx_http_request_t *r, ngx_http_autoindex_ctx_t *ctx)
+{
+    ngx_int_t                  rc;
+    ngx_pool_t                *pool;
+    ngx_event_t               *wev;
+    ngx_array_t                entries;
+    ngx_connection_t          *c;
+    ngx_http_core_loc_conf_t  *clcf;
+
+    c = r->connection;
+    wev = c->write;
+
+    /*
+     * the entries of an unsorted listing are sent in the directory order
+     * in batches, the worker returns to the event loop between the batches
+     */
+
+    if (ctx->busy) {
+        rc = ngx_http_output_filter(r, NULL);
+
+        if (rc == NGX_ERROR) {
+            return NGX_ERROR;
+        }
+
+        ngx_chain_update_chains(ctx->pool, &ctx->free, &ctx->busy, &ctx->out,
+                                (ngx_buf_tag_t) &ngx_http_autoindex_module);
+
+        if (ctx->busy) {
+            goto again;
+        }
+    }
+
+    pool = ngx_create_pool(NGX_DEFAULT_POOL_SIZE, c->log);
+    if (pool == NULL) {
+        return NGX_ERROR;
+    }
+
+    if (ngx_array_init(&entries, pool, 40,
+                       sizeof(ngx_http_autoindex_entry_t))
+        != NGX_OK)
+    {
+        ngx_destroy_pool(pool);
+        return NGX_ERROR;
+    }
+
+    if (ngx_http_autoindex_read(r, ctx, &entries, pool,
+                                NGX_HTTP_AUTOINDEX_BATCH)
+        != NGX_OK)
+    {
+        ngx_destroy_pool(pool);
+        return NGX_ERROR;
+    }
+
+    rc = ngx_http_autoindex_render(r, ctx, &entries);
+
+    ngx_destroy_pool(pool);
+
+    if (rc != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    rc = ngx_http_autoindex_send(r, ctx);
+
+    if (rc == NGX_ERROR || ctx->done) {
+        return rc;
+    }
+
+    if (ctx->busy) {
+        goto again;
+    }
+
+    if (wev->timer_set && !wev->delayed) {
+        ngx_del_timer(wev);
+    }
+
+    ngx_post_event(wev, &ngx_posted_events);
+
+    return NGX_DONE;
+
+again:
+
+    clcf = ngx_http_get_module_loc_conf(r->main, ngx_http_core_module);
+
+    if (!wev->delayed) {
+        ngx_add_timer(wev, clcf->send_timeout);
+    }
+
+    if (ngx_handle_write_event(wev, clcf->send_lowat) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    return NGX_DONE;
+}
+
+
+static void
+ngx_http_autoindex_write_handler(ngx_http_request_t *r)
+{
+    ngx_int_t                  rc;
+    ngx_event_t               *wev;
+    ngx_connection_t          *c;
+    ngx_http_core_loc_conf_t  *clcf;
+    ngx_http_autoindex_ctx_t  *ctx;
+
+    c = r->connection;
+    wev = c->write;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "http autoindex write handler");
+
+    if (wev->timedout) {
+        ngx_log_error(NGX_LOG_INFO, c->log, NGX_ETIMEDOUT,
+                      "client timed out");
+        c->timedout = 1;
+
+        ngx_http_finalize_request(r, NGX_HTTP_REQUEST_TIME_OUT);
+        return;
+    }
+
+    if (wev->delayed || r->aio) {
+        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                       "http autoindex delayed");
+
+        clcf = ngx_http_get_module_loc_conf(r->main, ngx_http_core_module);
+
+        if (!wev->delayed) {
+            ngx_add_timer(wev, clcf->send_timeout);
+        }
+
+        if (ngx_handle_write_event(wev, clcf->send_lowat) != NGX_OK) {
+            ngx_http_finalize_request(r, NGX_ERROR);
+        }
+
+        return;
+    }
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_autoindex_module);
+
+    rc = ngx_http_autoindex_process(r, ctx);
+
+    if (rc == NGX_DONE) {
+        return;
+    }
+
+    r->write_event_handler = ngx_http_request_empty_handler;
+
+    ngx_http_finalize_request(r, rc);
+}
+
+
+static ngx_int_t
+ngx_http_autoindex_read(ngx_http_request_t *r, ngx_http_autoindex_ctx_t *ctx,
+    ngx_array_t *entries, ngx_pool_t *pool, ngx_uint_t max)
+{
+    size_t                       len;
+    ngx_err_t                    err;
+    ngx_dir_t                   *dir;
+    ngx_http_autoindex_entry_t  *entry;
+
+    dir = &ctx->dir;
+
+    while (max == 0 || entries->nelts < max) {
         ngx_set_errno(0);
 
-        if (ngx_read_dir(&dir) == NGX_ERROR) {
+        if (ngx_read_dir(dir) == NGX_ERROR) {
             err = ngx_errno;
 
             if (err != NGX_ENOMOREFILES) {
                 ngx_log_error(NGX_LOG_CRIT, r->connection->log, err,
-                              ngx_read_dir_n " \"%V\" failed", &path);
-                return ngx_http_autoindex_error(r, &dir, &path);
+                              ngx_read_dir_n " \"%V\" failed", &ctx->path);
+                return NGX_ERROR;
             }
 
+            ngx_http_autoindex_close(r, ctx);
+
+            ctx->done = 1;
+
             break;
         }
 
         ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                       "http autoindex file: \"%s\"", ngx_de_name(&dir));
+                       "http autoindex file: \"%s\"", ngx_de_name(dir));
 
-        len = ngx_de_namelen(&dir);
+        len = ngx_de_namelen(dir);
 
-        if (ngx_de_name(&dir)[0] == '.') {
+        if (ngx_de_name(dir)[0] == '.') {
             continue;
         }
 
-        if (!dir.valid_info) {
+        if (!dir->valid_info) {
 
             /* 1 byte for '/' and 1 byte for terminating '\0' */
 
-            if (path.len + 1 + len + 1 > allocated) {
-                allocated = path.len + 1 + len + 1
+            if (ctx->path.len + 1 + len + 1 > ctx->allocated) {
+                ctx->allocated = ctx->path.len + 1 + len + 1
                                      + NGX_HTTP_AUTOINDEX_PREALLOCATE;
 
-                filename = ngx_pnalloc(pool, allocated);
-                if (filename == NULL) {
-                    return ngx_http_autoindex_error(r, &dir, &path);
+                ctx->filename = ngx_pnalloc(r->pool, ctx->allocated);
+                if (ctx->filename == NULL) {
+                    return NGX_ERROR;
                 }
 
-                last = ngx_cpystrn(filename, path.data, path.len + 1);
-                *last++ = '/';
+                ctx->last = ngx_cpystrn(ctx->filename, ctx->path.data,
+                                        ctx->path.len + 1);
+                *ctx->last++ = '/';
             }
 
-            ngx_cpystrn(last, ngx_de_name(&dir), len + 1);
+            ngx_cpystrn(ctx->last, ngx_de_name(dir), len + 1);
 
-            if (ngx_de_info(filename, &dir) == NGX_FILE_ERROR) {
+            if (ngx_de_info(ctx->filename, dir) == NGX_FILE_ERROR) {
                 err = ngx_errno;
 
                 if (err != NGX_ENOENT && err != NGX_ELOOP) {
                     ngx_log_error(NGX_LOG_CRIT, r->connection->log, err,
-                                  ngx_de_info_n " \"%s\" failed", filename);
+                                  ngx_de_info_n " \"%s\" failed",
+                                  ctx->filename);
 
                     if (err == NGX_EACCES) {
                         continue;
                     }
 
-                    return ngx_http_autoindex_error(r, &dir, &path);
+                    return NGX_ERROR;
                 }
 
-                if (ngx_de_link_info(filename, &dir) == NGX_FILE_ERROR) {
+                if (ngx_de_link_info(ctx->filename, dir) == NGX_FILE_ERROR) {
                     ngx_log_error(NGX_LOG_CRIT, r->connection->log, ngx_errno,
                                   ngx_de_link_info_n " \"%s\" failed",
-                                  filename);
-                    return ngx_http_autoindex_error(r, &dir, &path);
+                                  ctx->filename);
+                    return NGX_ERROR;
                 }
             }
         }
 
-        entry = ngx_array_push(&entries);
+        entry = ngx_array_push(entries);
         if (entry == NULL) {
-            return ngx_http_autoindex_error(r, &dir, &path);
+            return NGX_ERROR;
         }
 
         entry->name.len = len;
 
         entry->name.data = ngx_pnalloc(pool, len + 1);
         if (entry->name.data == NULL) {
-            return ngx_http_autoindex_error(r, &dir, &path);
+            return NGX_ERROR;
         }
 
-        ngx_cpystrn(entry->name.data, ngx_de_name(&dir), len + 1);
+        ngx_cpystrn(entry->name.data, ngx_de_name(dir), len + 1);
 
-        entry->dir = ngx_de_is_dir(&dir);
-        entry->file = ngx_de_is_file(&dir);
-        entry->mtime = ngx_de_mtime(&dir);
-        entry->size = ngx_de_size(&dir);
+        entry->dir = ngx_de_is_dir(dir);
+        entry->file = ngx_de_is_file(dir);
+        entry->mtime = ngx_de_mtime(dir);
+        entry->size = ngx_de_size(dir);
     }
 
-    if (ngx_close_dir(&dir) == NGX_ERROR) {
-        ngx_log_error(NGX_LOG_ALERT, r->connection->log, ngx_errno,
-                      ngx_close_dir_n " \"%V\" failed", &path);
-    }
+    return NGX_OK;
+}
 
-    if (entries.nelts > 1) {
-        ngx_qsort(entries.elts, (size_t) entries.nelts,
-                  sizeof(ngx_http_autoindex_entry_t),
-                  ngx_http_autoindex_cmp_entries);
-    }
 
-    switch (format) {
+static ngx_int_t
+ngx_http_autoindex_render(ngx_http_request_t *r, ngx_http_autoindex_ctx_t *ctx,
+    ngx_array_t *entries)
+{
+    ngx_int_t  rc;
+
+    switch (ctx->format) {
 
     case NGX_HTTP_AUTOINDEX_JSON:
-        b = ngx_http_autoindex_json(r, &entries, NULL);
+        rc = ngx_http_autoindex_json(r, ctx, entries, NULL);
         break;
 
     case NGX_HTTP_AUTOINDEX_JSONP:
-        b = ngx_http_autoindex_json(r, &entries, &callback);
+        rc = ngx_http_autoindex_json(r, ctx, entries, &ctx->callback);
         break;
 
     case NGX_HTTP_AUTOINDEX_XML:
-        b = ngx_http_autoindex_xml(r, &entries);
+        rc = ngx_http_autoindex_xml(r, ctx, entries);
         break;
 
     default: /* NGX_HTTP_AUTOINDEX_HTML */
-        b = ngx_http_autoindex_html(r, &entries);
+        rc = ngx_http_autoindex_html(r, ctx, entries);
         break;
     }
 
-    if (b == NULL) {
-        return NGX_ERROR;
+    ctx->started = 1;
+    ctx->count += entries->nelts;
+
+    return rc;
+}
+
+
+static ngx_int_t
+ngx_http_autoindex_send(ngx_http_request_t *r, ngx_http_autoindex_ctx_t *ctx)
+{
+    ngx_int_t     rc;
+    ngx_chain_t  *out;
+
+    if (ctx->out == NULL) {
+        return NGX_OK;
     }
 
-    /* TODO: free temporary pool */
+    if (ctx->done) {
+        if (r == r->main) {
+            ctx->buf->last_buf = 1;
+        }
 
-    if (r == r->main) {
-        b->last_buf = 1;
+        ctx->buf->last_in_chain = 1;
+
+    } else {
+        ctx->buf->flush = 1;
     }
 
-    b->last_in_chain = 1;
+    if (ctx->copy && ngx_http_autoindex_cache_copy(r, ctx) != NGX_OK) {
+        return NGX_ERROR;
+    }
 
-    out.buf = b;
-    out.next = NULL;
+    out = ctx->out;
 
-    return ngx_http_output_filter(r, &out);
+    ctx->out = NULL;
+    ctx->last_out = &ctx->out;
+    ctx->buf = NULL;
+
+    rc = ngx_http_output_filter(r, out);
+
+    ngx_chain_update_chains(ctx->pool, &ctx->free, &ctx->busy, &out,
+                            (ngx_buf_tag_t) &ngx_http_autoindex_module);
+
+    if (ctx->done && ctx->copy) {
+        ngx_http_autoindex_cache_insert(r, ctx);
+    }
+
+    return rc;
 }
 
 
-static ngx_buf_t *
-ngx_http_autoindex_html(ngx_http_request_t *r, ngx_array_t *entries)
+static ngx_int_t
+ngx_http_autoindex_html(ngx_http_request_t *r, ngx_http_autoindex_ctx_t *ctx,
+    ngx_array_t *entries)
 {
     u_char                         *last, scale;
     off_t                           length;
@@ -464,26 +893,47 @@ ngx_http_autoindex_html(ngx_http_request_t *r, ngx_array_t *entries)
     static char  *months[] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun",
                                "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
 
-    if (r->headers_out.charset.len == 5
-        && ngx_strncasecmp(r->headers_out.charset.data, (u_char *) "utf-8", 5)
-           == 0)
-    {
-        utf8 = 1;
+    utf8 = ngx_http_autoindex_utf8(r);
 
-    } else {
-        utf8 = 0;
-    }
+    if (!ctx->started) {
+        escape_html = ngx_escape_html(NULL, r->uri.data, r->uri.len);
+
+        len = sizeof(title) - 1
+              + r->uri.len + escape_html
+              + sizeof(header) - 1
+              + r->uri.len + escape_html
+              + sizeof("</h1>") - 1
+              + sizeof("<hr><pre><a href=\"../\">../</a>" CRLF) - 1;
+
+        b = ngx_http_autoindex_alloc(ctx, len);
+        if (b == NULL) {
+            return NGX_ERROR;
+        }
+
+        b->last = ngx_cpymem(b->last, title, sizeof(title) - 1);
+
+        if (escape_html) {
+            b->last = (u_char *) ngx_escape_html(b->last, r->uri.data,
+                                                 r->uri.len);
+            b->last = ngx_cpymem(b->last, header, sizeof(header) - 1);
+            b->last = (u_char *) ngx_escape_html(b->last, r->uri.data,
+                                                 r->uri.len);
+
+        } else {
+            b->last = ngx_cpymem(b->last, r->uri.data, r->uri.len);
+            b->last = ngx_cpymem(b->last, header, sizeof(header) - 1);
+            b->last = ngx_cpymem(b->last, r->uri.data, r->uri.len);
+        }
 
-    escape_html = ngx_escape_html(NULL, r->uri.data, r->uri.len);
+        b->last = ngx_cpymem(b->last, "</h1>", sizeof("</h1>") - 1);
+
+        b->last = ngx_cpymem(b->last, "<hr><pre><a href=\"../\">../</a>" CRLF,
+                             sizeof("<hr><pre><a href=\"../\">../</a>" CRLF)
+                             - 1);
+    }
 
-    len = sizeof(title) - 1
-          + r->uri.len + escape_html
-          + sizeof(header) - 1
-          + r->uri.len + escape_html
-          + sizeof("</h1>") - 1
-          + sizeof("<hr><pre><a href=\"../\">../</a>" CRLF) - 1
-          + sizeof("</pre><hr>") - 1
-          + sizeof(tail) - 1;
+    alcf = ngx_http_get_module_loc_conf(r, ngx_http_autoindex_module);
+    tp = ngx_timeofday();
 
     entry = entries->elts;
     for (i = 0; i < entries->nelts; i++) {
@@ -501,7 +951,7 @@ ngx_http_autoindex_html(ngx_http_request_t *r, ngx_array_t *entries)
             entry[i].utf_len = entry[i].name.len;
         }
 
-        len += sizeof("<a href=\"") - 1
+        len = sizeof("<a href=\"") - 1
             + entry[i].name.len + entry[i].escape
             + 1                                          /* 1 is for "/" */
             + sizeof("\">") - 1
@@ -512,35 +962,12 @@ ngx_http_autoindex_html(ngx_http_request_t *r, ngx_array_t *entries)
             + sizeof(" 28-Sep-1970 12:00 ") - 1
             + 20                                         /* the file size */
             + 2;
-    }
-
-    b = ngx_create_temp_buf(r->pool, len);
-    if (b == NULL) {
-        return NULL;
-    }
-
-    b->last = ngx_cpymem(b->last, title, sizeof(title) - 1);
-
-    if (escape_html) {
-        b->last = (u_char *) ngx_escape_html(b->last, r->uri.data, r->uri.len);
-        b->last = ngx_cpymem(b->last, header, sizeof(header) - 1);
-        b->last = (u_char *) ngx_escape_html(b->last, r->uri.data, r->uri.len);
-
-    } else {
-        b->last = ngx_cpymem(b->last, r->uri.data, r->uri.len);
-        b->last = ngx_cpymem(b->last, header, sizeof(header) - 1);
-        b->last = ngx_cpymem(b->last, r->uri.data, r->uri.len);
-    }
 
-    b->last = ngx_cpymem(b->last, "</h1>", sizeof("</h1>") - 1);
-
-    b->last = ngx_cpymem(b->last, "<hr><pre><a href=\"../\">../</a>" CRLF,
-                         sizeof("<hr><pre><a href=\"../\">../</a>" CRLF) - 1);
-
-    alcf = ngx_http_get_module_loc_conf(r, ngx_http_autoindex_module);
-    tp = ngx_timeofday();
+        b = ngx_http_autoindex_alloc(ctx, len);
+        if (b == NULL) {
+            return NGX_ERROR;
+        }
 
-    for (i = 0; i < entries->nelts; i++) {
         b->last = ngx_cpymem(b->last, "<a href=\"", sizeof("<a href=\"") - 1);
 
         if (entry[i].escape) {
@@ -687,27 +1114,62 @@ ngx_http_autoindex_html(ngx_http_request_t *r, ngx_array_t *entries)
         *b->last++ = LF;
     }
 
-    b->last = ngx_cpymem(b->last, "</pre><hr>", sizeof("</pre><hr>") - 1);
+    if (ctx->done) {
+        b = ngx_http_autoindex_alloc(ctx, sizeof("</pre><hr>") - 1
+                                          + sizeof(tail) - 1);
+        if (b == NULL) {
+            return NGX_ERROR;
+        }
 
-    b->last = ngx_cpymem(b->last, tail, sizeof(tail) - 1);
+        b->last = ngx_cpymem(b->last, "</pre><hr>", sizeof("</pre><hr>") - 1);
 
-    return b;
-}
+        b->last = ngx_cpymem(b->last, tail, sizeof(tail) - 1);
+    }
+
+    return NGX_OK;
+}
 
 
-static ngx_buf_t *
-ngx_http_autoindex_json(ngx_http_request_t *r, ngx_array_t *entries,
-    ngx_str_t *callback)
+static ngx_uint_t
+ngx_http_autoindex_utf8(ngx_http_request_t *r)
+{
+    return r->headers_out.charset.len == 5
+           && ngx_strncasecmp(r->headers_out.charset.data,
+                              (u_char *) "utf-8", 5) == 0;
+}
+
+
+static ngx_int_t
+ngx_http_autoindex_json(ngx_http_request_t *r, ngx_http_autoindex_ctx_t *ctx,
+    ngx_array_t *entries, ngx_str_t *callback)
 {
     size_t                       len;
     ngx_buf_t                   *b;
     ngx_uint_t                   i;
     ngx_http_autoindex_entry_t  *entry;
 
-    len = sizeof("[" CRLF CRLF "]") - 1;
+    if (!ctx->started) {
+        len = sizeof("[") - 1;
+
+        if (callback) {
+            len += sizeof("/* callback */" CRLF "(") - 1 + callback->len;
+        }
+
+        b = ngx_http_autoindex_alloc(ctx, len);
+        if (b == NULL) {
+            return NGX_ERROR;
+        }
 
-    if (callback) {
-        len += sizeof("/* callback */" CRLF "();") - 1 + callback->len;
+        if (callback) {
+            b->last = ngx_cpymem(b->last, "/* callback */" CRLF,
+                                 sizeof("/* callback */" CRLF) - 1);
+
+            b->last = ngx_cpymem(b->last, callback->data, callback->len);
+
+            *b->last++ = '(';
+        }
+
+        *b->last++ = '[';
     }
 
     entry = entries->elts;
@@ -716,7 +1178,7 @@ ngx_http_autoindex_json(ngx_http_request_t *r, ngx_array_t *entries,
         entry[i].escape = ngx_escape_json(NULL, entry[i].name.data,
                                           entry[i].name.len);
 
-        len += sizeof("{  }," CRLF) - 1
+        len = sizeof(",{  }" CRLF) - 1
             + sizeof("\"name\":\"\"") - 1
             + entry[i].name.len + entry[i].escape
             + sizeof(", \"type\":\"directory\"") - 1
@@ -725,25 +1187,16 @@ ngx_http_autoindex_json(ngx_http_request_t *r, ngx_array_t *entries,
         if (entry[i].file) {
             len += sizeof(", \"size\":") - 1 + NGX_OFF_T_LEN;
         }
-    }
-
-    b = ngx_create_temp_buf(r->pool, len);
-    if (b == NULL) {
-        return NULL;
-    }
-
-    if (callback) {
-        b->last = ngx_cpymem(b->last, "/* callback */" CRLF,
-                             sizeof("/* callback */" CRLF) - 1);
-
-        b->last = ngx_cpymem(b->last, callback->data, callback->len);
 
-        *b->last++ = '(';
-    }
+        b = ngx_http_autoindex_alloc(ctx, len);
+        if (b == NULL) {
+            return NGX_ERROR;
+        }
 
-    *b->last++ = '[';
+        if (ctx->count + i > 0) {
+            *b->last++ = ',';
+        }
 
-    for (i = 0; i < entries->nelts; i++) {
         b->last = ngx_cpymem(b->last, CRLF "{ \"name\":\"",
                              sizeof(CRLF "{ \"name\":\"") - 1);
 
@@ -782,20 +1235,29 @@ ngx_http_autoindex_json(ngx_http_request_t *r, ngx_array_t *entries,
             *b->last++ = '"';
         }
 
-        b->last = ngx_cpymem(b->last, " },", sizeof(" },") - 1);
+        b->last = ngx_cpymem(b->last, " }", sizeof(" }") - 1);
     }
 
-    if (i > 0) {
-        b->last--;  /* strip last comma */
-    }
+    if (ctx->done) {
+        len = sizeof(CRLF "]") - 1;
+
+        if (callback) {
+            len += sizeof(");") - 1;
+        }
+
+        b = ngx_http_autoindex_alloc(ctx, len);
+        if (b == NULL) {
+            return NGX_ERROR;
+        }
 
-    b->last = ngx_cpymem(b->last, CRLF "]", sizeof(CRLF "]") - 1);
+        b->last = ngx_cpymem(b->last, CRLF "]", sizeof(CRLF "]") - 1);
 
-    if (callback) {
-        *b->last++ = ')'; *b->last++ = ';';
+        if (callback) {
+            *b->last++ = ')'; *b->last++ = ';';
+        }
     }
 
-    return b;
+    return NGX_OK;
 }
 
 
@@ -840,8 +1302,9 @@ ngx_http_autoindex_jsonp_callback(ngx_http_request_t *r, ngx_str_t *callback)
 }
 
 
-static ngx_buf_t *
-ngx_http_autoindex_xml(ngx_http_request_t *r, ngx_array_t *entries)
+static ngx_int_t
+ngx_http_autoindex_xml(ngx_http_request_t *r, ngx_http_autoindex_ctx_t *ctx,
+    ngx_array_t *entries)
 {
     size_t                          len;
     ngx_tm_t                        tm;
@@ -853,7 +1316,14 @@ ngx_http_autoindex_xml(ngx_http_request_t *r, ngx_array_t *entries)
     static u_char  head[] = "<?xml version=\"1.0\"?>" CRLF "<list>" CRLF;
     static u_char  tail[] = "</list>" CRLF;
 
-    len = sizeof(head) - 1 + sizeof(tail) - 1;
+    if (!ctx->started) {
+        b = ngx_http_autoindex_alloc(ctx, sizeof(head) - 1);
+        if (b == NULL) {
+            return NGX_ERROR;
+        }
+
+        b->last = ngx_cpymem(b->last, head, sizeof(head) - 1);
+    }
 
     entry = entries->elts;
 
@@ -861,23 +1331,19 @@ ngx_http_autoindex_xml(ngx_http_request_t *r, ngx_array_t *entries)
         entry[i].escape = ngx_escape_html(NULL, entry[i].name.data,
                                           entry[i].name.len);
 
-        len += sizeof("<directory></directory>" CRLF) - 1
+        len = sizeof("<directory></directory>" CRLF) - 1
             + entry[i].name.len + entry[i].escape
             + sizeof(" mtime=\"1986-12-31T10:00:00Z\"") - 1;
 
         if (entry[i].file) {
             len += sizeof(" size=\"\"") - 1 + NGX_OFF_T_LEN;
         }
-    }
-
-    b = ngx_create_temp_buf(r->pool, len);
-    if (b == NULL) {
-        return NULL;
-    }
 
-    b->last = ngx_cpymem(b->last, head, sizeof(head) - 1);
+        b = ngx_http_autoindex_alloc(ctx, len);
+        if (b == NULL) {
+            return NGX_ERROR;
+        }
 
-    for (i = 0; i < entries->nelts; i++) {
         *b->last++ = '<';
 
         if (entry[i].dir) {
@@ -926,9 +1392,16 @@ ngx_http_autoindex_xml(ngx_http_request_t *r, ngx_array_t *entries)
         *b->last++ = CR; *b->last++ = LF;
     }
 
-    b->last = ngx_cpymem(b->last, tail, sizeof(tail) - 1);
+    if (ctx->done) {
+        b = ngx_http_autoindex_alloc(ctx, sizeof(tail) - 1);
+        if (b == NULL) {
+            return NGX_ERROR;
+        }
 
-    return b;
+        b->last = ngx_cpymem(b->last, tail, sizeof(tail) - 1);
+    }
+
+    return NGX_OK;
 }
 
 
@@ -952,8 +1425,6 @@ ngx_http_autoindex_cmp_entries(const void *one, const void *two)
 }
 
 
-#if 0
-
 static ngx_buf_t *
 ngx_http_autoindex_alloc(ngx_http_autoindex_ctx_t *ctx, size_t size)
 {
@@ -964,21 +1435,32 @@ ngx_http_autoindex_alloc(ngx_http_autoindex_ctx_t *ctx, size_t size)
         if ((size_t) (ctx->buf->end - ctx->buf->last) >= size) {
             return ctx->buf;
         }
-
-        ctx->size += ctx->buf->last - ctx->buf->pos;
     }
 
-    ctx->buf = ngx_create_temp_buf(ctx->pool, ctx->alloc_size);
-    if (ctx->buf == NULL) {
-        return NULL;
-    }
+    if (ctx->free && size <= ctx->alloc_size) {
+        cl = ctx->free;
+        ctx->free = cl->next;
 
-    cl = ngx_alloc_chain_link(ctx->pool);
-    if (cl == NULL) {
-        return NULL;
+        ctx->buf = cl->buf;
+        ctx->buf->flush = 0;
+
+    } else {
+        ctx->buf = ngx_create_temp_buf(ctx->pool,
+                                       ngx_max(size, ctx->alloc_size));
+        if (ctx->buf == NULL) {
+            return NULL;
+        }
+
+        ctx->buf->tag = (ngx_buf_tag_t) &ngx_http_autoindex_module;
+
+        cl = ngx_alloc_chain_link(ctx->pool);
+        if (cl == NULL) {
+            return NULL;
+        }
+
+        cl->buf = ctx->buf;
     }
 
-    cl->buf = ctx->buf;
     cl->next = NULL;
 
     *ctx->last_out = cl;
@@ -987,18 +1469,467 @@ ngx_http_autoindex_alloc(ngx_http_autoindex_ctx_t *ctx, size_t size)
     return ctx->buf;
 }
 
-#endif
+
+static void
+ngx_http_autoindex_close(ngx_http_request_t *r, ngx_http_autoindex_ctx_t *ctx)
+{
+    if (!ctx->opened) {
+        return;
+    }
+
+    ctx->opened = 0;
+
+    if (ngx_close_dir(&ctx->dir) == NGX_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, r->connection->log, ngx_errno,
+                      ngx_close_dir_n " \"%V\" failed", &ctx->path);
+    }
+}
+
+
+static void
+ngx_http_autoindex_cleanup(void *data)
+{
+    ngx_http_request_t *r = data;
+
+    ngx_http_autoindex_ctx_t  *ctx;
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_autoindex_module);
+
+    if (ctx) {
+        ngx_http_autoindex_close(r, ctx);
+    }
+}
 
 
 static ngx_int_t
-ngx_http_autoindex_error(ngx_http_request_t *r, ngx_dir_t *dir, ngx_str_t *name)
+ngx_http_autoindex_cache_key(ngx_http_request_t *r,
+    ngx_http_autoindex_ctx_t *ctx, ngx_http_autoindex_loc_conf_t *alcf)
 {
-    if (ngx_close_dir(dir) == NGX_ERROR) {
-        ngx_log_error(NGX_LOG_ALERT, r->connection->log, ngx_errno,
-                      ngx_close_dir_n " \"%V\" failed", name);
+    ngx_uint_t                 flags;
+    ngx_file_info_t            fi;
+    ngx_http_core_srv_conf_t  *cscf;
+
+    /*
+     * the listing is rendered differently depending on the format,
+     * the location settings, the server, and the request URI; the charset
+     * is not known before the header is sent, and it is checked against
+     * the one a cached HTML listing was rendered for after that
+     */
+
+    flags = alcf->localtime | alcf->exact_size << 1 | alcf->sort << 2;
+
+    cscf = ngx_http_get_module_srv_conf(r, ngx_http_core_module);
+
+    if (ngx_file_info(ctx->path.data, &fi) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, r->connection->log, ngx_errno,
+                      ngx_file_info_n " \"%V\" failed", &ctx->path);
+        return NGX_DECLINED;
+    }
+
+    ctx->key.data = ngx_pnalloc(r->pool, 2 * NGX_INT_T_LEN + 3
+                                         + cscf->server_name.len
+                                         + ctx->path.len + 1 + r->uri.len);
+    if (ctx->key.data == NULL) {
+        return NGX_ERROR;
+    }
+
+    ctx->key.len = ngx_sprintf(ctx->key.data, "%ui:%ui:%V:%V:%V",
+                               ctx->format, flags, &cscf->server_name,
+                               &ctx->path, &r->uri)
+                   - ctx->key.data;
+
+    if (ctx->key.len > 65535) {
+        return NGX_DECLINED;
+    }
+
+    ctx->hash = ngx_crc32_short(ctx->key.data, ctx->key.len);
+    ctx->uniq = ngx_file_uniq(&fi);
+    ctx->mtime = ngx_file_mtime(&fi);
+    ctx->cache = alcf->shm_zone->data;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_autoindex_cache_send(ngx_http_request_t *r,
+    ngx_http_autoindex_ctx_t *ctx)
+{
+    ngx_int_t                         rc;
+    ngx_buf_t                        *b;
+    ngx_uint_t                        utf8;
+    ngx_chain_t                       out;
+    ngx_http_autoindex_cache_t       *cache;
+    ngx_http_autoindex_cache_node_t  *an;
+
+    cache = ctx->cache;
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    an = ngx_http_autoindex_cache_lookup(cache, &ctx->key, ctx->hash);
+
+    if (an == NULL
+        || an->valid < ngx_time()
+        || an->uniq != ctx->uniq
+        || an->mtime != ctx->mtime)
+    {
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "http autoindex cache %s", an ? "expired" : "miss");
+
+        rc = NGX_DECLINED;
+        goto miss;
+    }
+
+    ngx_queue_remove(&an->queue);
+    ngx_queue_insert_head(&cache->sh->queue, &an->queue);
+
+    b = ngx_create_temp_buf(r->pool, an->size);
+    if (b == NULL) {
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    b->last = ngx_cpymem(b->pos, an->data + an->len, an->size);
+    utf8 = an->utf8;
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http autoindex cache hit: %uz", b->last - b->pos);
+
+    /*
+     * long names in HTML listings are cut depending on whether
+     * the charset set by the header filters is UTF-8, so a cached HTML
+     * listing is sent without the length, and it is rendered again
+     * if it was cached for another charset
+     */
+
+    if (ctx->format != NGX_HTTP_AUTOINDEX_HTML) {
+        ngx_http_autoindex_close(r, ctx);
+        r->headers_out.content_length_n = b->last - b->pos;
+    }
+
+    rc = ngx_http_send_header(r);
+
+    if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+        return rc;
+    }
+
+    if (ctx->format == NGX_HTTP_AUTOINDEX_HTML) {
+
+        if (ngx_http_autoindex_utf8(r) != utf8) {
+            ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                           "http autoindex cache charset mismatch");
+
+            ngx_pfree(r->pool, b->start);
+
+            rc = NGX_AGAIN;
+            goto miss;
+        }
+
+        ngx_http_autoindex_close(r, ctx);
+    }
+
+    if (r == r->main) {
+        b->last_buf = 1;
+    }
+
+    b->last_in_chain = 1;
+
+    out.buf = b;
+    out.next = NULL;
+
+    return ngx_http_output_filter(r, &out);
+
+miss:
+
+    /*
+     * a directory changed within the current second
+     * may change again unnoticed
+     */
+
+    if (ctx->mtime < ngx_time()) {
+        ctx->copy = ngx_create_temp_buf(r->pool,
+                                        ngx_min(ctx->alloc_size,
+                                                cache->max_size));
+        if (ctx->copy == NULL) {
+            return NGX_HTTP_INTERNAL_SERVER_ERROR;
+        }
+    }
+
+    return rc;
+}
+
+
+static ngx_int_t
+ngx_http_autoindex_cache_copy(ngx_http_request_t *r,
+    ngx_http_autoindex_ctx_t *ctx)
+{
+    size_t        size, len;
+    ngx_buf_t    *b, *copy;
+    ngx_chain_t  *cl;
+
+    copy = ctx->copy;
+
+    for (cl = ctx->out; cl; cl = cl->next) {
+        b = cl->buf;
+        len = b->last - b->pos;
+
+        if ((size_t) (copy->end - copy->last) < len) {
+
+            size = copy->last - copy->pos + len;
+
+            if (size > ctx->cache->max_size) {
+                ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                               "http autoindex cache: listing too large");
+                ctx->copy = NULL;
+                return NGX_OK;
+            }
+
+            size = ngx_min(ngx_max(size, 2 * (size_t) (copy->end - copy->pos)),
+                           ctx->cache->max_size);
+
+            copy = ngx_create_temp_buf(r->pool, size);
+            if (copy == NULL) {
+                return NGX_ERROR;
+            }
+
+            copy->last = ngx_cpymem(copy->pos, ctx->copy->pos,
+                                    ctx->copy->last - ctx->copy->pos);
+
+            ngx_pfree(r->pool, ctx->copy->start);
+
+            ctx->copy = copy;
+        }
+
+        copy->last = ngx_cpymem(copy->last, b->pos, len);
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_http_autoindex_cache_node_t *
+ngx_http_autoindex_cache_lookup(ngx_http_autoindex_cache_t *cache,
+    ngx_str_t *key, uint32_t hash)
+{
+    ngx_int_t                         rc;
+    ngx_rbtree_node_t                *node, *sentinel;
+    ngx_http_autoindex_cache_node_t  *an;
+
+    node = cache->sh->rbtree.root;
+    sentinel = cache->sh->rbtree.sentinel;
+
+    while (node != sentinel) {
+
+        if (hash < node->key) {
+            node = node->left;
+            continue;
+        }
+
+        if (hash > node->key) {
+            node = node->right;
+            continue;
+        }
+
+        /* hash == node->key */
+
+        an = (ngx_http_autoindex_cache_node_t *) &node->color;
+
+        rc = ngx_memn2cmp(key->data, an->data, key->len, (size_t) an->len);
+
+        if (rc == 0) {
+            return an;
+        }
+
+        node = (rc < 0) ? node->left : node->right;
+    }
+
+    return NULL;
+}
+
+
+static void
+ngx_http_autoindex_cache_insert(ngx_http_request_t *r,
+    ngx_http_autoindex_ctx_t *ctx)
+{
+    size_t                            size, len;
+    ngx_queue_t                      *q;
+    ngx_rbtree_node_t                *node;
+    ngx_http_autoindex_cache_t       *cache;
+    ngx_http_autoindex_cache_node_t  *an;
+
+    cache = ctx->cache;
+    len = ctx->copy->last - ctx->copy->pos;
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    an = ngx_http_autoindex_cache_lookup(cache, &ctx->key, ctx->hash);
+
+    if (an) {
+        node = (ngx_rbtree_node_t *)
+                   ((u_char *) an - offsetof(ngx_rbtree_node_t, color));
+
+        ngx_queue_remove(&an->queue);
+        ngx_rbtree_delete(&cache->sh->rbtree, node);
+        ngx_slab_free_locked(cache->shpool, node);
+    }
+
+    size = offsetof(ngx_rbtree_node_t, color)
+           + offsetof(ngx_http_autoindex_cache_node_t, data)
+           + ctx->key.len + len;
+
+    for ( ;; ) {
+        node = ngx_slab_alloc_locked(cache->shpool, size);
+
+        if (node) {
+            break;
+        }
+
+        /* evict the least recently used listings */
+
+        if (ngx_queue_empty(&cache->sh->queue)) {
+            ngx_shmtx_unlock(&cache->shpool->mutex);
+
+            ngx_log_error(NGX_LOG_WARN, r->connection->log, 0,
+                          "could not allocate node%s",
+                          cache->shpool->log_ctx);
+            return;
+        }
+
+        q = ngx_queue_last(&cache->sh->queue);
+        ngx_queue_remove(q);
+
+        an = ngx_queue_data(q, ngx_http_autoindex_cache_node_t, queue);
+
+        ngx_rbtree_delete(&cache->sh->rbtree, (ngx_rbtree_node_t *)
+                          ((u_char *) an - offsetof(ngx_rbtree_node_t, color)));
+
+        ngx_slab_free_locked(cache->shpool, (u_char *) an
+                                     - offsetof(ngx_rbtree_node_t, color));
+    }
+
+    node->key = ctx->hash;
+
+    an = (ngx_http_autoindex_cache_node_t *) &node->color;
+
+    an->len = (u_short) ctx->key.len;
+    an->uniq = ctx->uniq;
+    an->mtime = ctx->mtime;
+    an->size = len;
+    an->valid = ngx_time() + cache->valid;
+    an->utf8 = ngx_http_autoindex_utf8(r);
+
+    ngx_memcpy(ngx_cpymem(an->data, ctx->key.data, ctx->key.len),
+               ctx->copy->pos, len);
+
+    ngx_rbtree_insert(&cache->sh->rbtree, node);
+
+    ngx_queue_insert_head(&cache->sh->queue, &an->queue);
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http autoindex cache add: %uz", len);
+}
+
+
+static void
+ngx_http_autoindex_cache_rbtree_insert_value(ngx_rbtree_node_t *temp,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel)
+{
+    ngx_rbtree_node_t                **p;
+    ngx_http_autoindex_cache_node_t   *an, *ant;
+
+    for ( ;; ) {
+
+        if (node->key < temp->key) {
+
+            p = &temp->left;
+
+        } else if (node->key > temp->key) {
+
+            p = &temp->right;
+
+        } else { /* node->key == temp->key */
+
+            an = (ngx_http_autoindex_cache_node_t *) &node->color;
+            ant = (ngx_http_autoindex_cache_node_t *) &temp->color;
+
+            p = (ngx_memn2cmp(an->data, ant->data, an->len, ant->len) < 0)
+                ? &temp->left : &temp->right;
+        }
+
+        if (*p == sentinel) {
+            break;
+        }
+
+        temp = *p;
     }
 
-    return r->header_sent ? NGX_ERROR : NGX_HTTP_INTERNAL_SERVER_ERROR;
+    *p = node;
+    node->parent = temp;
+    node->left = sentinel;
+    node->right = sentinel;
+    ngx_rbt_red(node);
+}
+
+
+static ngx_int_t
+ngx_http_autoindex_cache_init_zone(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_http_autoindex_cache_t  *ocache = data;
+
+    size_t                       len;
+    ngx_http_autoindex_cache_t  *cache;
+
+    cache = shm_zone->data;
+
+    if (ocache) {
+        cache->sh = ocache->sh;
+        cache->shpool = ocache->shpool;
+
+        return NGX_OK;
+    }
+
+    cache->shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    if (shm_zone->shm.exists) {
+        cache->sh = cache->shpool->data;
+
+        return NGX_OK;
+    }
+
+    cache->sh = ngx_slab_alloc(cache->shpool,
+                               sizeof(ngx_http_autoindex_cache_shctx_t));
+    if (cache->sh == NULL) {
+        return NGX_ERROR;
+    }
+
+    cache->shpool->data = cache->sh;
+
+    ngx_rbtree_init(&cache->sh->rbtree, &cache->sh->sentinel,
+                    ngx_http_autoindex_cache_rbtree_insert_value);
+
+    ngx_queue_init(&cache->sh->queue);
+
+    len = sizeof(" in autoindex cache zone \"\"") + shm_zone->shm.name.len;
+
+    cache->shpool->log_ctx = ngx_slab_alloc(cache->shpool, len);
+    if (cache->shpool->log_ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_sprintf(cache->shpool->log_ctx, " in autoindex cache zone \"%V\"%Z",
+                &shm_zone->shm.name);
+
+    /* the least recently used listings are evicted instead */
+
+    cache->shpool->log_nomem = 0;
+
+    return NGX_OK;
 }
 
 
@@ -1016,6 +1947,8 @@ ngx_http_autoindex_create_loc_conf(ngx_conf_t *cf)
     conf->format = NGX_CONF_UNSET_UINT;
     conf->localtime = NGX_CONF_UNSET;
     conf->exact_size = NGX_CONF_UNSET;
+    conf->sort = NGX_CONF_UNSET;
+    conf->shm_zone = NGX_CONF_UNSET_PTR;
 
     return conf;
 }
@@ -1032,6 +1965,173 @@ ngx_http_autoindex_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
                               NGX_HTTP_AUTOINDEX_HTML);
     ngx_conf_merge_value(conf->localtime, prev->localtime, 0);
     ngx_conf_merge_value(conf->exact_size, prev->exact_size, 1);
+    ngx_conf_merge_value(conf->sort, prev->sort, 1);
+    ngx_conf_merge_ptr_value(conf->shm_zone, prev->shm_zone, NULL);
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_http_autoindex_cache_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    u_char                      *p;
+    ssize_t                      size, max_size;
+    ngx_str_t                   *value, name, s;
+    ngx_uint_t                   i;
+    ngx_shm_zone_t              *shm_zone;
+    ngx_http_autoindex_cache_t  *cache;
+
+    value = cf->args->elts;
+
+    cache = ngx_pcalloc(cf->pool, sizeof(ngx_http_autoindex_cache_t));
+    if (cache == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    cache->max_size = NGX_CONF_UNSET_SIZE;
+    cache->valid = 60;
+
+    size = 0;
+    name.len = 0;
+
+    for (i = 1; i < cf->args->nelts; i++) {
+
+        if (ngx_strncmp(value[i].data, "zone=", 5) == 0) {
+
+            name.data = value[i].data + 5;
+
+            p = (u_char *) ngx_strchr(name.data, ':');
+
+            if (p == NULL) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid zone size \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            name.len = p - name.data;
+
+            s.data = p + 1;
+            s.len = value[i].data + value[i].len - s.data;
+
+            size = ngx_parse_size(&s);
+
+            if (size == NGX_ERROR) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid zone size \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            if (size < (ssize_t) (8 * ngx_pagesize)) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "zone \"%V\" is too small", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "max_size=", 9) == 0) {
+
+            s.len = value[i].len - 9;
+            s.data = value[i].data + 9;
+
+            max_size = ngx_parse_size(&s);
+            if (max_size == NGX_ERROR || max_size == 0) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid max_size value \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            cache->max_size = max_size;
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "valid=", 6) == 0) {
+
+            s.len = value[i].len - 6;
+            s.data = value[i].data + 6;
+
+            cache->valid = ngx_parse_time(&s, 1);
+            if (cache->valid == (time_t) NGX_ERROR) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid valid value \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid parameter \"%V\"", &value[i]);
+        return NGX_CONF_ERROR;
+    }
+
+    if (name.len == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"%V\" must have \"zone\" parameter",
+                           &cmd->name);
+        return NGX_CONF_ERROR;
+    }
+
+    /*
+     * a listing may take at most 1/8 of the zone, so a listing being
+     * cached does not evict all others, and always fits into the zone
+     */
+
+    if (cache->max_size == NGX_CONF_UNSET_SIZE) {
+        cache->max_size = ngx_min(1024 * 1024, (size_t) size / 8);
+
+    } else if (cache->max_size > (size_t) size / 8) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"max_size\" must not be greater than "
+                           "1/8 of the zone \"%V\" size", &name);
+        return NGX_CONF_ERROR;
+    }
+
+    shm_zone = ngx_shared_memory_add(cf, &name, size,
+                                     &ngx_http_autoindex_module);
+    if (shm_zone == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    if (shm_zone->data) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "duplicate zone \"%V\"", &name);
+        return NGX_CONF_ERROR;
+    }
+
+    shm_zone->init = ngx_http_autoindex_cache_init_zone;
+    shm_zone->data = cache;
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_http_autoindex_cache(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_autoindex_loc_conf_t *alcf = conf;
+
+    ngx_str_t  *value;
+
+    if (alcf->shm_zone != NGX_CONF_UNSET_PTR) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    if (ngx_strcmp(value[1].data, "off") == 0) {
+        alcf->shm_zone = NULL;
+        return NGX_CONF_OK;
+    }
+
+    alcf->shm_zone = ngx_shared_memory_add(cf, &value[1], 0,
+                                           &ngx_http_autoindex_module);
+    if (alcf->shm_zone == NULL) {
+        return NGX_CONF_ERROR;
+    }
 
     return NGX_CONF_OK;
 }
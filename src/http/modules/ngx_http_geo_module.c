@@ -72,7 +72,7 @@ typedef struct {
         ngx_http_geo_high_ranges_t   high;
     } u;
 
-    ngx_array_t                     *proxies;
+    ngx_cidr_tree_t                 *proxies;
     unsigned                         proxy_recursive:1;
 
     ngx_int_t                        index;
@@ -465,7 +465,13 @@ ngx_http_geo_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         goto failed;
     }
 
-    geo->proxies = ctx.proxies;
+    if (ctx.proxies) {
+        geo->proxies = ngx_cidr_tree_create(cf->pool, ctx.proxies);
+        if (geo->proxies == NULL) {
+            goto failed;
+        }
+    }
+
     geo->proxy_recursive = ctx.proxy_recursive;
 
     if (ctx.ranges) {
@@ -554,6 +560,16 @@ ngx_http_geo_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
             goto failed;
         }
 #endif
+
+        if (ngx_radix_tree_compile(ctx.tree) != NGX_OK) {
+            goto failed;
+        }
+
+#if (NGX_HAVE_INET6)
+        if (ngx_radix_tree_compile(ctx.tree6) != NGX_OK) {
+            goto failed;
+        }
+#endif
     }
 
     ngx_destroy_pool(ctx.temp_pool);
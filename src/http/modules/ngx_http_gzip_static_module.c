@@ -15,15 +15,32 @@
 #define NGX_HTTP_GZIP_STATIC_ALWAYS  2
 
 
+#define NGX_HTTP_GZIP_STATIC_ENCODINGS  3
+#define NGX_HTTP_GZIP_STATIC_MAX_EXT     4
+
+
+typedef struct {
+    ngx_str_t     name;
+    ngx_str_t     ext;
+} ngx_http_gzip_static_encoding_t;
+
+
 typedef struct {
-    ngx_uint_t  enable;
+    ngx_uint_t    enable;
+    ngx_array_t  *encodings;
 } ngx_http_gzip_static_conf_t;
 
 
 static ngx_int_t ngx_http_gzip_static_handler(ngx_http_request_t *r);
+static ngx_int_t ngx_http_gzip_static_open(ngx_http_request_t *r,
+    ngx_str_t *path, ngx_open_file_info_t *of);
+static ngx_uint_t ngx_http_gzip_static_quality(ngx_str_t *ae,
+    ngx_str_t *name);
 static void *ngx_http_gzip_static_create_conf(ngx_conf_t *cf);
 static char *ngx_http_gzip_static_merge_conf(ngx_conf_t *cf, void *parent,
     void *child);
+static char *ngx_http_gzip_static_encodings(ngx_conf_t *cf,
+    ngx_command_t *cmd, void *conf);
 static ngx_int_t ngx_http_gzip_static_init(ngx_conf_t *cf);
 
 
@@ -35,6 +52,14 @@ static ngx_conf_enum_t  ngx_http_gzip_static[] = {
 };
 
 
+static ngx_http_gzip_static_encoding_t  ngx_http_gzip_static_known[] = {
+    { ngx_string("gzip"), ngx_string(".gz") },
+    { ngx_string("br"), ngx_string(".br") },
+    { ngx_string("zstd"), ngx_string(".zst") },
+    { ngx_null_string, ngx_null_string }
+};
+
+
 static ngx_command_t  ngx_http_gzip_static_commands[] = {
 
     { ngx_string("gzip_static"),
@@ -44,6 +69,13 @@ static ngx_command_t  ngx_http_gzip_static_commands[] = {
       offsetof(ngx_http_gzip_static_conf_t, enable),
       &ngx_http_gzip_static },
 
+    { ngx_string("gzip_static_encodings"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_1MORE,
+      ngx_http_gzip_static_encodings,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
       ngx_null_command
 };
 
@@ -82,18 +114,20 @@ ngx_module_t  ngx_http_gzip_static_module = {
 static ngx_int_t
 ngx_http_gzip_static_handler(ngx_http_request_t *r)
 {
-    u_char                       *p;
-    size_t                        root;
-    ngx_str_t                     path;
-    ngx_int_t                     rc;
-    ngx_uint_t                    level;
-    ngx_log_t                    *log;
-    ngx_buf_t                    *b;
-    ngx_chain_t                   out;
-    ngx_table_elt_t              *h;
-    ngx_open_file_info_t          of;
-    ngx_http_core_loc_conf_t     *clcf;
-    ngx_http_gzip_static_conf_t  *gzcf;
+    u_char                           *p, *base;
+    size_t                            root;
+    ngx_str_t                         path, *ae;
+    ngx_int_t                         rc;
+    ngx_uint_t                        i, j, n, t, vary;
+    ngx_uint_t                        q[NGX_HTTP_GZIP_STATIC_ENCODINGS];
+    ngx_log_t                        *log;
+    ngx_buf_t                        *b;
+    ngx_chain_t                       out;
+    ngx_table_elt_t                  *h;
+    ngx_open_file_info_t              of;
+    ngx_http_core_loc_conf_t         *clcf;
+    ngx_http_gzip_static_conf_t      *gzcf;
+    ngx_http_gzip_static_encoding_t  *enc[NGX_HTTP_GZIP_STATIC_ENCODINGS], *e;
 
     if (!(r->method & (NGX_HTTP_GET|NGX_HTTP_HEAD))) {
         return NGX_DECLINED;
@@ -109,110 +143,116 @@ ngx_http_gzip_static_handler(ngx_http_request_t *r)
         return NGX_DECLINED;
     }
 
-    if (gzcf->enable == NGX_HTTP_GZIP_STATIC_ON) {
-        rc = ngx_http_gzip_ok(r);
+    if (gzcf->encodings) {
+        n = gzcf->encodings->nelts;
+        ngx_memcpy(enc, gzcf->encodings->elts, n * sizeof(e));
 
     } else {
-        /* always */
-        rc = NGX_OK;
+        n = 1;
+        enc[0] = &ngx_http_gzip_static_known[0];
     }
 
-    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+    /*
+     * the acceptable encodings are ordered by their quality values,
+     * and by the configured order for equal values; all encodings are
+     * subject to the gzip_http_version, gzip_proxied, etc. checks
+     */
 
-    if (!clcf->gzip_vary && rc != NGX_OK) {
-        return NGX_DECLINED;
-    }
+    ae = r->headers_in.accept_encoding ? &r->headers_in.accept_encoding->value
+                                       : NULL;
 
-    log = r->connection->log;
+    /*
+     * with "always", gzip is sent regardless of Accept-Encoding,
+     * but other encodings still depend on it
+     */
 
-    p = ngx_http_map_uri_to_path(r, &path, &root, sizeof(".gz") - 1);
-    if (p == NULL) {
-        return NGX_HTTP_INTERNAL_SERVER_ERROR;
-    }
+    vary = (gzcf->enable == NGX_HTTP_GZIP_STATIC_ON);
 
-    *p++ = '.';
-    *p++ = 'g';
-    *p++ = 'z';
-    *p = '\0';
+    for (i = 0; i < n; i++) {
+        q[i] = 0;
 
-    path.len = p - path.data;
+        if (enc[i] == &ngx_http_gzip_static_known[0]) {
 
-    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, log, 0,
-                   "http filename: \"%s\"", path.data);
+            if (ngx_http_gzip_ok(r) == NGX_OK) {
+                q[i] = ngx_http_gzip_static_quality(ae, &enc[i]->name);
+                q[i] = ngx_max(q[i], 1);
+            }
+
+            if (q[i] == 0 && gzcf->enable == NGX_HTTP_GZIP_STATIC_ALWAYS) {
+                q[i] = 1;
+            }
 
-    ngx_memzero(&of, sizeof(ngx_open_file_info_t));
+            continue;
+        }
 
-    of.read_ahead = clcf->read_ahead;
-    of.directio = clcf->directio;
-    of.valid = clcf->open_file_cache_valid;
-    of.min_uses = clcf->open_file_cache_min_uses;
-    of.errors = clcf->open_file_cache_errors;
-    of.events = clcf->open_file_cache_events;
+        vary = 1;
 
-    if (ngx_http_set_disable_symlinks(r, clcf, &path, &of) != NGX_OK) {
-        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+        if (ae && ngx_http_compression_ok(r) == NGX_OK) {
+            q[i] = ngx_http_gzip_static_quality(ae, &enc[i]->name);
+        }
     }
 
-    if (ngx_open_cached_file(clcf->open_file_cache, &path, &of, r->pool)
-        != NGX_OK)
-    {
-        switch (of.err) {
+    for (i = 1; i < n; i++) {
+        for (j = i; j > 0 && q[j] > q[j - 1]; j--) {
+            e = enc[j];
+            enc[j] = enc[j - 1];
+            enc[j - 1] = e;
 
-        case 0:
-            return NGX_HTTP_INTERNAL_SERVER_ERROR;
+            t = q[j];
+            q[j] = q[j - 1];
+            q[j - 1] = t;
+        }
+    }
 
-        case NGX_ENOENT:
-        case NGX_ENOTDIR:
-        case NGX_ENAMETOOLONG:
+    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
 
-            return NGX_DECLINED;
+    if (!clcf->gzip_vary && q[0] == 0) {
+        return NGX_DECLINED;
+    }
 
-        case NGX_EACCES:
-#if (NGX_HAVE_OPENAT)
-        case NGX_EMLINK:
-        case NGX_ELOOP:
-#endif
+    log = r->connection->log;
 
-            level = NGX_LOG_ERR;
-            break;
+    base = ngx_http_map_uri_to_path(r, &path, &root,
+                                    NGX_HTTP_GZIP_STATIC_MAX_EXT);
+    if (base == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
 
-        default:
+    /* the variants, including those not acceptable, are probed for Vary */
 
-            level = NGX_LOG_CRIT;
-            break;
-        }
+    for (i = 0; i < n; i++) {
+        e = enc[i];
 
-        ngx_log_error(level, log, of.err,
-                      "%s \"%s\" failed", of.failed, path.data);
+        p = ngx_cpymem(base, e->ext.data, e->ext.len);
+        *p = '\0';
 
-        return NGX_DECLINED;
-    }
+        path.len = p - path.data;
 
-    if (gzcf->enable == NGX_HTTP_GZIP_STATIC_ON) {
-        r->gzip_vary = 1;
+        rc = ngx_http_gzip_static_open(r, &path, &of);
 
-        if (rc != NGX_OK) {
-            return NGX_DECLINED;
+        if (rc == NGX_HTTP_INTERNAL_SERVER_ERROR) {
+            return rc;
         }
-    }
 
-    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, log, 0, "http static fd: %d", of.fd);
+        if (rc == NGX_OK) {
+            break;
+        }
+    }
 
-    if (of.is_dir) {
-        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, log, 0, "http dir");
+    if (i == n) {
         return NGX_DECLINED;
     }
 
-#if !(NGX_WIN32) /* the not regular files are probably Unix specific */
-
-    if (!of.is_file) {
-        ngx_log_error(NGX_LOG_CRIT, log, 0,
-                      "\"%s\" is not a regular file", path.data);
+    if (vary) {
+        r->gzip_vary = 1;
+    }
 
-        return NGX_HTTP_NOT_FOUND;
+    if (q[i] == 0) {
+        return NGX_DECLINED;
     }
 
-#endif
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, log, 0, "http static %V fd: %d",
+                   &e->name, of.fd);
 
     r->root_tested = !r->error_page;
 
@@ -243,7 +283,7 @@ ngx_http_gzip_static_handler(ngx_http_request_t *r)
 
     h->hash = 1;
     ngx_str_set(&h->key, "Content-Encoding");
-    ngx_str_set(&h->value, "gzip");
+    h->value = e->name;
     r->headers_out.content_encoding = h;
 
     /* we need to allocate all before the header would be sent */
@@ -283,6 +323,179 @@ ngx_http_gzip_static_handler(ngx_http_request_t *r)
 }
 
 
+static ngx_int_t
+ngx_http_gzip_static_open(ngx_http_request_t *r, ngx_str_t *path,
+    ngx_open_file_info_t *of)
+{
+    ngx_uint_t                 level;
+    ngx_log_t                 *log;
+    ngx_http_core_loc_conf_t  *clcf;
+
+    log = r->connection->log;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, log, 0,
+                   "http filename: \"%s\"", path->data);
+
+    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+
+    ngx_memzero(of, sizeof(ngx_open_file_info_t));
+
+    of->read_ahead = clcf->read_ahead;
+    of->directio = clcf->directio;
+    of->valid = clcf->open_file_cache_valid;
+    of->min_uses = clcf->open_file_cache_min_uses;
+    of->events = clcf->open_file_cache_events;
+
+    /*
+     * missing variants are expected, and are always cached,
+     * so they cost no syscalls while the cache entry is valid
+     */
+
+    of->errors = 1;
+
+    if (ngx_http_set_disable_symlinks(r, clcf, path, of) != NGX_OK) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    if (ngx_open_cached_file(clcf->open_file_cache, path, of, r->pool)
+        != NGX_OK)
+    {
+        switch (of->err) {
+
+        case 0:
+            return NGX_HTTP_INTERNAL_SERVER_ERROR;
+
+        case NGX_ENOENT:
+        case NGX_ENOTDIR:
+        case NGX_ENAMETOOLONG:
+
+            return NGX_DECLINED;
+
+        case NGX_EACCES:
+#if (NGX_HAVE_OPENAT)
+        case NGX_EMLINK:
+        case NGX_ELOOP:
+#endif
+
+            level = NGX_LOG_ERR;
+            break;
+
+        default:
+
+            level = NGX_LOG_CRIT;
+            break;
+        }
+
+        ngx_log_error(level, log, of->err,
+                      "%s \"%s\" failed", of->failed, path->data);
+
+        return NGX_DECLINED;
+    }
+
+    if (of->is_dir) {
+        ngx_log_debug0(NGX_LOG_DEBUG_HTTP, log, 0, "http dir");
+        return NGX_DECLINED;
+    }
+
+#if !(NGX_WIN32) /* the not regular files are probably Unix specific */
+
+    if (!of->is_file) {
+        ngx_log_error(NGX_LOG_CRIT, log, 0,
+                      "\"%s\" is not a regular file", path->data);
+
+        return NGX_DECLINED;
+    }
+
+#endif
+
+    return NGX_OK;
+}
+
+
+/*
+ * returns the quality value of the encoding in Accept-Encoding
+ * multiplied by 1000, the "*" value if the encoding is not listed,
+ * or 0 if the encoding is not acceptable
+ */
+
+static ngx_uint_t
+ngx_http_gzip_static_quality(ngx_str_t *ae, ngx_str_t *name)
+{
+    u_char      *p, *last, *token;
+    size_t       len;
+    ngx_uint_t   q, m, any;
+
+    any = 0;
+
+    p = ae->data;
+    last = p + ae->len;
+
+    while (p < last) {
+
+        while (p < last && (*p == ' ' || *p == '\t' || *p == ',')) {
+            p++;
+        }
+
+        token = p;
+
+        while (p < last
+               && *p != ' ' && *p != '\t' && *p != ',' && *p != ';')
+        {
+            p++;
+        }
+
+        len = p - token;
+        q = 1000;
+
+        while (p < last && *p != ',') {
+
+            if (*p++ != ';') {
+                continue;
+            }
+
+            while (p < last && (*p == ' ' || *p == '\t')) {
+                p++;
+            }
+
+            if (last - p < 3 || (*p != 'q' && *p != 'Q') || p[1] != '=') {
+                continue;
+            }
+
+            p += 2;
+
+            if (*p != '0' && *p != '1') {
+                q = 0;
+                continue;
+            }
+
+            q = (*p++ - '0') * 1000;
+
+            if (p < last && *p == '.') {
+                p++;
+
+                for (m = 100; p < last && *p >= '0' && *p <= '9'; m /= 10) {
+                    q += (*p++ - '0') * m;
+                }
+            }
+
+            if (q > 1000) {
+                q = 0;
+            }
+        }
+
+        if (len == name->len && ngx_strncasecmp(token, name->data, len) == 0) {
+            return q;
+        }
+
+        if (len == 1 && *token == '*') {
+            any = q;
+        }
+    }
+
+    return any;
+}
+
+
 static void *
 ngx_http_gzip_static_create_conf(ngx_conf_t *cf)
 {
@@ -294,6 +507,7 @@ ngx_http_gzip_static_create_conf(ngx_conf_t *cf)
     }
 
     conf->enable = NGX_CONF_UNSET_UINT;
+    conf->encodings = NGX_CONF_UNSET_PTR;
 
     return conf;
 }
@@ -308,6 +522,70 @@ ngx_http_gzip_static_merge_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_conf_merge_uint_value(conf->enable, prev->enable,
                               NGX_HTTP_GZIP_STATIC_OFF);
 
+    ngx_conf_merge_ptr_value(conf->encodings, prev->encodings, NULL);
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_http_gzip_static_encodings(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf)
+{
+    ngx_http_gzip_static_conf_t *gzcf = conf;
+
+    ngx_str_t                         *value;
+    ngx_uint_t                         i, j, k;
+    ngx_http_gzip_static_encoding_t  **e;
+
+    if (gzcf->encodings != NGX_CONF_UNSET_PTR) {
+        return "is duplicate";
+    }
+
+    gzcf->encodings = ngx_array_create(cf->pool, cf->args->nelts - 1,
+                                 sizeof(ngx_http_gzip_static_encoding_t *));
+    if (gzcf->encodings == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    value = cf->args->elts;
+
+    for (i = 1; i < cf->args->nelts; i++) {
+
+        for (k = 0; ngx_http_gzip_static_known[k].name.len; k++) {
+            if (value[i].len == ngx_http_gzip_static_known[k].name.len
+                && ngx_strcasecmp(value[i].data,
+                                  ngx_http_gzip_static_known[k].name.data)
+                   == 0)
+            {
+                break;
+            }
+        }
+
+        if (ngx_http_gzip_static_known[k].name.len == 0) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "unknown encoding \"%V\"", &value[i]);
+            return NGX_CONF_ERROR;
+        }
+
+        e = gzcf->encodings->elts;
+
+        for (j = 0; j < gzcf->encodings->nelts; j++) {
+            if (e[j] == &ngx_http_gzip_static_known[k]) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "duplicate encoding \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+        }
+
+        e = ngx_array_push(gzcf->encodings);
+        if (e == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        *e = &ngx_http_gzip_static_known[k];
+    }
+
     return NGX_CONF_OK;
 }
 
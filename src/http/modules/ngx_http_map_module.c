@@ -16,6 +16,51 @@ typedef struct {
 } ngx_http_map_conf_t;
 
 
+typedef struct {
+    u_char                      MAPBIN[6];
+    u_char                      version;
+    u_char                      hostnames;
+    uint32_t                    endianness;
+    uint32_t                    crc32;
+    uint32_t                    nbuckets;
+    uint32_t                    nkeys;
+    uint64_t                    length;    /* of the base */
+    uint64_t                    mtime;     /* of the source */
+    uint64_t                    size;      /* of the source */
+} ngx_http_map_header_t;
+
+
+/*
+ * A binary map base consists of the header, an array of nbuckets offsets
+ * of the buckets, the buckets themselves, each being a list of elements
+ * terminated by a zero value offset, and the values.  All references are
+ * offsets from the start of the file, so the file is used as is through
+ * a read-only mapping shared by all processes.  The CRC32 covers the
+ * header only, the data are not read when the base is mapped, and the
+ * offsets are checked on lookups instead.
+ */
+
+typedef struct {
+    uint32_t                    value;
+    u_short                     len;
+    u_char                      name[2];
+} ngx_http_map_binary_elt_t;
+
+
+typedef struct {
+    uint32_t                    len;
+    u_char                      data[4];
+} ngx_http_map_binary_value_t;
+
+
+typedef struct {
+    u_char                     *base;
+    size_t                      size;
+    uint32_t                   *buckets;
+    ngx_uint_t                  nbuckets;
+} ngx_http_map_binary_t;
+
+
 typedef struct {
     ngx_hash_keys_arrays_t      keys;
 
@@ -26,6 +71,15 @@ typedef struct {
 
     ngx_http_variable_value_t  *default_value;
     ngx_conf_t                 *cf;
+
+    ngx_http_map_binary_t      *binary;
+    ngx_str_t                   binary_name;
+    ngx_str_t                   include_name;
+    ngx_uint_t                  include_keys;
+    ngx_uint_t                  include_nkeys;
+    ngx_file_info_t             include_info;
+    ngx_uint_t                  includes;
+
     unsigned                    hostnames:1;
     unsigned                    no_cacheable:1;
 } ngx_http_map_conf_ctx_t;
@@ -33,17 +87,39 @@ typedef struct {
 
 typedef struct {
     ngx_http_map_t              map;
+    ngx_http_map_binary_t      *binary;
     ngx_http_complex_value_t    value;
     ngx_http_variable_value_t  *default_value;
     ngx_uint_t                  hostnames;      /* unsigned  hostnames:1 */
 } ngx_http_map_ctx_t;
 
 
+#define ngx_http_map_binary_elt_size(len)                                     \
+    ngx_align(offsetof(ngx_http_map_binary_elt_t, name) + (len),              \
+              sizeof(uint32_t))
+
+#define ngx_http_map_binary_value_size(len)                                   \
+    ngx_align(offsetof(ngx_http_map_binary_value_t, data) + (len),            \
+              sizeof(uint32_t))
+
+
 static int ngx_libc_cdecl ngx_http_map_cmp_dns_wildcards(const void *one,
     const void *two);
 static void *ngx_http_map_create_conf(ngx_conf_t *cf);
 static char *ngx_http_map_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
 static char *ngx_http_map(ngx_conf_t *cf, ngx_command_t *dummy, void *conf);
+static char *ngx_http_map_include(ngx_conf_t *cf, ngx_command_t *dummy,
+    void *conf);
+static ngx_int_t ngx_http_map_binary_name(ngx_conf_t *cf, ngx_str_t *file,
+    ngx_str_t *name);
+static ngx_int_t ngx_http_map_include_binary_base(ngx_conf_t *cf,
+    ngx_http_map_conf_ctx_t *ctx, ngx_str_t *file, ngx_str_t *name);
+static void ngx_http_map_cleanup_binary_base(void *data);
+static ngx_int_t ngx_http_map_create_binary_base(ngx_conf_t *cf,
+    ngx_http_map_conf_ctx_t *ctx);
+static ngx_http_variable_value_t *ngx_http_map_binary_find(
+    ngx_http_map_binary_t *binary, u_char *name, size_t len,
+    ngx_http_variable_value_t *vv);
 
 
 static ngx_command_t  ngx_http_map_commands[] = {
@@ -73,6 +149,11 @@ static ngx_command_t  ngx_http_map_commands[] = {
 };
 
 
+static ngx_http_map_header_t  ngx_http_map_header = {
+    { 'M', 'A', 'P', 'B', 'I', 'N' }, 2, 0, 0x12345678, 0, 0, 0, 0, 0, 0
+};
+
+
 static ngx_http_module_t  ngx_http_map_module_ctx = {
     NULL,                                  /* preconfiguration */
     NULL,                                  /* postconfiguration */
@@ -112,7 +193,7 @@ ngx_http_map_variable(ngx_http_request_t *r, ngx_http_variable_value_t *v,
 
     ngx_str_t                   val, str;
     ngx_http_complex_value_t   *cv;
-    ngx_http_variable_value_t  *value;
+    ngx_http_variable_value_t  *value, vv;
 
     ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                    "http map started");
@@ -125,7 +206,15 @@ ngx_http_map_variable(ngx_http_request_t *r, ngx_http_variable_value_t *v,
         val.len--;
     }
 
-    value = ngx_http_map_find(r, &map->map, &val);
+    value = NULL;
+
+    if (map->binary) {
+        value = ngx_http_map_binary_find(map->binary, val.data, val.len, &vv);
+    }
+
+    if (value == NULL) {
+        value = ngx_http_map_find(r, &map->map, &val);
+    }
 
     if (value == NULL) {
         value = map->default_value;
@@ -155,6 +244,82 @@ ngx_http_map_variable(ngx_http_request_t *r, ngx_http_variable_value_t *v,
 }
 
 
+static ngx_http_variable_value_t *
+ngx_http_map_binary_find(ngx_http_map_binary_t *binary, u_char *name,
+    size_t len, ngx_http_variable_value_t *vv)
+{
+    size_t                        size, offset;
+    ngx_uint_t                    i, key;
+    ngx_http_map_binary_elt_t    *elt;
+    ngx_http_map_binary_value_t  *value;
+
+    key = 0;
+
+    for (i = 0; i < len; i++) {
+        key = ngx_hash(key, ngx_tolower(name[i]));
+    }
+
+    size = binary->size;
+    offset = binary->buckets[key % binary->nbuckets];
+
+    if (offset == 0) {
+        return NULL;
+    }
+
+    for ( ;; ) {
+
+        /* the offsets in the base are not trusted */
+
+        if (offset % sizeof(uint32_t) || offset > size - sizeof(uint32_t)) {
+            return NULL;
+        }
+
+        elt = (ngx_http_map_binary_elt_t *) (binary->base + offset);
+
+        if (elt->value == 0) {
+            return NULL;
+        }
+
+        if (offset > size - offsetof(ngx_http_map_binary_elt_t, name)
+            || elt->len > size - offset
+                          - offsetof(ngx_http_map_binary_elt_t, name))
+        {
+            return NULL;
+        }
+
+        if (len == (size_t) elt->len
+            && ngx_strncasecmp(elt->name, name, len) == 0)
+        {
+            if (elt->value % sizeof(uint32_t)
+                || elt->value > size - offsetof(ngx_http_map_binary_value_t,
+                                                data))
+            {
+                return NULL;
+            }
+
+            value = (ngx_http_map_binary_value_t *)
+                        (binary->base + elt->value);
+
+            if (value->len > size - elt->value
+                             - offsetof(ngx_http_map_binary_value_t, data))
+            {
+                return NULL;
+            }
+
+            vv->len = value->len;
+            vv->valid = 1;
+            vv->no_cacheable = 0;
+            vv->not_found = 0;
+            vv->data = value->data;
+
+            return vv;
+        }
+
+        offset += ngx_http_map_binary_elt_size(elt->len);
+    }
+}
+
+
 static void *
 ngx_http_map_create_conf(ngx_conf_t *cf)
 {
@@ -179,13 +344,19 @@ ngx_http_map_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
     char                              *rv;
     ngx_str_t                         *value, name;
+    ngx_uint_t                         i;
     ngx_conf_t                         save;
     ngx_pool_t                        *pool;
+    ngx_hash_key_t                    *key;
     ngx_hash_init_t                    hash;
     ngx_http_map_ctx_t                *map;
+    ngx_http_variable_value_t          vv;
     ngx_http_variable_t               *var;
     ngx_http_map_conf_ctx_t            ctx;
     ngx_http_compile_complex_value_t   ccv;
+#if (NGX_PCRE)
+    ngx_regex_t                      **rep;
+#endif
 
     if (mcf->hash_max_size == NGX_CONF_UNSET_UINT) {
         mcf->hash_max_size = 2048;
@@ -265,6 +436,9 @@ ngx_http_map_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
     ctx.default_value = NULL;
     ctx.cf = &save;
+    ctx.binary = NULL;
+    ctx.include_name.len = 0;
+    ctx.includes = 0;
     ctx.hostnames = 0;
     ctx.no_cacheable = 0;
 
@@ -292,6 +466,36 @@ ngx_http_map_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
     map->hostnames = ctx.hostnames;
 
+    if (ctx.binary == NULL
+        && ctx.include_name.len
+        && ctx.includes == 1
+        && ctx.include_nkeys > 100000)
+    {
+        if (ngx_http_map_create_binary_base(cf, &ctx) == NGX_ERROR) {
+            ngx_destroy_pool(pool);
+            return NGX_CONF_ERROR;
+        }
+    }
+
+    if (ctx.binary) {
+        key = ctx.keys.keys.elts;
+
+        for (i = 0; i < ctx.keys.keys.nelts; i++) {
+            if (ngx_http_map_binary_find(ctx.binary, key[i].key.data,
+                                         key[i].key.len, &vv)
+                != NULL)
+            {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "conflicting parameter \"%V\"",
+                                   &key[i].key);
+                ngx_destroy_pool(pool);
+                return NGX_CONF_ERROR;
+            }
+        }
+
+        map->binary = ctx.binary;
+    }
+
     hash.key = ngx_hash_key_lc;
     hash.max_size = mcf->hash_max_size;
     hash.bucket_size = mcf->hash_bucket_size;
@@ -355,6 +559,23 @@ ngx_http_map_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     if (ctx.regexes.nelts) {
         map->map.regex = ctx.regexes.elts;
         map->map.nregex = ctx.regexes.nelts;
+
+        rep = ngx_palloc(cf->pool, map->map.nregex * sizeof(ngx_regex_t *));
+        if (rep == NULL) {
+            ngx_destroy_pool(pool);
+            return NGX_CONF_ERROR;
+        }
+
+        for (i = 0; i < map->map.nregex; i++) {
+            rep[i] = map->map.regex[i].regex->regex;
+        }
+
+        map->map.regex_set = ngx_regex_set_create(cf->pool, rep,
+                                                  map->map.nregex);
+        if (map->map.regex_set == NULL) {
+            ngx_destroy_pool(pool);
+            return NGX_CONF_ERROR;
+        }
     }
 
 #endif
@@ -415,7 +636,7 @@ ngx_http_map(ngx_conf_t *cf, ngx_command_t *dummy, void *conf)
     }
 
     if (ngx_strcmp(value[0].data, "include") == 0) {
-        return ngx_conf_include(cf, dummy, conf);
+        return ngx_http_map_include(cf, dummy, conf);
     }
 
     key = 0;
@@ -587,3 +808,482 @@ found:
 
     return NGX_CONF_ERROR;
 }
+
+
+static char *
+ngx_http_map_include(ngx_conf_t *cf, ngx_command_t *dummy, void *conf)
+{
+    char                       *rv;
+    ngx_str_t                  *value, file, name;
+    ngx_uint_t                  keys, wc_head, wc_tail, hostnames;
+    ngx_http_map_conf_ctx_t    *ctx;
+    ngx_http_variable_value_t  *default_value;
+#if (NGX_PCRE)
+    ngx_uint_t                  regexes;
+#endif
+
+    ctx = cf->ctx;
+
+    value = cf->args->elts;
+
+    ctx->includes++;
+
+    if (strpbrk((char *) value[1].data, "*?[") != NULL) {
+        return ngx_conf_include(cf, dummy, conf);
+    }
+
+    file = value[1];
+
+    if (ngx_conf_full_name(cf->cycle, &file, 1) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
+
+    if (ngx_http_map_binary_name(cf, &file, &name) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
+
+    if (ctx->binary == NULL) {
+        ngx_log_debug1(NGX_LOG_DEBUG_CORE, cf->log, 0, "include %s", name.data);
+
+        switch (ngx_http_map_include_binary_base(cf, ctx, &file, &name)) {
+        case NGX_OK:
+            return NGX_CONF_OK;
+        case NGX_ERROR:
+            return NGX_CONF_ERROR;
+        default:
+            break;
+        }
+    }
+
+    if (ngx_file_info(file.data, &ctx->include_info) == NGX_FILE_ERROR) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, ngx_errno,
+                           ngx_file_info_n " \"%s\" failed", file.data);
+        return NGX_CONF_ERROR;
+    }
+
+    keys = ctx->keys.keys.nelts;
+    wc_head = ctx->keys.dns_wc_head.nelts;
+    wc_tail = ctx->keys.dns_wc_tail.nelts;
+    hostnames = ctx->hostnames;
+    default_value = ctx->default_value;
+#if (NGX_PCRE)
+    regexes = ctx->regexes.nelts;
+#endif
+
+    ngx_log_debug1(NGX_LOG_DEBUG_CORE, cf->log, 0, "include %s", file.data);
+
+    rv = ngx_conf_parse(cf, &file);
+
+    if (rv != NGX_CONF_OK) {
+        return rv;
+    }
+
+    /*
+     * only an include of plain exact keys is eligible
+     * to be replaced with a binary base
+     */
+
+    if (ctx->includes == 1
+        && ctx->keys.dns_wc_head.nelts == wc_head
+        && ctx->keys.dns_wc_tail.nelts == wc_tail
+        && ctx->hostnames == hostnames
+        && ctx->default_value == default_value
+#if (NGX_PCRE)
+        && ctx->regexes.nelts == regexes
+#endif
+       )
+    {
+        ctx->binary_name = name;
+        ctx->include_name = file;
+        ctx->include_keys = keys;
+        ctx->include_nkeys = ctx->keys.keys.nelts - keys;
+    }
+
+    return NGX_CONF_OK;
+}
+
+
+/*
+ * the base of an include is kept in the prefix rather than next to
+ * the source, which may be not writable, and its name is made unique
+ * with the CRC32 of the full name of the source
+ */
+
+static ngx_int_t
+ngx_http_map_binary_name(ngx_conf_t *cf, ngx_str_t *file, ngx_str_t *name)
+{
+    u_char  *p, *last;
+
+    last = file->data + file->len;
+
+    for (p = last; p > file->data; p--) {
+        if (ngx_path_separator(p[-1])) {
+            break;
+        }
+    }
+
+    name->len = last - p + sizeof(".12345678.bin") - 1;
+    name->data = ngx_pnalloc(cf->pool, name->len + 1);
+    if (name->data == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_sprintf(name->data, "%*s.%08xD.bin%Z",
+                last - p, p, ngx_crc32_long(file->data, file->len));
+
+    return ngx_conf_full_name(cf->cycle, name, 0);
+}
+
+
+static ngx_int_t
+ngx_http_map_include_binary_base(ngx_conf_t *cf, ngx_http_map_conf_ctx_t *ctx,
+    ngx_str_t *file, ngx_str_t *name)
+{
+    size_t                 size;
+    uint32_t               crc32;
+    ngx_err_t              err;
+    ngx_file_info_t        fi;
+    ngx_pool_cleanup_t    *cln;
+    ngx_file_mapping_t    *fm;
+    ngx_http_map_header_t  *header;
+    ngx_http_map_binary_t  *binary;
+
+    if (ngx_file_info(name->data, &fi) == NGX_FILE_ERROR) {
+        err = ngx_errno;
+        if (err != NGX_ENOENT) {
+            ngx_conf_log_error(NGX_LOG_CRIT, cf, err,
+                               ngx_file_info_n " \"%s\" failed", name->data);
+        }
+        return NGX_DECLINED;
+    }
+
+    size = (size_t) ngx_file_size(&fi);
+
+    if (ngx_file_info(file->data, &fi) == NGX_FILE_ERROR) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, ngx_errno,
+                           ngx_file_info_n " \"%s\" failed", file->data);
+        return NGX_ERROR;
+    }
+
+    if (size < sizeof(ngx_http_map_header_t)) {
+        ngx_conf_log_error(NGX_LOG_WARN, cf, 0,
+                           "incompatible binary map base \"%s\"", name->data);
+        return NGX_DECLINED;
+    }
+
+    fm = ngx_palloc(ctx->cf->pool, sizeof(ngx_file_mapping_t));
+    if (fm == NULL) {
+        return NGX_ERROR;
+    }
+
+    fm->name = name->data;
+    fm->log = cf->log;
+
+    if (ngx_open_file_mapping(fm) != NGX_OK) {
+        return NGX_DECLINED;
+    }
+
+    header = fm->addr;
+
+    if (fm->size < sizeof(ngx_http_map_header_t)
+        || ngx_memcmp(header->MAPBIN, ngx_http_map_header.MAPBIN, 6) != 0
+        || header->version != ngx_http_map_header.version
+        || header->endianness != ngx_http_map_header.endianness
+        || header->hostnames != ctx->hostnames
+        || header->length != fm->size
+        || header->nbuckets == 0
+        || fm->size < sizeof(ngx_http_map_header_t)
+                      + header->nbuckets * sizeof(uint32_t))
+    {
+        ngx_conf_log_error(NGX_LOG_WARN, cf, 0,
+                           "incompatible binary map base \"%s\"", name->data);
+        goto failed;
+    }
+
+    crc32 = ngx_crc32_long((u_char *) &header->nbuckets,
+                           sizeof(ngx_http_map_header_t)
+                           - offsetof(ngx_http_map_header_t, nbuckets));
+
+    if (crc32 != header->crc32) {
+        ngx_conf_log_error(NGX_LOG_WARN, cf, 0,
+                           "CRC32 mismatch in binary map base \"%s\"",
+                           name->data);
+        goto failed;
+    }
+
+    /*
+     * the base is stale unless it was built from exactly this version
+     * of the source file, the modification time alone is not enough
+     * if the source is replaced with an older copy
+     */
+
+    if (header->mtime != (uint64_t) ngx_file_mtime(&fi)
+        || header->size != (uint64_t) ngx_file_size(&fi))
+    {
+        ngx_conf_log_error(NGX_LOG_WARN, cf, 0,
+                           "stale binary map base \"%s\"", name->data);
+        goto failed;
+    }
+
+    binary = ngx_palloc(ctx->cf->pool, sizeof(ngx_http_map_binary_t));
+    if (binary == NULL) {
+        goto error;
+    }
+
+    cln = ngx_pool_cleanup_add(ctx->cf->pool, 0);
+    if (cln == NULL) {
+        goto error;
+    }
+
+    cln->handler = ngx_http_map_cleanup_binary_base;
+    cln->data = fm;
+
+    binary->base = fm->addr;
+    binary->size = fm->size;
+    binary->buckets = (uint32_t *) (binary->base
+                                    + sizeof(ngx_http_map_header_t));
+    binary->nbuckets = header->nbuckets;
+
+    ngx_conf_log_error(NGX_LOG_NOTICE, cf, 0,
+                       "using binary map base \"%s\"", name->data);
+
+    ctx->binary = binary;
+
+    return NGX_OK;
+
+failed:
+
+    ngx_close_file_mapping(fm);
+
+    return NGX_DECLINED;
+
+error:
+
+    ngx_close_file_mapping(fm);
+
+    return NGX_ERROR;
+}
+
+
+static void
+ngx_http_map_cleanup_binary_base(void *data)
+{
+    ngx_file_mapping_t  *fm = data;
+
+    ngx_close_file_mapping(fm);
+}
+
+
+static ngx_int_t
+ngx_http_map_create_binary_base(ngx_conf_t *cf, ngx_http_map_conf_ctx_t *ctx)
+{
+    u_char                        *p;
+    size_t                         size;
+    uint32_t                      *buckets, *sizes, **offsets;
+    ngx_str_t                      name;
+    ngx_int_t                      rc;
+    ngx_uint_t                     i, j, k, m, n, nbuckets;
+    ngx_pool_t                    *pool;
+    ngx_hash_key_t                *key;
+    ngx_file_mapping_t             fm;
+    ngx_http_map_header_t         *header;
+    ngx_http_variable_value_t     *vv, **vp;
+    ngx_http_map_binary_elt_t     *elt;
+    ngx_http_map_binary_value_t   *value;
+
+    pool = ctx->keys.temp_pool;
+
+    key = (ngx_hash_key_t *) ctx->keys.keys.elts + ctx->include_keys;
+    n = ctx->include_nkeys;
+
+    for (i = 0; i < n; i++) {
+        vv = key[i].value;
+
+        if (!vv->valid || key[i].key.len > 0xffff) {
+            return NGX_DECLINED;
+        }
+    }
+
+    nbuckets = n;
+
+    sizes = ngx_pcalloc(pool, nbuckets * sizeof(uint32_t));
+    if (sizes == NULL) {
+        return NGX_ERROR;
+    }
+
+    for (i = 0; i < n; i++) {
+        k = key[i].key_hash % nbuckets;
+
+        if (sizes[k] == 0) {
+            sizes[k] = sizeof(uint32_t);
+        }
+
+        sizes[k] += ngx_http_map_binary_elt_size(key[i].key.len);
+    }
+
+    size = sizeof(ngx_http_map_header_t) + nbuckets * sizeof(uint32_t);
+
+    for (k = 0; k < nbuckets; k++) {
+        size += sizes[k];
+    }
+
+    /* the values are found by their pointers through the values hash */
+
+    offsets = ngx_pcalloc(pool, ctx->keys.hsize * sizeof(uint32_t *));
+    if (offsets == NULL) {
+        return NGX_ERROR;
+    }
+
+    for (k = 0; k < ctx->keys.hsize; k++) {
+        vp = ctx->values_hash[k].elts;
+
+        if (vp == NULL) {
+            continue;
+        }
+
+        offsets[k] = ngx_pcalloc(pool,
+                                 ctx->values_hash[k].nelts * sizeof(uint32_t));
+        if (offsets[k] == NULL) {
+            return NGX_ERROR;
+        }
+
+        for (j = 0; j < ctx->values_hash[k].nelts; j++) {
+            if (vp[j]->valid) {
+                offsets[k][j] = size;
+                size += ngx_http_map_binary_value_size(vp[j]->len);
+            }
+        }
+    }
+
+    if (size > 0xffffffff) {
+        return NGX_DECLINED;
+    }
+
+    name = ctx->binary_name;
+
+    fm.name = ngx_pnalloc(pool, name.len + 2 + NGX_INT64_LEN);
+    if (fm.name == NULL) {
+        return NGX_ERROR;
+    }
+
+    /* the base is built aside, as the old one may be still mapped */
+
+    ngx_sprintf(fm.name, "%V.%P%Z", &name, ngx_pid);
+
+    fm.size = size;
+    fm.log = cf->log;
+
+    ngx_log_error(NGX_LOG_NOTICE, fm.log, 0,
+                  "creating binary map base \"%V\" from \"%V\"",
+                  &name, &ctx->include_name);
+
+    if (ngx_create_file_mapping(&fm) != NGX_OK) {
+        return NGX_DECLINED;
+    }
+
+    header = fm.addr;
+    *header = ngx_http_map_header;
+    header->hostnames = ctx->hostnames;
+    header->nbuckets = nbuckets;
+    header->nkeys = n;
+    header->length = size;
+    header->mtime = ngx_file_mtime(&ctx->include_info);
+    header->size = ngx_file_size(&ctx->include_info);
+
+    buckets = (uint32_t *) ((u_char *) fm.addr
+                            + sizeof(ngx_http_map_header_t));
+
+    p = (u_char *) &buckets[nbuckets];
+
+    for (k = 0; k < nbuckets; k++) {
+        if (sizes[k]) {
+            buckets[k] = p - (u_char *) fm.addr;
+            p += sizes[k];
+
+            /* a bucket is terminated by a zero value offset */
+
+            *(uint32_t *) (p - sizeof(uint32_t)) = 0;
+
+            sizes[k] = buckets[k];
+
+        } else {
+            buckets[k] = 0;
+        }
+    }
+
+    for (i = 0; i < n; i++) {
+        k = key[i].key_hash % nbuckets;
+
+        elt = (ngx_http_map_binary_elt_t *) ((u_char *) fm.addr + sizes[k]);
+
+        vv = key[i].value;
+        j = ngx_hash_key(vv->data, vv->len) % ctx->keys.hsize;
+
+        vp = ctx->values_hash[j].elts;
+
+        for (m = 0; vp[m] != vv; m++) { /* void */ }
+
+        elt->value = offsets[j][m];
+        elt->len = (u_short) key[i].key.len;
+        ngx_memcpy(elt->name, key[i].key.data, key[i].key.len);
+
+        sizes[k] += ngx_http_map_binary_elt_size(key[i].key.len);
+    }
+
+    for (k = 0; k < ctx->keys.hsize; k++) {
+        vp = ctx->values_hash[k].elts;
+
+        if (vp == NULL) {
+            continue;
+        }
+
+        for (j = 0; j < ctx->values_hash[k].nelts; j++) {
+            if (vp[j]->valid) {
+                value = (ngx_http_map_binary_value_t *)
+                            ((u_char *) fm.addr + offsets[k][j]);
+                value->len = vp[j]->len;
+                ngx_memcpy(value->data, vp[j]->data, vp[j]->len);
+            }
+        }
+    }
+
+    header->crc32 = ngx_crc32_long((u_char *) &header->nbuckets,
+                                   sizeof(ngx_http_map_header_t)
+                                   - offsetof(ngx_http_map_header_t,
+                                              nbuckets));
+
+    ngx_close_file_mapping(&fm);
+
+    if (ngx_rename_file(fm.name, name.data) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, cf->log, ngx_errno,
+                      ngx_rename_file_n " \"%s\" to \"%s\" failed",
+                      fm.name, name.data);
+
+        if (ngx_delete_file(fm.name) == NGX_FILE_ERROR) {
+            ngx_log_error(NGX_LOG_CRIT, cf->log, ngx_errno,
+                          ngx_delete_file_n " \"%s\" failed", fm.name);
+        }
+
+        return NGX_DECLINED;
+    }
+
+    /* switch to the base just built, the parsed keys are not needed */
+
+    rc = ngx_http_map_include_binary_base(cf, ctx, &ctx->include_name,
+                                          &name);
+
+    if (rc != NGX_OK) {
+        return rc;
+    }
+
+    key = ctx->keys.keys.elts;
+    n = ctx->keys.keys.nelts - ctx->include_keys - ctx->include_nkeys;
+
+    ngx_memmove(&key[ctx->include_keys],
+                &key[ctx->include_keys + ctx->include_nkeys],
+                n * sizeof(ngx_hash_key_t));
+
+    ctx->keys.keys.nelts -= ctx->include_nkeys;
+
+    return NGX_OK;
+}
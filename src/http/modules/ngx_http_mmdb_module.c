@@ -0,0 +1,1287 @@
+
+/*
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+
+#define NGX_HTTP_MMDB_POINTER     1
+#define NGX_HTTP_MMDB_STRING      2
+#define NGX_HTTP_MMDB_DOUBLE      3
+#define NGX_HTTP_MMDB_BYTES       4
+#define NGX_HTTP_MMDB_UINT16      5
+#define NGX_HTTP_MMDB_UINT32      6
+#define NGX_HTTP_MMDB_MAP         7
+#define NGX_HTTP_MMDB_INT32       8
+#define NGX_HTTP_MMDB_UINT64      9
+#define NGX_HTTP_MMDB_UINT128     10
+#define NGX_HTTP_MMDB_ARRAY       11
+#define NGX_HTTP_MMDB_BOOLEAN     14
+#define NGX_HTTP_MMDB_FLOAT       15
+
+#define NGX_HTTP_MMDB_SEPARATOR   16
+#define NGX_HTTP_MMDB_META_MAX    (128 * 1024)
+
+
+typedef struct {
+    u_char                      *start;
+    size_t                       size;
+} ngx_http_mmdb_section_t;
+
+
+typedef struct {
+    ngx_uint_t                   type;
+    size_t                       size;
+    size_t                       offset;
+    size_t                       next;
+} ngx_http_mmdb_field_t;
+
+
+typedef struct {
+    ngx_file_mapping_t           fm;
+    u_char                      *tree;
+    ngx_http_mmdb_section_t      data;
+    ngx_uint_t                   node_count;
+    ngx_uint_t                   record_size;
+    ngx_uint_t                   ip_version;
+    ngx_uint_t                   ipv4_start;
+    time_t                       mtime;
+    ngx_file_uniq_t              uniq;
+} ngx_http_mmdb_file_t;
+
+
+typedef struct {
+    ngx_str_t                    name;
+    ngx_http_mmdb_file_t         file;
+    ngx_uint_t                   index;
+    ngx_uint_t                   generation;
+    time_t                       reload;
+    time_t                       checked;
+} ngx_http_mmdb_db_t;
+
+
+typedef struct {
+    ngx_http_mmdb_db_t          *db;
+    ngx_str_t                   *keys;
+    ngx_uint_t                   nkeys;
+    ngx_str_t                    default_value;
+} ngx_http_mmdb_var_t;
+
+
+/*
+ * The result of the search tree walk is kept per request for each
+ * database, so all variables taken from one database share a single
+ * lookup.  The generation detects a database reloaded in between.
+ */
+
+typedef struct {
+    ngx_uint_t                   generation;
+    size_t                       offset;
+    unsigned                     done:1;
+    unsigned                     found:1;
+} ngx_http_mmdb_ctx_t;
+
+
+typedef struct {
+    ngx_array_t                  dbs;        /* ngx_http_mmdb_db_t * */
+    ngx_array_t                 *proxies;    /* array of ngx_cidr_t */
+    ngx_cidr_tree_t             *proxies_tree;
+    ngx_flag_t                   proxy_recursive;
+} ngx_http_mmdb_conf_t;
+
+
+static ngx_int_t ngx_http_mmdb_variable(ngx_http_request_t *r,
+    ngx_http_variable_value_t *v, uintptr_t data);
+static ngx_http_mmdb_ctx_t *ngx_http_mmdb_get_ctx(ngx_http_request_t *r,
+    ngx_http_mmdb_db_t *db);
+static ngx_int_t ngx_http_mmdb_lookup(ngx_http_mmdb_file_t *file,
+    ngx_addr_t *addr, size_t *offset);
+static ngx_uint_t ngx_http_mmdb_record(ngx_http_mmdb_file_t *file,
+    ngx_uint_t node, ngx_uint_t bit);
+static ngx_int_t ngx_http_mmdb_decode(ngx_http_mmdb_section_t *s,
+    size_t offset, ngx_http_mmdb_field_t *f);
+static ngx_int_t ngx_http_mmdb_resolve(ngx_http_mmdb_section_t *s,
+    size_t offset, ngx_http_mmdb_field_t *f);
+static ngx_int_t ngx_http_mmdb_skip(ngx_http_mmdb_section_t *s,
+    size_t *offset);
+static ngx_int_t ngx_http_mmdb_find(ngx_http_mmdb_section_t *s,
+    size_t offset, ngx_str_t *keys, ngx_uint_t nkeys,
+    ngx_http_mmdb_field_t *f);
+static ngx_int_t ngx_http_mmdb_uint(ngx_http_mmdb_section_t *s,
+    ngx_http_mmdb_field_t *f, uint64_t *value);
+static ngx_int_t ngx_http_mmdb_value(ngx_http_request_t *r,
+    ngx_http_mmdb_section_t *s, ngx_http_mmdb_field_t *f,
+    ngx_http_variable_value_t *v);
+static void ngx_http_mmdb_check(ngx_http_mmdb_db_t *db);
+static ngx_int_t ngx_http_mmdb_open(ngx_http_mmdb_file_t *file, u_char *name,
+    ngx_log_t *log);
+
+static void *ngx_http_mmdb_create_conf(ngx_conf_t *cf);
+static char *ngx_http_mmdb_init_conf(ngx_conf_t *cf, void *conf);
+static char *ngx_http_mmdb_block(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+static char *ngx_http_mmdb(ngx_conf_t *cf, ngx_command_t *dummy, void *conf);
+static char *ngx_http_mmdb_proxy(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+static void ngx_http_mmdb_cleanup(void *data);
+
+
+static ngx_command_t  ngx_http_mmdb_commands[] = {
+
+    { ngx_string("mmdb"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_BLOCK|NGX_CONF_TAKE1,
+      ngx_http_mmdb_block,
+      NGX_HTTP_MAIN_CONF_OFFSET,
+      0,
+      NULL },
+
+    { ngx_string("mmdb_proxy"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
+      ngx_http_mmdb_proxy,
+      NGX_HTTP_MAIN_CONF_OFFSET,
+      0,
+      NULL },
+
+    { ngx_string("mmdb_proxy_recursive"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_MAIN_CONF_OFFSET,
+      offsetof(ngx_http_mmdb_conf_t, proxy_recursive),
+      NULL },
+
+      ngx_null_command
+};
+
+
+static ngx_http_module_t  ngx_http_mmdb_module_ctx = {
+    NULL,                                  /* preconfiguration */
+    NULL,                                  /* postconfiguration */
+
+    ngx_http_mmdb_create_conf,             /* create main configuration */
+    ngx_http_mmdb_init_conf,               /* init main configuration */
+
+    NULL,                                  /* create server configuration */
+    NULL,                                  /* merge server configuration */
+
+    NULL,                                  /* create location configuration */
+    NULL                                   /* merge location configuration */
+};
+
+
+ngx_module_t  ngx_http_mmdb_module = {
+    NGX_MODULE_V1,
+    &ngx_http_mmdb_module_ctx,             /* module context */
+    ngx_http_mmdb_commands,                /* module directives */
+    NGX_HTTP_MODULE,                       /* module type */
+    NULL,                                  /* init master */
+    NULL,                                  /* init module */
+    NULL,                                  /* init process */
+    NULL,                                  /* init thread */
+    NULL,                                  /* exit thread */
+    NULL,                                  /* exit process */
+    NULL,                                  /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+static u_char  ngx_http_mmdb_marker[] = "\xab\xcd\xef" "MaxMind.com";
+
+
+static ngx_int_t
+ngx_http_mmdb_variable(ngx_http_request_t *r, ngx_http_variable_value_t *v,
+    uintptr_t data)
+{
+    ngx_http_mmdb_var_t *var = (ngx_http_mmdb_var_t *) data;
+
+    ngx_int_t               rc;
+    ngx_http_mmdb_db_t     *db;
+    ngx_http_mmdb_ctx_t    *ctx;
+    ngx_http_mmdb_field_t   f;
+
+    db = var->db;
+
+    ctx = ngx_http_mmdb_get_ctx(r, db);
+    if (ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    if (!ctx->found) {
+        goto not_found;
+    }
+
+    rc = ngx_http_mmdb_find(&db->file.data, ctx->offset, var->keys,
+                            var->nkeys, &f);
+
+    if (rc == NGX_OK) {
+        rc = ngx_http_mmdb_value(r, &db->file.data, &f, v);
+
+        if (rc == NGX_OK) {
+            return NGX_OK;
+        }
+
+        if (rc == NGX_ABORT) {
+            return NGX_ERROR;
+        }
+    }
+
+    if (rc == NGX_ERROR) {
+        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                      "invalid data in mmdb \"%V\"", &db->name);
+    }
+
+not_found:
+
+    if (var->default_value.data == NULL) {
+        v->not_found = 1;
+        return NGX_OK;
+    }
+
+    v->len = var->default_value.len;
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
+    v->data = var->default_value.data;
+
+    return NGX_OK;
+}
+
+
+static ngx_http_mmdb_ctx_t *
+ngx_http_mmdb_get_ctx(ngx_http_request_t *r, ngx_http_mmdb_db_t *db)
+{
+    ngx_int_t              rc;
+    ngx_addr_t             addr;
+    ngx_array_t           *xfwd;
+    ngx_http_mmdb_ctx_t   *ctx;
+    ngx_http_mmdb_conf_t  *mcf;
+
+    mcf = ngx_http_get_module_main_conf(r, ngx_http_mmdb_module);
+
+    ctx = ngx_http_get_module_ctx(r, ngx_http_mmdb_module);
+
+    if (ctx == NULL) {
+        ctx = ngx_pcalloc(r->pool,
+                          mcf->dbs.nelts * sizeof(ngx_http_mmdb_ctx_t));
+        if (ctx == NULL) {
+            return NULL;
+        }
+
+        ngx_http_set_ctx(r, ctx, ngx_http_mmdb_module);
+    }
+
+    ctx = &ctx[db->index];
+
+    if (!ctx->done) {
+        ngx_http_mmdb_check(db);
+
+    } else if (ctx->generation == db->generation) {
+        return ctx;
+    }
+
+    addr.sockaddr = r->connection->sockaddr;
+    addr.socklen = r->connection->socklen;
+    /* addr.name = r->connection->addr_text; */
+
+    xfwd = &r->headers_in.x_forwarded_for;
+
+    if (xfwd->nelts > 0 && mcf->proxies_tree != NULL) {
+        (void) ngx_http_get_forwarded_addr(r, &addr, xfwd, NULL,
+                                           mcf->proxies_tree,
+                                           mcf->proxy_recursive);
+    }
+
+    rc = ngx_http_mmdb_lookup(&db->file, &addr, &ctx->offset);
+
+    if (rc == NGX_ERROR) {
+        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                      "invalid search tree in mmdb \"%V\"", &db->name);
+    }
+
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "mmdb \"%V\" lookup: %i %uz",
+                   &db->name, rc, ctx->offset);
+
+    ctx->found = (rc == NGX_OK);
+    ctx->done = 1;
+    ctx->generation = db->generation;
+
+    return ctx;
+}
+
+
+static ngx_int_t
+ngx_http_mmdb_lookup(ngx_http_mmdb_file_t *file, ngx_addr_t *addr,
+    size_t *offset)
+{
+    u_char               *p;
+    ngx_uint_t            i, bits, node;
+    struct sockaddr_in   *sin;
+#if (NGX_HAVE_INET6)
+    struct sockaddr_in6  *sin6;
+#endif
+
+    switch (addr->sockaddr->sa_family) {
+
+#if (NGX_HAVE_INET6)
+    case AF_INET6:
+        sin6 = (struct sockaddr_in6 *) addr->sockaddr;
+        p = sin6->sin6_addr.s6_addr;
+
+        if (IN6_IS_ADDR_V4MAPPED(&sin6->sin6_addr)) {
+            p += 12;
+            bits = 32;
+
+        } else {
+            bits = 128;
+        }
+
+        break;
+#endif
+
+    case AF_INET:
+        sin = (struct sockaddr_in *) addr->sockaddr;
+        p = (u_char *) &sin->sin_addr.s_addr;
+        bits = 32;
+        break;
+
+    default: /* AF_UNIX */
+        return NGX_DECLINED;
+    }
+
+    if (bits == 32) {
+        node = file->ipv4_start;
+
+    } else if (file->ip_version == 6) {
+        node = 0;
+
+    } else {
+        return NGX_DECLINED;
+    }
+
+    for (i = 0; i < bits && node < file->node_count; i++) {
+        node = ngx_http_mmdb_record(file, node,
+                                    (p[i >> 3] >> (7 - (i & 7))) & 1);
+    }
+
+    if (node < file->node_count) {
+        return NGX_ERROR;
+    }
+
+    if (node == file->node_count) {
+        return NGX_DECLINED;
+    }
+
+    *offset = node - file->node_count - NGX_HTTP_MMDB_SEPARATOR;
+
+    if (*offset >= file->data.size) {
+        return NGX_ERROR;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_uint_t
+ngx_http_mmdb_record(ngx_http_mmdb_file_t *file, ngx_uint_t node,
+    ngx_uint_t bit)
+{
+    u_char  *p;
+
+    switch (file->record_size) {
+
+    case 24:
+        p = file->tree + node * 6 + bit * 3;
+        return ((ngx_uint_t) p[0] << 16) | (p[1] << 8) | p[2];
+
+    case 28:
+        p = file->tree + node * 7;
+
+        if (bit) {
+            return ((ngx_uint_t) (p[3] & 0x0f) << 24)
+                   | ((ngx_uint_t) p[4] << 16) | (p[5] << 8) | p[6];
+        }
+
+        return ((ngx_uint_t) (p[3] & 0xf0) << 20)
+               | ((ngx_uint_t) p[0] << 16) | (p[1] << 8) | p[2];
+
+    default: /* 32 */
+        p = file->tree + node * 8 + bit * 4;
+        return ((ngx_uint_t) p[0] << 24) | ((ngx_uint_t) p[1] << 16)
+               | (p[2] << 8) | p[3];
+    }
+}
+
+
+/*
+ * A field of the data section starts with a control byte holding
+ * the type and the size.  The size of maps and arrays is a number of
+ * entries, and the size of booleans is the value itself, so only other
+ * types have a payload; pointers are returned unresolved.
+ */
+
+static ngx_int_t
+ngx_http_mmdb_decode(ngx_http_mmdb_section_t *s, size_t offset,
+    ngx_http_mmdb_field_t *f)
+{
+    u_char      *p, *last;
+    size_t       size, n;
+    ngx_uint_t   c, type;
+
+    p = s->start + offset;
+    last = s->start + s->size;
+
+    if (offset >= s->size) {
+        return NGX_ERROR;
+    }
+
+    c = *p++;
+    type = c >> 5;
+
+    if (type == NGX_HTTP_MMDB_POINTER) {
+        n = ((c >> 3) & 3) + 1;
+
+        if ((size_t) (last - p) < n) {
+            return NGX_ERROR;
+        }
+
+        switch (n) {
+
+        case 1:
+            size = ((c & 7) << 8) | p[0];
+            break;
+
+        case 2:
+            size = (((c & 7) << 16) | (p[0] << 8) | p[1]) + 2048;
+            break;
+
+        case 3:
+            size = (((size_t) (c & 7) << 24) | (p[0] << 16) | (p[1] << 8)
+                    | p[2])
+                   + 526336;
+            break;
+
+        default: /* 4 */
+            size = ((size_t) p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+        }
+
+        f->type = NGX_HTTP_MMDB_POINTER;
+        f->size = 0;
+        f->offset = size;
+        f->next = p + n - s->start;
+
+        return NGX_OK;
+    }
+
+    if (type == 0) {
+        if (p == last) {
+            return NGX_ERROR;
+        }
+
+        type = 7 + *p++;
+    }
+
+    size = c & 0x1f;
+
+    if (size >= 29) {
+        n = size - 28;
+
+        if ((size_t) (last - p) < n) {
+            return NGX_ERROR;
+        }
+
+        switch (n) {
+
+        case 1:
+            size = 29 + p[0];
+            break;
+
+        case 2:
+            size = 285 + ((p[0] << 8) | p[1]);
+            break;
+
+        default: /* 3 */
+            size = 65821 + ((p[0] << 16) | (p[1] << 8) | p[2]);
+        }
+
+        p += n;
+    }
+
+    f->type = type;
+    f->size = size;
+    f->offset = p - s->start;
+
+    switch (type) {
+
+    case NGX_HTTP_MMDB_MAP:
+    case NGX_HTTP_MMDB_ARRAY:
+    case NGX_HTTP_MMDB_BOOLEAN:
+        f->next = f->offset;
+        break;
+
+    default:
+        if ((size_t) (last - p) < size) {
+            return NGX_ERROR;
+        }
+
+        f->next = f->offset + size;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_mmdb_resolve(ngx_http_mmdb_section_t *s, size_t offset,
+    ngx_http_mmdb_field_t *f)
+{
+    size_t  next;
+
+    if (ngx_http_mmdb_decode(s, offset, f) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    if (f->type != NGX_HTTP_MMDB_POINTER) {
+        return NGX_OK;
+    }
+
+    next = f->next;
+
+    if (ngx_http_mmdb_decode(s, f->offset, f) != NGX_OK
+        || f->type == NGX_HTTP_MMDB_POINTER)
+    {
+        return NGX_ERROR;
+    }
+
+    f->next = next;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_mmdb_skip(ngx_http_mmdb_section_t *s, size_t *offset)
+{
+    size_t                 n;
+    ngx_http_mmdb_field_t  f;
+
+    for (n = 1; n; n--) {
+
+        if (ngx_http_mmdb_decode(s, *offset, &f) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        if (f.type == NGX_HTTP_MMDB_MAP) {
+            n += 2 * f.size;
+
+        } else if (f.type == NGX_HTTP_MMDB_ARRAY) {
+            n += f.size;
+        }
+
+        *offset = f.next;
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_mmdb_find(ngx_http_mmdb_section_t *s, size_t offset, ngx_str_t *keys,
+    ngx_uint_t nkeys, ngx_http_mmdb_field_t *f)
+{
+    size_t                 n;
+    ngx_int_t              index;
+    ngx_uint_t             i;
+    ngx_http_mmdb_field_t  key;
+
+    for (i = 0; i < nkeys; i++) {
+
+        if (ngx_http_mmdb_resolve(s, offset, f) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        offset = f->offset;
+
+        if (f->type == NGX_HTTP_MMDB_MAP) {
+
+            for (n = f->size; /* void */ ; n--) {
+
+                if (n == 0) {
+                    return NGX_DECLINED;
+                }
+
+                if (ngx_http_mmdb_resolve(s, offset, &key) != NGX_OK
+                    || key.type != NGX_HTTP_MMDB_STRING)
+                {
+                    return NGX_ERROR;
+                }
+
+                offset = key.next;
+
+                if (key.size == keys[i].len
+                    && ngx_memcmp(s->start + key.offset, keys[i].data,
+                                  key.size)
+                       == 0)
+                {
+                    break;
+                }
+
+                if (ngx_http_mmdb_skip(s, &offset) != NGX_OK) {
+                    return NGX_ERROR;
+                }
+            }
+
+            continue;
+        }
+
+        if (f->type == NGX_HTTP_MMDB_ARRAY) {
+
+            index = ngx_atoi(keys[i].data, keys[i].len);
+
+            if (index == NGX_ERROR || (size_t) index >= f->size) {
+                return NGX_DECLINED;
+            }
+
+            while (index--) {
+                if (ngx_http_mmdb_skip(s, &offset) != NGX_OK) {
+                    return NGX_ERROR;
+                }
+            }
+
+            continue;
+        }
+
+        return NGX_DECLINED;
+    }
+
+    return ngx_http_mmdb_resolve(s, offset, f);
+}
+
+
+static ngx_int_t
+ngx_http_mmdb_uint(ngx_http_mmdb_section_t *s, ngx_http_mmdb_field_t *f,
+    uint64_t *value)
+{
+    u_char  *p;
+    size_t   i;
+
+    switch (f->type) {
+
+    case NGX_HTTP_MMDB_UINT16:
+        if (f->size > 2) {
+            return NGX_ERROR;
+        }
+
+        break;
+
+    case NGX_HTTP_MMDB_UINT32:
+    case NGX_HTTP_MMDB_INT32:
+        if (f->size > 4) {
+            return NGX_ERROR;
+        }
+
+        break;
+
+    case NGX_HTTP_MMDB_UINT64:
+        if (f->size > 8) {
+            return NGX_ERROR;
+        }
+
+        break;
+
+    default:
+        return NGX_ERROR;
+    }
+
+    p = s->start + f->offset;
+
+    *value = 0;
+
+    for (i = 0; i < f->size; i++) {
+        *value = (*value << 8) | p[i];
+    }
+
+    return NGX_OK;
+}
+
+
+/*
+ * The value is copied from the mapping, as a reload may unmap
+ * the database while the request still uses the variable.
+ */
+
+static ngx_int_t
+ngx_http_mmdb_value(ngx_http_request_t *r, ngx_http_mmdb_section_t *s,
+    ngx_http_mmdb_field_t *f, ngx_http_variable_value_t *v)
+{
+    u_char    *p;
+    float      fv;
+    double     dv;
+    uint32_t   u32;
+    uint64_t   u64;
+
+    p = s->start + f->offset;
+
+    switch (f->type) {
+
+    case NGX_HTTP_MMDB_STRING:
+    case NGX_HTTP_MMDB_BYTES:
+
+        v->data = ngx_pnalloc(r->pool, f->size);
+        if (v->data == NULL) {
+            return NGX_ABORT;
+        }
+
+        v->len = ngx_cpymem(v->data, p, f->size) - v->data;
+        break;
+
+    case NGX_HTTP_MMDB_DOUBLE:
+
+        if (f->size != 8) {
+            return NGX_ERROR;
+        }
+
+        u64 = ((uint64_t) p[0] << 56) | ((uint64_t) p[1] << 48)
+              | ((uint64_t) p[2] << 40) | ((uint64_t) p[3] << 32)
+              | ((uint64_t) p[4] << 24) | ((uint64_t) p[5] << 16)
+              | ((uint64_t) p[6] << 8) | p[7];
+
+        ngx_memcpy(&dv, &u64, 8);
+
+        v->data = ngx_pnalloc(r->pool, NGX_INT64_LEN + 6);
+        if (v->data == NULL) {
+            return NGX_ABORT;
+        }
+
+        v->len = ngx_sprintf(v->data, "%.4f", dv) - v->data;
+        break;
+
+    case NGX_HTTP_MMDB_FLOAT:
+
+        if (f->size != 4) {
+            return NGX_ERROR;
+        }
+
+        u32 = ((uint32_t) p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+
+        ngx_memcpy(&fv, &u32, 4);
+
+        v->data = ngx_pnalloc(r->pool, NGX_INT64_LEN + 6);
+        if (v->data == NULL) {
+            return NGX_ABORT;
+        }
+
+        v->len = ngx_sprintf(v->data, "%.4f", (double) fv) - v->data;
+        break;
+
+    case NGX_HTTP_MMDB_UINT16:
+    case NGX_HTTP_MMDB_UINT32:
+    case NGX_HTTP_MMDB_UINT64:
+    case NGX_HTTP_MMDB_INT32:
+
+        if (ngx_http_mmdb_uint(s, f, &u64) != NGX_OK) {
+            return NGX_ERROR;
+        }
+
+        v->data = ngx_pnalloc(r->pool, NGX_INT64_LEN);
+        if (v->data == NULL) {
+            return NGX_ABORT;
+        }
+
+        if (f->type == NGX_HTTP_MMDB_INT32) {
+            v->len = ngx_sprintf(v->data, "%D", (int32_t) (uint32_t) u64)
+                     - v->data;
+
+        } else {
+            v->len = ngx_sprintf(v->data, "%uL", u64) - v->data;
+        }
+
+        break;
+
+    case NGX_HTTP_MMDB_UINT128:
+
+        if (f->size > 16) {
+            return NGX_ERROR;
+        }
+
+        v->data = ngx_pnalloc(r->pool, sizeof("0x") - 1 + 2 * 16 + 1);
+        if (v->data == NULL) {
+            return NGX_ABORT;
+        }
+
+        v->len = ngx_hex_dump(ngx_cpymem(v->data, "0x", 2), p, f->size)
+                 - v->data;
+
+        if (f->size == 0) {
+            v->data[v->len++] = '0';
+        }
+
+        break;
+
+    case NGX_HTTP_MMDB_BOOLEAN:
+
+        v->data = (u_char *) (f->size ? "1" : "0");
+        v->len = 1;
+        break;
+
+    default:
+        return NGX_DECLINED;
+    }
+
+    v->valid = 1;
+    v->no_cacheable = 0;
+    v->not_found = 0;
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_mmdb_check(ngx_http_mmdb_db_t *db)
+{
+    time_t                now;
+    ngx_file_info_t       fi;
+    ngx_http_mmdb_file_t  file;
+
+    if (db->reload == 0) {
+        return;
+    }
+
+    now = ngx_time();
+
+    if (now - db->checked < db->reload) {
+        return;
+    }
+
+    db->checked = now;
+
+    if (ngx_file_info(db->name.data, &fi) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ERR, ngx_cycle->log, ngx_errno,
+                      ngx_file_info_n " \"%s\" failed", db->name.data);
+        return;
+    }
+
+    if (ngx_file_uniq(&fi) == db->file.uniq
+        && ngx_file_mtime(&fi) == db->file.mtime
+        && (size_t) ngx_file_size(&fi) == db->file.fm.size)
+    {
+        return;
+    }
+
+    if (ngx_http_mmdb_open(&file, db->name.data, ngx_cycle->log) != NGX_OK) {
+        return;
+    }
+
+    ngx_close_file_mapping(&db->file.fm);
+
+    db->file = file;
+    db->generation++;
+
+    ngx_log_error(NGX_LOG_NOTICE, ngx_cycle->log, 0,
+                  "mmdb \"%s\" reloaded", db->name.data);
+}
+
+
+static ngx_int_t
+ngx_http_mmdb_open(ngx_http_mmdb_file_t *file, u_char *name, ngx_log_t *log)
+{
+    u_char                   *p, *start, *last;
+    size_t                    size;
+    uint64_t                  n;
+    ngx_uint_t                i;
+    ngx_str_t                 key;
+    ngx_file_info_t           fi;
+    ngx_http_mmdb_field_t     f;
+    ngx_http_mmdb_section_t   meta;
+
+    ngx_memzero(file, sizeof(ngx_http_mmdb_file_t));
+
+    file->fm.name = name;
+    file->fm.log = log;
+
+    if (ngx_open_file_mapping(&file->fm) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    if (ngx_fd_info(file->fm.fd, &fi) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, log, ngx_errno,
+                      ngx_fd_info_n " \"%s\" failed", name);
+        goto failed;
+    }
+
+    file->mtime = ngx_file_mtime(&fi);
+    file->uniq = ngx_file_uniq(&fi);
+
+    /* the metadata follow the last marker within the end of the file */
+
+    start = file->fm.addr;
+    last = start + file->fm.size;
+    size = sizeof(ngx_http_mmdb_marker) - 1;
+
+    if (file->fm.size < size) {
+        goto invalid;
+    }
+
+    p = last - size;
+
+    for ( ;; ) {
+        if (ngx_memcmp(p, ngx_http_mmdb_marker, size) == 0) {
+            break;
+        }
+
+        if (p == start || last - p >= NGX_HTTP_MMDB_META_MAX) {
+            goto invalid;
+        }
+
+        p--;
+    }
+
+    meta.start = p + size;
+    meta.size = last - meta.start;
+
+    ngx_str_set(&key, "binary_format_major_version");
+
+    if (ngx_http_mmdb_find(&meta, 0, &key, 1, &f) != NGX_OK
+        || ngx_http_mmdb_uint(&meta, &f, &n) != NGX_OK
+        || n != 2)
+    {
+        goto invalid;
+    }
+
+    ngx_str_set(&key, "node_count");
+
+    if (ngx_http_mmdb_find(&meta, 0, &key, 1, &f) != NGX_OK
+        || ngx_http_mmdb_uint(&meta, &f, &n) != NGX_OK
+        || n == 0 || n > 0xffffffff)
+    {
+        goto invalid;
+    }
+
+    file->node_count = (ngx_uint_t) n;
+
+    ngx_str_set(&key, "record_size");
+
+    if (ngx_http_mmdb_find(&meta, 0, &key, 1, &f) != NGX_OK
+        || ngx_http_mmdb_uint(&meta, &f, &n) != NGX_OK
+        || (n != 24 && n != 28 && n != 32))
+    {
+        goto invalid;
+    }
+
+    file->record_size = (ngx_uint_t) n;
+
+    ngx_str_set(&key, "ip_version");
+
+    if (ngx_http_mmdb_find(&meta, 0, &key, 1, &f) != NGX_OK
+        || ngx_http_mmdb_uint(&meta, &f, &n) != NGX_OK
+        || (n != 4 && n != 6))
+    {
+        goto invalid;
+    }
+
+    file->ip_version = (ngx_uint_t) n;
+
+    /* the search tree, a zero separator, and the data section */
+
+    n = (uint64_t) file->node_count * file->record_size / 4;
+
+    if ((uint64_t) (p - start) < n + NGX_HTTP_MMDB_SEPARATOR) {
+        goto invalid;
+    }
+
+    size = (size_t) n;
+
+    file->tree = start;
+    file->data.start = start + size + NGX_HTTP_MMDB_SEPARATOR;
+    file->data.size = p - file->data.start;
+
+    if (file->ip_version == 6) {
+        for (i = 0; i < 96 && file->ipv4_start < file->node_count; i++) {
+            file->ipv4_start = ngx_http_mmdb_record(file, file->ipv4_start, 0);
+        }
+    }
+
+    ngx_str_set(&key, "database_type");
+
+    if (ngx_http_mmdb_find(&meta, 0, &key, 1, &f) == NGX_OK
+        && f.type == NGX_HTTP_MMDB_STRING)
+    {
+        ngx_log_debug6(NGX_LOG_DEBUG_CORE, log, 0,
+                       "mmdb \"%s\": %*s, nodes:%ui, record:%ui, ipv%ui",
+                       name, f.size, meta.start + f.offset,
+                       file->node_count, file->record_size,
+                       file->ip_version);
+    }
+
+    return NGX_OK;
+
+invalid:
+
+    ngx_log_error(NGX_LOG_CRIT, log, 0, "invalid mmdb \"%s\"", name);
+
+failed:
+
+    ngx_close_file_mapping(&file->fm);
+
+    return NGX_ERROR;
+}
+
+
+static void *
+ngx_http_mmdb_create_conf(ngx_conf_t *cf)
+{
+    ngx_http_mmdb_conf_t  *conf;
+
+    conf = ngx_pcalloc(cf->pool, sizeof(ngx_http_mmdb_conf_t));
+    if (conf == NULL) {
+        return NULL;
+    }
+
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     conf->proxies = NULL;
+     *     conf->proxies_tree = NULL;
+     */
+
+    if (ngx_array_init(&conf->dbs, cf->pool, 2, sizeof(ngx_http_mmdb_db_t *))
+        != NGX_OK)
+    {
+        return NULL;
+    }
+
+    conf->proxy_recursive = NGX_CONF_UNSET;
+
+    return conf;
+}
+
+
+static char *
+ngx_http_mmdb_init_conf(ngx_conf_t *cf, void *conf)
+{
+    ngx_http_mmdb_conf_t  *mcf = conf;
+
+    ngx_conf_init_value(mcf->proxy_recursive, 0);
+
+    if (mcf->proxies) {
+        mcf->proxies_tree = ngx_cidr_tree_create(cf->pool, mcf->proxies);
+        if (mcf->proxies_tree == NULL) {
+            return NGX_CONF_ERROR;
+        }
+    }
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_http_mmdb_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_mmdb_conf_t  *mcf = conf;
+
+    char                 *rv;
+    ngx_str_t            *value;
+    ngx_conf_t            save;
+    ngx_pool_cleanup_t   *cln;
+    ngx_http_mmdb_db_t   *db, **dbp;
+
+    value = cf->args->elts;
+
+    db = ngx_pcalloc(cf->pool, sizeof(ngx_http_mmdb_db_t));
+    if (db == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    db->name = value[1];
+
+    if (ngx_conf_full_name(cf->cycle, &db->name, 1) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
+
+    db->index = mcf->dbs.nelts;
+
+    dbp = ngx_array_push(&mcf->dbs);
+    if (dbp == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    *dbp = db;
+
+    if (ngx_http_mmdb_open(&db->file, db->name.data, cf->log) != NGX_OK) {
+        return NGX_CONF_ERROR;
+    }
+
+    cln = ngx_pool_cleanup_add(cf->pool, 0);
+    if (cln == NULL) {
+        ngx_close_file_mapping(&db->file.fm);
+        return NGX_CONF_ERROR;
+    }
+
+    cln->handler = ngx_http_mmdb_cleanup;
+    cln->data = db;
+
+    db->checked = ngx_time();
+
+    save = *cf;
+    cf->handler = ngx_http_mmdb;
+    cf->handler_conf = (void *) db;
+
+    rv = ngx_conf_parse(cf, NULL);
+
+    *cf = save;
+
+    return rv;
+}
+
+
+static char *
+ngx_http_mmdb(ngx_conf_t *cf, ngx_command_t *dummy, void *conf)
+{
+    ngx_http_mmdb_db_t  *db = conf;
+
+    ngx_str_t             *value, name;
+    ngx_uint_t             i, nkeys;
+    ngx_http_variable_t   *v;
+    ngx_http_mmdb_var_t   *var;
+
+    value = cf->args->elts;
+
+    if (cf->args->nelts == 2 && ngx_strcmp(value[0].data, "reload") == 0) {
+
+        if (ngx_strcmp(value[1].data, "off") == 0) {
+            db->reload = 0;
+            return NGX_CONF_OK;
+        }
+
+        db->reload = ngx_parse_time(&value[1], 1);
+
+        if (db->reload == (time_t) NGX_ERROR || db->reload == 0) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "invalid reload interval \"%V\"", &value[1]);
+            return NGX_CONF_ERROR;
+        }
+
+        return NGX_CONF_OK;
+    }
+
+    name = value[0];
+
+    if (name.data[0] != '$' || name.len < 2) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid variable name \"%V\"", &name);
+        return NGX_CONF_ERROR;
+    }
+
+    name.len--;
+    name.data++;
+
+    var = ngx_pcalloc(cf->pool, sizeof(ngx_http_mmdb_var_t));
+    if (var == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    var->db = db;
+
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     var->default_value = { 0, NULL };
+     */
+
+    nkeys = 0;
+
+    for (i = 1; i < cf->args->nelts; i++) {
+
+        if (ngx_strncmp(value[i].data, "default=", 8) == 0) {
+            var->default_value.len = value[i].len - 8;
+            var->default_value.data = value[i].data + 8;
+            continue;
+        }
+
+        if (var->default_value.data) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "invalid parameter \"%V\"", &value[i]);
+            return NGX_CONF_ERROR;
+        }
+
+        nkeys++;
+    }
+
+    if (nkeys == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "no data path for variable \"%V\"", &value[0]);
+        return NGX_CONF_ERROR;
+    }
+
+    var->keys = ngx_palloc(cf->pool, nkeys * sizeof(ngx_str_t));
+    if (var->keys == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    ngx_memcpy(var->keys, &value[1], nkeys * sizeof(ngx_str_t));
+    var->nkeys = nkeys;
+
+    v = ngx_http_add_variable(cf, &name, NGX_HTTP_VAR_CHANGEABLE);
+    if (v == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    v->get_handler = ngx_http_mmdb_variable;
+    v->data = (uintptr_t) var;
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_http_mmdb_proxy(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_mmdb_conf_t  *mcf = conf;
+
+    ngx_int_t    rc;
+    ngx_str_t   *value;
+    ngx_cidr_t  *cidr;
+
+    value = cf->args->elts;
+
+    if (mcf->proxies == NULL) {
+        mcf->proxies = ngx_array_create(cf->pool, 4, sizeof(ngx_cidr_t));
+        if (mcf->proxies == NULL) {
+            return NGX_CONF_ERROR;
+        }
+    }
+
+    cidr = ngx_array_push(mcf->proxies);
+    if (cidr == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    rc = ngx_ptocidr(&value[1], cidr);
+
+    if (rc == NGX_ERROR) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0, "invalid network \"%V\"",
+                           &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    if (rc == NGX_DONE) {
+        ngx_conf_log_error(NGX_LOG_WARN, cf, 0,
+                           "low address bits of %V are meaningless",
+                           &value[1]);
+    }
+
+    return NGX_CONF_OK;
+}
+
+
+static void
+ngx_http_mmdb_cleanup(void *data)
+{
+    ngx_http_mmdb_db_t  *db = data;
+
+    ngx_close_file_mapping(&db->file.fm);
+}
@@ -422,6 +422,13 @@ static ngx_command_t  ngx_http_proxy_commands[] = {
       offsetof(ngx_http_proxy_loc_conf_t, upstream.bufs),
       NULL },
 
+    { ngx_string("proxy_adaptive_buffers"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_FLAG,
+      ngx_conf_set_flag_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_proxy_loc_conf_t, upstream.adaptive_buffers),
+      NULL },
+
     { ngx_string("proxy_busy_buffers_size"),
       NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
       ngx_conf_set_size_slot,
@@ -516,11 +523,11 @@ static ngx_command_t  ngx_http_proxy_commands[] = {
       &ngx_http_upstream_cache_method_mask },
 
     { ngx_string("proxy_cache_lock"),
-      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_FLAG,
-      ngx_conf_set_flag_slot,
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_enum_slot,
       NGX_HTTP_LOC_CONF_OFFSET,
       offsetof(ngx_http_proxy_loc_conf_t, upstream.cache_lock),
-      NULL },
+      &ngx_http_upstream_cache_lock },
 
     { ngx_string("proxy_cache_lock_timeout"),
       NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
@@ -2829,6 +2836,7 @@ ngx_http_proxy_create_loc_conf(ngx_conf_t *cf)
     conf->upstream.next_upstream_tries = NGX_CONF_UNSET_UINT;
     conf->upstream.buffering = NGX_CONF_UNSET;
     conf->upstream.request_buffering = NGX_CONF_UNSET;
+    conf->upstream.adaptive_buffers = NGX_CONF_UNSET;
     conf->upstream.ignore_client_abort = NGX_CONF_UNSET;
     conf->upstream.force_ranges = NGX_CONF_UNSET;
 
@@ -2904,13 +2912,14 @@ ngx_http_proxy_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_http_proxy_loc_conf_t *prev = parent;
     ngx_http_proxy_loc_conf_t *conf = child;
 
-    u_char                     *p;
-    size_t                      size;
-    ngx_int_t                   rc;
-    ngx_hash_init_t             hash;
-    ngx_http_core_loc_conf_t   *clcf;
-    ngx_http_proxy_rewrite_t   *pr;
-    ngx_http_script_compile_t   sc;
+    u_char                         *p;
+    size_t                          size;
+    ngx_int_t                       rc;
+    ngx_hash_init_t                 hash;
+    ngx_http_core_loc_conf_t       *clcf;
+    ngx_http_proxy_rewrite_t       *pr;
+    ngx_http_script_compile_t       sc;
+    ngx_http_upstream_main_conf_t  *umcf;
 
 #if (NGX_HTTP_CACHE)
 
@@ -2944,6 +2953,9 @@ ngx_http_proxy_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_conf_merge_value(conf->upstream.request_buffering,
                               prev->upstream.request_buffering, 1);
 
+    ngx_conf_merge_value(conf->upstream.adaptive_buffers,
+                              prev->upstream.adaptive_buffers, 0);
+
     ngx_conf_merge_value(conf->upstream.ignore_client_abort,
                               prev->upstream.ignore_client_abort, 0);
 
@@ -2984,6 +2996,18 @@ ngx_http_proxy_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
         return NGX_CONF_ERROR;
     }
 
+    umcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_upstream_module);
+
+    if (umcf->buffers_arena
+        && conf->upstream.bufs.size > umcf->buffers_arena->max_size)
+    {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+             "\"upstream_buffers_arena\" must be equal to or greater "
+             "than one of the \"proxy_buffers\"");
+
+        return NGX_CONF_ERROR;
+    }
+
 
     size = conf->upstream.buffer_size;
     if (size < conf->upstream.bufs.size) {
@@ -56,6 +56,10 @@ typedef struct {
     off_t        offset;
     ngx_str_t    boundary_header;
     ngx_array_t  ranges;
+    ngx_uint_t   index;
+
+    unsigned     ordered:1;
+    unsigned     stream:1;
 } ngx_http_range_filter_ctx_t;
 
 
@@ -72,6 +76,12 @@ static ngx_int_t ngx_http_range_singlepart_body(ngx_http_request_t *r,
     ngx_http_range_filter_ctx_t *ctx, ngx_chain_t *in);
 static ngx_int_t ngx_http_range_multipart_body(ngx_http_request_t *r,
     ngx_http_range_filter_ctx_t *ctx, ngx_chain_t *in);
+static ngx_int_t ngx_http_range_multipart_stream(ngx_http_request_t *r,
+    ngx_http_range_filter_ctx_t *ctx, ngx_chain_t *in);
+static ngx_chain_t *ngx_http_range_boundary(ngx_http_request_t *r,
+    ngx_http_range_filter_ctx_t *ctx, ngx_http_range_t *range);
+static ngx_chain_t *ngx_http_range_last_boundary(ngx_http_request_t *r,
+    ngx_http_range_filter_ctx_t *ctx);
 
 static ngx_int_t ngx_http_range_header_filter_init(ngx_conf_t *cf);
 static ngx_int_t ngx_http_range_body_filter_init(ngx_conf_t *cf);
@@ -272,7 +282,7 @@ ngx_http_range_parse(ngx_http_request_t *r, ngx_http_range_filter_ctx_t *ctx,
     u_char                       *p;
     off_t                         start, end, size, content_length, cutoff,
                                   cutlim;
-    ngx_uint_t                    suffix;
+    ngx_uint_t                    i, suffix;
     ngx_http_range_t             *range;
     ngx_http_range_filter_ctx_t  *mctx;
 
@@ -281,6 +291,7 @@ ngx_http_range_parse(ngx_http_request_t *r, ngx_http_range_filter_ctx_t *ctx,
                                        ngx_http_range_body_filter_module);
         if (mctx) {
             ctx->ranges = mctx->ranges;
+            ctx->ordered = mctx->ordered;
             return NGX_OK;
         }
     }
@@ -404,6 +415,20 @@ ngx_http_range_parse(ngx_http_request_t *r, ngx_http_range_filter_ctx_t *ctx,
         return NGX_DECLINED;
     }
 
+    range = ctx->ranges.elts;
+
+    for (i = 1; i < ctx->ranges.nelts; i++) {
+        if (range[i].start < range[i - 1].end) {
+            break;
+        }
+    }
+
+    ctx->ordered = (i >= ctx->ranges.nelts);
+
+    if (r->ordered_ranges && !ctx->ordered) {
+        return NGX_DECLINED;
+    }
+
     return NGX_OK;
 }
 
@@ -639,19 +664,32 @@ ngx_http_range_body_filter(ngx_http_request_t *r, ngx_chain_t *in)
         return ngx_http_range_singlepart_body(r, ctx, in);
     }
 
+    if (ctx->stream) {
+        return ngx_http_range_multipart_stream(r, ctx, in);
+    }
+
     /*
-     * multipart ranges are supported only if whole body is in a single buffer
+     * multipart ranges in arbitrary order are supported only if whole body
+     * is in a single buffer, ranges in ascending order are sent as the body
+     * buffers pass through
      */
 
     if (ngx_buf_special(in->buf)) {
         return ngx_http_next_body_filter(r, in);
     }
 
-    if (ngx_http_range_test_overlapped(r, ctx, in) != NGX_OK) {
+    switch (ngx_http_range_test_overlapped(r, ctx, in)) {
+
+    case NGX_OK:
+        return ngx_http_range_multipart_body(r, ctx, in);
+
+    case NGX_DECLINED:
+        ctx->stream = 1;
+        return ngx_http_range_multipart_stream(r, ctx, in);
+
+    default: /* NGX_ERROR */
         return NGX_ERROR;
     }
-
-    return ngx_http_range_multipart_body(r, ctx, in);
 }
 
 
@@ -677,6 +715,11 @@ ngx_http_range_test_overlapped(ngx_http_request_t *r,
         range = ctx->ranges.elts;
         for (i = 0; i < ctx->ranges.nelts; i++) {
             if (start > range[i].start || last < range[i].end) {
+
+                if (ctx->ordered) {
+                    return NGX_DECLINED;
+                }
+
                 goto overlapped;
             }
         }
@@ -788,7 +831,7 @@ ngx_http_range_multipart_body(ngx_http_request_t *r,
 {
     ngx_buf_t         *b, *buf;
     ngx_uint_t         i;
-    ngx_chain_t       *out, *hcl, *rcl, *dcl, **ll;
+    ngx_chain_t       *out, *hcl, *dcl, **ll;
     ngx_http_range_t  *range;
 
     ll = &out;
@@ -797,50 +840,11 @@ ngx_http_range_multipart_body(ngx_http_request_t *r,
 
     for (i = 0; i < ctx->ranges.nelts; i++) {
 
-        /*
-         * The boundary header of the range:
-         * CRLF
-         * "--0123456789" CRLF
-         * "Content-Type: image/jpeg" CRLF
-         * "Content-Range: bytes "
-         */
-
-        b = ngx_calloc_buf(r->pool);
-        if (b == NULL) {
-            return NGX_ERROR;
-        }
-
-        b->memory = 1;
-        b->pos = ctx->boundary_header.data;
-        b->last = ctx->boundary_header.data + ctx->boundary_header.len;
-
-        hcl = ngx_alloc_chain_link(r->pool);
+        hcl = ngx_http_range_boundary(r, ctx, &range[i]);
         if (hcl == NULL) {
             return NGX_ERROR;
         }
 
-        hcl->buf = b;
-
-
-        /* "SSSS-EEEE/TTTT" CRLF CRLF */
-
-        b = ngx_calloc_buf(r->pool);
-        if (b == NULL) {
-            return NGX_ERROR;
-        }
-
-        b->temporary = 1;
-        b->pos = range[i].content_range.data;
-        b->last = range[i].content_range.data + range[i].content_range.len;
-
-        rcl = ngx_alloc_chain_link(r->pool);
-        if (rcl == NULL) {
-            return NGX_ERROR;
-        }
-
-        rcl->buf = b;
-
-
         /* the range data */
 
         b = ngx_calloc_buf(r->pool);
@@ -872,25 +876,269 @@ ngx_http_range_multipart_body(ngx_http_request_t *r,
         dcl->buf = b;
 
         *ll = hcl;
-        hcl->next = rcl;
-        rcl->next = dcl;
+        hcl->next->next = dcl;
         ll = &dcl->next;
     }
 
+    hcl = ngx_http_range_last_boundary(r, ctx);
+    if (hcl == NULL) {
+        return NGX_ERROR;
+    }
+
+    *ll = hcl;
+
+    return ngx_http_next_body_filter(r, out);
+}
+
+
+static ngx_int_t
+ngx_http_range_multipart_stream(ngx_http_request_t *r,
+    ngx_http_range_filter_ctx_t *ctx, ngx_chain_t *in)
+{
+    off_t              start, last, from, to;
+    ngx_buf_t         *b, *buf;
+    ngx_uint_t         i, end;
+    ngx_chain_t       *out, *cl, *hcl, *dcl, *next, **ll;
+    ngx_http_range_t  *range;
+
+    out = NULL;
+    ll = &out;
+    range = ctx->ranges.elts;
+
+    for (cl = in; cl; cl = next) {
+
+        next = cl->next;
+        buf = cl->buf;
+
+        start = ctx->offset;
+        last = ctx->offset + ngx_buf_size(buf);
+
+        ctx->offset = last;
+
+        /* a subrequest body ends with last_in_chain instead of last_buf */
+
+        end = buf->last_buf || (r != r->main && buf->last_in_chain);
+
+        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "http range multipart buf: %O-%O", start, last);
+
+        if (ngx_buf_special(buf)) {
+
+            if (end) {
+                goto last_boundary;
+            }
+
+            *ll = cl;
+            ll = &cl->next;
+            continue;
+        }
+
+        dcl = NULL;
+
+        for (i = ctx->index; i < ctx->ranges.nelts; i++) {
+
+            if (range[i].start >= last) {
+                break;
+            }
+
+            from = ngx_max(range[i].start, start);
+            to = ngx_min(range[i].end, last);
+
+            if (from == range[i].start) {
+                hcl = ngx_http_range_boundary(r, ctx, &range[i]);
+                if (hcl == NULL) {
+                    return NGX_ERROR;
+                }
+
+                *ll = hcl;
+                ll = &hcl->next->next;
+            }
+
+            if (to == last
+                || i + 1 == ctx->ranges.nelts
+                || range[i + 1].start >= last)
+            {
+                /*
+                 * the last part of the buffer is sent in the buffer itself,
+                 * so the buffer is not reused by its owner before the parts
+                 * preceding it are sent
+                 */
+
+                if (buf->in_file) {
+                    buf->file_last = buf->file_pos + (to - start);
+                    buf->file_pos += from - start;
+                }
+
+                if (ngx_buf_in_memory(buf)) {
+                    buf->last = buf->pos + (size_t) (to - start);
+                    buf->pos += (size_t) (from - start);
+                }
+
+                dcl = cl;
+
+            } else {
+
+                b = ngx_calloc_buf(r->pool);
+                if (b == NULL) {
+                    return NGX_ERROR;
+                }
+
+                b->in_file = buf->in_file;
+                b->temporary = buf->temporary;
+                b->memory = buf->memory;
+                b->mmap = buf->mmap;
+                b->file = buf->file;
+
+                if (buf->in_file) {
+                    b->file_pos = buf->file_pos + (from - start);
+                    b->file_last = buf->file_pos + (to - start);
+                }
+
+                if (ngx_buf_in_memory(buf)) {
+                    b->pos = buf->pos + (size_t) (from - start);
+                    b->last = buf->pos + (size_t) (to - start);
+                }
+
+                dcl = ngx_alloc_chain_link(r->pool);
+                if (dcl == NULL) {
+                    return NGX_ERROR;
+                }
+
+                dcl->buf = b;
+            }
+
+            *ll = dcl;
+            ll = &dcl->next;
+
+            if (range[i].end > last) {
+                break;
+            }
+
+            ctx->index = i + 1;
+        }
+
+        if (dcl != cl) {
+
+            ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                           "http range body skip");
+
+            if (buf->in_file) {
+                buf->file_pos = buf->file_last;
+            }
+
+            buf->pos = buf->last;
+            buf->sync = 1;
+        }
+
+        if (!end) {
+            continue;
+        }
+
+        buf->last_buf = 0;
+        buf->last_in_chain = 0;
+
+    last_boundary:
+
+        hcl = ngx_http_range_last_boundary(r, ctx);
+        if (hcl == NULL) {
+            return NGX_ERROR;
+        }
+
+        *ll = hcl;
+        ll = &hcl->next;
+
+        break;
+    }
+
+    *ll = NULL;
+
+    if (out == NULL) {
+        return NGX_OK;
+    }
+
+    return ngx_http_next_body_filter(r, out);
+}
+
+
+static ngx_chain_t *
+ngx_http_range_boundary(ngx_http_request_t *r,
+    ngx_http_range_filter_ctx_t *ctx, ngx_http_range_t *range)
+{
+    ngx_buf_t    *b;
+    ngx_chain_t  *hcl, *rcl;
+
+    /*
+     * The boundary header of the range:
+     * CRLF
+     * "--0123456789" CRLF
+     * "Content-Type: image/jpeg" CRLF
+     * "Content-Range: bytes "
+     */
+
+    b = ngx_calloc_buf(r->pool);
+    if (b == NULL) {
+        return NULL;
+    }
+
+    b->memory = 1;
+    b->pos = ctx->boundary_header.data;
+    b->last = ctx->boundary_header.data + ctx->boundary_header.len;
+
+    hcl = ngx_alloc_chain_link(r->pool);
+    if (hcl == NULL) {
+        return NULL;
+    }
+
+    hcl->buf = b;
+
+
+    /* "SSSS-EEEE/TTTT" CRLF CRLF */
+
+    b = ngx_calloc_buf(r->pool);
+    if (b == NULL) {
+        return NULL;
+    }
+
+    b->temporary = 1;
+    b->pos = range->content_range.data;
+    b->last = range->content_range.data + range->content_range.len;
+
+    rcl = ngx_alloc_chain_link(r->pool);
+    if (rcl == NULL) {
+        return NULL;
+    }
+
+    rcl->buf = b;
+    rcl->next = NULL;
+
+    hcl->next = rcl;
+
+    return hcl;
+}
+
+
+static ngx_chain_t *
+ngx_http_range_last_boundary(ngx_http_request_t *r,
+    ngx_http_range_filter_ctx_t *ctx)
+{
+    ngx_buf_t    *b;
+    ngx_chain_t  *cl;
+
     /* the last boundary CRLF "--0123456789--" CRLF  */
 
     b = ngx_calloc_buf(r->pool);
     if (b == NULL) {
-        return NGX_ERROR;
+        return NULL;
     }
 
     b->temporary = 1;
-    b->last_buf = 1;
+    b->last_buf = (r == r->main) ? 1 : 0;
+    b->last_in_chain = 1;
 
     b->pos = ngx_pnalloc(r->pool, sizeof(CRLF "--") - 1 + NGX_ATOMIC_T_LEN
                                   + sizeof("--" CRLF) - 1);
     if (b->pos == NULL) {
-        return NGX_ERROR;
+        return NULL;
     }
 
     b->last = ngx_cpymem(b->pos, ctx->boundary_header.data,
@@ -898,17 +1146,15 @@ ngx_http_range_multipart_body(ngx_http_request_t *r,
     *b->last++ = '-'; *b->last++ = '-';
     *b->last++ = CR; *b->last++ = LF;
 
-    hcl = ngx_alloc_chain_link(r->pool);
-    if (hcl == NULL) {
-        return NGX_ERROR;
+    cl = ngx_alloc_chain_link(r->pool);
+    if (cl == NULL) {
+        return NULL;
     }
 
-    hcl->buf = b;
-    hcl->next = NULL;
-
-    *ll = hcl;
+    cl->buf = b;
+    cl->next = NULL;
 
-    return ngx_http_next_body_filter(r, out);
+    return cl;
 }
 
 
@@ -18,6 +18,7 @@
 
 typedef struct {
     ngx_array_t       *from;     /* array of ngx_cidr_t */
+    ngx_cidr_tree_t   *from_tree;
     ngx_uint_t         type;
     ngx_uint_t         hash;
     ngx_str_t          header;
@@ -233,7 +234,7 @@ found:
     addr.socklen = c->socklen;
     /* addr.name = c->addr_text; */
 
-    if (ngx_http_get_forwarded_addr(r, &addr, xfwd, value, rlcf->from,
+    if (ngx_http_get_forwarded_addr(r, &addr, xfwd, value, rlcf->from_tree,
                                     rlcf->recursive)
         != NGX_DECLINED)
     {
@@ -465,6 +466,7 @@ ngx_http_realip_create_loc_conf(ngx_conf_t *cf)
      * set by ngx_pcalloc():
      *
      *     conf->from = NULL;
+     *     conf->from_tree = NULL;
      *     conf->hash = 0;
      *     conf->header = { 0, NULL };
      */
@@ -483,7 +485,24 @@ ngx_http_realip_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_http_realip_loc_conf_t  *conf = child;
 
     if (conf->from == NULL) {
+
+        /* the main level is not merged, so its tree is built here */
+
+        if (prev->from && prev->from_tree == NULL) {
+            prev->from_tree = ngx_cidr_tree_create(cf->pool, prev->from);
+            if (prev->from_tree == NULL) {
+                return NGX_CONF_ERROR;
+            }
+        }
+
         conf->from = prev->from;
+        conf->from_tree = prev->from_tree;
+
+    } else if (conf->from_tree == NULL) {
+        conf->from_tree = ngx_cidr_tree_create(cf->pool, conf->from);
+        if (conf->from_tree == NULL) {
+            return NGX_CONF_ERROR;
+        }
     }
 
     ngx_conf_merge_uint_value(conf->type, prev->type, NGX_HTTP_REALIP_XREALIP);
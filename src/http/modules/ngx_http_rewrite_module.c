@@ -968,9 +968,13 @@ static char *
 ngx_http_rewrite_value(ngx_conf_t *cf, ngx_http_rewrite_loc_conf_t *lcf,
     ngx_str_t *value)
 {
-    ngx_int_t                              n;
+    u_char                                *start;
+    ngx_int_t                              n, rc;
+    ngx_uint_t                             offset, nparts;
+    ngx_http_script_part_t                *parts;
     ngx_http_script_compile_t              sc;
     ngx_http_script_value_code_t          *val;
+    ngx_http_script_parts_code_t          *code;
     ngx_http_script_complex_value_code_t  *complex;
 
     n = ngx_http_script_variables_count(value);
@@ -1002,6 +1006,8 @@ ngx_http_rewrite_value(ngx_conf_t *cf, ngx_http_rewrite_loc_conf_t *lcf,
         return NGX_CONF_ERROR;
     }
 
+    offset = (u_char *) complex - (u_char *) lcf->codes->elts;
+
     complex->code = ngx_http_script_complex_value_code;
     complex->lengths = NULL;
 
@@ -1018,5 +1024,37 @@ ngx_http_rewrite_value(ngx_conf_t *cf, ngx_http_rewrite_loc_conf_t *lcf,
         return NGX_CONF_ERROR;
     }
 
+    /*
+     * replace the complex value code and the value codes following it
+     * by a single code if the value has constants, variables and captures
+     */
+
+    start = (u_char *) lcf->codes->elts + offset
+            + sizeof(ngx_http_script_complex_value_code_t);
+
+    rc = ngx_http_script_compile_parts(cf, start,
+                               (u_char *) lcf->codes->elts + lcf->codes->nelts,
+                               &parts, &nparts);
+
+    if (rc == NGX_ERROR) {
+        return NGX_CONF_ERROR;
+    }
+
+    if (rc == NGX_DECLINED) {
+        return NGX_CONF_OK;
+    }
+
+    lcf->codes->nelts = offset;
+
+    code = ngx_http_script_start_code(cf->pool, &lcf->codes,
+                                      sizeof(ngx_http_script_parts_code_t));
+    if (code == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    code->code = ngx_http_script_parts_code;
+    code->parts = parts;
+    code->nparts = nparts;
+
     return NGX_CONF_OK;
 }
@@ -10,10 +10,105 @@
 #include <ngx_http.h>
 
 
+/* the time a request may take to fill an entry for others to wait */
+#define NGX_HTTP_STATIC_CACHE_FILL_TIME  5
+
+
+typedef struct {
+    u_char                          color;
+    u_char                          dummy;
+    u_short                         len;
+    ngx_queue_t                     queue;
+    ngx_file_uniq_t                 uniq;
+    time_t                          mtime;
+    time_t                          valid;
+    time_t                          updating;
+    size_t                          size;
+    ngx_vaddr_t                     conf;
+    ngx_uint_t                      generation;
+    u_short                         etag_len;
+    u_short                         type_len;
+    unsigned                        uncacheable:1;
+
+    /* the path, ETag, Content-Type, and the body */
+    u_char                          data[1];
+} ngx_http_static_cache_node_t;
+
+
+typedef struct {
+    ngx_rbtree_t                    rbtree;
+    ngx_rbtree_node_t               sentinel;
+    ngx_queue_t                     queue;
+    ngx_uint_t                      generation;
+} ngx_http_static_cache_shctx_t;
+
+
+typedef struct {
+    ngx_http_static_cache_shctx_t  *sh;
+    ngx_slab_pool_t                *shpool;
+    size_t                          max_size;
+    time_t                          valid;
+    ngx_uint_t                      generation;
+} ngx_http_static_cache_t;
+
+
+typedef struct {
+    ngx_shm_zone_t                 *shm_zone;
+} ngx_http_static_loc_conf_t;
+
+
 static ngx_int_t ngx_http_static_handler(ngx_http_request_t *r);
+static ngx_int_t ngx_http_static_cache_send(ngx_http_request_t *r,
+    ngx_http_static_cache_t *cache, ngx_str_t *path, uint32_t hash,
+    ngx_uint_t *fill);
+static ngx_http_static_cache_node_t *ngx_http_static_cache_lookup(
+    ngx_http_static_cache_t *cache, ngx_str_t *path, uint32_t hash);
+static ngx_int_t ngx_http_static_cache_revalidate(ngx_http_request_t *r,
+    ngx_http_static_cache_t *cache, ngx_str_t *path, uint32_t hash,
+    ngx_open_file_info_t *of);
+static void ngx_http_static_cache_insert(ngx_http_request_t *r,
+    ngx_http_static_cache_t *cache, ngx_str_t *path, uint32_t hash,
+    ngx_open_file_info_t *of, u_char *data);
+static void ngx_http_static_cache_delete(ngx_http_static_cache_t *cache,
+    ngx_str_t *path, uint32_t hash);
+static ngx_rbtree_node_t *ngx_http_static_cache_alloc(
+    ngx_http_static_cache_t *cache, size_t size);
+static void ngx_http_static_cache_free(ngx_http_static_cache_t *cache,
+    ngx_http_static_cache_node_t *sn);
+static void ngx_http_static_cache_rbtree_insert_value(ngx_rbtree_node_t *temp,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel);
+static ngx_int_t ngx_http_static_cache_init_zone(ngx_shm_zone_t *shm_zone,
+    void *data);
+static void *ngx_http_static_create_loc_conf(ngx_conf_t *cf);
+static char *ngx_http_static_merge_loc_conf(ngx_conf_t *cf, void *parent,
+    void *child);
+static char *ngx_http_static_cache_zone(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+static char *ngx_http_static_cache(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
 static ngx_int_t ngx_http_static_init(ngx_conf_t *cf);
 
 
+static ngx_command_t  ngx_http_static_commands[] = {
+
+    { ngx_string("static_cache_zone"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_1MORE,
+      ngx_http_static_cache_zone,
+      0,
+      0,
+      NULL },
+
+    { ngx_string("static_cache"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_http_static_cache,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      0,
+      NULL },
+
+      ngx_null_command
+};
+
+
 static ngx_http_module_t  ngx_http_static_module_ctx = {
     NULL,                                  /* preconfiguration */
     ngx_http_static_init,                  /* postconfiguration */
@@ -24,15 +119,15 @@ static ngx_http_module_t  ngx_http_static_module_ctx = {
     NULL,                                  /* create server configuration */
     NULL,                                  /* merge server configuration */
 
-    NULL,                                  /* create location configuration */
-    NULL                                   /* merge location configuration */
+    ngx_http_static_create_loc_conf,       /* create location configuration */
+    ngx_http_static_merge_loc_conf         /* merge location configuration */
 };
 
 
 ngx_module_t  ngx_http_static_module = {
     NGX_MODULE_V1,
     &ngx_http_static_module_ctx,           /* module context */
-    NULL,                                  /* module directives */
+    ngx_http_static_commands,              /* module directives */
     NGX_HTTP_MODULE,                       /* module type */
     NULL,                                  /* init master */
     NULL,                                  /* init module */
@@ -48,16 +143,21 @@ ngx_module_t  ngx_http_static_module = {
 static ngx_int_t
 ngx_http_static_handler(ngx_http_request_t *r)
 {
-    u_char                    *last, *location;
-    size_t                     root, len;
-    ngx_str_t                  path;
-    ngx_int_t                  rc;
-    ngx_uint_t                 level;
-    ngx_log_t                 *log;
-    ngx_buf_t                 *b;
-    ngx_chain_t                out;
-    ngx_open_file_info_t       of;
-    ngx_http_core_loc_conf_t  *clcf;
+    u_char                      *last, *location;
+    size_t                       root, len;
+    ssize_t                      n;
+    uint32_t                     hash;
+    ngx_str_t                    path;
+    ngx_int_t                    rc;
+    ngx_uint_t                   level, fill;
+    ngx_log_t                   *log;
+    ngx_buf_t                   *b, *cached;
+    ngx_file_t                   file;
+    ngx_chain_t                  out;
+    ngx_open_file_info_t         of;
+    ngx_http_static_cache_t     *cache;
+    ngx_http_core_loc_conf_t    *clcf;
+    ngx_http_static_loc_conf_t  *slcf;
 
     if (!(r->method & (NGX_HTTP_GET|NGX_HTTP_HEAD|NGX_HTTP_POST))) {
         return NGX_HTTP_NOT_ALLOWED;
@@ -84,6 +184,25 @@ ngx_http_static_handler(ngx_http_request_t *r)
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, log, 0,
                    "http filename: \"%s\"", path.data);
 
+    slcf = ngx_http_get_module_loc_conf(r, ngx_http_static_module);
+
+    fill = 0;
+
+    if (slcf->shm_zone) {
+        cache = slcf->shm_zone->data;
+        hash = ngx_crc32_short(path.data, path.len);
+
+        rc = ngx_http_static_cache_send(r, cache, &path, hash, &fill);
+
+        if (rc != NGX_DECLINED) {
+            return rc;
+        }
+
+    } else {
+        cache = NULL;
+        hash = 0;
+    }
+
     clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
 
     ngx_memzero(&of, sizeof(ngx_open_file_info_t));
@@ -137,6 +256,10 @@ ngx_http_static_handler(ngx_http_request_t *r)
                           "%s \"%s\" failed", of.failed, path.data);
         }
 
+        if (fill) {
+            ngx_http_static_cache_delete(cache, &path, hash);
+        }
+
         return rc;
     }
 
@@ -144,6 +267,10 @@ ngx_http_static_handler(ngx_http_request_t *r)
 
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, log, 0, "http static fd: %d", of.fd);
 
+    if (fill && !of.is_file) {
+        ngx_http_static_cache_delete(cache, &path, hash);
+    }
+
     if (of.is_dir) {
 
         ngx_log_debug0(NGX_LOG_DEBUG_HTTP, log, 0, "http dir");
@@ -208,6 +335,10 @@ ngx_http_static_handler(ngx_http_request_t *r)
 
     rc = ngx_http_discard_request_body(r);
 
+    if (rc != NGX_OK && fill) {
+        ngx_http_static_cache_delete(cache, &path, hash);
+    }
+
     if (rc != NGX_OK) {
         return rc;
     }
@@ -226,12 +357,74 @@ ngx_http_static_handler(ngx_http_request_t *r)
         return NGX_HTTP_INTERNAL_SERVER_ERROR;
     }
 
+    /*
+     * a small file is read to the cache, and sent from memory; a file
+     * which is not to be cached is remembered as such for a while, and
+     * an entry of an unchanged file is revalidated without reading it
+     */
+
+    cached = NULL;
+
+    if (fill) {
+
+        if (r->header_only
+            || of.size == 0
+            || (size_t) of.size > cache->max_size
+            || of.is_directio)
+        {
+            ngx_http_static_cache_insert(r, cache, &path, hash, &of, NULL);
+
+        } else if (ngx_http_static_cache_revalidate(r, cache, &path, hash, &of)
+                   != NGX_OK)
+        {
+            cached = ngx_create_temp_buf(r->pool, of.size);
+            if (cached == NULL) {
+                ngx_http_static_cache_delete(cache, &path, hash);
+                return NGX_HTTP_INTERNAL_SERVER_ERROR;
+            }
+
+            ngx_memzero(&file, sizeof(ngx_file_t));
+
+            file.fd = of.fd;
+            file.name = path;
+            file.log = log;
+
+            n = ngx_read_file(&file, cached->pos, of.size, 0);
+
+            if (n == of.size) {
+                cached->last += n;
+                ngx_http_static_cache_insert(r, cache, &path, hash, &of,
+                                             cached->pos);
+
+            } else {
+                ngx_http_static_cache_delete(cache, &path, hash);
+                cached = NULL;
+            }
+        }
+    }
+
     if (r != r->main && of.size == 0) {
         return ngx_http_send_header(r);
     }
 
     r->allow_ranges = 1;
 
+    if (cached) {
+        rc = ngx_http_send_header(r);
+
+        if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+            return rc;
+        }
+
+        cached->last_buf = (r == r->main) ? 1: 0;
+        cached->last_in_chain = 1;
+
+        out.buf = cached;
+        out.next = NULL;
+
+        return ngx_http_output_filter(r, &out);
+    }
+
     /* we need to allocate all before the header would be sent */
 
     b = ngx_calloc_buf(r->pool);
@@ -269,6 +462,717 @@ ngx_http_static_handler(ngx_http_request_t *r)
 }
 
 
+/*
+ * on a miss, a GET request becomes the one to fill the entry, which is
+ * marked as being updated until then, so others do not read the file
+ * at the same time, but send it from the file
+ */
+
+static ngx_int_t
+ngx_http_static_cache_send(ngx_http_request_t *r,
+    ngx_http_static_cache_t *cache, ngx_str_t *path, uint32_t hash,
+    ngx_uint_t *fill)
+{
+    u_char                        *p;
+    size_t                         len;
+    time_t                         now, mtime;
+    ngx_int_t                      rc;
+    ngx_str_t                      etag, type;
+    ngx_buf_t                     *b;
+    ngx_chain_t                    out;
+    ngx_table_elt_t               *h;
+    ngx_rbtree_node_t             *node;
+    ngx_http_core_loc_conf_t      *clcf;
+    ngx_http_static_cache_node_t  *sn;
+
+    *fill = 0;
+
+    if (!(r->method & (NGX_HTTP_GET|NGX_HTTP_HEAD))) {
+        return NGX_DECLINED;
+    }
+
+    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+
+    now = ngx_time();
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    sn = ngx_http_static_cache_lookup(cache, path, hash);
+
+    if (sn == NULL
+        || sn->valid < now
+        || sn->uncacheable
+        || sn->conf != (ngx_vaddr_t) clcf
+        || sn->generation != cache->generation)
+    {
+        if (r->method == NGX_HTTP_GET
+            && path->len <= 65535
+            && (sn == NULL || sn->updating < now)
+            && !(sn && sn->uncacheable && sn->valid >= now))
+        {
+            if (sn == NULL) {
+                len = offsetof(ngx_rbtree_node_t, color)
+                      + offsetof(ngx_http_static_cache_node_t, data)
+                      + path->len;
+
+                node = ngx_http_static_cache_alloc(cache, len);
+
+                if (node) {
+                    node->key = hash;
+
+                    sn = (ngx_http_static_cache_node_t *) &node->color;
+
+                    ngx_memzero(sn, offsetof(ngx_http_static_cache_node_t,
+                                             data));
+
+                    sn->len = (u_short) path->len;
+                    ngx_memcpy(sn->data, path->data, path->len);
+
+                    ngx_rbtree_insert(&cache->sh->rbtree, node);
+                    ngx_queue_insert_head(&cache->sh->queue, &sn->queue);
+                }
+            }
+
+            if (sn) {
+                sn->updating = now + NGX_HTTP_STATIC_CACHE_FILL_TIME;
+                *fill = 1;
+            }
+        }
+
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+
+#if (NGX_STAT_STUB)
+        (void) ngx_atomic_fetch_add(ngx_stat_static_cache_misses, 1);
+#endif
+
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                       "http static cache miss, fill:%ui", *fill);
+
+        return NGX_DECLINED;
+    }
+
+    ngx_queue_remove(&sn->queue);
+    ngx_queue_insert_head(&cache->sh->queue, &sn->queue);
+
+    mtime = sn->mtime;
+
+    b = ngx_create_temp_buf(r->pool, sn->size);
+    if (b == NULL) {
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    p = ngx_pnalloc(r->pool, sn->etag_len + sn->type_len);
+    if (p == NULL) {
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    etag.len = sn->etag_len;
+    etag.data = p;
+
+    type.len = sn->type_len;
+    type.data = p + etag.len;
+
+    ngx_memcpy(p, sn->data + sn->len, etag.len + type.len);
+
+    b->last = ngx_cpymem(b->pos, sn->data + sn->len + etag.len + type.len,
+                         sn->size);
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+#if (NGX_STAT_STUB)
+    (void) ngx_atomic_fetch_add(ngx_stat_static_cache_hits, 1);
+#endif
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http static cache hit: %uz", b->last - b->pos);
+
+    r->root_tested = !r->error_page;
+
+    rc = ngx_http_discard_request_body(r);
+
+    if (rc != NGX_OK) {
+        return rc;
+    }
+
+    r->connection->log->action = "sending response to client";
+
+    r->headers_out.status = NGX_HTTP_OK;
+    r->headers_out.content_length_n = b->last - b->pos;
+    r->headers_out.last_modified_time = mtime;
+
+    /* the ETag and Content-Type were computed when the file was cached */
+
+    if (etag.len) {
+        h = ngx_list_push(&r->headers_out.headers);
+        if (h == NULL) {
+            return NGX_HTTP_INTERNAL_SERVER_ERROR;
+        }
+
+        h->hash = 1;
+        ngx_str_set(&h->key, "ETag");
+        h->value = etag;
+
+        r->headers_out.etag = h;
+    }
+
+    if (r->headers_out.content_type.len == 0) {
+        r->headers_out.content_type_len = type.len;
+        r->headers_out.content_type = type;
+    }
+
+    r->allow_ranges = 1;
+
+    rc = ngx_http_send_header(r);
+
+    if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+        return rc;
+    }
+
+    b->last_buf = (r == r->main) ? 1: 0;
+    b->last_in_chain = 1;
+
+    out.buf = b;
+    out.next = NULL;
+
+    return ngx_http_output_filter(r, &out);
+}
+
+
+static ngx_http_static_cache_node_t *
+ngx_http_static_cache_lookup(ngx_http_static_cache_t *cache, ngx_str_t *path,
+    uint32_t hash)
+{
+    ngx_int_t                      rc;
+    ngx_rbtree_node_t             *node, *sentinel;
+    ngx_http_static_cache_node_t  *sn;
+
+    node = cache->sh->rbtree.root;
+    sentinel = cache->sh->rbtree.sentinel;
+
+    while (node != sentinel) {
+
+        if (hash < node->key) {
+            node = node->left;
+            continue;
+        }
+
+        if (hash > node->key) {
+            node = node->right;
+            continue;
+        }
+
+        /* hash == node->key */
+
+        sn = (ngx_http_static_cache_node_t *) &node->color;
+
+        rc = ngx_memn2cmp(path->data, sn->data, path->len, (size_t) sn->len);
+
+        if (rc == 0) {
+            return sn;
+        }
+
+        node = (rc < 0) ? node->left : node->right;
+    }
+
+    return NULL;
+}
+
+
+/*
+ * the headers are cached along with the body, so an entry is only used
+ * in the location which cached it, as they depend on its configuration;
+ * the location is identified by its conf address along with the zone
+ * generation, as the address may be reused by another location after
+ * a reload
+ */
+
+static ngx_int_t
+ngx_http_static_cache_revalidate(ngx_http_request_t *r,
+    ngx_http_static_cache_t *cache, ngx_str_t *path, uint32_t hash,
+    ngx_open_file_info_t *of)
+{
+    ngx_http_core_loc_conf_t      *clcf;
+    ngx_http_static_cache_node_t  *sn;
+
+    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    sn = ngx_http_static_cache_lookup(cache, path, hash);
+
+    if (sn == NULL
+        || sn->uncacheable
+        || sn->size == 0
+        || sn->conf != (ngx_vaddr_t) clcf
+        || sn->generation != cache->generation
+        || sn->uniq != of->uniq
+        || sn->mtime != of->mtime
+        || sn->size != (size_t) of->size)
+    {
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+        return NGX_DECLINED;
+    }
+
+    /* the file was not changed */
+
+    sn->valid = ngx_time() + cache->valid;
+    sn->updating = 0;
+
+    ngx_queue_remove(&sn->queue);
+    ngx_queue_insert_head(&cache->sh->queue, &sn->queue);
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http static cache revalidated");
+
+    return NGX_OK;
+}
+
+
+/* the entry without data marks a file which is not cached */
+
+static void
+ngx_http_static_cache_insert(ngx_http_request_t *r,
+    ngx_http_static_cache_t *cache, ngx_str_t *path, uint32_t hash,
+    ngx_open_file_info_t *of, u_char *data)
+{
+    u_char                        *p;
+    size_t                         size, len;
+    ngx_str_t                      etag, type;
+    ngx_rbtree_node_t             *node;
+    ngx_http_static_cache_node_t  *sn;
+
+    if (r->headers_out.etag) {
+        etag = r->headers_out.etag->value;
+
+    } else {
+        ngx_str_null(&etag);
+    }
+
+    type = r->headers_out.content_type;
+
+    size = data ? (size_t) of->size : 0;
+
+    if (path->len > 65535 || etag.len > 65535 || type.len > 65535) {
+        ngx_http_static_cache_delete(cache, path, hash);
+        return;
+    }
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    sn = ngx_http_static_cache_lookup(cache, path, hash);
+
+    if (sn) {
+        ngx_http_static_cache_free(cache, sn);
+    }
+
+    len = offsetof(ngx_rbtree_node_t, color)
+          + offsetof(ngx_http_static_cache_node_t, data)
+          + path->len + etag.len + type.len + size;
+
+    node = ngx_http_static_cache_alloc(cache, len);
+
+    if (node == NULL) {
+        ngx_shmtx_unlock(&cache->shpool->mutex);
+
+        ngx_log_error(NGX_LOG_WARN, r->connection->log, 0,
+                      "could not allocate node%s", cache->shpool->log_ctx);
+        return;
+    }
+
+    node->key = hash;
+
+    sn = (ngx_http_static_cache_node_t *) &node->color;
+
+    sn->len = (u_short) path->len;
+    sn->uniq = of->uniq;
+    sn->mtime = of->mtime;
+    sn->size = size;
+    sn->valid = ngx_time() + cache->valid;
+    sn->updating = 0;
+    sn->conf = (ngx_vaddr_t) ngx_http_get_module_loc_conf(r,
+                                                          ngx_http_core_module);
+    sn->generation = cache->generation;
+    sn->etag_len = (u_short) etag.len;
+    sn->type_len = (u_short) type.len;
+    sn->uncacheable = data ? 0 : 1;
+
+    p = ngx_cpymem(sn->data, path->data, path->len);
+    p = ngx_cpymem(p, etag.data, etag.len);
+    p = ngx_cpymem(p, type.data, type.len);
+    ngx_memcpy(p, data, size);
+
+    ngx_rbtree_insert(&cache->sh->rbtree, node);
+
+    ngx_queue_insert_head(&cache->sh->queue, &sn->queue);
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http static cache add: %O%s",
+                   of->size, data ? "" : ", not cached");
+}
+
+
+static void
+ngx_http_static_cache_delete(ngx_http_static_cache_t *cache,
+    ngx_str_t *path, uint32_t hash)
+{
+    ngx_http_static_cache_node_t  *sn;
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    sn = ngx_http_static_cache_lookup(cache, path, hash);
+
+    if (sn) {
+        ngx_http_static_cache_free(cache, sn);
+    }
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+}
+
+
+/* evicts the least recently used files if needed */
+
+static ngx_rbtree_node_t *
+ngx_http_static_cache_alloc(ngx_http_static_cache_t *cache, size_t size)
+{
+    ngx_queue_t                   *q;
+    ngx_rbtree_node_t             *node;
+    ngx_http_static_cache_node_t  *sn;
+
+    for ( ;; ) {
+        node = ngx_slab_alloc_locked(cache->shpool, size);
+
+        if (node) {
+            return node;
+        }
+
+        if (ngx_queue_empty(&cache->sh->queue)) {
+            return NULL;
+        }
+
+        q = ngx_queue_last(&cache->sh->queue);
+
+        sn = ngx_queue_data(q, ngx_http_static_cache_node_t, queue);
+
+        ngx_http_static_cache_free(cache, sn);
+    }
+}
+
+
+static void
+ngx_http_static_cache_free(ngx_http_static_cache_t *cache,
+    ngx_http_static_cache_node_t *sn)
+{
+    ngx_rbtree_node_t  *node;
+
+    node = (ngx_rbtree_node_t *)
+               ((u_char *) sn - offsetof(ngx_rbtree_node_t, color));
+
+    ngx_queue_remove(&sn->queue);
+    ngx_rbtree_delete(&cache->sh->rbtree, node);
+    ngx_slab_free_locked(cache->shpool, node);
+}
+
+
+static void
+ngx_http_static_cache_rbtree_insert_value(ngx_rbtree_node_t *temp,
+    ngx_rbtree_node_t *node, ngx_rbtree_node_t *sentinel)
+{
+    ngx_rbtree_node_t             **p;
+    ngx_http_static_cache_node_t   *sn, *snt;
+
+    for ( ;; ) {
+
+        if (node->key < temp->key) {
+
+            p = &temp->left;
+
+        } else if (node->key > temp->key) {
+
+            p = &temp->right;
+
+        } else { /* node->key == temp->key */
+
+            sn = (ngx_http_static_cache_node_t *) &node->color;
+            snt = (ngx_http_static_cache_node_t *) &temp->color;
+
+            p = (ngx_memn2cmp(sn->data, snt->data, sn->len, snt->len) < 0)
+                ? &temp->left : &temp->right;
+        }
+
+        if (*p == sentinel) {
+            break;
+        }
+
+        temp = *p;
+    }
+
+    *p = node;
+    node->parent = temp;
+    node->left = sentinel;
+    node->right = sentinel;
+    ngx_rbt_red(node);
+}
+
+
+static ngx_int_t
+ngx_http_static_cache_init_zone(ngx_shm_zone_t *shm_zone, void *data)
+{
+    ngx_http_static_cache_t  *ocache = data;
+
+    size_t                    len;
+    ngx_http_static_cache_t  *cache;
+
+    cache = shm_zone->data;
+
+    if (ocache) {
+        cache->sh = ocache->sh;
+        cache->shpool = ocache->shpool;
+        cache->generation = ++cache->sh->generation;
+
+        return NGX_OK;
+    }
+
+    cache->shpool = (ngx_slab_pool_t *) shm_zone->shm.addr;
+
+    if (shm_zone->shm.exists) {
+        cache->sh = cache->shpool->data;
+        cache->generation = ++cache->sh->generation;
+
+        return NGX_OK;
+    }
+
+    cache->sh = ngx_slab_alloc(cache->shpool,
+                               sizeof(ngx_http_static_cache_shctx_t));
+    if (cache->sh == NULL) {
+        return NGX_ERROR;
+    }
+
+    cache->shpool->data = cache->sh;
+
+    ngx_rbtree_init(&cache->sh->rbtree, &cache->sh->sentinel,
+                    ngx_http_static_cache_rbtree_insert_value);
+
+    ngx_queue_init(&cache->sh->queue);
+
+    cache->sh->generation = 0;
+
+    len = sizeof(" in static cache zone \"\"") + shm_zone->shm.name.len;
+
+    cache->shpool->log_ctx = ngx_slab_alloc(cache->shpool, len);
+    if (cache->shpool->log_ctx == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_sprintf(cache->shpool->log_ctx, " in static cache zone \"%V\"%Z",
+                &shm_zone->shm.name);
+
+    /* the least recently used files are evicted instead */
+
+    cache->shpool->log_nomem = 0;
+
+    return NGX_OK;
+}
+
+
+static void *
+ngx_http_static_create_loc_conf(ngx_conf_t *cf)
+{
+    ngx_http_static_loc_conf_t  *conf;
+
+    conf = ngx_palloc(cf->pool, sizeof(ngx_http_static_loc_conf_t));
+    if (conf == NULL) {
+        return NULL;
+    }
+
+    conf->shm_zone = NGX_CONF_UNSET_PTR;
+
+    return conf;
+}
+
+
+static char *
+ngx_http_static_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
+{
+    ngx_http_static_loc_conf_t *prev = parent;
+    ngx_http_static_loc_conf_t *conf = child;
+
+    ngx_conf_merge_ptr_value(conf->shm_zone, prev->shm_zone, NULL);
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_http_static_cache_zone(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    u_char                   *p;
+    ssize_t                   size, max_size;
+    ngx_str_t                *value, name, s;
+    ngx_uint_t                i;
+    ngx_shm_zone_t           *shm_zone;
+    ngx_http_static_cache_t  *cache;
+
+    value = cf->args->elts;
+
+    cache = ngx_pcalloc(cf->pool, sizeof(ngx_http_static_cache_t));
+    if (cache == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    cache->max_size = NGX_CONF_UNSET_SIZE;
+    cache->valid = 60;
+
+    size = 0;
+    name.len = 0;
+
+    for (i = 1; i < cf->args->nelts; i++) {
+
+        if (ngx_strncmp(value[i].data, "zone=", 5) == 0) {
+
+            name.data = value[i].data + 5;
+
+            p = (u_char *) ngx_strchr(name.data, ':');
+
+            if (p == NULL) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid zone size \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            name.len = p - name.data;
+
+            s.data = p + 1;
+            s.len = value[i].data + value[i].len - s.data;
+
+            size = ngx_parse_size(&s);
+
+            if (size == NGX_ERROR) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid zone size \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            if (size < (ssize_t) (8 * ngx_pagesize)) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "zone \"%V\" is too small", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "max_size=", 9) == 0) {
+
+            s.len = value[i].len - 9;
+            s.data = value[i].data + 9;
+
+            max_size = ngx_parse_size(&s);
+            if (max_size == NGX_ERROR) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid max_size value \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            cache->max_size = max_size;
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "valid=", 6) == 0) {
+
+            s.len = value[i].len - 6;
+            s.data = value[i].data + 6;
+
+            cache->valid = ngx_parse_time(&s, 1);
+            if (cache->valid == (time_t) NGX_ERROR) {
+                ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                                   "invalid valid value \"%V\"", &value[i]);
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid parameter \"%V\"", &value[i]);
+        return NGX_CONF_ERROR;
+    }
+
+    if (name.len == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"%V\" must have \"zone\" parameter",
+                           &cmd->name);
+        return NGX_CONF_ERROR;
+    }
+
+    /*
+     * a file may take at most 1/8 of the zone, so a file being cached
+     * does not evict all others, and always fits into the zone
+     */
+
+    if (cache->max_size == NGX_CONF_UNSET_SIZE) {
+        cache->max_size = ngx_min(16 * 1024, (size_t) size / 8);
+
+    } else if (cache->max_size > (size_t) size / 8) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"max_size\" must not be greater than "
+                           "1/8 of the zone \"%V\" size", &name);
+        return NGX_CONF_ERROR;
+    }
+
+    shm_zone = ngx_shared_memory_add(cf, &name, size,
+                                     &ngx_http_static_module);
+    if (shm_zone == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    if (shm_zone->data) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "duplicate zone \"%V\"", &name);
+        return NGX_CONF_ERROR;
+    }
+
+    shm_zone->init = ngx_http_static_cache_init_zone;
+    shm_zone->data = cache;
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_http_static_cache(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_static_loc_conf_t *slcf = conf;
+
+    ngx_str_t  *value;
+
+    if (slcf->shm_zone != NGX_CONF_UNSET_PTR) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    if (ngx_strcmp(value[1].data, "off") == 0) {
+        slcf->shm_zone = NULL;
+        return NGX_CONF_OK;
+    }
+
+    slcf->shm_zone = ngx_shared_memory_add(cf, &value[1], 0,
+                                           &ngx_http_static_module);
+    if (slcf->shm_zone == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    return NGX_CONF_OK;
+}
+
+
 static ngx_int_t
 ngx_http_static_init(ngx_conf_t *cf)
 {
@@ -76,6 +76,36 @@ static ngx_http_variable_t  ngx_http_stub_status_vars[] = {
     { ngx_string("connections_waiting"), NULL, ngx_http_stub_status_variable,
       3, NGX_HTTP_VAR_NOCACHEABLE, 0 },
 
+    { ngx_string("aio_inline_bytes"), NULL, ngx_http_stub_status_variable,
+      4, NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("aio_offloaded_bytes"), NULL, ngx_http_stub_status_variable,
+      5, NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("aio_io_uring_requests"), NULL,
+      ngx_http_stub_status_variable, 6, NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("aio_io_uring_depth"), NULL, ngx_http_stub_status_variable,
+      7, NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("aio_io_uring_latency"), NULL, ngx_http_stub_status_variable,
+      8, NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("idle_http_bytes"), NULL, ngx_http_stub_status_variable,
+      9, NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("idle_https_bytes"), NULL, ngx_http_stub_status_variable,
+      10, NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("idle_http2_bytes"), NULL, ngx_http_stub_status_variable,
+      11, NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("static_cache_hits"), NULL, ngx_http_stub_status_variable,
+      12, NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
+    { ngx_string("static_cache_misses"), NULL, ngx_http_stub_status_variable,
+      13, NGX_HTTP_VAR_NOCACHEABLE, 0 },
+
       ngx_http_null_variable
 };
 
@@ -165,7 +195,7 @@ ngx_http_stub_status_variable(ngx_http_request_t *r,
     ngx_http_variable_value_t *v, uintptr_t data)
 {
     u_char            *p;
-    ngx_atomic_int_t   value;
+    ngx_atomic_int_t   value, n;
 
     p = ngx_pnalloc(r->pool, NGX_ATOMIC_T_LEN);
     if (p == NULL) {
@@ -189,6 +219,51 @@ ngx_http_stub_status_variable(ngx_http_request_t *r,
         value = *ngx_stat_waiting;
         break;
 
+    case 4:
+        value = *ngx_stat_file_inline;
+        break;
+
+    case 5:
+        value = *ngx_stat_file_offloaded;
+        break;
+
+    case 6:
+        value = *ngx_stat_io_uring_requests;
+        break;
+
+    case 7:
+        value = *ngx_stat_io_uring_depth;
+        break;
+
+    case 8:
+        value = *ngx_stat_io_uring_latency;
+        break;
+
+    /* the average memory held by an idle connection */
+
+    case 9:
+        n = *ngx_stat_idle_http;
+        value = n ? *ngx_stat_idle_http_size / n : 0;
+        break;
+
+    case 10:
+        n = *ngx_stat_idle_https;
+        value = n ? *ngx_stat_idle_https_size / n : 0;
+        break;
+
+    case 11:
+        n = *ngx_stat_idle_http2;
+        value = n ? *ngx_stat_idle_http2_size / n : 0;
+        break;
+
+    case 12:
+        value = *ngx_stat_static_cache_hits;
+        break;
+
+    case 13:
+        value = *ngx_stat_static_cache_misses;
+        break;
+
     /* suppress warning */
     default:
         value = 0;
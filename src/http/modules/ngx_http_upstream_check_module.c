@@ -0,0 +1,993 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+
+#define NGX_HTTP_UPSTREAM_CHECK_TCP     0
+#define NGX_HTTP_UPSTREAM_CHECK_HTTP    1
+
+#define NGX_HTTP_UPSTREAM_CHECK_BUFFER  4096
+
+
+typedef struct {
+    ngx_msec_t                           interval;
+    ngx_msec_t                           timeout;
+    ngx_uint_t                           fails;
+    ngx_uint_t                           passes;
+    ngx_uint_t                           type;
+    in_port_t                            port;
+    ngx_uint_t                           status_min;
+    ngx_uint_t                           status_max;
+    ngx_str_t                            body;
+    ngx_str_t                            request;
+} ngx_http_upstream_check_srv_conf_t;
+
+
+typedef struct {
+    ngx_http_upstream_check_srv_conf_t  *conf;
+    ngx_http_upstream_rr_peers_t        *peers;
+    ngx_http_upstream_rr_peer_t         *peer;
+    ngx_uint_t                           config;
+
+    ngx_pool_t                          *pool;
+    ngx_peer_connection_t                pc;
+    ngx_event_t                          timeout;
+    ngx_buf_t                           *buffer;
+    size_t                               sent;
+} ngx_http_upstream_check_peer_t;
+
+
+typedef struct {
+    ngx_http_upstream_check_srv_conf_t  *conf;
+    ngx_http_upstream_srv_conf_t        *upstream;
+    ngx_event_t                          event;
+    ngx_uint_t                           config;
+    ngx_uint_t                           npeers;
+    ngx_uint_t                           nalloc;
+    ngx_http_upstream_check_peer_t      *peers;
+} ngx_http_upstream_check_t;
+
+
+static ngx_int_t ngx_http_upstream_check_peers(ngx_http_upstream_check_t *uc);
+static ngx_uint_t ngx_http_upstream_check_changed(
+    ngx_http_upstream_check_peer_t *cp);
+static void ngx_http_upstream_check_timer_handler(ngx_event_t *ev);
+static void ngx_http_upstream_check_start(
+    ngx_http_upstream_check_peer_t *cp);
+static void ngx_http_upstream_check_write_handler(ngx_event_t *wev);
+static void ngx_http_upstream_check_read_handler(ngx_event_t *rev);
+static void ngx_http_upstream_check_dummy_handler(ngx_event_t *ev);
+static void ngx_http_upstream_check_timeout_handler(ngx_event_t *ev);
+static ngx_int_t ngx_http_upstream_check_test_connect(ngx_connection_t *c);
+static char *ngx_http_upstream_check_parse(ngx_http_upstream_check_peer_t *cp);
+static u_char *ngx_http_upstream_check_search(u_char *p, u_char *last,
+    u_char *s, size_t len);
+static void ngx_http_upstream_check_finish(ngx_http_upstream_check_peer_t *cp,
+    char *error);
+
+static void *ngx_http_upstream_check_create_conf(ngx_conf_t *cf);
+static char *ngx_http_upstream_check(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+static ngx_int_t ngx_http_upstream_check_init(ngx_conf_t *cf);
+static ngx_int_t ngx_http_upstream_check_init_process(ngx_cycle_t *cycle);
+
+
+static ngx_command_t  ngx_http_upstream_check_commands[] = {
+
+    { ngx_string("check"),
+      NGX_HTTP_UPS_CONF|NGX_CONF_ANY,
+      ngx_http_upstream_check,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      0,
+      NULL },
+
+      ngx_null_command
+};
+
+
+static ngx_http_module_t  ngx_http_upstream_check_module_ctx = {
+    NULL,                                  /* preconfiguration */
+    ngx_http_upstream_check_init,          /* postconfiguration */
+
+    NULL,                                  /* create main configuration */
+    NULL,                                  /* init main configuration */
+
+    ngx_http_upstream_check_create_conf,   /* create server configuration */
+    NULL,                                  /* merge server configuration */
+
+    NULL,                                  /* create location configuration */
+    NULL                                   /* merge location configuration */
+};
+
+
+ngx_module_t  ngx_http_upstream_check_module = {
+    NGX_MODULE_V1,
+    &ngx_http_upstream_check_module_ctx,   /* module context */
+    ngx_http_upstream_check_commands,      /* module directives */
+    NGX_HTTP_MODULE,                       /* module type */
+    NULL,                                  /* init master */
+    NULL,                                  /* init module */
+    ngx_http_upstream_check_init_process,  /* init process */
+    NULL,                                  /* init thread */
+    NULL,                                  /* exit thread */
+    NULL,                                  /* exit process */
+    NULL,                                  /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+static void
+ngx_http_upstream_check_timer_handler(ngx_event_t *ev)
+{
+    ngx_uint_t                  i;
+    ngx_http_upstream_check_t  *uc;
+
+    if (ngx_exiting) {
+        return;
+    }
+
+    uc = ev->data;
+
+    if (ngx_http_upstream_check_peers(uc) == NGX_OK) {
+
+        for (i = 0; i < uc->npeers; i++) {
+            if (uc->peers[i].pool == NULL) {
+                ngx_http_upstream_check_start(&uc->peers[i]);
+            }
+        }
+    }
+
+    ngx_add_timer(ev, uc->conf->interval);
+}
+
+
+/*
+ * The peers are indexed once and again after the peers resolved at run
+ * time change, when no check is in progress, as checks refer to them.
+ */
+
+static ngx_int_t
+ngx_http_upstream_check_peers(ngx_http_upstream_check_t *uc)
+{
+    ngx_uint_t                       i, n, config;
+    ngx_http_upstream_rr_peer_t     *peer;
+    ngx_http_upstream_rr_peers_t    *peers, *primary;
+    ngx_http_upstream_check_peer_t  *cp;
+
+    primary = uc->upstream->peer.data;
+
+    config = primary->config ? *primary->config : 0;
+
+    if (uc->peers && uc->config == config) {
+        return NGX_OK;
+    }
+
+    for (i = 0; i < uc->npeers; i++) {
+        if (uc->peers[i].pool) {
+            return NGX_AGAIN;
+        }
+    }
+
+again:
+
+    n = 0;
+
+    for (peers = primary; peers; peers = peers->next) {
+        ngx_http_upstream_rr_peers_rlock(peers);
+        n += peers->number;
+        ngx_http_upstream_rr_peers_unlock(peers);
+    }
+
+    if (n > uc->nalloc) {
+        if (uc->peers) {
+            ngx_free(uc->peers);
+        }
+
+        uc->npeers = 0;
+        uc->nalloc = 0;
+
+        uc->peers = ngx_alloc(sizeof(ngx_http_upstream_check_peer_t) * n,
+                              ngx_cycle->log);
+        if (uc->peers == NULL) {
+            return NGX_ERROR;
+        }
+
+        uc->nalloc = n;
+    }
+
+    /* the peers may change meanwhile, each one is checked in its list */
+
+    i = 0;
+
+    for (peers = primary; peers; peers = peers->next) {
+
+        ngx_http_upstream_rr_peers_rlock(peers);
+
+        if (peers == primary) {
+            uc->config = peers->config ? *peers->config : 0;
+        }
+
+        for (peer = peers->peer; peer; peer = peer->next) {
+
+            if (i == uc->nalloc) {
+                ngx_http_upstream_rr_peers_unlock(peers);
+                goto again;
+            }
+
+            cp = &uc->peers[i++];
+
+            ngx_memzero(cp, sizeof(ngx_http_upstream_check_peer_t));
+
+            cp->conf = uc->conf;
+            cp->peers = peers;
+            cp->peer = peer;
+            cp->config = peers->config ? *peers->config : 0;
+        }
+
+        ngx_http_upstream_rr_peers_unlock(peers);
+    }
+
+    uc->npeers = i;
+
+    return NGX_OK;
+}
+
+
+/* the peers are locked */
+
+static ngx_uint_t
+ngx_http_upstream_check_changed(ngx_http_upstream_check_peer_t *cp)
+{
+    return cp->peers->config && *cp->peers->config != cp->config;
+}
+
+
+/*
+ * Every worker process runs the timer, and the time of the last check
+ * in the shared peer makes sure only one of them checks a peer at a time.
+ */
+
+static void
+ngx_http_upstream_check_start(ngx_http_upstream_check_peer_t *cp)
+{
+    size_t                               len;
+    u_char                              *p;
+    ngx_int_t                            rc;
+    ngx_msec_t                           wait;
+    ngx_pool_t                          *pool;
+    socklen_t                            socklen;
+    ngx_sockaddr_t                       sockaddr;
+    ngx_connection_t                    *c;
+    ngx_http_upstream_rr_peer_t         *peer;
+    ngx_http_upstream_check_srv_conf_t  *ccf;
+    u_char                               name[NGX_SOCKADDR_STRLEN];
+
+    ccf = cp->conf;
+    peer = cp->peer;
+
+    wait = ngx_max(ccf->interval, ccf->timeout);
+
+    ngx_http_upstream_rr_peers_rlock(cp->peers);
+
+    if (ngx_http_upstream_check_changed(cp)) {
+        ngx_http_upstream_rr_peers_unlock(cp->peers);
+        return;
+    }
+
+    ngx_http_upstream_rr_peer_lock(cp->peers, peer);
+
+    if ((peer->down & ~NGX_HTTP_UPSTREAM_RR_CHECK_DOWN)
+        || ngx_current_msec - peer->check_time < wait)
+    {
+        ngx_http_upstream_rr_peer_unlock(cp->peers, peer);
+        ngx_http_upstream_rr_peers_unlock(cp->peers);
+        return;
+    }
+
+    peer->check_time = ngx_current_msec;
+
+    /* a peer resolved at run time may be freed once unlocked */
+
+    socklen = peer->socklen;
+    ngx_memcpy(&sockaddr, peer->sockaddr, socklen);
+
+    len = ngx_min(peer->name.len, NGX_SOCKADDR_STRLEN);
+    ngx_memcpy(name, peer->name.data, len);
+
+    ngx_http_upstream_rr_peer_unlock(cp->peers, peer);
+    ngx_http_upstream_rr_peers_unlock(cp->peers);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                   "upstream check %*s", len, name);
+
+    pool = ngx_create_pool(NGX_DEFAULT_POOL_SIZE, ngx_cycle->log);
+    if (pool == NULL) {
+        return;
+    }
+
+    cp->pool = pool;
+    cp->sent = 0;
+
+    ngx_memzero(&cp->pc, sizeof(ngx_peer_connection_t));
+
+    cp->pc.name = ngx_palloc(pool, sizeof(ngx_str_t) + len);
+    if (cp->pc.name == NULL) {
+        ngx_destroy_pool(pool);
+        cp->pool = NULL;
+        return;
+    }
+
+    p = (u_char *) cp->pc.name + sizeof(ngx_str_t);
+
+    ngx_memcpy(p, name, len);
+
+    cp->pc.name->len = len;
+    cp->pc.name->data = p;
+
+    cp->pc.sockaddr = ngx_palloc(pool, socklen);
+    if (cp->pc.sockaddr == NULL) {
+        ngx_http_upstream_check_finish(cp, "out of memory");
+        return;
+    }
+
+    ngx_memcpy(cp->pc.sockaddr, &sockaddr, socklen);
+
+    if (ccf->port) {
+        ngx_inet_set_port(cp->pc.sockaddr, ccf->port);
+    }
+
+    cp->pc.socklen = socklen;
+    cp->pc.get = ngx_event_get_peer;
+    cp->pc.log = ngx_cycle->log;
+    cp->pc.log_error = NGX_ERROR_INFO;
+
+    if (ccf->type == NGX_HTTP_UPSTREAM_CHECK_HTTP) {
+        cp->buffer = ngx_create_temp_buf(pool, NGX_HTTP_UPSTREAM_CHECK_BUFFER);
+        if (cp->buffer == NULL) {
+            ngx_http_upstream_check_finish(cp, "out of memory");
+            return;
+        }
+    }
+
+    rc = ngx_event_connect_peer(&cp->pc);
+
+    if (rc == NGX_ERROR || rc == NGX_BUSY || rc == NGX_DECLINED) {
+        ngx_http_upstream_check_finish(cp, "connect() failed");
+        return;
+    }
+
+    /* rc == NGX_OK || rc == NGX_AGAIN */
+
+    c = cp->pc.connection;
+
+    c->data = cp;
+    c->pool = pool;
+
+    c->write->handler = ngx_http_upstream_check_write_handler;
+    c->read->handler = ngx_http_upstream_check_dummy_handler;
+
+    cp->timeout.handler = ngx_http_upstream_check_timeout_handler;
+    cp->timeout.data = cp;
+    cp->timeout.log = ngx_cycle->log;
+    cp->timeout.cancelable = 1;
+
+    ngx_add_timer(&cp->timeout, ccf->timeout);
+
+    if (rc == NGX_OK) {
+        ngx_http_upstream_check_write_handler(c->write);
+    }
+}
+
+
+static void
+ngx_http_upstream_check_write_handler(ngx_event_t *wev)
+{
+    ssize_t                          n;
+    ngx_str_t                       *request;
+    ngx_connection_t                *c;
+    ngx_http_upstream_check_peer_t  *cp;
+
+    c = wev->data;
+    cp = c->data;
+
+    if (cp->sent == 0) {
+        if (ngx_http_upstream_check_test_connect(c) != NGX_OK) {
+            ngx_http_upstream_check_finish(cp, "connect() failed");
+            return;
+        }
+
+        if (cp->conf->type == NGX_HTTP_UPSTREAM_CHECK_TCP) {
+            ngx_http_upstream_check_finish(cp, NULL);
+            return;
+        }
+    }
+
+    request = &cp->conf->request;
+
+    while (cp->sent < request->len) {
+
+        n = c->send(c, request->data + cp->sent, request->len - cp->sent);
+
+        if (n == NGX_ERROR) {
+            ngx_http_upstream_check_finish(cp, "send() failed");
+            return;
+        }
+
+        if (n == NGX_AGAIN) {
+            if (ngx_handle_write_event(wev, 0) != NGX_OK) {
+                ngx_http_upstream_check_finish(cp, "send() failed");
+            }
+
+            return;
+        }
+
+        cp->sent += n;
+    }
+
+    wev->handler = ngx_http_upstream_check_dummy_handler;
+    c->read->handler = ngx_http_upstream_check_read_handler;
+
+    if (wev->active && (ngx_event_flags & NGX_USE_LEVEL_EVENT)) {
+        if (ngx_del_event(wev, NGX_WRITE_EVENT, 0) != NGX_OK) {
+            ngx_http_upstream_check_finish(cp, "send() failed");
+            return;
+        }
+    }
+
+    ngx_http_upstream_check_read_handler(c->read);
+}
+
+
+static void
+ngx_http_upstream_check_read_handler(ngx_event_t *rev)
+{
+    ssize_t                          n;
+    ngx_buf_t                       *b;
+    ngx_connection_t                *c;
+    ngx_http_upstream_check_peer_t  *cp;
+
+    c = rev->data;
+    cp = c->data;
+    b = cp->buffer;
+
+    /* the response is read until it is closed or fills the buffer */
+
+    while (b->last < b->end) {
+
+        n = c->recv(c, b->last, b->end - b->last);
+
+        if (n == NGX_AGAIN) {
+            if (ngx_handle_read_event(rev, 0) != NGX_OK) {
+                ngx_http_upstream_check_finish(cp, "recv() failed");
+            }
+
+            return;
+        }
+
+        if (n == NGX_ERROR) {
+            ngx_http_upstream_check_finish(cp, "recv() failed");
+            return;
+        }
+
+        if (n == 0) {
+            break;
+        }
+
+        b->last += n;
+    }
+
+    ngx_http_upstream_check_finish(cp, ngx_http_upstream_check_parse(cp));
+}
+
+
+static void
+ngx_http_upstream_check_dummy_handler(ngx_event_t *ev)
+{
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, ev->log, 0,
+                   "upstream check dummy handler");
+}
+
+
+static void
+ngx_http_upstream_check_timeout_handler(ngx_event_t *ev)
+{
+    ngx_http_upstream_check_finish(ev->data, "timed out");
+}
+
+
+static ngx_int_t
+ngx_http_upstream_check_test_connect(ngx_connection_t *c)
+{
+    int        err;
+    socklen_t  len;
+
+#if (NGX_HAVE_KQUEUE)
+
+    if (ngx_event_flags & NGX_USE_KQUEUE_EVENT)  {
+        if (c->write->pending_eof || c->read->pending_eof) {
+            return NGX_ERROR;
+        }
+
+        return NGX_OK;
+    }
+
+#endif
+
+    err = 0;
+    len = sizeof(int);
+
+    if (getsockopt(c->fd, SOL_SOCKET, SO_ERROR, (void *) &err, &len) == -1) {
+        err = ngx_socket_errno;
+    }
+
+    return err ? NGX_ERROR : NGX_OK;
+}
+
+
+static char *
+ngx_http_upstream_check_parse(ngx_http_upstream_check_peer_t *cp)
+{
+    u_char                              *p, *last;
+    ngx_int_t                            status;
+    ngx_http_upstream_check_srv_conf_t  *ccf;
+
+    ccf = cp->conf;
+
+    p = cp->buffer->pos;
+    last = cp->buffer->last;
+
+    if (last - p < 12 || ngx_strncmp(p, "HTTP/", 5) != 0) {
+        return "invalid response";
+    }
+
+    p = ngx_strlchr(p, last, ' ');
+
+    if (p == NULL || last - p < 4) {
+        return "invalid response";
+    }
+
+    status = ngx_atoi(p + 1, 3);
+
+    if (status == NGX_ERROR) {
+        return "invalid response";
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                   "upstream check %V status %i",
+                   cp->pc.name, status);
+
+    if ((ngx_uint_t) status < ccf->status_min
+        || (ngx_uint_t) status > ccf->status_max)
+    {
+        return "unexpected status";
+    }
+
+    if (ccf->body.len == 0) {
+        return NULL;
+    }
+
+    p = ngx_http_upstream_check_search(p, last, (u_char *) "\r\n\r\n", 4);
+
+    if (p == NULL
+        || ngx_http_upstream_check_search(p + 4, last, ccf->body.data,
+                                          ccf->body.len)
+           == NULL)
+    {
+        return "unexpected body";
+    }
+
+    return NULL;
+}
+
+
+/* the response may contain null bytes, so ngx_strnstr() is not used */
+
+static u_char *
+ngx_http_upstream_check_search(u_char *p, u_char *last, u_char *s, size_t len)
+{
+    while ((size_t) (last - p) >= len) {
+
+        if (*p == *s && ngx_memcmp(p, s, len) == 0) {
+            return p;
+        }
+
+        p++;
+    }
+
+    return NULL;
+}
+
+
+static void
+ngx_http_upstream_check_finish(ngx_http_upstream_check_peer_t *cp,
+    char *error)
+{
+    ngx_http_upstream_rr_peer_t         *peer;
+    ngx_http_upstream_check_srv_conf_t  *ccf;
+
+    ccf = cp->conf;
+    peer = cp->peer;
+
+    if (cp->timeout.timer_set) {
+        ngx_del_timer(&cp->timeout);
+    }
+
+    if (cp->pc.connection) {
+        ngx_close_connection(cp->pc.connection);
+        cp->pc.connection = NULL;
+    }
+
+    if (error) {
+        ngx_log_error(NGX_LOG_INFO, ngx_cycle->log, 0,
+                      "upstream \"%V\" peer %V check failed: %s",
+                      cp->peers->name, cp->pc.name, error);
+    }
+
+    ngx_destroy_pool(cp->pool);
+    cp->pool = NULL;
+
+    ngx_http_upstream_rr_peers_rlock(cp->peers);
+
+    if (ngx_http_upstream_check_changed(cp)) {
+        ngx_http_upstream_rr_peers_unlock(cp->peers);
+        return;
+    }
+
+    ngx_http_upstream_rr_peer_lock(cp->peers, peer);
+
+    if (error == NULL) {
+        peer->check_fails = 0;
+
+        if ((peer->down & NGX_HTTP_UPSTREAM_RR_CHECK_DOWN)
+            && ++peer->check_passes >= ccf->passes)
+        {
+            peer->down &= ~NGX_HTTP_UPSTREAM_RR_CHECK_DOWN;
+            peer->fails = 0;
+
+            ngx_log_error(NGX_LOG_NOTICE, ngx_cycle->log, 0,
+                          "upstream \"%V\" peer %V is up",
+                          cp->peers->name, &peer->name);
+        }
+
+    } else {
+        peer->check_passes = 0;
+
+        if (!(peer->down & NGX_HTTP_UPSTREAM_RR_CHECK_DOWN)
+            && ++peer->check_fails >= ccf->fails)
+        {
+            peer->down |= NGX_HTTP_UPSTREAM_RR_CHECK_DOWN;
+
+            ngx_log_error(NGX_LOG_WARN, ngx_cycle->log, 0,
+                          "upstream \"%V\" peer %V is down",
+                          cp->peers->name, &peer->name);
+        }
+    }
+
+    ngx_http_upstream_rr_peer_unlock(cp->peers, peer);
+    ngx_http_upstream_rr_peers_unlock(cp->peers);
+}
+
+
+static void *
+ngx_http_upstream_check_create_conf(ngx_conf_t *cf)
+{
+    ngx_http_upstream_check_srv_conf_t  *conf;
+
+    conf = ngx_pcalloc(cf->pool, sizeof(ngx_http_upstream_check_srv_conf_t));
+    if (conf == NULL) {
+        return NULL;
+    }
+
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     conf->type = NGX_HTTP_UPSTREAM_CHECK_TCP;
+     *     conf->port = 0;
+     *     conf->body = { 0, NULL };
+     *     conf->request = { 0, NULL };
+     */
+
+    conf->interval = NGX_CONF_UNSET_MSEC;
+
+    return conf;
+}
+
+
+static char *
+ngx_http_upstream_check(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_upstream_check_srv_conf_t  *ccf = conf;
+
+    u_char                        *p, *last;
+    ngx_int_t                      n;
+    ngx_str_t                     *value, s, uri;
+    ngx_uint_t                     i;
+    ngx_http_upstream_srv_conf_t  *uscf;
+
+    if (ccf->interval != NGX_CONF_UNSET_MSEC) {
+        return "is duplicate";
+    }
+
+    ccf->interval = 5000;
+    ccf->timeout = 1000;
+    ccf->fails = 1;
+    ccf->passes = 1;
+    ccf->type = NGX_HTTP_UPSTREAM_CHECK_HTTP;
+    ccf->status_min = 200;
+    ccf->status_max = 399;
+
+    ngx_str_set(&uri, "/");
+
+    value = cf->args->elts;
+
+    for (i = 1; i < cf->args->nelts; i++) {
+
+        if (ngx_strncmp(value[i].data, "interval=", 9) == 0) {
+
+            s.len = value[i].len - 9;
+            s.data = value[i].data + 9;
+
+            ccf->interval = ngx_parse_time(&s, 0);
+
+            if (ccf->interval == (ngx_msec_t) NGX_ERROR
+                || ccf->interval == 0)
+            {
+                goto invalid;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "timeout=", 8) == 0) {
+
+            s.len = value[i].len - 8;
+            s.data = value[i].data + 8;
+
+            ccf->timeout = ngx_parse_time(&s, 0);
+
+            if (ccf->timeout == (ngx_msec_t) NGX_ERROR || ccf->timeout == 0) {
+                goto invalid;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "fails=", 6) == 0) {
+
+            n = ngx_atoi(&value[i].data[6], value[i].len - 6);
+
+            if (n == NGX_ERROR || n == 0) {
+                goto invalid;
+            }
+
+            ccf->fails = n;
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "passes=", 7) == 0) {
+
+            n = ngx_atoi(&value[i].data[7], value[i].len - 7);
+
+            if (n == NGX_ERROR || n == 0) {
+                goto invalid;
+            }
+
+            ccf->passes = n;
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "port=", 5) == 0) {
+
+            n = ngx_atoi(&value[i].data[5], value[i].len - 5);
+
+            if (n == NGX_ERROR || n < 1 || n > 65535) {
+                goto invalid;
+            }
+
+            ccf->port = (in_port_t) n;
+
+            continue;
+        }
+
+        if (ngx_strcmp(value[i].data, "type=tcp") == 0) {
+            ccf->type = NGX_HTTP_UPSTREAM_CHECK_TCP;
+            continue;
+        }
+
+        if (ngx_strcmp(value[i].data, "type=http") == 0) {
+            ccf->type = NGX_HTTP_UPSTREAM_CHECK_HTTP;
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "uri=", 4) == 0) {
+
+            uri.len = value[i].len - 4;
+            uri.data = value[i].data + 4;
+
+            if (uri.len == 0 || uri.data[0] != '/') {
+                goto invalid;
+            }
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "status=", 7) == 0) {
+
+            p = value[i].data + 7;
+            last = value[i].data + value[i].len;
+
+            s.data = ngx_strlchr(p, last, '-');
+
+            if (s.data == NULL) {
+                s.data = last;
+            }
+
+            n = ngx_atoi(p, s.data - p);
+
+            if (n < 100 || n > 599) {
+                goto invalid;
+            }
+
+            ccf->status_min = n;
+
+            if (s.data != last) {
+                s.data++;
+                n = ngx_atoi(s.data, last - s.data);
+            }
+
+            if (n < (ngx_int_t) ccf->status_min || n > 599) {
+                goto invalid;
+            }
+
+            ccf->status_max = n;
+
+            continue;
+        }
+
+        if (ngx_strncmp(value[i].data, "body=", 5) == 0) {
+
+            ccf->body.len = value[i].len - 5;
+            ccf->body.data = value[i].data + 5;
+
+            continue;
+        }
+
+        goto invalid;
+    }
+
+    if (ccf->type == NGX_HTTP_UPSTREAM_CHECK_HTTP) {
+
+        uscf = ngx_http_conf_get_module_srv_conf(cf, ngx_http_upstream_module);
+
+        ccf->request.len = sizeof("GET  HTTP/1.0" CRLF) - 1 + uri.len
+                           + sizeof("Host: " CRLF) - 1 + uscf->host.len
+                           + sizeof("Connection: close" CRLF CRLF) - 1;
+
+        ccf->request.data = ngx_pnalloc(cf->pool, ccf->request.len);
+        if (ccf->request.data == NULL) {
+            return NGX_CONF_ERROR;
+        }
+
+        ngx_sprintf(ccf->request.data,
+                    "GET %V HTTP/1.0" CRLF
+                    "Host: %V" CRLF
+                    "Connection: close" CRLF CRLF,
+                    &uri, &uscf->host);
+    }
+
+    return NGX_CONF_OK;
+
+invalid:
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "invalid parameter \"%V\"", &value[i]);
+
+    return NGX_CONF_ERROR;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_check_init(ngx_conf_t *cf)
+{
+    ngx_uint_t                           i;
+    ngx_http_upstream_srv_conf_t       **uscfp;
+    ngx_http_upstream_main_conf_t       *umcf;
+    ngx_http_upstream_check_srv_conf_t  *ccf;
+
+    umcf = ngx_http_conf_get_module_main_conf(cf, ngx_http_upstream_module);
+
+    uscfp = umcf->upstreams.elts;
+
+    for (i = 0; i < umcf->upstreams.nelts; i++) {
+
+        if (uscfp[i]->srv_conf == NULL) {
+            continue;
+        }
+
+        ccf = uscfp[i]->srv_conf[ngx_http_upstream_check_module.ctx_index];
+
+        if (ccf->interval == NGX_CONF_UNSET_MSEC) {
+            continue;
+        }
+
+        if (uscfp[i]->shm_zone == NULL) {
+            ngx_log_error(NGX_LOG_EMERG, cf->log, 0,
+                          "\"check\" requires \"zone\" in upstream \"%V\" "
+                          "in %s:%ui", &uscfp[i]->host,
+                          uscfp[i]->file_name, uscfp[i]->line);
+            return NGX_ERROR;
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_check_init_process(ngx_cycle_t *cycle)
+{
+    ngx_uint_t                           i;
+    ngx_http_upstream_check_t           *uc;
+    ngx_http_upstream_srv_conf_t       **uscfp;
+    ngx_http_upstream_main_conf_t       *umcf;
+    ngx_http_upstream_check_srv_conf_t  *ccf;
+
+    if (ngx_process != NGX_PROCESS_WORKER
+        && ngx_process != NGX_PROCESS_SINGLE)
+    {
+        return NGX_OK;
+    }
+
+    umcf = ngx_http_cycle_get_module_main_conf(cycle,
+                                               ngx_http_upstream_module);
+
+    if (umcf == NULL) {
+        return NGX_OK;
+    }
+
+    uscfp = umcf->upstreams.elts;
+
+    for (i = 0; i < umcf->upstreams.nelts; i++) {
+
+        if (uscfp[i]->srv_conf == NULL) {
+            continue;
+        }
+
+        ccf = uscfp[i]->srv_conf[ngx_http_upstream_check_module.ctx_index];
+
+        if (ccf->interval == NGX_CONF_UNSET_MSEC) {
+            continue;
+        }
+
+        uc = ngx_pcalloc(cycle->pool, sizeof(ngx_http_upstream_check_t));
+        if (uc == NULL) {
+            return NGX_ERROR;
+        }
+
+        uc->conf = ccf;
+        uc->upstream = uscfp[i];
+
+        if (ngx_http_upstream_check_peers(uc) == NGX_ERROR) {
+            return NGX_ERROR;
+        }
+
+        uc->event.handler = ngx_http_upstream_check_timer_handler;
+        uc->event.data = uc;
+        uc->event.log = cycle->log;
+        uc->event.cancelable = 1;
+
+        /* spread the checks of worker processes over the interval */
+
+        ngx_add_timer(&uc->event, ngx_random() % ccf->interval);
+    }
+
+    return NGX_OK;
+}
@@ -0,0 +1,532 @@
+
+/*
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_http.h>
+
+
+#define NGX_HTTP_UPSTREAM_EWMA_TRIES  20
+
+
+typedef struct {
+    ngx_http_upstream_rr_peers_t      *peers;
+    ngx_uint_t                         config;
+    ngx_uint_t                         nalloc;
+    ngx_http_upstream_rr_peer_t      **peer;
+} ngx_http_upstream_ewma_peers_t;
+
+
+typedef struct {
+    ngx_msec_t                         decay;
+
+    /* peers and backup peers, indexed in each worker on first use */
+    ngx_http_upstream_ewma_peers_t     peers[2];
+} ngx_http_upstream_ewma_srv_conf_t;
+
+
+typedef struct {
+    /* the round robin data must be first */
+    ngx_http_upstream_rr_peer_data_t   rrp;
+
+    ngx_http_upstream_ewma_srv_conf_t *conf;
+    ngx_http_upstream_rr_peers_t      *primary;
+    ngx_http_upstream_t               *upstream;
+} ngx_http_upstream_ewma_peer_data_t;
+
+
+static ngx_int_t ngx_http_upstream_init_ewma_peer(ngx_http_request_t *r,
+    ngx_http_upstream_srv_conf_t *us);
+static ngx_int_t ngx_http_upstream_get_ewma_peer(ngx_peer_connection_t *pc,
+    void *data);
+static void ngx_http_upstream_free_ewma_peer(ngx_peer_connection_t *pc,
+    void *data, ngx_uint_t state);
+static ngx_http_upstream_rr_peer_t **ngx_http_upstream_ewma_index(
+    ngx_http_upstream_ewma_peers_t *ep, ngx_http_upstream_rr_peers_t *peers);
+static ngx_uint_t ngx_http_upstream_ewma_available(
+    ngx_http_upstream_rr_peer_data_t *rrp, ngx_http_upstream_rr_peer_t *peer,
+    ngx_uint_t i, time_t now);
+static ngx_uint_t ngx_http_upstream_ewma_decayed(
+    ngx_http_upstream_rr_peer_t *peer, ngx_msec_t decay);
+static void *ngx_http_upstream_ewma_create_conf(ngx_conf_t *cf);
+static char *ngx_http_upstream_ewma(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf);
+
+
+static ngx_command_t  ngx_http_upstream_ewma_commands[] = {
+
+    { ngx_string("ewma"),
+      NGX_HTTP_UPS_CONF|NGX_CONF_NOARGS|NGX_CONF_TAKE1,
+      ngx_http_upstream_ewma,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      0,
+      NULL },
+
+      ngx_null_command
+};
+
+
+static ngx_http_module_t  ngx_http_upstream_ewma_module_ctx = {
+    NULL,                                  /* preconfiguration */
+    NULL,                                  /* postconfiguration */
+
+    NULL,                                  /* create main configuration */
+    NULL,                                  /* init main configuration */
+
+    ngx_http_upstream_ewma_create_conf,    /* create server configuration */
+    NULL,                                  /* merge server configuration */
+
+    NULL,                                  /* create location configuration */
+    NULL                                   /* merge location configuration */
+};
+
+
+ngx_module_t  ngx_http_upstream_ewma_module = {
+    NGX_MODULE_V1,
+    &ngx_http_upstream_ewma_module_ctx,    /* module context */
+    ngx_http_upstream_ewma_commands,       /* module directives */
+    NGX_HTTP_MODULE,                       /* module type */
+    NULL,                                  /* init master */
+    NULL,                                  /* init module */
+    NULL,                                  /* init process */
+    NULL,                                  /* init thread */
+    NULL,                                  /* exit thread */
+    NULL,                                  /* exit process */
+    NULL,                                  /* exit master */
+    NGX_MODULE_V1_PADDING
+};
+
+
+static ngx_int_t
+ngx_http_upstream_init_ewma(ngx_conf_t *cf, ngx_http_upstream_srv_conf_t *us)
+{
+    size_t                              size;
+    ngx_uint_t                          i;
+    ngx_http_upstream_rr_peers_t       *peers;
+    ngx_http_upstream_ewma_srv_conf_t  *ecf;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, cf->log, 0,
+                   "init ewma");
+
+    if (ngx_http_upstream_init_round_robin(cf, us) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    ecf = ngx_http_conf_upstream_srv_conf(us, ngx_http_upstream_ewma_module);
+
+    /*
+     * with a shared memory zone, the peers are copied to the zone
+     * after the configuration is read, hence only the space for
+     * the indexes is allocated here
+     */
+
+    for (i = 0, peers = us->peer.data; peers; i++, peers = peers->next) {
+
+        size = peers->number * sizeof(ngx_http_upstream_rr_peer_t *);
+
+        ecf->peers[i].peer = ngx_pcalloc(cf->pool, size);
+        if (ecf->peers[i].peer == NULL) {
+            return NGX_ERROR;
+        }
+
+        ecf->peers[i].nalloc = peers->number;
+    }
+
+    us->peer.init = ngx_http_upstream_init_ewma_peer;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_upstream_init_ewma_peer(ngx_http_request_t *r,
+    ngx_http_upstream_srv_conf_t *us)
+{
+    ngx_http_upstream_ewma_peer_data_t  *ep;
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "init ewma peer");
+
+    ep = ngx_palloc(r->pool, sizeof(ngx_http_upstream_ewma_peer_data_t));
+    if (ep == NULL) {
+        return NGX_ERROR;
+    }
+
+    r->upstream->peer.data = &ep->rrp;
+
+    if (ngx_http_upstream_init_round_robin_peer(r, us) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    ep->conf = ngx_http_conf_upstream_srv_conf(us,
+                                               ngx_http_upstream_ewma_module);
+    ep->primary = us->peer.data;
+    ep->upstream = r->upstream;
+
+    r->upstream->peer.get = ngx_http_upstream_get_ewma_peer;
+    r->upstream->peer.free = ngx_http_upstream_free_ewma_peer;
+
+    return NGX_OK;
+}
+
+
+/*
+ * Two peers are chosen at random, and the one with the lower cost is
+ * used: the decayed average of the response header time, with recent
+ * peaks taken as is, multiplied by the number of active connections.
+ */
+
+static ngx_int_t
+ngx_http_upstream_get_ewma_peer(ngx_peer_connection_t *pc, void *data)
+{
+    ngx_http_upstream_ewma_peer_data_t  *ep = data;
+
+    time_t                             now;
+    uint64_t                           cost, best_cost;
+    ngx_uint_t                         i, n, p, x, ewma;
+    ngx_vaddr_t                        m;
+    ngx_http_upstream_rr_peer_t      **index, *peer, *best;
+    ngx_http_upstream_rr_peers_t      *peers;
+    ngx_http_upstream_rr_peer_data_t  *rrp;
+
+    rrp = &ep->rrp;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "get ewma peer, try: %ui", pc->tries);
+
+    if (rrp->peers->single) {
+        return ngx_http_upstream_get_round_robin_peer(pc, rrp);
+    }
+
+    pc->cached = 0;
+    pc->connection = NULL;
+
+    now = ngx_time();
+
+    peers = rrp->peers;
+
+    ngx_http_upstream_rr_peers_wlock(peers);
+
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    if (peers->config && rrp->config != *peers->config) {
+        goto fallback;
+    }
+#endif
+
+    if (peers->number == 0) {
+        goto fallback;
+    }
+
+    index = ngx_http_upstream_ewma_index(
+                               &ep->conf->peers[peers != ep->primary], peers);
+
+    if (index == NULL) {
+        goto fallback;
+    }
+
+    best = NULL;
+    best_cost = 0;
+    p = 0;
+
+    for (i = 0, n = 0; i < NGX_HTTP_UPSTREAM_EWMA_TRIES && n < 2; i++) {
+
+        x = ngx_random() % peers->number;
+        peer = index[x];
+
+        if (!ngx_http_upstream_ewma_available(rrp, peer, x, now)) {
+            continue;
+        }
+
+        if (best && x == p) {
+            continue;
+        }
+
+        ewma = ngx_http_upstream_ewma_decayed(peer, ep->conf->decay);
+        cost = (uint64_t) (ewma + 1) * (peer->conns + 1);
+
+        ngx_log_debug3(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                       "get ewma peer, candidate: %V %uL %ui",
+                       &peer->name, cost, peer->conns);
+
+        if (best == NULL
+            || cost * best->weight < best_cost * peer->weight)
+        {
+            best = peer;
+            best_cost = cost;
+            p = x;
+        }
+
+        n++;
+    }
+
+    if (best == NULL) {
+        goto fallback;
+    }
+
+    if (now - best->checked > best->fail_timeout) {
+        best->checked = now;
+    }
+
+    pc->sockaddr = best->sockaddr;
+    pc->socklen = best->socklen;
+    pc->name = &best->name;
+
+    best->conns++;
+
+    rrp->current = best;
+
+    n = p / (8 * sizeof(uintptr_t));
+    m = (ngx_vaddr_t) 1 << p % (8 * sizeof(uintptr_t));
+
+    rrp->tried[n] |= m;
+
+    ngx_http_upstream_rr_peers_unlock(peers);
+
+    return NGX_OK;
+
+fallback:
+
+    /* no available peer was chosen, the round robin checks them all */
+
+    ngx_http_upstream_rr_peers_unlock(peers);
+
+    return ngx_http_upstream_get_round_robin_peer(pc, rrp);
+}
+
+
+static void
+ngx_http_upstream_free_ewma_peer(ngx_peer_connection_t *pc, void *data,
+    ngx_uint_t state)
+{
+    ngx_http_upstream_ewma_peer_data_t  *ep = data;
+
+    ngx_msec_t                    decay, elapsed;
+    ngx_uint_t                    ewma, rtt;
+    ngx_http_upstream_t          *u;
+    ngx_http_upstream_rr_peer_t  *peer;
+
+    u = ep->upstream;
+    peer = ep->rrp.current;
+
+    if (state & NGX_PEER_FAILED
+        || peer == NULL
+        || u->state == NULL
+        || u->state->header_time == (ngx_msec_t) -1)
+    {
+        goto done;
+    }
+
+    /* the average is kept in microseconds */
+
+    rtt = u->state->header_time * 1000;
+    decay = ep->conf->decay;
+
+    ngx_http_upstream_rr_peers_rlock(ep->rrp.peers);
+    ngx_http_upstream_rr_peer_lock(ep->rrp.peers, peer);
+
+    ewma = ngx_http_upstream_ewma_decayed(peer, decay);
+
+    if (rtt >= ewma) {
+        ewma = rtt;
+
+    } else {
+        elapsed = ngx_current_msec - peer->ewma_time;
+
+        ewma = ((uint64_t) peer->ewma * decay + (uint64_t) rtt * elapsed)
+               / ((uint64_t) decay + elapsed);
+    }
+
+    peer->ewma = ewma;
+    peer->ewma_time = ngx_current_msec;
+
+    ngx_http_upstream_rr_peer_unlock(ep->rrp.peers, peer);
+    ngx_http_upstream_rr_peers_unlock(ep->rrp.peers);
+
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, pc->log, 0,
+                   "free ewma peer %V %M ewma:%ui",
+                   &peer->name, u->state->header_time, ewma);
+
+done:
+
+    ngx_http_upstream_free_round_robin_peer(pc, &ep->rrp, state);
+}
+
+
+static ngx_http_upstream_rr_peer_t **
+ngx_http_upstream_ewma_index(ngx_http_upstream_ewma_peers_t *ep,
+    ngx_http_upstream_rr_peers_t *peers)
+{
+    ngx_uint_t                     i, n, config;
+    ngx_http_upstream_rr_peer_t   *peer, **index;
+
+    /* the peers are locked */
+
+    config = 0;
+
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    if (peers->config) {
+        config = *peers->config;
+    }
+#endif
+
+    if (ep->peers == peers && ep->config == config) {
+        return ep->peer;
+    }
+
+    if (peers->number > ep->nalloc) {
+
+        /* the peers were added at run time */
+
+        n = 2 * peers->number;
+
+        index = ngx_palloc(ngx_cycle->pool,
+                           n * sizeof(ngx_http_upstream_rr_peer_t *));
+        if (index == NULL) {
+            return NULL;
+        }
+
+        ep->peer = index;
+        ep->nalloc = n;
+    }
+
+    for (i = 0, peer = peers->peer; peer; i++, peer = peer->next) {
+        ep->peer[i] = peer;
+    }
+
+    ep->peers = peers;
+    ep->config = config;
+
+    return ep->peer;
+}
+
+
+static ngx_uint_t
+ngx_http_upstream_ewma_available(ngx_http_upstream_rr_peer_data_t *rrp,
+    ngx_http_upstream_rr_peer_t *peer, ngx_uint_t i, time_t now)
+{
+    ngx_uint_t   n;
+    ngx_vaddr_t  m;
+
+    n = i / (8 * sizeof(uintptr_t));
+    m = (ngx_vaddr_t) 1 << i % (8 * sizeof(uintptr_t));
+
+    if (rrp->tried[n] & m) {
+        return 0;
+    }
+
+    if (peer->down) {
+        return 0;
+    }
+
+    if (peer->max_fails
+        && peer->fails >= peer->max_fails
+        && now - peer->checked <= peer->fail_timeout)
+    {
+        return 0;
+    }
+
+    if (peer->max_conns && peer->conns >= peer->max_conns) {
+        return 0;
+    }
+
+    return 1;
+}
+
+
+/*
+ * The average decays with time since the last response, so a peer
+ * once slow is eventually tried again.
+ */
+
+static ngx_uint_t
+ngx_http_upstream_ewma_decayed(ngx_http_upstream_rr_peer_t *peer,
+    ngx_msec_t decay)
+{
+    ngx_msec_t  elapsed;
+
+    elapsed = ngx_current_msec - peer->ewma_time;
+
+    return (uint64_t) peer->ewma * decay / ((uint64_t) decay + elapsed);
+}
+
+
+static void *
+ngx_http_upstream_ewma_create_conf(ngx_conf_t *cf)
+{
+    ngx_http_upstream_ewma_srv_conf_t  *conf;
+
+    conf = ngx_pcalloc(cf->pool, sizeof(ngx_http_upstream_ewma_srv_conf_t));
+    if (conf == NULL) {
+        return NULL;
+    }
+
+    /*
+     * set by ngx_pcalloc():
+     *
+     *     conf->peers = { { NULL, 0, 0, NULL }, { NULL, 0, 0, NULL } };
+     */
+
+    conf->decay = NGX_CONF_UNSET_MSEC;
+
+    return conf;
+}
+
+
+static char *
+ngx_http_upstream_ewma(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
+{
+    ngx_http_upstream_ewma_srv_conf_t  *ecf = conf;
+
+    ngx_str_t                     *value, s;
+    ngx_http_upstream_srv_conf_t  *uscf;
+
+    if (ecf->decay != NGX_CONF_UNSET_MSEC) {
+        return "is duplicate";
+    }
+
+    ecf->decay = 10000;
+
+    value = cf->args->elts;
+
+    if (cf->args->nelts == 2) {
+
+        if (ngx_strncmp(value[1].data, "decay=", 6) != 0) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "invalid parameter \"%V\"", &value[1]);
+            return NGX_CONF_ERROR;
+        }
+
+        s.len = value[1].len - 6;
+        s.data = value[1].data + 6;
+
+        ecf->decay = ngx_parse_time(&s, 0);
+
+        if (ecf->decay == (ngx_msec_t) NGX_ERROR || ecf->decay == 0) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "invalid decay \"%V\"", &value[1]);
+            return NGX_CONF_ERROR;
+        }
+    }
+
+    uscf = ngx_http_conf_get_module_srv_conf(cf, ngx_http_upstream_module);
+
+    if (uscf->peer.init_upstream) {
+        ngx_conf_log_error(NGX_LOG_WARN, cf, 0,
+                           "load balancing method redefined");
+    }
+
+    uscf->peer.init_upstream = ngx_http_upstream_init_ewma;
+
+    uscf->flags = NGX_HTTP_UPSTREAM_CREATE
+                  |NGX_HTTP_UPSTREAM_WEIGHT
+                  |NGX_HTTP_UPSTREAM_MAX_CONNS
+                  |NGX_HTTP_UPSTREAM_MAX_FAILS
+                  |NGX_HTTP_UPSTREAM_FAIL_TIMEOUT
+                  |NGX_HTTP_UPSTREAM_DOWN
+                  |NGX_HTTP_UPSTREAM_BACKUP;
+
+    return NGX_CONF_OK;
+}
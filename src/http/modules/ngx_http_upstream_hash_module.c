@@ -49,6 +49,9 @@ static ngx_int_t ngx_http_upstream_get_hash_peer(ngx_peer_connection_t *pc,
 
 static ngx_int_t ngx_http_upstream_init_chash(ngx_conf_t *cf,
     ngx_http_upstream_srv_conf_t *us);
+static void ngx_http_upstream_chash_add_points(
+    ngx_http_upstream_chash_points_t *points, ngx_str_t *server,
+    ngx_uint_t weight);
 static int ngx_libc_cdecl
     ngx_http_upstream_chash_cmp_points(const void *one, const void *two);
 static ngx_uint_t ngx_http_upstream_find_chash_point(
@@ -178,7 +181,19 @@ ngx_http_upstream_get_hash_peer(ngx_peer_connection_t *pc, void *data)
 
     ngx_http_upstream_rr_peers_wlock(hp->rrp.peers);
 
-    if (hp->tries > 20 || hp->rrp.peers->single) {
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    if (hp->rrp.peers->config
+        && hp->rrp.config != *hp->rrp.peers->config)
+    {
+        ngx_http_upstream_rr_peers_unlock(hp->rrp.peers);
+        return hp->get_rr_peer(pc, &hp->rrp);
+    }
+#endif
+
+    if (hp->tries > 20
+        || hp->rrp.peers->single
+        || hp->rrp.peers->number == 0)
+    {
         ngx_http_upstream_rr_peers_unlock(hp->rrp.peers);
         return hp->get_rr_peer(pc, &hp->rrp);
     }
@@ -279,19 +294,15 @@ ngx_http_upstream_get_hash_peer(ngx_peer_connection_t *pc, void *data)
 static ngx_int_t
 ngx_http_upstream_init_chash(ngx_conf_t *cf, ngx_http_upstream_srv_conf_t *us)
 {
-    u_char                             *host, *port, c;
-    size_t                              host_len, port_len, size;
-    uint32_t                            hash, base_hash;
-    ngx_str_t                          *server;
+    size_t                              size;
     ngx_uint_t                          npoints, i, j;
     ngx_http_upstream_rr_peer_t        *peer;
     ngx_http_upstream_rr_peers_t       *peers;
     ngx_http_upstream_chash_points_t   *points;
     ngx_http_upstream_hash_srv_conf_t  *hcf;
-    union {
-        uint32_t                        value;
-        u_char                          byte[4];
-    } prev_hash;
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    ngx_http_upstream_server_t         *server;
+#endif
 
     if (ngx_http_upstream_init_round_robin(cf, us) != NGX_OK) {
         return NGX_ERROR;
@@ -302,6 +313,23 @@ ngx_http_upstream_init_chash(ngx_conf_t *cf, ngx_http_upstream_srv_conf_t *us)
     peers = us->peer.data;
     npoints = peers->total_weight * 160;
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+
+    /*
+     * a name resolved at run time has the points of a single address,
+     * its peers are matched by the server name
+     */
+
+    server = us->servers->elts;
+
+    for (i = 0; i < us->servers->nelts; i++) {
+        if (server[i].host.len && !server[i].backup) {
+            npoints += server[i].weight * 160;
+        }
+    }
+
+#endif
+
     size = sizeof(ngx_http_upstream_chash_points_t)
            + sizeof(ngx_http_upstream_chash_point_t) * (npoints - 1);
 
@@ -313,74 +341,20 @@ ngx_http_upstream_init_chash(ngx_conf_t *cf, ngx_http_upstream_srv_conf_t *us)
     points->number = 0;
 
     for (peer = peers->peer; peer; peer = peer->next) {
-        server = &peer->server;
-
-        /*
-         * Hash expression is compatible with Cache::Memcached::Fast:
-         * crc32(HOST \0 PORT PREV_HASH).
-         */
-
-        if (server->len >= 5
-            && ngx_strncasecmp(server->data, (u_char *) "unix:", 5) == 0)
-        {
-            host = server->data + 5;
-            host_len = server->len - 5;
-            port = NULL;
-            port_len = 0;
-            goto done;
-        }
-
-        for (j = 0; j < server->len; j++) {
-            c = server->data[server->len - j - 1];
+        ngx_http_upstream_chash_add_points(points, &peer->server,
+                                           peer->weight);
+    }
 
-            if (c == ':') {
-                host = server->data;
-                host_len = server->len - j - 1;
-                port = server->data + server->len - j;
-                port_len = j;
-                goto done;
-            }
+#if (NGX_HTTP_UPSTREAM_ZONE)
 
-            if (c < '0' || c > '9') {
-                break;
-            }
+    for (i = 0; i < us->servers->nelts; i++) {
+        if (server[i].host.len && !server[i].backup) {
+            ngx_http_upstream_chash_add_points(points, &server[i].name,
+                                               server[i].weight);
         }
+    }
 
-        host = server->data;
-        host_len = server->len;
-        port = NULL;
-        port_len = 0;
-
-    done:
-
-        ngx_crc32_init(base_hash);
-        ngx_crc32_update(&base_hash, host, host_len);
-        ngx_crc32_update(&base_hash, (u_char *) "", 1);
-        ngx_crc32_update(&base_hash, port, port_len);
-
-        prev_hash.value = 0;
-        npoints = peer->weight * 160;
-
-        for (j = 0; j < npoints; j++) {
-            hash = base_hash;
-
-            ngx_crc32_update(&hash, prev_hash.byte, 4);
-            ngx_crc32_final(hash);
-
-            points->point[points->number].hash = hash;
-            points->point[points->number].server = server;
-            points->number++;
-
-#if (NGX_HAVE_LITTLE_ENDIAN)
-            prev_hash.value = hash;
-#else
-            prev_hash.byte[0] = (u_char) (hash & 0xff);
-            prev_hash.byte[1] = (u_char) ((hash >> 8) & 0xff);
-            prev_hash.byte[2] = (u_char) ((hash >> 16) & 0xff);
-            prev_hash.byte[3] = (u_char) ((hash >> 24) & 0xff);
 #endif
-        }
-    }
 
     ngx_qsort(points->point,
               points->number,
@@ -402,6 +376,87 @@ ngx_http_upstream_init_chash(ngx_conf_t *cf, ngx_http_upstream_srv_conf_t *us)
 }
 
 
+static void
+ngx_http_upstream_chash_add_points(ngx_http_upstream_chash_points_t *points,
+    ngx_str_t *server, ngx_uint_t weight)
+{
+    u_char      *host, *port, c;
+    size_t       host_len, port_len;
+    uint32_t     hash, base_hash;
+    ngx_uint_t   npoints, j;
+    union {
+        uint32_t  value;
+        u_char    byte[4];
+    } prev_hash;
+
+    /*
+     * Hash expression is compatible with Cache::Memcached::Fast:
+     * crc32(HOST \0 PORT PREV_HASH).
+     */
+
+    if (server->len >= 5
+        && ngx_strncasecmp(server->data, (u_char *) "unix:", 5) == 0)
+    {
+        host = server->data + 5;
+        host_len = server->len - 5;
+        port = NULL;
+        port_len = 0;
+        goto done;
+    }
+
+    for (j = 0; j < server->len; j++) {
+        c = server->data[server->len - j - 1];
+
+        if (c == ':') {
+            host = server->data;
+            host_len = server->len - j - 1;
+            port = server->data + server->len - j;
+            port_len = j;
+            goto done;
+        }
+
+        if (c < '0' || c > '9') {
+            break;
+        }
+    }
+
+    host = server->data;
+    host_len = server->len;
+    port = NULL;
+    port_len = 0;
+
+done:
+
+    ngx_crc32_init(base_hash);
+    ngx_crc32_update(&base_hash, host, host_len);
+    ngx_crc32_update(&base_hash, (u_char *) "", 1);
+    ngx_crc32_update(&base_hash, port, port_len);
+
+    prev_hash.value = 0;
+    npoints = weight * 160;
+
+    for (j = 0; j < npoints; j++) {
+        hash = base_hash;
+
+        ngx_crc32_update(&hash, prev_hash.byte, 4);
+        ngx_crc32_final(hash);
+
+        points->point[points->number].hash = hash;
+        points->point[points->number].server = server;
+        points->number++;
+
+#if (NGX_HAVE_LITTLE_ENDIAN)
+        prev_hash.value = hash;
+#else
+        prev_hash.byte[0] = (u_char) (hash & 0xff);
+        prev_hash.byte[1] = (u_char) ((hash >> 8) & 0xff);
+        prev_hash.byte[2] = (u_char) ((hash >> 16) & 0xff);
+        prev_hash.byte[3] = (u_char) ((hash >> 24) & 0xff);
+#endif
+    }
+}
+
+
 static int ngx_libc_cdecl
 ngx_http_upstream_chash_cmp_points(const void *one, const void *two)
 {
@@ -503,7 +558,19 @@ ngx_http_upstream_get_chash_peer(ngx_peer_connection_t *pc, void *data)
 
     ngx_http_upstream_rr_peers_wlock(hp->rrp.peers);
 
-    if (hp->tries > 20 || hp->rrp.peers->single) {
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    if (hp->rrp.peers->config
+        && hp->rrp.config != *hp->rrp.peers->config)
+    {
+        ngx_http_upstream_rr_peers_unlock(hp->rrp.peers);
+        return hp->get_rr_peer(pc, &hp->rrp);
+    }
+#endif
+
+    if (hp->tries > 20
+        || hp->rrp.peers->single
+        || hp->rrp.peers->number == 0)
+    {
         ngx_http_upstream_rr_peers_unlock(hp->rrp.peers);
         return hp->get_rr_peer(pc, &hp->rrp);
     }
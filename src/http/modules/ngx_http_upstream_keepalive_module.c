@@ -10,12 +10,45 @@
 #include <ngx_http.h>
 
 
+typedef struct ngx_http_upstream_keepalive_bucket_s
+    ngx_http_upstream_keepalive_bucket_t;
+
+/*
+ * Cached connections are kept in a bucket of their peer, looked up
+ * by the peer address in a hash, as well as in the common LRU queue.
+ * Peers not known at configuration time share the "other" bucket,
+ * where connections are matched by address.
+ */
+
+struct ngx_http_upstream_keepalive_bucket_s {
+    ngx_queue_t                        cache;
+    ngx_uint_t                         cached;
+
+    ngx_uint_t                         hits;
+    ngx_uint_t                         misses;
+
+    ngx_str_t                          name;
+    struct sockaddr                   *sockaddr;
+    socklen_t                          socklen;
+
+    ngx_http_upstream_keepalive_bucket_t  *next;
+};
+
+
 typedef struct {
     ngx_uint_t                         max_cached;
+    ngx_uint_t                         max_peer;
+
+    ngx_msec_t                         timeout;
+    ngx_uint_t                         requests;
 
     ngx_queue_t                        cache;
     ngx_queue_t                        free;
 
+    ngx_http_upstream_keepalive_bucket_t  **buckets;
+    ngx_uint_t                         nbuckets;
+    ngx_http_upstream_keepalive_bucket_t   other;
+
     ngx_http_upstream_init_pt          original_init_upstream;
     ngx_http_upstream_init_peer_pt     original_init_peer;
 
@@ -24,8 +57,10 @@ typedef struct {
 
 typedef struct {
     ngx_http_upstream_keepalive_srv_conf_t  *conf;
+    ngx_http_upstream_keepalive_bucket_t    *bucket;
 
     ngx_queue_t                        queue;
+    ngx_queue_t                        peer_queue;
     ngx_connection_t                  *connection;
 
     socklen_t                          socklen;
@@ -58,6 +93,12 @@ static ngx_int_t ngx_http_upstream_get_keepalive_peer(ngx_peer_connection_t *pc,
     void *data);
 static void ngx_http_upstream_free_keepalive_peer(ngx_peer_connection_t *pc,
     void *data, ngx_uint_t state);
+static ngx_http_upstream_keepalive_bucket_t *
+    ngx_http_upstream_keepalive_bucket(
+    ngx_http_upstream_keepalive_srv_conf_t *kcf, struct sockaddr *sockaddr,
+    socklen_t socklen);
+static void ngx_http_upstream_keepalive_remove(
+    ngx_http_upstream_keepalive_cache_t *item);
 
 static void ngx_http_upstream_keepalive_dummy_handler(ngx_event_t *ev);
 static void ngx_http_upstream_keepalive_close_handler(ngx_event_t *ev);
@@ -70,20 +111,46 @@ static void ngx_http_upstream_keepalive_save_session(ngx_peer_connection_t *pc,
     void *data);
 #endif
 
+static ngx_int_t ngx_http_upstream_keepalive_status_handler(
+    ngx_http_request_t *r);
+
 static void *ngx_http_upstream_keepalive_create_conf(ngx_conf_t *cf);
 static char *ngx_http_upstream_keepalive(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
+static char *ngx_http_upstream_keepalive_status(ngx_conf_t *cf,
+    ngx_command_t *cmd, void *conf);
 
 
 static ngx_command_t  ngx_http_upstream_keepalive_commands[] = {
 
     { ngx_string("keepalive"),
-      NGX_HTTP_UPS_CONF|NGX_CONF_TAKE1,
+      NGX_HTTP_UPS_CONF|NGX_CONF_TAKE12,
       ngx_http_upstream_keepalive,
       NGX_HTTP_SRV_CONF_OFFSET,
       0,
       NULL },
 
+    { ngx_string("keepalive_timeout"),
+      NGX_HTTP_UPS_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_msec_slot,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      offsetof(ngx_http_upstream_keepalive_srv_conf_t, timeout),
+      NULL },
+
+    { ngx_string("keepalive_requests"),
+      NGX_HTTP_UPS_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_num_slot,
+      NGX_HTTP_SRV_CONF_OFFSET,
+      offsetof(ngx_http_upstream_keepalive_srv_conf_t, requests),
+      NULL },
+
+    { ngx_string("upstream_keepalive_status"),
+      NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_NOARGS,
+      ngx_http_upstream_keepalive_status,
+      0,
+      0,
+      NULL },
+
       ngx_null_command
 };
 
@@ -123,9 +190,13 @@ static ngx_int_t
 ngx_http_upstream_init_keepalive(ngx_conf_t *cf,
     ngx_http_upstream_srv_conf_t *us)
 {
-    ngx_uint_t                               i;
-    ngx_http_upstream_keepalive_srv_conf_t  *kcf;
+    uint32_t                                 hash;
+    ngx_uint_t                               i, n;
+    ngx_http_upstream_rr_peer_t             *peer;
+    ngx_http_upstream_rr_peers_t            *peers;
     ngx_http_upstream_keepalive_cache_t     *cached;
+    ngx_http_upstream_keepalive_bucket_t    *bucket;
+    ngx_http_upstream_keepalive_srv_conf_t  *kcf;
 
     ngx_log_debug0(NGX_LOG_DEBUG_HTTP, cf->log, 0,
                    "init keepalive");
@@ -133,6 +204,9 @@ ngx_http_upstream_init_keepalive(ngx_conf_t *cf,
     kcf = ngx_http_conf_upstream_srv_conf(us,
                                           ngx_http_upstream_keepalive_module);
 
+    ngx_conf_init_msec_value(kcf->timeout, 60000);
+    ngx_conf_init_uint_value(kcf->requests, 100);
+
     if (kcf->original_init_upstream(cf, us) != NGX_OK) {
         return NGX_ERROR;
     }
@@ -157,6 +231,56 @@ ngx_http_upstream_init_keepalive(ngx_conf_t *cf,
         cached[i].conf = kcf;
     }
 
+    /* create a bucket for each peer address */
+
+    ngx_queue_init(&kcf->other.cache);
+    ngx_str_set(&kcf->other.name, "other");
+
+    n = 0;
+
+    for (peers = us->peer.data; peers; peers = peers->next) {
+        n += peers->number;
+    }
+
+    for (kcf->nbuckets = 1; kcf->nbuckets < 2 * n; kcf->nbuckets <<= 1) {
+        /* void */
+    }
+
+    kcf->buckets = ngx_pcalloc(cf->pool,
+               sizeof(ngx_http_upstream_keepalive_bucket_t *) * kcf->nbuckets);
+    if (kcf->buckets == NULL) {
+        return NGX_ERROR;
+    }
+
+    for (peers = us->peer.data; peers; peers = peers->next) {
+        for (peer = peers->peer; peer; peer = peer->next) {
+
+            bucket = ngx_http_upstream_keepalive_bucket(kcf, peer->sockaddr,
+                                                        peer->socklen);
+            if (bucket != &kcf->other) {
+                continue;
+            }
+
+            bucket = ngx_pcalloc(cf->pool,
+                                 sizeof(ngx_http_upstream_keepalive_bucket_t));
+            if (bucket == NULL) {
+                return NGX_ERROR;
+            }
+
+            ngx_queue_init(&bucket->cache);
+
+            bucket->name = peer->name;
+            bucket->sockaddr = peer->sockaddr;
+            bucket->socklen = peer->socklen;
+
+            hash = ngx_crc32_short((u_char *) peer->sockaddr, peer->socklen);
+            hash &= kcf->nbuckets - 1;
+
+            bucket->next = kcf->buckets[hash];
+            kcf->buckets[hash] = bucket;
+        }
+    }
+
     return NGX_OK;
 }
 
@@ -209,6 +333,7 @@ ngx_http_upstream_get_keepalive_peer(ngx_peer_connection_t *pc, void *data)
 {
     ngx_http_upstream_keepalive_peer_data_t  *kp = data;
     ngx_http_upstream_keepalive_cache_t      *item;
+    ngx_http_upstream_keepalive_bucket_t     *bucket;
 
     ngx_int_t          rc;
     ngx_queue_t       *q, *cache;
@@ -227,33 +352,59 @@ ngx_http_upstream_get_keepalive_peer(ngx_peer_connection_t *pc, void *data)
 
     /* search cache for suitable connection */
 
-    cache = &kp->conf->cache;
+    bucket = ngx_http_upstream_keepalive_bucket(kp->conf, pc->sockaddr,
+                                                pc->socklen);
+    cache = &bucket->cache;
+
+    if (bucket != &kp->conf->other) {
+
+        if (!ngx_queue_empty(cache)) {
+            q = ngx_queue_head(cache);
+            item = ngx_queue_data(q, ngx_http_upstream_keepalive_cache_t,
+                                  peer_queue);
+            goto found;
+        }
+
+        bucket->misses++;
+
+        return NGX_OK;
+    }
 
     for (q = ngx_queue_head(cache);
          q != ngx_queue_sentinel(cache);
          q = ngx_queue_next(q))
     {
-        item = ngx_queue_data(q, ngx_http_upstream_keepalive_cache_t, queue);
-        c = item->connection;
+        item = ngx_queue_data(q, ngx_http_upstream_keepalive_cache_t,
+                              peer_queue);
 
         if (ngx_memn2cmp((u_char *) &item->sockaddr, (u_char *) pc->sockaddr,
                          item->socklen, pc->socklen)
             == 0)
         {
-            ngx_queue_remove(q);
-            ngx_queue_insert_head(&kp->conf->free, q);
-
             goto found;
         }
     }
 
+    bucket->misses++;
+
     return NGX_OK;
 
 found:
 
+    bucket->hits++;
+
+    ngx_http_upstream_keepalive_remove(item);
+    ngx_queue_insert_head(&kp->conf->free, &item->queue);
+
+    c = item->connection;
+
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, pc->log, 0,
                    "get keepalive peer: using connection %p", c);
 
+    if (c->read->timer_set) {
+        ngx_del_timer(c->read);
+    }
+
     c->idle = 0;
     c->sent = 0;
     c->log = pc->log;
@@ -274,6 +425,7 @@ ngx_http_upstream_free_keepalive_peer(ngx_peer_connection_t *pc, void *data,
 {
     ngx_http_upstream_keepalive_peer_data_t  *kp = data;
     ngx_http_upstream_keepalive_cache_t      *item;
+    ngx_http_upstream_keepalive_bucket_t     *bucket;
 
     ngx_queue_t          *q;
     ngx_connection_t     *c;
@@ -298,6 +450,10 @@ ngx_http_upstream_free_keepalive_peer(ngx_peer_connection_t *pc, void *data,
         goto invalid;
     }
 
+    if (c->requests >= kp->conf->requests) {
+        goto invalid;
+    }
+
     if (!u->keepalive) {
         goto invalid;
     }
@@ -317,13 +473,28 @@ ngx_http_upstream_free_keepalive_peer(ngx_peer_connection_t *pc, void *data,
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, pc->log, 0,
                    "free keepalive peer: saving connection %p", c);
 
-    if (ngx_queue_empty(&kp->conf->free)) {
+    bucket = ngx_http_upstream_keepalive_bucket(kp->conf, pc->sockaddr,
+                                                pc->socklen);
 
-        q = ngx_queue_last(&kp->conf->cache);
-        ngx_queue_remove(q);
+    if (kp->conf->max_peer
+        && bucket->cached >= kp->conf->max_peer
+        && bucket != &kp->conf->other)
+    {
+        /* the least recently used connection of the peer */
+
+        q = ngx_queue_last(&bucket->cache);
+        item = ngx_queue_data(q, ngx_http_upstream_keepalive_cache_t,
+                              peer_queue);
 
+        ngx_http_upstream_keepalive_remove(item);
+        ngx_http_upstream_keepalive_close(item->connection);
+
+    } else if (ngx_queue_empty(&kp->conf->free)) {
+
+        q = ngx_queue_last(&kp->conf->cache);
         item = ngx_queue_data(q, ngx_http_upstream_keepalive_cache_t, queue);
 
+        ngx_http_upstream_keepalive_remove(item);
         ngx_http_upstream_keepalive_close(item->connection);
 
     } else {
@@ -333,8 +504,12 @@ ngx_http_upstream_free_keepalive_peer(ngx_peer_connection_t *pc, void *data,
         item = ngx_queue_data(q, ngx_http_upstream_keepalive_cache_t, queue);
     }
 
-    ngx_queue_insert_head(&kp->conf->cache, q);
+    ngx_queue_insert_head(&kp->conf->cache, &item->queue);
+    ngx_queue_insert_head(&bucket->cache, &item->peer_queue);
 
+    bucket->cached++;
+
+    item->bucket = bucket;
     item->connection = c;
 
     pc->connection = NULL;
@@ -360,6 +535,8 @@ ngx_http_upstream_free_keepalive_peer(ngx_peer_connection_t *pc, void *data,
     item->socklen = pc->socklen;
     ngx_memcpy(&item->sockaddr, pc->sockaddr, pc->socklen);
 
+    ngx_add_timer(c->read, kp->conf->timeout);
+
     if (c->read->ready) {
         ngx_http_upstream_keepalive_close_handler(c->read);
     }
@@ -370,6 +547,41 @@ invalid:
 }
 
 
+static ngx_http_upstream_keepalive_bucket_t *
+ngx_http_upstream_keepalive_bucket(ngx_http_upstream_keepalive_srv_conf_t *kcf,
+    struct sockaddr *sockaddr, socklen_t socklen)
+{
+    uint32_t                               hash;
+    ngx_http_upstream_keepalive_bucket_t  *bucket;
+
+    hash = ngx_crc32_short((u_char *) sockaddr, socklen);
+
+    for (bucket = kcf->buckets[hash & (kcf->nbuckets - 1)];
+         bucket;
+         bucket = bucket->next)
+    {
+        if (ngx_memn2cmp((u_char *) bucket->sockaddr, (u_char *) sockaddr,
+                         bucket->socklen, socklen)
+            == 0)
+        {
+            return bucket;
+        }
+    }
+
+    return &kcf->other;
+}
+
+
+static void
+ngx_http_upstream_keepalive_remove(ngx_http_upstream_keepalive_cache_t *item)
+{
+    ngx_queue_remove(&item->queue);
+    ngx_queue_remove(&item->peer_queue);
+
+    item->bucket->cached--;
+}
+
+
 static void
 ngx_http_upstream_keepalive_dummy_handler(ngx_event_t *ev)
 {
@@ -393,7 +605,7 @@ ngx_http_upstream_keepalive_close_handler(ngx_event_t *ev)
 
     c = ev->data;
 
-    if (c->close) {
+    if (c->close || c->read->timedout) {
         goto close;
     }
 
@@ -416,7 +628,7 @@ close:
 
     ngx_http_upstream_keepalive_close(c);
 
-    ngx_queue_remove(&item->queue);
+    ngx_http_upstream_keepalive_remove(item);
     ngx_queue_insert_head(&conf->free, &item->queue);
 }
 
@@ -467,6 +679,142 @@ ngx_http_upstream_keepalive_save_session(ngx_peer_connection_t *pc, void *data)
 #endif
 
 
+/*
+ * Connection reuse by peer in the worker process serving the request.
+ */
+
+static ngx_int_t
+ngx_http_upstream_keepalive_status_handler(ngx_http_request_t *r)
+{
+    size_t                                   size;
+    ngx_int_t                                rc;
+    ngx_buf_t                               *b;
+    ngx_uint_t                               i, j, cached;
+    ngx_chain_t                              out;
+    ngx_http_upstream_srv_conf_t           **uscfp;
+    ngx_http_upstream_main_conf_t           *umcf;
+    ngx_http_upstream_keepalive_bucket_t    *bucket;
+    ngx_http_upstream_keepalive_srv_conf_t  *kcf;
+
+    if (!(r->method & (NGX_HTTP_GET|NGX_HTTP_HEAD))) {
+        return NGX_HTTP_NOT_ALLOWED;
+    }
+
+    rc = ngx_http_discard_request_body(r);
+
+    if (rc != NGX_OK) {
+        return rc;
+    }
+
+    r->headers_out.content_type_len = sizeof("text/plain") - 1;
+    ngx_str_set(&r->headers_out.content_type, "text/plain");
+    r->headers_out.content_type_lowcase = NULL;
+
+    if (r->method == NGX_HTTP_HEAD) {
+        r->headers_out.status = NGX_HTTP_OK;
+
+        rc = ngx_http_send_header(r);
+
+        if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+            return rc;
+        }
+    }
+
+    umcf = ngx_http_get_module_main_conf(r, ngx_http_upstream_module);
+    uscfp = umcf->upstreams.elts;
+
+    size = sizeof("Worker: \n") + NGX_INT64_LEN;
+
+    for (i = 0; i < umcf->upstreams.nelts; i++) {
+
+        if (uscfp[i]->srv_conf == NULL) {
+            continue;
+        }
+
+        kcf = ngx_http_conf_upstream_srv_conf(uscfp[i],
+                                          ngx_http_upstream_keepalive_module);
+
+        if (kcf->max_cached == 0) {
+            continue;
+        }
+
+        size += sizeof("Upstream :  idle\n") + uscfp[i]->host.len
+                + NGX_INT_T_LEN;
+
+        for (j = 0; j <= kcf->nbuckets; j++) {
+
+            bucket = (j < kcf->nbuckets) ? kcf->buckets[j] : &kcf->other;
+
+            for ( /* void */ ; bucket; bucket = bucket->next) {
+                size += sizeof(" : idle  hits  misses \n") + bucket->name.len
+                        + 3 * NGX_INT_T_LEN;
+            }
+        }
+    }
+
+    b = ngx_create_temp_buf(r->pool, size);
+    if (b == NULL) {
+        return NGX_HTTP_INTERNAL_SERVER_ERROR;
+    }
+
+    out.buf = b;
+    out.next = NULL;
+
+    b->last = ngx_sprintf(b->last, "Worker: %P\n", ngx_pid);
+
+    for (i = 0; i < umcf->upstreams.nelts; i++) {
+
+        if (uscfp[i]->srv_conf == NULL) {
+            continue;
+        }
+
+        kcf = ngx_http_conf_upstream_srv_conf(uscfp[i],
+                                          ngx_http_upstream_keepalive_module);
+
+        if (kcf->max_cached == 0) {
+            continue;
+        }
+
+        cached = kcf->other.cached;
+
+        for (j = 0; j < kcf->nbuckets; j++) {
+            for (bucket = kcf->buckets[j]; bucket; bucket = bucket->next) {
+                cached += bucket->cached;
+            }
+        }
+
+        b->last = ngx_sprintf(b->last, "Upstream %V: %ui idle\n",
+                              &uscfp[i]->host, cached);
+
+        for (j = 0; j <= kcf->nbuckets; j++) {
+
+            bucket = (j < kcf->nbuckets) ? kcf->buckets[j] : &kcf->other;
+
+            for ( /* void */ ; bucket; bucket = bucket->next) {
+                b->last = ngx_sprintf(b->last,
+                                      " %V: idle %ui hits %ui misses %ui\n",
+                                      &bucket->name, bucket->cached,
+                                      bucket->hits, bucket->misses);
+            }
+        }
+    }
+
+    r->headers_out.status = NGX_HTTP_OK;
+    r->headers_out.content_length_n = b->last - b->pos;
+
+    b->last_buf = (r == r->main) ? 1 : 0;
+    b->last_in_chain = 1;
+
+    rc = ngx_http_send_header(r);
+
+    if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+        return rc;
+    }
+
+    return ngx_http_output_filter(r, &out);
+}
+
+
 static void *
 ngx_http_upstream_keepalive_create_conf(ngx_conf_t *cf)
 {
@@ -484,8 +832,12 @@ ngx_http_upstream_keepalive_create_conf(ngx_conf_t *cf)
      *     conf->original_init_upstream = NULL;
      *     conf->original_init_peer = NULL;
      *     conf->max_cached = 0;
+     *     conf->max_peer = 0;
      */
 
+    conf->timeout = NGX_CONF_UNSET_MSEC;
+    conf->requests = NGX_CONF_UNSET_UINT;
+
     return conf;
 }
 
@@ -518,6 +870,25 @@ ngx_http_upstream_keepalive(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
     kcf->max_cached = n;
 
+    if (cf->args->nelts == 3) {
+
+        if (ngx_strncmp(value[2].data, "max_per_peer=", 13) != 0) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "invalid parameter \"%V\"", &value[2]);
+            return NGX_CONF_ERROR;
+        }
+
+        n = ngx_atoi(value[2].data + 13, value[2].len - 13);
+
+        if (n == NGX_ERROR || n == 0) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "invalid parameter \"%V\"", &value[2]);
+            return NGX_CONF_ERROR;
+        }
+
+        kcf->max_peer = n;
+    }
+
     uscf = ngx_http_conf_get_module_srv_conf(cf, ngx_http_upstream_module);
 
     kcf->original_init_upstream = uscf->peer.init_upstream
@@ -528,3 +899,16 @@ ngx_http_upstream_keepalive(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
     return NGX_CONF_OK;
 }
+
+
+static char *
+ngx_http_upstream_keepalive_status(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf)
+{
+    ngx_http_core_loc_conf_t  *clcf;
+
+    clcf = ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module);
+    clcf->handler = ngx_http_upstream_keepalive_status_handler;
+
+    return NGX_CONF_OK;
+}
@@ -10,6 +10,14 @@
 #include <ngx_http.h>
 
 
+typedef struct {
+    ngx_http_upstream_server_t     *server;
+    ngx_http_upstream_srv_conf_t   *upstream;
+    ngx_http_upstream_rr_peers_t   *peers;
+    ngx_event_t                     event;
+} ngx_http_upstream_zone_host_t;
+
+
 static char *ngx_http_upstream_zone(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 static ngx_int_t ngx_http_upstream_init_zone(ngx_shm_zone_t *shm_zone,
@@ -18,6 +26,18 @@ static ngx_http_upstream_rr_peers_t *ngx_http_upstream_zone_copy_peers(
     ngx_slab_pool_t *shpool, ngx_http_upstream_srv_conf_t *uscf);
 static ngx_http_upstream_rr_peer_t *ngx_http_upstream_zone_copy_peer(
     ngx_http_upstream_rr_peers_t *peers, ngx_http_upstream_rr_peer_t *src);
+static void ngx_http_upstream_zone_free_peer_locked(
+    ngx_http_upstream_rr_peers_t *peers, ngx_http_upstream_rr_peer_t *peer);
+
+static ngx_int_t ngx_http_upstream_zone_init_process(ngx_cycle_t *cycle);
+static void ngx_http_upstream_zone_resolve_timer(ngx_event_t *event);
+static void ngx_http_upstream_zone_resolve_handler(ngx_resolver_ctx_t *ctx);
+static void ngx_http_upstream_zone_update(ngx_http_upstream_zone_host_t *host,
+    ngx_resolver_addr_t *addrs, ngx_uint_t naddrs);
+static void ngx_http_upstream_zone_free_zombies(
+    ngx_http_upstream_rr_peers_t *peers);
+static ngx_int_t ngx_http_upstream_zone_add_peer_locked(
+    ngx_http_upstream_zone_host_t *host, ngx_resolver_addr_t *addr);
 
 
 static ngx_command_t  ngx_http_upstream_zone_commands[] = {
@@ -55,7 +75,7 @@ ngx_module_t  ngx_http_upstream_zone_module = {
     NGX_HTTP_MODULE,                       /* module type */
     NULL,                                  /* init master */
     NULL,                                  /* init module */
-    NULL,                                  /* init process */
+    ngx_http_upstream_zone_init_process,   /* init process */
     NULL,                                  /* init thread */
     NULL,                                  /* exit thread */
     NULL,                                  /* exit process */
@@ -188,9 +208,15 @@ ngx_http_upstream_zone_copy_peers(ngx_slab_pool_t *shpool,
     ngx_http_upstream_srv_conf_t *uscf)
 {
     ngx_str_t                     *name;
+    ngx_uint_t                    *config;
     ngx_http_upstream_rr_peer_t   *peer, **peerp;
     ngx_http_upstream_rr_peers_t  *peers, *backup;
 
+    config = ngx_slab_calloc(shpool, sizeof(ngx_uint_t));
+    if (config == NULL) {
+        return NULL;
+    }
+
     peers = ngx_slab_alloc(shpool, sizeof(ngx_http_upstream_rr_peers_t));
     if (peers == NULL) {
         return NULL;
@@ -214,6 +240,7 @@ ngx_http_upstream_zone_copy_peers(ngx_slab_pool_t *shpool,
     peers->name = name;
 
     peers->shpool = shpool;
+    peers->config = config;
 
     for (peerp = &peers->peer; *peerp; peerp = &peer->next) {
         /* pool is unlocked */
@@ -239,6 +266,7 @@ ngx_http_upstream_zone_copy_peers(ngx_slab_pool_t *shpool,
     backup->name = name;
 
     backup->shpool = shpool;
+    backup->config = config;
 
     for (peerp = &backup->peer; *peerp; peerp = &peer->next) {
         /* pool is unlocked */
@@ -323,3 +351,415 @@ failed:
 
     return NULL;
 }
+
+
+static void
+ngx_http_upstream_zone_free_peer_locked(ngx_http_upstream_rr_peers_t *peers,
+    ngx_http_upstream_rr_peer_t *peer)
+{
+    ngx_slab_pool_t  *pool;
+
+    pool = peers->shpool;
+
+    if (peer->server.data) {
+        ngx_slab_free_locked(pool, peer->server.data);
+    }
+
+    if (peer->name.data) {
+        ngx_slab_free_locked(pool, peer->name.data);
+    }
+
+    if (peer->sockaddr) {
+        ngx_slab_free_locked(pool, peer->sockaddr);
+    }
+
+#if (NGX_HTTP_SSL)
+    if (peer->ssl_session) {
+        ngx_slab_free_locked(pool, peer->ssl_session);
+    }
+#endif
+
+    ngx_slab_free_locked(pool, peer);
+}
+
+
+/*
+ * Each name resolved at run time is resolved by one worker process,
+ * which updates the peers in the zone for all of them.
+ */
+
+static ngx_int_t
+ngx_http_upstream_zone_init_process(ngx_cycle_t *cycle)
+{
+    ngx_uint_t                      i, j, n;
+    ngx_core_conf_t                *ccf;
+    ngx_http_upstream_server_t     *server;
+    ngx_http_upstream_rr_peers_t   *peers;
+    ngx_http_upstream_srv_conf_t   *uscf, **uscfp;
+    ngx_http_upstream_zone_host_t  *host;
+    ngx_http_upstream_main_conf_t  *umcf;
+
+    if (ngx_process != NGX_PROCESS_WORKER
+        && ngx_process != NGX_PROCESS_SINGLE)
+    {
+        return NGX_OK;
+    }
+
+    umcf = ngx_http_cycle_get_module_main_conf(cycle,
+                                               ngx_http_upstream_module);
+
+    if (umcf == NULL) {
+        return NGX_OK;
+    }
+
+    ccf = (ngx_core_conf_t *) ngx_get_conf(cycle->conf_ctx, ngx_core_module);
+
+    uscfp = umcf->upstreams.elts;
+    n = 0;
+
+    for (i = 0; i < umcf->upstreams.nelts; i++) {
+        uscf = uscfp[i];
+
+        if (uscf->shm_zone == NULL || uscf->resolver == NULL) {
+            continue;
+        }
+
+        server = uscf->servers->elts;
+
+        for (j = 0; j < uscf->servers->nelts; j++) {
+
+            if (server[j].host.len == 0) {
+                continue;
+            }
+
+            if (ngx_process == NGX_PROCESS_WORKER
+                && n++ % ccf->worker_processes != (ngx_uint_t) ngx_worker)
+            {
+                continue;
+            }
+
+            peers = uscf->peer.data;
+
+            if (server[j].backup) {
+                peers = peers->next;
+            }
+
+            host = ngx_pcalloc(cycle->pool,
+                               sizeof(ngx_http_upstream_zone_host_t));
+            if (host == NULL) {
+                return NGX_ERROR;
+            }
+
+            host->server = &server[j];
+            host->upstream = uscf;
+            host->peers = peers;
+
+            host->event.handler = ngx_http_upstream_zone_resolve_timer;
+            host->event.data = host;
+            host->event.log = cycle->log;
+            host->event.cancelable = 1;
+
+            ngx_add_timer(&host->event, 1);
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_upstream_zone_resolve_timer(ngx_event_t *event)
+{
+    ngx_resolver_ctx_t             *ctx;
+    ngx_http_upstream_zone_host_t  *host;
+
+    host = event->data;
+
+    ngx_http_upstream_zone_free_zombies(host->peers);
+
+    ctx = ngx_resolve_start(host->upstream->resolver, NULL);
+    if (ctx == NULL) {
+        goto retry;
+    }
+
+    if (ctx == NGX_NO_RESOLVER) {
+        ngx_log_error(NGX_LOG_ERR, event->log, 0,
+                      "no resolver defined to resolve %V",
+                      &host->server->host);
+        return;
+    }
+
+    ctx->name = host->server->host;
+    ctx->handler = ngx_http_upstream_zone_resolve_handler;
+    ctx->data = host;
+    ctx->timeout = host->upstream->resolver_timeout;
+    ctx->cancelable = 1;
+
+    if (ngx_resolve_name(ctx) == NGX_OK) {
+        return;
+    }
+
+retry:
+
+    ngx_add_timer(event, ngx_max(host->upstream->resolver_timeout, 1000));
+}
+
+
+static void
+ngx_http_upstream_zone_resolve_handler(ngx_resolver_ctx_t *ctx)
+{
+    time_t                          now;
+    ngx_msec_t                      timer;
+    ngx_event_t                    *event;
+    ngx_http_upstream_zone_host_t  *host;
+
+    host = ctx->data;
+    event = &host->event;
+
+    if (ctx->state) {
+        ngx_log_error(NGX_LOG_ERR, event->log, 0,
+                      "upstream \"%V\" server %V could not be resolved "
+                      "(%i: %s)", &host->upstream->host, &host->server->name,
+                      ctx->state, ngx_resolver_strerror(ctx->state));
+
+        /*
+         * a name which does not exist anymore has no peers, while
+         * the peers are kept on other errors, such as timeouts
+         */
+
+        if (ctx->state == NGX_RESOLVE_NXDOMAIN) {
+            ngx_http_upstream_zone_update(host, NULL, 0);
+        }
+
+    } else {
+        ngx_log_debug3(NGX_LOG_DEBUG_HTTP, event->log, 0,
+                       "upstream \"%V\" server %V resolved, naddrs:%ui",
+                       &host->upstream->host, &host->server->name,
+                       ctx->naddrs);
+
+        ngx_http_upstream_zone_update(host, ctx->addrs, ctx->naddrs);
+    }
+
+    /*
+     * the name is resolved again once the answer expires; a second later,
+     * as the resolver still considers the answer valid within the second
+     */
+
+    now = ngx_time();
+
+    timer = (ctx->valid > now) ? (ngx_msec_t) (ctx->valid - now) * 1000 : 0;
+    timer += 1000;
+
+    if (ctx->state && timer < 10000) {
+        timer = 10000;
+    }
+
+    ngx_resolve_name_done(ctx);
+
+    ngx_add_timer(event, timer);
+}
+
+
+/*
+ * Peers of addresses no longer resolved are removed, and the new ones
+ * are added, while the state of peers with the same addresses is kept.
+ * A removed peer still in use is kept as a zombie until released.
+ */
+
+static void
+ngx_http_upstream_zone_update(ngx_http_upstream_zone_host_t *host,
+    ngx_resolver_addr_t *addrs, ngx_uint_t naddrs)
+{
+    ngx_uint_t                     i, changed;
+    ngx_http_upstream_rr_peer_t   *peer, **peerp;
+    ngx_http_upstream_rr_peers_t  *peers;
+    ngx_http_upstream_server_t    *server;
+
+    server = host->server;
+    peers = host->peers;
+    changed = 0;
+
+    for (i = 0; i < naddrs; i++) {
+        ngx_inet_set_port(addrs[i].sockaddr, server->port);
+    }
+
+    ngx_http_upstream_rr_peers_wlock(peers);
+    ngx_shmtx_lock(&peers->shpool->mutex);
+
+    for (peerp = &peers->peer; *peerp; /* void */) {
+        peer = *peerp;
+
+        if (peer->host != server) {
+            peerp = &peer->next;
+            continue;
+        }
+
+        for (i = 0; i < naddrs; i++) {
+            if (ngx_cmp_sockaddr(peer->sockaddr, peer->socklen,
+                                 addrs[i].sockaddr, addrs[i].socklen, 1)
+                == NGX_OK)
+            {
+                break;
+            }
+        }
+
+        if (i < naddrs) {
+            peerp = &peer->next;
+            continue;
+        }
+
+        ngx_log_error(NGX_LOG_NOTICE, host->event.log, 0,
+                      "upstream \"%V\" peer %V of %V removed",
+                      &host->upstream->host, &peer->name, &server->name);
+
+        *peerp = peer->next;
+
+        peers->number--;
+        peers->total_weight -= peer->weight;
+        changed = 1;
+
+        if (peer->conns) {
+            peer->next = peers->zombies;
+            peers->zombies = peer;
+            continue;
+        }
+
+        ngx_http_upstream_zone_free_peer_locked(peers, peer);
+    }
+
+    for (i = 0; i < naddrs; i++) {
+
+        for (peer = peers->peer; peer; peer = peer->next) {
+            if (peer->host == server
+                && ngx_cmp_sockaddr(peer->sockaddr, peer->socklen,
+                                    addrs[i].sockaddr, addrs[i].socklen, 1)
+                   == NGX_OK)
+            {
+                break;
+            }
+        }
+
+        if (peer) {
+            continue;
+        }
+
+        if (ngx_http_upstream_zone_add_peer_locked(host, &addrs[i])
+            != NGX_OK)
+        {
+            ngx_log_error(NGX_LOG_ERR, host->event.log, 0,
+                          "could not add peer of %V to upstream \"%V\"%s",
+                          &server->name, &host->upstream->host,
+                          peers->shpool->log_ctx);
+            break;
+        }
+
+        changed = 1;
+    }
+
+    if (changed) {
+        peers->weighted = (peers->total_weight != peers->number);
+        (*peers->config)++;
+    }
+
+    ngx_shmtx_unlock(&peers->shpool->mutex);
+    ngx_http_upstream_rr_peers_unlock(peers);
+}
+
+
+/*
+ * zombies are freed once released on each resolve timer of any server
+ * of the peers list, so they are freed even if the name of the server
+ * they were resolved from does not resolve anymore
+ */
+
+static void
+ngx_http_upstream_zone_free_zombies(ngx_http_upstream_rr_peers_t *peers)
+{
+    ngx_http_upstream_rr_peer_t  *peer, **peerp;
+
+    ngx_http_upstream_rr_peers_wlock(peers);
+
+    if (peers->zombies == NULL) {
+        ngx_http_upstream_rr_peers_unlock(peers);
+        return;
+    }
+
+    ngx_shmtx_lock(&peers->shpool->mutex);
+
+    for (peerp = &peers->zombies; *peerp; /* void */) {
+        peer = *peerp;
+
+        if (peer->conns) {
+            peerp = &peer->next;
+            continue;
+        }
+
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, ngx_cycle->log, 0,
+                       "upstream zone free zombie %V", &peer->name);
+
+        *peerp = peer->next;
+
+        ngx_http_upstream_zone_free_peer_locked(peers, peer);
+    }
+
+    ngx_shmtx_unlock(&peers->shpool->mutex);
+    ngx_http_upstream_rr_peers_unlock(peers);
+}
+
+
+static ngx_int_t
+ngx_http_upstream_zone_add_peer_locked(ngx_http_upstream_zone_host_t *host,
+    ngx_resolver_addr_t *addr)
+{
+    ngx_http_upstream_server_t    *server;
+    ngx_http_upstream_rr_peer_t   *peer, **peerp;
+    ngx_http_upstream_rr_peers_t  *peers;
+
+    server = host->server;
+    peers = host->peers;
+
+    peer = ngx_http_upstream_zone_copy_peer(peers, NULL);
+    if (peer == NULL) {
+        return NGX_ERROR;
+    }
+
+    peer->server.data = ngx_slab_alloc_locked(peers->shpool,
+                                              server->name.len);
+    if (peer->server.data == NULL) {
+        ngx_http_upstream_zone_free_peer_locked(peers, peer);
+        return NGX_ERROR;
+    }
+
+    ngx_memcpy(peer->server.data, server->name.data, server->name.len);
+    peer->server.len = server->name.len;
+
+    ngx_memcpy(peer->sockaddr, addr->sockaddr, addr->socklen);
+    peer->socklen = addr->socklen;
+
+    peer->name.len = ngx_sock_ntop(peer->sockaddr, peer->socklen,
+                                   peer->name.data, NGX_SOCKADDR_STRLEN, 1);
+
+    peer->weight = server->weight;
+    peer->effective_weight = server->weight;
+    peer->current_weight = 0;
+    peer->max_conns = server->max_conns;
+    peer->max_fails = server->max_fails;
+    peer->fail_timeout = server->fail_timeout;
+    peer->down = server->down;
+    peer->host = server;
+
+    for (peerp = &peers->peer; *peerp; peerp = &(*peerp)->next) {
+        /* void */
+    }
+
+    *peerp = peer;
+
+    peers->number++;
+    peers->total_weight += peer->weight;
+
+    ngx_log_error(NGX_LOG_NOTICE, host->event.log, 0,
+                  "upstream \"%V\" peer %V of %V added",
+                  &host->upstream->host, &peer->name, &server->name);
+
+    return NGX_OK;
+}
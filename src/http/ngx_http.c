@@ -10,6 +10,16 @@
 #include <ngx_http.h>
 
 
+typedef struct ngx_http_location_trie_s  ngx_http_location_trie_t;
+
+struct ngx_http_location_trie_s {
+    u_char                      *name;
+    size_t                       len;
+    ngx_http_location_queue_t   *lq;
+    ngx_array_t                  children;
+};
+
+
 static char *ngx_http_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf);
 static ngx_int_t ngx_http_init_phases(ngx_conf_t *cf,
     ngx_http_core_main_conf_t *cmcf);
@@ -41,11 +51,15 @@ static ngx_int_t ngx_http_cmp_locations(const ngx_queue_t *one,
     const ngx_queue_t *two);
 static ngx_int_t ngx_http_join_exact_locations(ngx_conf_t *cf,
     ngx_queue_t *locations);
-static void ngx_http_create_locations_list(ngx_queue_t *locations,
-    ngx_queue_t *q);
 static ngx_http_location_tree_node_t *
-    ngx_http_create_locations_tree(ngx_conf_t *cf, ngx_queue_t *locations,
-    size_t prefix);
+    ngx_http_create_locations_tree(ngx_conf_t *cf, ngx_queue_t *locations);
+static ngx_int_t ngx_http_add_location_trie(ngx_conf_t *cf,
+    ngx_http_location_trie_t *node, ngx_http_location_queue_t *lq,
+    ngx_uint_t *nodes);
+static ngx_http_location_trie_t *ngx_http_create_location_trie(ngx_conf_t *cf,
+    u_char *name, size_t len);
+static int ngx_libc_cdecl ngx_http_cmp_location_keys(const void *one,
+    const void *two);
 
 static ngx_int_t ngx_http_optimize_servers(ngx_conf_t *cf,
     ngx_http_core_main_conf_t *cmcf, ngx_array_t *ports);
@@ -676,6 +690,7 @@ ngx_http_init_locations(ngx_conf_t *cf, ngx_http_core_srv_conf_t *cscf,
 #if (NGX_PCRE)
     ngx_uint_t                   r;
     ngx_queue_t                 *regex;
+    ngx_regex_t                **rep;
 #endif
 
     locations = pclcf->locations;
@@ -773,17 +788,28 @@ ngx_http_init_locations(ngx_conf_t *cf, ngx_http_core_srv_conf_t *cscf,
 
         pclcf->regex_locations = clcfp;
 
+        rep = ngx_palloc(cf->pool, r * sizeof(ngx_regex_t *));
+        if (rep == NULL) {
+            return NGX_ERROR;
+        }
+
         for (q = regex;
              q != ngx_queue_sentinel(locations);
              q = ngx_queue_next(q))
         {
             lq = (ngx_http_location_queue_t *) q;
 
+            *(rep++) = lq->exact->regex->regex;
             *(clcfp++) = lq->exact;
         }
 
         *clcfp = NULL;
 
+        pclcf->regex_set = ngx_regex_set_create(cf->pool, rep - r, r);
+        if (pclcf->regex_set == NULL) {
+            return NGX_ERROR;
+        }
+
         ngx_queue_split(locations, regex, &tail);
     }
 
@@ -828,9 +854,7 @@ ngx_http_init_static_location_trees(ngx_conf_t *cf,
         return NGX_ERROR;
     }
 
-    ngx_http_create_locations_list(locations, ngx_queue_head(locations));
-
-    pclcf->static_locations = ngx_http_create_locations_tree(cf, locations, 0);
+    pclcf->static_locations = ngx_http_create_locations_tree(cf, locations);
     if (pclcf->static_locations == NULL) {
         return NGX_ERROR;
     }
@@ -878,8 +902,6 @@ ngx_http_add_location(ngx_conf_t *cf, ngx_queue_t **locations,
     lq->file_name = cf->conf_file->file.name.data;
     lq->line = cf->conf_file->line;
 
-    ngx_queue_init(&lq->list);
-
     ngx_queue_insert_tail(*locations, &lq->queue);
 
     return NGX_OK;
@@ -1000,140 +1022,236 @@ ngx_http_join_exact_locations(ngx_conf_t *cf, ngx_queue_t *locations)
 }
 
 
-static void
-ngx_http_create_locations_list(ngx_queue_t *locations, ngx_queue_t *q)
-{
-    u_char                     *name;
-    size_t                      len;
-    ngx_queue_t                *x, tail;
-    ngx_http_location_queue_t  *lq, *lx;
-
-    if (q == ngx_queue_last(locations)) {
-        return;
-    }
-
-    lq = (ngx_http_location_queue_t *) q;
+/*
+ * the static locations of a level are inserted into a radix trie,
+ * which is then laid out as one array of nodes in the breadth-first order,
+ * with the names and the children keys stored in one block
+ */
 
-    if (lq->inclusive == NULL) {
-        ngx_http_create_locations_list(locations, ngx_queue_next(q));
-        return;
+static ngx_http_location_tree_node_t *
+ngx_http_create_locations_tree(ngx_conf_t *cf, ngx_queue_t *locations)
+{
+    u_char                          *p;
+    size_t                           size;
+    ngx_uint_t                       i, k, n, head, tail;
+    ngx_queue_t                     *q;
+    ngx_http_location_trie_t        *root, *t, **trie, **child;
+    ngx_http_location_queue_t       *lq;
+    ngx_http_location_tree_node_t   *nodes, *node;
+
+    root = ngx_http_create_location_trie(cf, NULL, 0);
+    if (root == NULL) {
+        return NULL;
     }
 
-    len = lq->name->len;
-    name = lq->name->data;
+    n = 1;
+    size = 0;
 
-    for (x = ngx_queue_next(q);
-         x != ngx_queue_sentinel(locations);
-         x = ngx_queue_next(x))
+    for (q = ngx_queue_head(locations);
+         q != ngx_queue_sentinel(locations);
+         q = ngx_queue_next(q))
     {
-        lx = (ngx_http_location_queue_t *) x;
+        lq = (ngx_http_location_queue_t *) q;
 
-        if (len > lx->name->len
-            || ngx_filename_cmp(name, lx->name->data, len) != 0)
-        {
-            break;
+        if (ngx_http_add_location_trie(cf, root, lq, &n) != NGX_OK) {
+            return NULL;
         }
+
+        size += lq->name->len;
     }
 
-    q = ngx_queue_next(q);
+    /* the splits do not add characters, each node but the root adds a key */
 
-    if (q == x) {
-        ngx_http_create_locations_list(locations, x);
-        return;
+    nodes = ngx_palloc(cf->pool, n * sizeof(ngx_http_location_tree_node_t));
+    if (nodes == NULL) {
+        return NULL;
     }
 
-    ngx_queue_split(locations, q, &tail);
-    ngx_queue_add(&lq->list, &tail);
+    p = ngx_pnalloc(cf->pool, size + n);
+    if (p == NULL) {
+        return NULL;
+    }
 
-    if (x == ngx_queue_sentinel(locations)) {
-        ngx_http_create_locations_list(&lq->list, ngx_queue_head(&lq->list));
-        return;
+    trie = ngx_palloc(cf->temp_pool, n * sizeof(ngx_http_location_trie_t *));
+    if (trie == NULL) {
+        return NULL;
     }
 
-    ngx_queue_split(&lq->list, x, &tail);
-    ngx_queue_add(locations, &tail);
+    trie[0] = root;
+    tail = 1;
 
-    ngx_http_create_locations_list(&lq->list, ngx_queue_head(&lq->list));
+    for (head = 0; head < tail; head++) {
+        t = trie[head];
+        node = &nodes[head];
 
-    ngx_http_create_locations_list(locations, x);
-}
+        lq = t->lq;
 
+        if (lq) {
+            node->exact = lq->exact;
+            node->inclusive = lq->inclusive;
 
-/*
- * to keep cache locality for left leaf nodes, allocate nodes in following
- * order: node, left subtree, right subtree, inclusive subtree
- */
+            node->auto_redirect = (u_char)
+                           ((lq->exact && lq->exact->auto_redirect)
+                            || (lq->inclusive && lq->inclusive->auto_redirect));
 
-static ngx_http_location_tree_node_t *
-ngx_http_create_locations_tree(ngx_conf_t *cf, ngx_queue_t *locations,
-    size_t prefix)
-{
-    size_t                          len;
-    ngx_queue_t                    *q, tail;
-    ngx_http_location_queue_t      *lq;
-    ngx_http_location_tree_node_t  *node;
+        } else {
+            node->exact = NULL;
+            node->inclusive = NULL;
+            node->auto_redirect = 0;
+        }
 
-    q = ngx_queue_middle(locations);
+        node->name = p;
+        node->len = (u_short) t->len;
 
-    lq = (ngx_http_location_queue_t *) q;
-    len = lq->name->len - prefix;
+        for (i = 0; i < t->len; i++) {
+            *p++ = ngx_http_location_key(t->name[i]);
+        }
 
-    node = ngx_palloc(cf->pool,
-                      offsetof(ngx_http_location_tree_node_t, name) + len);
-    if (node == NULL) {
-        return NULL;
+        child = t->children.elts;
+        k = t->children.nelts;
+
+        ngx_qsort(child, k, sizeof(ngx_http_location_trie_t *),
+                  ngx_http_cmp_location_keys);
+
+        node->children = &nodes[tail];
+        node->nchildren = (u_short) k;
+        node->keys = p;
+
+        for (i = 0; i < k; i++) {
+            *p++ = ngx_http_location_key(child[i]->name[0]);
+            trie[tail++] = child[i];
+        }
     }
 
-    node->left = NULL;
-    node->right = NULL;
-    node->tree = NULL;
-    node->exact = lq->exact;
-    node->inclusive = lq->inclusive;
+    return nodes;
+}
 
-    node->auto_redirect = (u_char) ((lq->exact && lq->exact->auto_redirect)
-                           || (lq->inclusive && lq->inclusive->auto_redirect));
 
-    node->len = (u_char) len;
-    ngx_memcpy(node->name, &lq->name->data[prefix], len);
+static ngx_int_t
+ngx_http_add_location_trie(ngx_conf_t *cf, ngx_http_location_trie_t *node,
+    ngx_http_location_queue_t *lq, ngx_uint_t *nodes)
+{
+    u_char                     *name;
+    size_t                      len, n;
+    ngx_uint_t                  i;
+    ngx_http_location_trie_t   *t, *split, **child;
 
-    ngx_queue_split(locations, q, &tail);
+    name = lq->name->data;
+    len = lq->name->len;
 
-    if (ngx_queue_empty(locations)) {
-        /*
-         * ngx_queue_split() insures that if left part is empty,
-         * then right one is empty too
-         */
-        goto inclusive;
-    }
+    for ( ;; ) {
 
-    node->left = ngx_http_create_locations_tree(cf, locations, prefix);
-    if (node->left == NULL) {
-        return NULL;
-    }
+        if (len == 0) {
+            node->lq = lq;
+            return NGX_OK;
+        }
 
-    ngx_queue_remove(q);
+        child = node->children.elts;
 
-    if (ngx_queue_empty(&tail)) {
-        goto inclusive;
-    }
+        for (i = 0; i < node->children.nelts; i++) {
+            if (ngx_http_location_key(child[i]->name[0])
+                == ngx_http_location_key(name[0]))
+            {
+                break;
+            }
+        }
 
-    node->right = ngx_http_create_locations_tree(cf, &tail, prefix);
-    if (node->right == NULL) {
-        return NULL;
+        if (i == node->children.nelts) {
+            child = ngx_array_push(&node->children);
+            if (child == NULL) {
+                return NGX_ERROR;
+            }
+
+            t = ngx_http_create_location_trie(cf, name, len);
+            if (t == NULL) {
+                return NGX_ERROR;
+            }
+
+            t->lq = lq;
+
+            *child = t;
+            (*nodes)++;
+
+            return NGX_OK;
+        }
+
+        t = child[i];
+
+        for (n = 1; n < t->len && n < len; n++) {
+            if (ngx_http_location_key(t->name[n])
+                != ngx_http_location_key(name[n]))
+            {
+                break;
+            }
+        }
+
+        if (n < t->len) {
+
+            /* split the node */
+
+            split = ngx_http_create_location_trie(cf, t->name, n);
+            if (split == NULL) {
+                return NGX_ERROR;
+            }
+
+            child[i] = split;
+
+            child = ngx_array_push(&split->children);
+            if (child == NULL) {
+                return NGX_ERROR;
+            }
+
+            t->name += n;
+            t->len -= n;
+
+            *child = t;
+            (*nodes)++;
+
+            t = split;
+        }
+
+        node = t;
+        name += n;
+        len -= n;
     }
+}
+
 
-inclusive:
+static ngx_http_location_trie_t *
+ngx_http_create_location_trie(ngx_conf_t *cf, u_char *name, size_t len)
+{
+    ngx_http_location_trie_t  *t;
 
-    if (ngx_queue_empty(&lq->list)) {
-        return node;
+    t = ngx_palloc(cf->temp_pool, sizeof(ngx_http_location_trie_t));
+    if (t == NULL) {
+        return NULL;
     }
 
-    node->tree = ngx_http_create_locations_tree(cf, &lq->list, prefix + len);
-    if (node->tree == NULL) {
+    if (ngx_array_init(&t->children, cf->temp_pool, 2,
+                       sizeof(ngx_http_location_trie_t *))
+        != NGX_OK)
+    {
         return NULL;
     }
 
-    return node;
+    t->name = name;
+    t->len = len;
+    t->lq = NULL;
+
+    return t;
+}
+
+
+static int ngx_libc_cdecl
+ngx_http_cmp_location_keys(const void *one, const void *two)
+{
+    ngx_http_location_trie_t  *first, *second;
+
+    first = *(ngx_http_location_trie_t **) one;
+    second = *(ngx_http_location_trie_t **) two;
+
+    return (int) ngx_http_location_key(first->name[0])
+           - (int) ngx_http_location_key(second->name[0]);
 }
 
 
@@ -1324,6 +1442,7 @@ ngx_http_add_address(ngx_conf_t *cf, ngx_http_core_srv_conf_t *cscf,
 #if (NGX_PCRE)
     addr->nregex = 0;
     addr->regex = NULL;
+    addr->regex_set = NULL;
 #endif
     addr->default_server = cscf;
     addr->servers.elts = NULL;
@@ -1430,6 +1549,7 @@ ngx_http_server_names(ngx_conf_t *cf, ngx_http_core_main_conf_t *cmcf,
     ngx_http_core_srv_conf_t  **cscfp;
 #if (NGX_PCRE)
     ngx_uint_t                  regex, i;
+    ngx_regex_t               **rep;
 
     regex = 0;
 #endif
@@ -1562,6 +1682,20 @@ ngx_http_server_names(ngx_conf_t *cf, ngx_http_core_main_conf_t *cmcf,
         }
     }
 
+    rep = ngx_palloc(cf->pool, regex * sizeof(ngx_regex_t *));
+    if (rep == NULL) {
+        return NGX_ERROR;
+    }
+
+    for (i = 0; i < regex; i++) {
+        rep[i] = addr->regex[i].regex->regex;
+    }
+
+    addr->regex_set = ngx_regex_set_create(cf->pool, rep, regex);
+    if (addr->regex_set == NULL) {
+        return NGX_ERROR;
+    }
+
 #endif
 
     return NGX_OK;
@@ -1832,6 +1966,7 @@ ngx_http_add_addrs(ngx_conf_t *cf, ngx_http_port_t *hport,
 #if (NGX_PCRE)
         vn->nregex = addr[i].nregex;
         vn->regex = addr[i].regex;
+        vn->regex_set = addr[i].regex_set;
 #endif
     }
 
@@ -1897,6 +2032,7 @@ ngx_http_add_addrs6(ngx_conf_t *cf, ngx_http_port_t *hport,
 #if (NGX_PCRE)
         vn->nregex = addr[i].nregex;
         vn->regex = addr[i].regex;
+        vn->regex_set = addr[i].regex_set;
 #endif
     }
 
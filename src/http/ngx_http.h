@@ -85,6 +85,12 @@ ngx_int_t ngx_http_add_listen(ngx_conf_t *cf, ngx_http_core_srv_conf_t *cscf,
 void ngx_http_init_connection(ngx_connection_t *c);
 void ngx_http_close_connection(ngx_connection_t *c);
 
+#if (NGX_STAT_STUB)
+void ngx_http_stat_idle(ngx_connection_t *c, ngx_http_connection_t *hc,
+    ngx_uint_t protocol);
+void ngx_http_stat_busy(ngx_http_connection_t *hc);
+#endif
+
 #if (NGX_HTTP_SSL && defined SSL_CTRL_SET_TLSEXT_HOSTNAME)
 int ngx_http_ssl_servername(ngx_ssl_conn_t *ssl_conn, int *ad, void *arg);
 #endif
@@ -59,6 +59,10 @@ typedef struct {
     size_t                           body_start;
     off_t                            fs_size;
     ngx_msec_t                       lock_time;
+
+    /* the temporary file of the lock owner, readable while it is filled */
+    u_char                          *temp_name;
+    off_t                            temp_length;
 } ngx_http_file_cache_node_t;
 
 
@@ -105,9 +109,14 @@ struct ngx_http_cache_s {
     ngx_msec_t                       wait_time;
 
     ngx_event_t                      wait_event;
+    ngx_queue_t                      queue;
 
     unsigned                         lock:1;
     unsigned                         waiting:1;
+    unsigned                         queued:1;
+    unsigned                         stream:1;
+    unsigned                         streaming:1;
+    unsigned                         published:1;
 
     unsigned                         updated:1;
     unsigned                         updating:1;
@@ -181,6 +190,10 @@ struct ngx_http_file_cache_s {
 
     ngx_uint_t                       use_temp_path;
                                      /* unsigned use_temp_path:1 */
+
+    /* lock waiters and readers of files being filled in this process */
+    ngx_queue_t                      waiters;
+    ngx_event_t                      wait_event;
 };
 
 
@@ -191,6 +204,7 @@ ngx_int_t ngx_http_file_cache_open(ngx_http_request_t *r);
 ngx_int_t ngx_http_file_cache_set_header(ngx_http_request_t *r, u_char *buf);
 void ngx_http_file_cache_update(ngx_http_request_t *r, ngx_temp_file_t *tf);
 void ngx_http_file_cache_update_header(ngx_http_request_t *r);
+void ngx_http_file_cache_progress(ngx_http_request_t *r, ngx_temp_file_t *tf);
 ngx_int_t ngx_http_cache_send(ngx_http_request_t *);
 void ngx_http_file_cache_free(ngx_http_cache_t *c, ngx_temp_file_t *tf);
 time_t ngx_http_file_cache_valid(ngx_array_t *cache_valid, ngx_uint_t status);
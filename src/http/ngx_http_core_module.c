@@ -63,6 +63,8 @@ static char *ngx_http_core_error_page(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 static char *ngx_http_core_open_file_cache(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
+static char *ngx_http_core_open_file_cache_zone(ngx_conf_t *cf,
+    ngx_command_t *cmd, void *conf);
 static char *ngx_http_core_error_log(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 static char *ngx_http_core_keepalive(ngx_conf_t *cf, ngx_command_t *cmd,
@@ -78,7 +80,7 @@ static char *ngx_http_gzip_disable(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
 #endif
 static ngx_int_t ngx_http_get_forwarded_addr_internal(ngx_http_request_t *r,
-    ngx_addr_t *addr, u_char *xff, size_t xfflen, ngx_array_t *proxies,
+    ngx_addr_t *addr, u_char *xff, size_t xfflen, ngx_cidr_tree_t *proxies,
     int recursive);
 #if (NGX_HAVE_OPENAT)
 static char *ngx_http_disable_symlinks(ngx_conf_t *cf, ngx_command_t *cmd,
@@ -476,6 +478,13 @@ static ngx_command_t  ngx_http_core_commands[] = {
       offsetof(ngx_http_core_loc_conf_t, postpone_output),
       NULL },
 
+    { ngx_string("pipelined_output_buffer"),
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
+      ngx_conf_set_size_slot,
+      NGX_HTTP_LOC_CONF_OFFSET,
+      offsetof(ngx_http_core_loc_conf_t, pipelined_output),
+      NULL },
+
     { ngx_string("limit_rate"),
       NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_HTTP_LIF_CONF
                         |NGX_CONF_TAKE1,
@@ -670,12 +679,19 @@ static ngx_command_t  ngx_http_core_commands[] = {
       NULL },
 
     { ngx_string("open_file_cache"),
-      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE12,
+      NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE123,
       ngx_http_core_open_file_cache,
       NGX_HTTP_LOC_CONF_OFFSET,
       offsetof(ngx_http_core_loc_conf_t, open_file_cache),
       NULL },
 
+    { ngx_string("open_file_cache_zone"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE12,
+      ngx_http_core_open_file_cache_zone,
+      0,
+      0,
+      NULL },
+
     { ngx_string("open_file_cache_valid"),
       NGX_HTTP_MAIN_CONF|NGX_HTTP_SRV_CONF|NGX_HTTP_LOC_CONF|NGX_CONF_TAKE1,
       ngx_conf_set_sec_slot,
@@ -1306,6 +1322,7 @@ ngx_http_core_find_location(ngx_http_request_t *r)
     ngx_http_core_loc_conf_t  *pclcf;
 #if (NGX_PCRE)
     ngx_int_t                  n;
+    uintptr_t                 *candidates;
     ngx_uint_t                 noregex;
     ngx_http_core_loc_conf_t  *clcf, **clcfp;
 
@@ -1339,8 +1356,20 @@ ngx_http_core_find_location(ngx_http_request_t *r)
 
     if (noregex == 0 && pclcf->regex_locations) {
 
+        /* the locations which cannot match are skipped */
+
+        candidates = pclcf->regex_set
+                     ? ngx_regex_set_match(pclcf->regex_set, &r->uri)
+                     : NULL;
+
         for (clcfp = pclcf->regex_locations; *clcfp; clcfp++) {
 
+            if (!ngx_regex_set_candidate(candidates,
+                                         clcfp - pclcf->regex_locations))
+            {
+                continue;
+            }
+
             ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                            "test location: ~ \"%V\"", &(*clcfp)->name);
 
@@ -1380,9 +1409,15 @@ static ngx_int_t
 ngx_http_core_find_static_location(ngx_http_request_t *r,
     ngx_http_location_tree_node_t *node)
 {
-    u_char     *uri;
-    size_t      len, n;
-    ngx_int_t   rc, rv;
+    u_char                         *uri, c;
+    size_t                          len;
+    ngx_int_t                       rv;
+    ngx_uint_t                      lo, hi, mid;
+    ngx_http_location_tree_node_t  *next;
+
+    if (node == NULL) {
+        return NGX_DECLINED;
+    }
 
     len = r->uri.len;
     uri = r->uri.data;
@@ -1391,67 +1426,81 @@ ngx_http_core_find_static_location(ngx_http_request_t *r,
 
     for ( ;; ) {
 
-        if (node == NULL) {
-            return rv;
-        }
+        /* the node name matches, the uri points after it */
 
-        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
-                       "test location: \"%*s\"",
-                       (size_t) node->len, node->name);
+        if (len == 0) {
 
-        n = (len <= (size_t) node->len) ? len : node->len;
-
-        rc = ngx_filename_cmp(uri, node->name, n);
+            if (node->exact) {
+                r->loc_conf = node->exact->loc_conf;
+                return NGX_OK;
+            }
 
-        if (rc != 0) {
-            node = (rc < 0) ? node->left : node->right;
+            if (node->inclusive) {
+                r->loc_conf = node->inclusive->loc_conf;
+                return NGX_AGAIN;
+            }
 
-            continue;
-        }
+            c = '/';
 
-        if (len > (size_t) node->len) {
+        } else {
 
             if (node->inclusive) {
+                ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                               "test location: \"%V\"",
+                               &node->inclusive->name);
 
                 r->loc_conf = node->inclusive->loc_conf;
                 rv = NGX_AGAIN;
-
-                node = node->tree;
-                uri += n;
-                len -= n;
-
-                continue;
             }
 
-            /* exact only */
-
-            node = node->right;
-
-            continue;
+            c = ngx_http_location_key(*uri);
         }
 
-        if (len == (size_t) node->len) {
+        lo = 0;
+        hi = node->nchildren;
 
-            if (node->exact) {
-                r->loc_conf = node->exact->loc_conf;
-                return NGX_OK;
+        while (lo < hi) {
+            mid = (lo + hi) / 2;
+
+            if (node->keys[mid] < c) {
+                lo = mid + 1;
 
             } else {
-                r->loc_conf = node->inclusive->loc_conf;
-                return NGX_AGAIN;
+                hi = mid;
             }
         }
 
-        /* len < node->len */
+        if (lo == node->nchildren || node->keys[lo] != c) {
+            return rv;
+        }
+
+        next = &node->children[lo];
+
+        if (len < next->len) {
+
+            /* auto redirect from the uri without the trailing slash */
+
+            if (len + 1 == next->len
+                && next->auto_redirect
+                && ngx_http_location_cmp(uri, next->name, len) == 0)
+            {
+                r->loc_conf = (next->exact) ? next->exact->loc_conf:
+                                              next->inclusive->loc_conf;
+                return NGX_DONE;
+            }
 
-        if (len + 1 == (size_t) node->len && node->auto_redirect) {
+            return rv;
+        }
 
-            r->loc_conf = (node->exact) ? node->exact->loc_conf:
-                                          node->inclusive->loc_conf;
-            rv = NGX_DONE;
+        if (ngx_http_location_cmp(uri + 1, next->name + 1, next->len - 1)
+            != 0)
+        {
+            return rv;
         }
 
-        node = node->left;
+        node = next;
+        uri += node->len;
+        len -= node->len;
     }
 }
 
@@ -1928,11 +1977,7 @@ ngx_http_auth_basic_user(ngx_http_request_t *r)
 ngx_int_t
 ngx_http_gzip_ok(ngx_http_request_t *r)
 {
-    time_t                     date, expires;
-    ngx_uint_t                 p;
-    ngx_array_t               *cc;
-    ngx_table_elt_t           *e, *d, *ae;
-    ngx_http_core_loc_conf_t  *clcf;
+    ngx_table_elt_t  *ae;
 
     r->gzip_tested = 1;
 
@@ -1964,6 +2009,34 @@ ngx_http_gzip_ok(ngx_http_request_t *r)
         return NGX_DECLINED;
     }
 
+    if (ngx_http_compression_ok(r) != NGX_OK) {
+        return NGX_DECLINED;
+    }
+
+    r->gzip_ok = 1;
+
+    return NGX_OK;
+}
+
+
+/*
+ * the gzip_disable, gzip_http_version, and gzip_proxied checks,
+ * which apply to precompressed variants of any encoding
+ */
+
+ngx_int_t
+ngx_http_compression_ok(ngx_http_request_t *r)
+{
+    time_t                     date, expires;
+    ngx_uint_t                 p;
+    ngx_array_t               *cc;
+    ngx_table_elt_t           *e, *d;
+    ngx_http_core_loc_conf_t  *clcf;
+
+    if (r != r->main) {
+        return NGX_DECLINED;
+    }
+
     clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
 
     if (r->headers_in.msie6 && clcf->gzip_disable_msie6) {
@@ -2080,8 +2153,6 @@ ok:
 
 #endif
 
-    r->gzip_ok = 1;
-
     return NGX_OK;
 }
 
@@ -2609,7 +2680,7 @@ ngx_http_set_disable_symlinks(ngx_http_request_t *r,
 
 ngx_int_t
 ngx_http_get_forwarded_addr(ngx_http_request_t *r, ngx_addr_t *addr,
-    ngx_array_t *headers, ngx_str_t *value, ngx_array_t *proxies,
+    ngx_array_t *headers, ngx_str_t *value, ngx_cidr_tree_t *proxies,
     int recursive)
 {
     ngx_int_t          rc;
@@ -2656,13 +2727,13 @@ ngx_http_get_forwarded_addr(ngx_http_request_t *r, ngx_addr_t *addr,
 
 static ngx_int_t
 ngx_http_get_forwarded_addr_internal(ngx_http_request_t *r, ngx_addr_t *addr,
-    u_char *xff, size_t xfflen, ngx_array_t *proxies, int recursive)
+    u_char *xff, size_t xfflen, ngx_cidr_tree_t *proxies, int recursive)
 {
     u_char      *p;
     ngx_int_t    rc;
     ngx_addr_t   paddr;
 
-    if (ngx_cidr_match(addr->sockaddr, proxies) != NGX_OK) {
+    if (ngx_cidr_tree_match(addr->sockaddr, proxies) != NGX_OK) {
         return NGX_DECLINED;
     }
 
@@ -3388,6 +3459,7 @@ ngx_http_core_create_loc_conf(ngx_conf_t *cf)
     clcf->send_timeout = NGX_CONF_UNSET_MSEC;
     clcf->send_lowat = NGX_CONF_UNSET_SIZE;
     clcf->postpone_output = NGX_CONF_UNSET_SIZE;
+    clcf->pipelined_output = NGX_CONF_UNSET_SIZE;
     clcf->limit_rate = NGX_CONF_UNSET_SIZE;
     clcf->limit_rate_after = NGX_CONF_UNSET_SIZE;
     clcf->keepalive_timeout = NGX_CONF_UNSET_MSEC;
@@ -3618,6 +3690,8 @@ ngx_http_core_merge_loc_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_conf_merge_size_value(conf->send_lowat, prev->send_lowat, 0);
     ngx_conf_merge_size_value(conf->postpone_output, prev->postpone_output,
                               1460);
+    ngx_conf_merge_size_value(conf->pipelined_output, prev->pipelined_output,
+                              0);
     ngx_conf_merge_size_value(conf->limit_rate, prev->limit_rate, 0);
     ngx_conf_merge_size_value(conf->limit_rate_after, prev->limit_rate_after,
                               0);
@@ -4472,6 +4546,18 @@ ngx_http_core_set_aio(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
 #endif
 
+    if (ngx_strcmp(value[1].data, "io_uring") == 0) {
+#if (NGX_HAVE_IO_URING)
+        clcf->aio = NGX_HTTP_AIO_IO_URING;
+        return NGX_CONF_OK;
+#else
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "\"aio io_uring\" "
+                           "is unsupported on this platform");
+        return NGX_CONF_ERROR;
+#endif
+    }
+
     if (ngx_strncmp(value[1].data, "threads", 7) == 0
         && (value[1].len == 7 || value[1].data[7] == '='))
     {
@@ -4684,10 +4770,11 @@ ngx_http_core_open_file_cache(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 {
     ngx_http_core_loc_conf_t *clcf = conf;
 
-    time_t       inactive;
-    ngx_str_t   *value, s;
-    ngx_int_t    max;
-    ngx_uint_t   i;
+    time_t           inactive;
+    ngx_str_t       *value, s;
+    ngx_int_t        max;
+    ngx_uint_t       i;
+    ngx_shm_zone_t  *shared;
 
     if (clcf->open_file_cache != NGX_CONF_UNSET_PTR) {
         return "is duplicate";
@@ -4697,6 +4784,7 @@ ngx_http_core_open_file_cache(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
     max = 0;
     inactive = 60;
+    shared = NULL;
 
     for (i = 1; i < cf->args->nelts; i++) {
 
@@ -4710,6 +4798,19 @@ ngx_http_core_open_file_cache(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
             continue;
         }
 
+        if (ngx_strncmp(value[i].data, "shared=", 7) == 0) {
+
+            s.len = value[i].len - 7;
+            s.data = value[i].data + 7;
+
+            shared = ngx_shared_memory_add(cf, &s, 0, &ngx_http_core_module);
+            if (shared == NULL) {
+                return NGX_CONF_ERROR;
+            }
+
+            continue;
+        }
+
         if (ngx_strncmp(value[i].data, "inactive=", 9) == 0) {
 
             s.len = value[i].len - 9;
@@ -4749,10 +4850,104 @@ ngx_http_core_open_file_cache(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     }
 
     clcf->open_file_cache = ngx_open_file_cache_init(cf->pool, max, inactive);
-    if (clcf->open_file_cache) {
-        return NGX_CONF_OK;
+    if (clcf->open_file_cache == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    clcf->open_file_cache->shared = shared;
+
+    return NGX_CONF_OK;
+}
+
+
+static char *
+ngx_http_core_open_file_cache_zone(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf)
+{
+    u_char                        *p;
+    time_t                         valid;
+    ssize_t                        size;
+    ngx_str_t                     *value, name, s;
+    ngx_shm_zone_t                *shm_zone;
+    ngx_open_file_cache_shared_t  *shared;
+
+    value = cf->args->elts;
+
+    if (ngx_strncmp(value[1].data, "zone=", 5) != 0) {
+        goto invalid;
+    }
+
+    name.data = value[1].data + 5;
+
+    p = (u_char *) ngx_strchr(name.data, ':');
+
+    if (p == NULL) {
+        goto invalid;
+    }
+
+    name.len = p - name.data;
+
+    s.data = p + 1;
+    s.len = value[1].data + value[1].len - s.data;
+
+    size = ngx_parse_size(&s);
+
+    if (size == NGX_ERROR) {
+        goto invalid;
+    }
+
+    if (size < (ssize_t) (8 * ngx_pagesize)) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "zone \"%V\" is too small", &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    valid = 600;
+
+    if (cf->args->nelts == 3) {
+
+        if (ngx_strncmp(value[2].data, "valid=", 6) != 0) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "invalid parameter \"%V\"", &value[2]);
+            return NGX_CONF_ERROR;
+        }
+
+        s.len = value[2].len - 6;
+        s.data = value[2].data + 6;
+
+        valid = ngx_parse_time(&s, 1);
+        if (valid == (time_t) NGX_ERROR) {
+            ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                               "invalid valid value \"%V\"", &value[2]);
+            return NGX_CONF_ERROR;
+        }
+    }
+
+    shm_zone = ngx_shared_memory_add(cf, &name, size, &ngx_http_core_module);
+    if (shm_zone == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    if (shm_zone->data) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "duplicate zone \"%V\"", &name);
+        return NGX_CONF_ERROR;
+    }
+
+    shared = ngx_open_file_cache_shared_init(cf->pool, valid);
+    if (shared == NULL) {
+        return NGX_CONF_ERROR;
     }
 
+    shm_zone->init = ngx_open_file_cache_init_zone;
+    shm_zone->data = shared;
+
+    return NGX_CONF_OK;
+
+invalid:
+
+    ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                       "invalid zone \"%V\"", &value[1]);
     return NGX_CONF_ERROR;
 }
 
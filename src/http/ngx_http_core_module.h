@@ -34,6 +34,7 @@ typedef struct ngx_thread_pool_s  ngx_thread_pool_t;
 #define NGX_HTTP_AIO_OFF                0
 #define NGX_HTTP_AIO_ON                 1
 #define NGX_HTTP_AIO_THREADS            2
+#define NGX_HTTP_AIO_IO_URING           3
 
 
 #define NGX_HTTP_SATISFY_ALL            0
@@ -224,6 +225,9 @@ typedef struct {
 
     ngx_uint_t                 nregex;
     ngx_http_server_name_t    *regex;
+#if (NGX_PCRE)
+    ngx_regex_set_t           *regex_set;
+#endif
 } ngx_http_virtual_names_t;
 
 
@@ -279,6 +283,7 @@ typedef struct {
 #if (NGX_PCRE)
     ngx_uint_t                 nregex;
     ngx_http_server_name_t    *regex;
+    ngx_regex_set_t           *regex_set;
 #endif
 
     /* the default server configuration for this address:port */
@@ -318,6 +323,7 @@ struct ngx_http_core_loc_conf_s {
     ngx_http_location_tree_node_t   *static_locations;
 #if (NGX_PCRE)
     ngx_http_core_loc_conf_t       **regex_locations;
+    ngx_regex_set_t                 *regex_set;
 #endif
 
     /* pointer to the modules' loc_conf */
@@ -347,6 +353,7 @@ struct ngx_http_core_loc_conf_s {
     size_t        client_body_buffer_size; /* client_body_buffer_size */
     size_t        send_lowat;              /* send_lowat */
     size_t        postpone_output;         /* postpone_output */
+    size_t        pipelined_output;        /* pipelined_output_buffer */
     size_t        limit_rate;              /* limit_rate */
     size_t        limit_rate_after;        /* limit_rate_after */
     size_t        sendfile_max_chunk;      /* sendfile_max_chunk */
@@ -445,21 +452,45 @@ typedef struct {
     ngx_str_t                       *name;
     u_char                          *file_name;
     ngx_uint_t                       line;
-    ngx_queue_t                      list;
 } ngx_http_location_queue_t;
 
 
-struct ngx_http_location_tree_node_s {
-    ngx_http_location_tree_node_t   *left;
-    ngx_http_location_tree_node_t   *right;
-    ngx_http_location_tree_node_t   *tree;
+#if (NGX_HAVE_CASELESS_FILESYSTEM)
+#define ngx_http_location_key(c)          ngx_tolower(c)
+#define ngx_http_location_cmp(s1, s2, n)  ngx_strncasecmp(s1, s2, n)
+#else
+#define ngx_http_location_key(c)          (c)
+#define ngx_http_location_cmp(s1, s2, n)  ngx_memcmp(s1, s2, n)
+#endif
 
+
+/*
+ * a node of the static locations radix trie; all nodes of the trie are
+ * allocated as one array in the breadth-first order, so children of a node
+ * are adjacent, and their first characters are kept in the "keys" array
+ */
+
+struct ngx_http_location_tree_node_s {
     ngx_http_core_loc_conf_t        *exact;
     ngx_http_core_loc_conf_t        *inclusive;
 
+    ngx_http_location_tree_node_t   *children;
+    u_char                          *keys;
+    u_char                          *name;
+
+    u_short                          len;
+    u_short                          nchildren;
     u_char                           auto_redirect;
-    u_char                           len;
-    u_char                           name[1];
+};
+
+
+struct ngx_http_pipelined_output_s {
+    ngx_buf_t                        buf;
+    ngx_event_t                      flush;
+    ngx_connection_t                *connection;
+    ngx_msec_t                       send_timeout;
+    unsigned                         busy:1;
+    unsigned                         armed:1;
 };
 
 
@@ -492,6 +523,7 @@ u_char *ngx_http_map_uri_to_path(ngx_http_request_t *r, ngx_str_t *name,
 ngx_int_t ngx_http_auth_basic_user(ngx_http_request_t *r);
 #if (NGX_HTTP_GZIP)
 ngx_int_t ngx_http_gzip_ok(ngx_http_request_t *r);
+ngx_int_t ngx_http_compression_ok(ngx_http_request_t *r);
 #endif
 
 
@@ -515,6 +547,7 @@ typedef ngx_int_t (*ngx_http_request_body_filter_pt)
 
 ngx_int_t ngx_http_output_filter(ngx_http_request_t *r, ngx_chain_t *chain);
 ngx_int_t ngx_http_write_filter(ngx_http_request_t *r, ngx_chain_t *chain);
+ngx_int_t ngx_http_send_pipelined(ngx_http_pipelined_output_t *po);
 ngx_int_t ngx_http_request_body_save_filter(ngx_http_request_t *r,
     ngx_chain_t *chain);
 
@@ -523,7 +556,7 @@ ngx_int_t ngx_http_set_disable_symlinks(ngx_http_request_t *r,
     ngx_http_core_loc_conf_t *clcf, ngx_str_t *path, ngx_open_file_info_t *of);
 
 ngx_int_t ngx_http_get_forwarded_addr(ngx_http_request_t *r, ngx_addr_t *addr,
-    ngx_array_t *headers, ngx_str_t *value, ngx_array_t *proxies,
+    ngx_array_t *headers, ngx_str_t *value, ngx_cidr_tree_t *proxies,
     int recursive);
 
 
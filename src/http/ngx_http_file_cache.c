@@ -11,11 +11,30 @@
 #include <ngx_md5.h>
 
 
+/*
+ * how often the waiters check entries filled by other worker processes,
+ * those filled in the same process wake them up directly
+ */
+
+#define NGX_HTTP_FILE_CACHE_WAIT  10
+
+
 static ngx_int_t ngx_http_file_cache_lock(ngx_http_request_t *r,
     ngx_http_cache_t *c);
 static void ngx_http_file_cache_lock_wait_handler(ngx_event_t *ev);
 static void ngx_http_file_cache_lock_wait(ngx_http_request_t *r,
     ngx_http_cache_t *c);
+static void ngx_http_file_cache_wait(ngx_http_cache_t *c);
+static void ngx_http_file_cache_unwait(ngx_http_cache_t *c);
+static void ngx_http_file_cache_wait_handler(ngx_event_t *ev);
+static void ngx_http_file_cache_wakeup(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_node_t *fcn);
+static void ngx_http_file_cache_unpublish(ngx_http_file_cache_t *cache,
+    ngx_http_cache_t *c);
+static ngx_int_t ngx_http_file_cache_stream_open(ngx_http_request_t *r,
+    ngx_http_cache_t *c, u_char *name, ngx_msec_t lock_time);
+static void ngx_http_file_cache_stream_handler(ngx_event_t *ev);
+static void ngx_http_file_cache_stream(ngx_http_request_t *r);
 static ngx_int_t ngx_http_file_cache_read(ngx_http_request_t *r,
     ngx_http_cache_t *c);
 static ssize_t ngx_http_file_cache_aio_read(ngx_http_request_t *r,
@@ -278,6 +297,10 @@ ngx_http_file_cache_open(ngx_http_request_t *r)
         return NGX_AGAIN;
     }
 
+    if (c->streaming) {
+        return NGX_OK;
+    }
+
     if (c->reading) {
         return ngx_http_file_cache_read(r, c);
     }
@@ -418,8 +441,16 @@ ngx_http_file_cache_lock(ngx_http_request_t *r, ngx_http_cache_t *c)
     timer = c->node->lock_time - now;
 
     if (!c->node->updating || (ngx_msec_int_t) timer <= 0) {
+
+        if (c->node->temp_name) {
+            /* left by the previous owner of the expired lock */
+            ngx_slab_free_locked(cache->shpool, c->node->temp_name);
+            c->node->temp_name = NULL;
+        }
+
         c->node->updating = 1;
         c->node->lock_time = now + c->lock_age;
+        c->node->temp_length = 0;
         c->updating = 1;
         c->lock_time = c->node->lock_time;
     }
@@ -448,9 +479,7 @@ ngx_http_file_cache_lock(ngx_http_request_t *r, ngx_http_cache_t *c)
         c->wait_event.log = r->connection->log;
     }
 
-    timer = c->wait_time - now;
-
-    ngx_add_timer(&c->wait_event, (timer > 500) ? 500 : timer);
+    ngx_http_file_cache_wait(c);
 
     r->main->blocked++;
 
@@ -481,8 +510,11 @@ ngx_http_file_cache_lock_wait_handler(ngx_event_t *ev)
 static void
 ngx_http_file_cache_lock_wait(ngx_http_request_t *r, ngx_http_cache_t *c)
 {
+    u_char                 *name;
+    size_t                  len;
+    ngx_int_t               rc;
     ngx_uint_t              wait;
-    ngx_msec_t              now, timer;
+    ngx_msec_t              now, timer, lock_time;
     ngx_http_file_cache_t  *cache;
 
     now = ngx_current_msec;
@@ -498,6 +530,8 @@ ngx_http_file_cache_lock_wait(ngx_http_request_t *r, ngx_http_cache_t *c)
 
     cache = c->file_cache;
     wait = 0;
+    name = NULL;
+    lock_time = 0;
 
     ngx_shmtx_lock(&cache->shpool->mutex);
 
@@ -505,23 +539,361 @@ ngx_http_file_cache_lock_wait(ngx_http_request_t *r, ngx_http_cache_t *c)
 
     if (c->node->updating && (ngx_msec_int_t) timer > 0) {
         wait = 1;
+
+        if (c->stream && c->node->temp_name && c->node->temp_length) {
+            len = ngx_strlen(c->node->temp_name) + 1;
+
+            name = ngx_pnalloc(r->pool, len);
+            if (name) {
+                ngx_memcpy(name, c->node->temp_name, len);
+                lock_time = c->node->lock_time;
+            }
+        }
     }
 
     ngx_shmtx_unlock(&cache->shpool->mutex);
 
+    if (name) {
+        rc = ngx_http_file_cache_stream_open(r, c, name, lock_time);
+
+        if (rc == NGX_OK) {
+            wait = 0;
+
+        } else if (rc == NGX_DECLINED) {
+            c->stream = 0;
+        }
+    }
+
     if (wait) {
-        ngx_add_timer(&c->wait_event, (timer > 500) ? 500 : timer);
+        ngx_http_file_cache_wait(c);
         return;
     }
 
 wakeup:
 
+    ngx_http_file_cache_unwait(c);
+
     c->waiting = 0;
     r->main->blocked--;
     r->write_event_handler(r);
 }
 
 
+static void
+ngx_http_file_cache_wait(ngx_http_cache_t *c)
+{
+    ngx_msec_t              timer;
+    ngx_http_file_cache_t  *cache;
+
+    cache = c->file_cache;
+
+    if (!c->queued) {
+        ngx_queue_insert_tail(&cache->waiters, &c->queue);
+        c->queued = 1;
+    }
+
+    timer = c->wait_time - ngx_current_msec;
+
+    if ((ngx_msec_int_t) timer < 0) {
+        timer = 0;
+    }
+
+    ngx_add_timer(&c->wait_event, timer);
+
+    if (!cache->wait_event.timer_set) {
+        cache->wait_event.handler = ngx_http_file_cache_wait_handler;
+        cache->wait_event.data = cache;
+        cache->wait_event.log = ngx_cycle->log;
+        cache->wait_event.cancelable = 1;
+
+        ngx_add_timer(&cache->wait_event, NGX_HTTP_FILE_CACHE_WAIT);
+    }
+}
+
+
+static void
+ngx_http_file_cache_unwait(ngx_http_cache_t *c)
+{
+    if (c->queued) {
+        ngx_queue_remove(&c->queue);
+        c->queued = 0;
+    }
+
+    if (c->wait_event.timer_set) {
+        ngx_del_timer(&c->wait_event);
+    }
+
+    if (c->wait_event.posted) {
+        ngx_delete_posted_event(&c->wait_event);
+    }
+}
+
+
+static void
+ngx_http_file_cache_wait_handler(ngx_event_t *ev)
+{
+    ngx_uint_t                   ready;
+    ngx_msec_t                   now;
+    ngx_queue_t                 *q;
+    ngx_http_cache_t            *c;
+    ngx_http_file_cache_t       *cache;
+    ngx_http_file_cache_node_t  *fcn;
+
+    cache = ev->data;
+
+    if (ngx_queue_empty(&cache->waiters)) {
+        return;
+    }
+
+    now = ngx_current_msec;
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    for (q = ngx_queue_head(&cache->waiters);
+         q != ngx_queue_sentinel(&cache->waiters);
+         q = ngx_queue_next(q))
+    {
+        c = ngx_queue_data(q, ngx_http_cache_t, queue);
+        fcn = c->node;
+
+        if (c->streaming) {
+            ready = !fcn->updating
+                    || fcn->lock_time != c->lock_time
+                    || fcn->temp_length > c->length;
+
+        } else {
+            ready = !fcn->updating
+                    || (ngx_msec_int_t) (fcn->lock_time - now) <= 0
+                    || (c->stream && fcn->temp_name && fcn->temp_length);
+        }
+
+        if (ready) {
+            ngx_post_event(&c->wait_event, &ngx_posted_events);
+        }
+    }
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    ngx_add_timer(ev, NGX_HTTP_FILE_CACHE_WAIT);
+}
+
+
+static void
+ngx_http_file_cache_wakeup(ngx_http_file_cache_t *cache,
+    ngx_http_file_cache_node_t *fcn)
+{
+    ngx_queue_t       *q;
+    ngx_http_cache_t  *c;
+
+    for (q = ngx_queue_head(&cache->waiters);
+         q != ngx_queue_sentinel(&cache->waiters);
+         q = ngx_queue_next(q))
+    {
+        c = ngx_queue_data(q, ngx_http_cache_t, queue);
+
+        if (c->node == fcn) {
+            ngx_post_event(&c->wait_event, &ngx_posted_events);
+        }
+    }
+}
+
+
+void
+ngx_http_file_cache_progress(ngx_http_request_t *r, ngx_temp_file_t *tf)
+{
+    u_char                      *name;
+    ngx_http_cache_t            *c;
+    ngx_http_file_cache_t       *cache;
+    ngx_http_file_cache_node_t  *fcn;
+
+    c = r->cache;
+
+    if (!c->stream || !c->updating || c->updated
+        || tf->file.fd == NGX_INVALID_FILE)
+    {
+        return;
+    }
+
+    fcn = c->node;
+
+    if (c->published && fcn->temp_length == tf->offset) {
+        return;
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http file cache progress: %O", tf->offset);
+
+    cache = c->file_cache;
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    if (fcn->lock_time == c->lock_time) {
+
+        if (!c->published) {
+            name = ngx_slab_alloc_locked(cache->shpool,
+                                         tf->file.name.len + 1);
+            if (name) {
+                ngx_memcpy(name, tf->file.name.data, tf->file.name.len + 1);
+                fcn->temp_name = name;
+            }
+        }
+
+        fcn->temp_length = tf->offset;
+    }
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    c->published = 1;
+
+    ngx_http_file_cache_wakeup(cache, fcn);
+}
+
+
+static void
+ngx_http_file_cache_unpublish(ngx_http_file_cache_t *cache,
+    ngx_http_cache_t *c)
+{
+    ngx_http_file_cache_node_t  *fcn;
+
+    fcn = c->node;
+
+    if (c->published && fcn->lock_time == c->lock_time && fcn->temp_name) {
+        ngx_slab_free_locked(cache->shpool, fcn->temp_name);
+        fcn->temp_name = NULL;
+        fcn->temp_length = 0;
+    }
+}
+
+
+static ngx_int_t
+ngx_http_file_cache_stream_open(ngx_http_request_t *r, ngx_http_cache_t *c,
+    u_char *name, ngx_msec_t lock_time)
+{
+    u_char                        *p;
+    ssize_t                        n;
+    ngx_fd_t                       fd;
+    ngx_str_t                     *key;
+    ngx_uint_t                     i;
+    ngx_file_t                     file;
+    ngx_file_info_t                fi;
+    ngx_pool_cleanup_t            *cln;
+    ngx_pool_cleanup_file_t       *clnf;
+    ngx_http_file_cache_header_t  *h;
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http file cache stream: \"%s\"", name);
+
+    if (c->buf == NULL) {
+        c->buf = ngx_create_temp_buf(r->pool, c->body_start);
+        if (c->buf == NULL) {
+            return NGX_DECLINED;
+        }
+    }
+
+    cln = ngx_pool_cleanup_add(r->pool, sizeof(ngx_pool_cleanup_file_t));
+    if (cln == NULL) {
+        return NGX_DECLINED;
+    }
+
+    fd = ngx_open_file(name, NGX_FILE_RDONLY, NGX_FILE_OPEN, 0);
+
+    if (fd == NGX_INVALID_FILE) {
+        /* the file may have been renamed or removed meanwhile */
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, ngx_errno,
+                       ngx_open_file_n " \"%s\" failed", name);
+        return NGX_AGAIN;
+    }
+
+    cln->handler = ngx_pool_cleanup_file;
+    clnf = cln->data;
+
+    clnf->fd = fd;
+    clnf->name = name;
+    clnf->log = r->pool->log;
+
+    if (ngx_fd_info(fd, &fi) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, r->connection->log, ngx_errno,
+                      ngx_fd_info_n " \"%s\" failed", name);
+        goto failed;
+    }
+
+    ngx_memzero(&file, sizeof(ngx_file_t));
+
+    file.fd = fd;
+    file.name.data = name;
+    file.name.len = ngx_strlen(name);
+    file.log = r->connection->log;
+
+    n = ngx_read_file(&file, c->buf->pos, c->body_start, 0);
+
+    if (n == NGX_ERROR) {
+        goto failed;
+    }
+
+    if ((size_t) n < c->header_start) {
+        ngx_pool_run_cleanup_file(r->pool, fd);
+        return NGX_AGAIN;
+    }
+
+    h = (ngx_http_file_cache_header_t *) c->buf->pos;
+
+    if (h->version != NGX_HTTP_CACHE_VERSION
+        || h->crc32 != c->crc32
+        || (size_t) h->header_start != c->header_start
+        || (size_t) h->body_start > c->body_start
+        || h->vary_len != 0)
+    {
+        goto failed;
+    }
+
+    p = c->buf->pos + sizeof(ngx_http_file_cache_header_t)
+        + sizeof(ngx_http_file_cache_key);
+
+    key = c->keys.elts;
+    for (i = 0; i < c->keys.nelts; i++) {
+        if (ngx_memcmp(p, key[i].data, key[i].len) != 0) {
+            goto failed;
+        }
+
+        p += key[i].len;
+    }
+
+    if ((size_t) h->body_start > (size_t) n) {
+        ngx_pool_run_cleanup_file(r->pool, fd);
+        return NGX_AGAIN;
+    }
+
+    c->buf->last = c->buf->pos + n;
+
+    c->valid_sec = h->valid_sec;
+    c->updating_sec = h->updating_sec;
+    c->error_sec = h->error_sec;
+    c->last_modified = h->last_modified;
+    c->date = h->date;
+    c->valid_msec = h->valid_msec;
+    c->body_start = h->body_start;
+    c->etag.len = h->etag_len;
+    c->etag.data = h->etag;
+
+    c->file.fd = fd;
+    c->file.log = r->connection->log;
+    c->length = h->body_start;
+    c->uniq = ngx_file_uniq(&fi);
+    c->lock_time = lock_time;
+    c->streaming = 1;
+
+    r->cached = 1;
+
+    return NGX_OK;
+
+failed:
+
+    ngx_pool_run_cleanup_file(r->pool, fd);
+
+    return NGX_DECLINED;
+}
+
+
 static ngx_int_t
 ngx_http_file_cache_read(ngx_http_request_t *r, ngx_http_cache_t *c)
 {
@@ -675,6 +1047,30 @@ ngx_http_file_cache_aio_read(ngx_http_request_t *r, ngx_http_cache_t *c)
 
 #if (NGX_HAVE_FILE_AIO)
 
+#if (NGX_HAVE_IO_URING)
+
+    if (clcf->aio == NGX_HTTP_AIO_IO_URING && ngx_file_io_uring) {
+        n = ngx_file_io_uring_read(&c->file, c->buf->pos, c->body_start, 0,
+                                   r->pool);
+
+        if (n != NGX_AGAIN) {
+            c->reading = 0;
+            return n;
+        }
+
+        c->reading = 1;
+
+        c->file.aio->data = r;
+        c->file.aio->handler = ngx_http_cache_aio_event_handler;
+
+        r->main->blocked++;
+        r->aio = 1;
+
+        return NGX_AGAIN;
+    }
+
+#endif
+
     if (clcf->aio == NGX_HTTP_AIO_ON && ngx_file_aio) {
         n = ngx_file_aio_read(&c->file, c->buf->pos, c->body_start, 0, r->pool);
 
@@ -1421,9 +1817,13 @@ ngx_http_file_cache_update(ngx_http_request_t *r, ngx_temp_file_t *tf)
         c->node->exists = 1;
     }
 
+    ngx_http_file_cache_unpublish(cache, c);
+
     c->node->updating = 0;
 
     ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    ngx_http_file_cache_wakeup(cache, c->node);
 }
 
 
@@ -1576,6 +1976,26 @@ ngx_http_cache_send(ngx_http_request_t *r)
         return ngx_http_send_header(r);
     }
 
+    if (c->streaming) {
+        r->allow_ranges = 0;
+
+        rc = ngx_http_send_header(r);
+
+        if (rc == NGX_ERROR || rc > NGX_OK || r->header_only) {
+            return rc;
+        }
+
+        c->wait_time = ngx_current_msec + c->lock_timeout;
+        c->wait_event.handler = ngx_http_file_cache_stream_handler;
+
+        r->read_event_handler = ngx_http_test_reading;
+        r->write_event_handler = ngx_http_file_cache_stream;
+
+        ngx_http_file_cache_stream(r);
+
+        return NGX_DONE;
+    }
+
     /* we need to allocate all before the header would be sent */
 
     b = ngx_calloc_buf(r->pool);
@@ -1612,12 +2032,202 @@ ngx_http_cache_send(ngx_http_request_t *r)
 }
 
 
+static void
+ngx_http_file_cache_stream_handler(ngx_event_t *ev)
+{
+    ngx_connection_t    *c;
+    ngx_http_request_t  *r;
+
+    r = ev->data;
+    c = r->connection;
+
+    ngx_http_set_log_request(c->log, r);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "http file cache stream handler: \"%V?%V\"",
+                   &r->uri, &r->args);
+
+    ngx_http_file_cache_stream(r);
+
+    ngx_http_run_posted_requests(c);
+}
+
+
+static void
+ngx_http_file_cache_stream(ngx_http_request_t *r)
+{
+    off_t                        size;
+    ngx_int_t                    rc, state;
+    ngx_buf_t                   *b;
+    ngx_chain_t                  out;
+    ngx_event_t                 *wev;
+    ngx_file_info_t              fi;
+    ngx_http_cache_t            *c;
+    ngx_http_file_cache_t       *cache;
+    ngx_http_core_loc_conf_t    *clcf;
+    ngx_http_file_cache_node_t  *fcn;
+
+    c = r->cache;
+    wev = r->connection->write;
+
+    ngx_log_debug3(NGX_LOG_DEBUG_HTTP, wev->log, 0,
+                   "http file cache stream: %O \"%V?%V\"",
+                   c->length, &r->uri, &r->args);
+
+    clcf = ngx_http_get_module_loc_conf(r->main, ngx_http_core_module);
+
+    if (wev->timedout) {
+        ngx_log_error(NGX_LOG_INFO, r->connection->log, NGX_ETIMEDOUT,
+                      "client timed out");
+        r->connection->timedout = 1;
+
+        ngx_http_finalize_request(r, NGX_HTTP_REQUEST_TIME_OUT);
+        return;
+    }
+
+    ngx_http_file_cache_unwait(c);
+
+    if (wev->delayed || r->aio) {
+        goto blocked;
+    }
+
+    if (r->buffered || r->connection->buffered) {
+        rc = ngx_http_output_filter(r, NULL);
+
+        if (rc == NGX_ERROR) {
+            ngx_http_finalize_request(r, rc);
+            return;
+        }
+
+        if (r->buffered || r->connection->buffered) {
+            goto blocked;
+        }
+    }
+
+    if (wev->timer_set) {
+        ngx_del_timer(wev);
+    }
+
+    cache = c->file_cache;
+    fcn = c->node;
+    size = 0;
+
+    ngx_shmtx_lock(&cache->shpool->mutex);
+
+    if (fcn->updating && fcn->lock_time == c->lock_time) {
+        state = NGX_AGAIN;
+        size = fcn->temp_length;
+
+    } else if (fcn->exists && fcn->uniq == c->uniq) {
+        state = NGX_OK;
+
+    } else {
+        state = NGX_ERROR;
+    }
+
+    ngx_shmtx_unlock(&cache->shpool->mutex);
+
+    if (state == NGX_ERROR) {
+        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                      "cache file \"%s\" was not completed",
+                      c->file.name.data);
+        ngx_http_finalize_request(r, NGX_ERROR);
+        return;
+    }
+
+    if (state == NGX_OK) {
+        if (ngx_fd_info(c->file.fd, &fi) == NGX_FILE_ERROR) {
+            ngx_log_error(NGX_LOG_CRIT, r->connection->log, ngx_errno,
+                          ngx_fd_info_n " \"%s\" failed",
+                          c->file.name.data);
+            ngx_http_finalize_request(r, NGX_ERROR);
+            return;
+        }
+
+        size = ngx_file_size(&fi);
+    }
+
+    if (size > c->length || state == NGX_OK) {
+
+        b = ngx_calloc_buf(r->pool);
+        if (b == NULL) {
+            ngx_http_finalize_request(r, NGX_ERROR);
+            return;
+        }
+
+        b->file = ngx_pcalloc(r->pool, sizeof(ngx_file_t));
+        if (b->file == NULL) {
+            ngx_http_finalize_request(r, NGX_ERROR);
+            return;
+        }
+
+        b->file_pos = c->length;
+        b->file_last = ngx_max(size, c->length);
+        b->in_file = (b->file_last > b->file_pos) ? 1 : 0;
+
+        if (state == NGX_OK) {
+            b->last_buf = 1;
+            b->last_in_chain = 1;
+
+        } else {
+            b->flush = 1;
+        }
+
+        b->file->fd = c->file.fd;
+        b->file->name = c->file.name;
+        b->file->log = r->connection->log;
+
+        out.buf = b;
+        out.next = NULL;
+
+        c->length = b->file_last;
+        c->wait_time = ngx_current_msec + c->lock_timeout;
+
+        rc = ngx_http_output_filter(r, &out);
+
+        if (state == NGX_OK || rc == NGX_ERROR) {
+            r->write_event_handler = ngx_http_request_empty_handler;
+            ngx_http_finalize_request(r, rc);
+            return;
+        }
+
+        if (r->buffered || r->connection->buffered) {
+            goto blocked;
+        }
+    }
+
+    if ((ngx_msec_int_t) (c->wait_time - ngx_current_msec) <= 0) {
+        ngx_log_error(NGX_LOG_ERR, r->connection->log, 0,
+                      "cache lock timeout while streaming \"%s\"",
+                      c->file.name.data);
+        ngx_http_finalize_request(r, NGX_ERROR);
+        return;
+    }
+
+    ngx_http_file_cache_wait(c);
+
+    return;
+
+blocked:
+
+    if (!wev->delayed) {
+        ngx_add_timer(wev, clcf->send_timeout);
+    }
+
+    if (ngx_handle_write_event(wev, clcf->send_lowat) != NGX_OK) {
+        ngx_http_finalize_request(r, NGX_ERROR);
+    }
+}
+
+
 void
 ngx_http_file_cache_free(ngx_http_cache_t *c, ngx_temp_file_t *tf)
 {
     ngx_http_file_cache_t       *cache;
     ngx_http_file_cache_node_t  *fcn;
 
+    ngx_http_file_cache_unwait(c);
+
     if (c->updated || c->node == NULL) {
         return;
     }
@@ -1633,6 +2243,7 @@ ngx_http_file_cache_free(ngx_http_cache_t *c, ngx_temp_file_t *tf)
     fcn->count--;
 
     if (c->updating && fcn->lock_time == c->lock_time) {
+        ngx_http_file_cache_unpublish(cache, c);
         fcn->updating = 0;
     }
 
@@ -1654,6 +2265,10 @@ ngx_http_file_cache_free(ngx_http_cache_t *c, ngx_temp_file_t *tf)
 
     ngx_shmtx_unlock(&cache->shpool->mutex);
 
+    if (c->published) {
+        ngx_http_file_cache_wakeup(cache, fcn);
+    }
+
     c->updated = 1;
     c->updating = 0;
 
@@ -1670,10 +2285,6 @@ ngx_http_file_cache_free(ngx_http_cache_t *c, ngx_temp_file_t *tf)
             }
         }
     }
-
-    if (c->wait_event.timer_set) {
-        ngx_del_timer(&c->wait_event);
-    }
 }
 
 
@@ -2321,6 +2932,8 @@ ngx_http_file_cache_set_slot(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
         return NGX_CONF_ERROR;
     }
 
+    ngx_queue_init(&cache->waiters);
+
     cache->path = ngx_pcalloc(cf->pool, sizeof(ngx_path_t));
     if (cache->path == NULL) {
         return NGX_CONF_ERROR;
@@ -48,6 +48,9 @@ static void ngx_http_request_finalizer(ngx_http_request_t *r);
 
 static void ngx_http_set_keepalive(ngx_http_request_t *r);
 static void ngx_http_keepalive_handler(ngx_event_t *ev);
+static void *ngx_http_alloc_header_buf(ngx_connection_t *c, size_t size);
+static ngx_int_t ngx_http_free_header_buf(ngx_connection_t *c, void *p,
+    size_t size);
 static void ngx_http_set_lingering_close(ngx_http_request_t *r);
 static void ngx_http_lingering_close_handler(ngx_event_t *ev);
 static ngx_int_t ngx_http_post_action(ngx_http_request_t *r);
@@ -64,6 +67,25 @@ static void ngx_http_ssl_handshake_handler(ngx_connection_t *c);
 #endif
 
 
+/*
+ * the header buffers released by idle connections are kept
+ * for reuse by a worker, up to the NGX_HTTP_HEADER_BUF_CACHE bytes
+ */
+
+#define NGX_HTTP_HEADER_BUF_CACHE        (1024 * 1024)
+#define NGX_HTTP_HEADER_BUF_CACHE_SIZES  4
+
+typedef struct {
+    size_t                     size;
+    void                      *free;
+} ngx_http_header_buf_cache_t;
+
+
+static ngx_http_header_buf_cache_t
+    ngx_http_header_buf_cache[NGX_HTTP_HEADER_BUF_CACHE_SIZES];
+static size_t  ngx_http_header_buf_cached;
+
+
 static char *ngx_http_client_errors[] = {
 
     /* NGX_HTTP_PARSE_INVALID_METHOD */
@@ -415,17 +437,20 @@ ngx_http_wait_request_handler(ngx_event_t *rev)
     b = c->buffer;
 
     if (b == NULL) {
-        b = ngx_create_temp_buf(c->pool, size);
+        b = ngx_calloc_buf(c->pool);
         if (b == NULL) {
             ngx_http_close_connection(c);
             return;
         }
 
+        b->temporary = 1;
+
         c->buffer = b;
+    }
 
-    } else if (b->start == NULL) {
+    if (b->start == NULL) {
 
-        b->start = ngx_palloc(c->pool, size);
+        b->start = ngx_http_alloc_header_buf(c, size);
         if (b->start == NULL) {
             ngx_http_close_connection(c);
             return;
@@ -454,7 +479,7 @@ ngx_http_wait_request_handler(ngx_event_t *rev)
          * We are trying to not hold c->buffer's memory for an idle connection.
          */
 
-        if (ngx_pfree(c->pool, b->start) == NGX_OK) {
+        if (ngx_http_free_header_buf(c, b->start, size) == NGX_OK) {
             b->start = NULL;
         }
 
@@ -1498,18 +1523,43 @@ ngx_http_alloc_large_header_buffer(ngx_http_request_t *r,
 
         b = cl->buf;
 
+        if (b->start == NULL) {
+
+            /* the buffer's memory was released by ngx_http_set_keepalive() */
+
+            b->start = ngx_http_alloc_header_buf(r->connection,
+                                       cscf->large_client_header_buffers.size);
+            if (b->start == NULL) {
+                return NGX_ERROR;
+            }
+
+            b->pos = b->start;
+            b->last = b->start;
+            b->end = b->start + cscf->large_client_header_buffers.size;
+        }
+
         ngx_log_debug2(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                        "http large header free: %p %uz",
                        b->pos, b->end - b->last);
 
     } else if (hc->nbusy < cscf->large_client_header_buffers.num) {
 
-        b = ngx_create_temp_buf(r->connection->pool,
-                                cscf->large_client_header_buffers.size);
+        b = ngx_calloc_buf(r->connection->pool);
         if (b == NULL) {
             return NGX_ERROR;
         }
 
+        b->start = ngx_http_alloc_header_buf(r->connection,
+                                       cscf->large_client_header_buffers.size);
+        if (b->start == NULL) {
+            return NGX_ERROR;
+        }
+
+        b->pos = b->start;
+        b->last = b->start;
+        b->end = b->start + cscf->large_client_header_buffers.size;
+        b->temporary = 1;
+
         cl = ngx_alloc_chain_link(r->connection->pool);
         if (cl == NULL) {
             return NGX_ERROR;
@@ -2154,10 +2204,17 @@ ngx_http_find_virtual_server(ngx_connection_t *c,
     if (host->len && virtual_names->nregex) {
         ngx_int_t                n;
         ngx_uint_t               i;
+        uintptr_t               *candidates;
         ngx_http_server_name_t  *sn;
 
         sn = virtual_names->regex;
 
+        /* the names which cannot match are skipped */
+
+        candidates = virtual_names->regex_set
+                     ? ngx_regex_set_match(virtual_names->regex_set, host)
+                     : NULL;
+
 #if (NGX_HTTP_SSL && defined SSL_CTRL_SET_TLSEXT_HOSTNAME)
 
         if (r == NULL) {
@@ -2165,6 +2222,10 @@ ngx_http_find_virtual_server(ngx_connection_t *c,
 
             for (i = 0; i < virtual_names->nregex; i++) {
 
+                if (!ngx_regex_set_candidate(candidates, i)) {
+                    continue;
+                }
+
                 n = ngx_regex_exec(sn[i].regex->regex, host, NULL, 0);
 
                 if (n == NGX_REGEX_NO_MATCHED) {
@@ -2194,6 +2255,10 @@ ngx_http_find_virtual_server(ngx_connection_t *c,
 
         for (i = 0; i < virtual_names->nregex; i++) {
 
+            if (!ngx_regex_set_candidate(candidates, i)) {
+                continue;
+            }
+
             n = ngx_http_regex_exec(r, sn[i].regex, host);
 
             if (n == NGX_DECLINED) {
@@ -2218,8 +2283,10 @@ ngx_http_find_virtual_server(ngx_connection_t *c,
 static void
 ngx_http_request_handler(ngx_event_t *ev)
 {
-    ngx_connection_t    *c;
-    ngx_http_request_t  *r;
+    ngx_int_t                     rc;
+    ngx_connection_t             *c;
+    ngx_http_request_t           *r;
+    ngx_http_pipelined_output_t  *po;
 
     c = ev->data;
     r = c->data;
@@ -2241,6 +2308,37 @@ ngx_http_request_handler(ngx_event_t *ev)
         ev->timedout = 0;
     }
 
+    po = r->http_connection ? r->http_connection->pipelined : NULL;
+
+    if (ev->write && po && po->armed) {
+
+        /* the output postponed by the previous pipelined requests */
+
+        if (ev->timedout) {
+            ngx_log_error(NGX_LOG_INFO, c->log, NGX_ETIMEDOUT,
+                          "client timed out");
+            c->timedout = 1;
+
+            r->main->count++;
+            ngx_http_terminate_request(r, NGX_HTTP_REQUEST_TIME_OUT);
+            ngx_http_run_posted_requests(c);
+            return;
+        }
+
+        rc = ngx_http_send_pipelined(po);
+
+        if (rc == NGX_ERROR) {
+            r->main->count++;
+            ngx_http_terminate_request(r, 0);
+            ngx_http_run_posted_requests(c);
+            return;
+        }
+
+        if (rc == NGX_AGAIN) {
+            return;
+        }
+    }
+
     if (ev->write) {
         r->write_event_handler(r);
 
@@ -2576,7 +2674,9 @@ ngx_http_terminate_handler(ngx_http_request_t *r)
 static void
 ngx_http_finalize_connection(ngx_http_request_t *r)
 {
-    ngx_http_core_loc_conf_t  *clcf;
+    ngx_int_t                     rc;
+    ngx_http_core_loc_conf_t     *clcf;
+    ngx_http_pipelined_output_t  *po;
 
 #if (NGX_HTTP_V2)
     if (r->stream) {
@@ -2610,6 +2710,35 @@ ngx_http_finalize_connection(ngx_http_request_t *r)
         r->lingering_close = 1;
     }
 
+    po = r->http_connection ? r->http_connection->pipelined : NULL;
+
+    if (po
+        && po->buf.pos != po->buf.last
+        && (ngx_terminate
+            || ngx_exiting
+            || !r->keepalive
+            || clcf->keepalive_timeout == 0
+            || r->header_in->pos == r->header_in->last))
+    {
+        /*
+         * the output postponed by the previous pipelined requests
+         * is sent before the connection is closed or becomes idle,
+         * as no response follows it
+         */
+
+        rc = ngx_http_send_pipelined(po);
+
+        if (rc == NGX_AGAIN) {
+            r->write_event_handler = ngx_http_finalize_connection;
+            return;
+        }
+
+        if (rc == NGX_ERROR) {
+            ngx_http_close_request(r, 0);
+            return;
+        }
+    }
+
     if (!ngx_terminate
          && !ngx_exiting
          && r->keepalive
@@ -2889,13 +3018,14 @@ closed:
 static void
 ngx_http_set_keepalive(ngx_http_request_t *r)
 {
-    int                        tcp_nodelay;
-    ngx_buf_t                 *b, *f;
-    ngx_chain_t               *cl, *ln;
-    ngx_event_t               *rev, *wev;
-    ngx_connection_t          *c;
-    ngx_http_connection_t     *hc;
-    ngx_http_core_loc_conf_t  *clcf;
+    int                           tcp_nodelay;
+    ngx_buf_t                    *b, *f;
+    ngx_chain_t                  *cl, *ln;
+    ngx_event_t                  *rev, *wev;
+    ngx_connection_t             *c;
+    ngx_http_connection_t        *hc;
+    ngx_http_core_loc_conf_t     *clcf;
+    ngx_http_pipelined_output_t  *po;
 
     c = r->connection;
     rev = c->read;
@@ -3001,6 +3131,23 @@ ngx_http_set_keepalive(ngx_http_request_t *r)
 
         rev->handler = ngx_http_process_request_line;
         ngx_post_event(rev, &ngx_posted_events);
+
+        po = hc->pipelined;
+
+        if (po && po->buf.pos != po->buf.last) {
+
+            /*
+             * the postponed output is sent after the pipelined request,
+             * unless it is sent along with its response
+             */
+
+            if (po->flush.posted) {
+                ngx_delete_posted_event(&po->flush);
+            }
+
+            ngx_post_event(&po->flush, &ngx_posted_events);
+        }
+
         return;
     }
 
@@ -3013,7 +3160,7 @@ ngx_http_set_keepalive(ngx_http_request_t *r)
 
     b = c->buffer;
 
-    if (ngx_pfree(c->pool, b->start) == NGX_OK) {
+    if (ngx_http_free_header_buf(c, b->start, b->end - b->start) == NGX_OK) {
 
         /*
          * the special note for ngx_http_keepalive_handler() that
@@ -3027,18 +3174,32 @@ ngx_http_set_keepalive(ngx_http_request_t *r)
         b->last = b->start;
     }
 
+    po = hc->pipelined;
+
+    if (po && po->buf.start && po->buf.pos == po->buf.last
+        && ngx_pfree(c->pool, po->buf.start) == NGX_OK)
+    {
+        po->buf.start = NULL;
+    }
+
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->log, 0, "hc free: %p",
                    hc->free);
 
-    if (hc->free) {
-        for (cl = hc->free; cl; /* void */) {
-            ln = cl;
-            cl = cl->next;
-            ngx_pfree(c->pool, ln->buf->start);
-            ngx_free_chain(c->pool, ln);
-        }
+    /*
+     * the large header buffers' memory is released, while the buffers
+     * and the chain links are kept in hc->free, so they do not have
+     * to be allocated from c->pool again for the next request
+     */
+
+    for (cl = hc->free; cl; cl = cl->next) {
+        f = cl->buf;
 
-        hc->free = NULL;
+        if (f->start
+            && ngx_http_free_header_buf(c, f->start, f->end - f->start)
+               == NGX_OK)
+        {
+            f->start = NULL;
+        }
     }
 
     ngx_log_debug2(NGX_LOG_DEBUG_HTTP, c->log, 0, "hc busy: %p %i",
@@ -3048,8 +3209,21 @@ ngx_http_set_keepalive(ngx_http_request_t *r)
         for (cl = hc->busy; cl; /* void */) {
             ln = cl;
             cl = cl->next;
-            ngx_pfree(c->pool, ln->buf->start);
-            ngx_free_chain(c->pool, ln);
+
+            f = ln->buf;
+
+            if (ngx_http_free_header_buf(c, f->start, f->end - f->start)
+                == NGX_OK)
+            {
+                f->start = NULL;
+
+            } else {
+                f->pos = f->start;
+                f->last = f->start;
+            }
+
+            ln->next = hc->free;
+            hc->free = ln;
         }
 
         hc->busy = NULL;
@@ -3100,6 +3274,15 @@ ngx_http_set_keepalive(ngx_http_request_t *r)
     c->idle = 1;
     ngx_reusable_connection(c, 1);
 
+#if (NGX_STAT_STUB)
+#if (NGX_HTTP_SSL)
+    ngx_http_stat_idle(c, hc, c->ssl ? NGX_HTTP_IDLE_HTTPS
+                                     : NGX_HTTP_IDLE_HTTP);
+#else
+    ngx_http_stat_idle(c, hc, NGX_HTTP_IDLE_HTTP);
+#endif
+#endif
+
     ngx_add_timer(rev, clcf->keepalive_timeout);
 
     if (rev->ready) {
@@ -3120,6 +3303,10 @@ ngx_http_keepalive_handler(ngx_event_t *rev)
 
     ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->log, 0, "http keepalive handler");
 
+#if (NGX_STAT_STUB)
+    ngx_http_stat_busy(c->data);
+#endif
+
     if (rev->timedout || c->close) {
         ngx_http_close_connection(c);
         return;
@@ -3156,7 +3343,7 @@ ngx_http_keepalive_handler(ngx_event_t *rev)
          * to keep the buffer size.
          */
 
-        b->pos = ngx_palloc(c->pool, size);
+        b->pos = ngx_http_alloc_header_buf(c, size);
         if (b->pos == NULL) {
             ngx_http_close_connection(c);
             return;
@@ -3189,7 +3376,7 @@ ngx_http_keepalive_handler(ngx_event_t *rev)
          * c->buffer's memory for a keepalive connection.
          */
 
-        if (ngx_pfree(c->pool, b->start) == NGX_OK) {
+        if (ngx_http_free_header_buf(c, b->start, size) == NGX_OK) {
 
             /*
              * the special note that c->buffer's memory was freed
@@ -3198,6 +3385,15 @@ ngx_http_keepalive_handler(ngx_event_t *rev)
             b->pos = NULL;
         }
 
+#if (NGX_STAT_STUB)
+#if (NGX_HTTP_SSL)
+        ngx_http_stat_idle(c, c->data, c->ssl ? NGX_HTTP_IDLE_HTTPS
+                                              : NGX_HTTP_IDLE_HTTP);
+#else
+        ngx_http_stat_idle(c, c->data, NGX_HTTP_IDLE_HTTP);
+#endif
+#endif
+
         return;
     }
 
@@ -3239,6 +3435,164 @@ ngx_http_keepalive_handler(ngx_event_t *rev)
 }
 
 
+static void *
+ngx_http_alloc_header_buf(ngx_connection_t *c, size_t size)
+{
+    void        *p;
+    ngx_uint_t   i;
+
+    if (size <= c->pool->max) {
+        return ngx_palloc(c->pool, size);
+    }
+
+    for (i = 0; i < NGX_HTTP_HEADER_BUF_CACHE_SIZES; i++) {
+
+        if (ngx_http_header_buf_cache[i].size != size) {
+            continue;
+        }
+
+        p = ngx_http_header_buf_cache[i].free;
+
+        if (p == NULL) {
+            break;
+        }
+
+        if (ngx_pool_attach(c->pool, p) != NGX_OK) {
+            return NULL;
+        }
+
+        ngx_http_header_buf_cache[i].free = *(void **) p;
+        ngx_http_header_buf_cached -= size;
+
+        ngx_log_debug2(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                       "http header buf reuse: %p:%uz", p, size);
+
+        return p;
+    }
+
+    return ngx_palloc(c->pool, size);
+}
+
+
+static ngx_int_t
+ngx_http_free_header_buf(ngx_connection_t *c, void *p, size_t size)
+{
+    ngx_uint_t  i;
+
+    if (ngx_pool_detach(c->pool, p) != NGX_OK) {
+        return NGX_DECLINED;
+    }
+
+    if (ngx_http_header_buf_cached + size <= NGX_HTTP_HEADER_BUF_CACHE) {
+
+        for (i = 0; i < NGX_HTTP_HEADER_BUF_CACHE_SIZES; i++) {
+
+            if (ngx_http_header_buf_cache[i].size == 0) {
+                ngx_http_header_buf_cache[i].size = size;
+            }
+
+            if (ngx_http_header_buf_cache[i].size == size) {
+                *(void **) p = ngx_http_header_buf_cache[i].free;
+                ngx_http_header_buf_cache[i].free = p;
+                ngx_http_header_buf_cached += size;
+
+                ngx_log_debug2(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                               "http header buf cache: %p:%uz", p, size);
+
+                return NGX_OK;
+            }
+        }
+    }
+
+    ngx_free(p);
+
+    return NGX_OK;
+}
+
+
+#if (NGX_STAT_STUB)
+
+void
+ngx_http_stat_idle(ngx_connection_t *c, ngx_http_connection_t *hc,
+    ngx_uint_t protocol)
+{
+    size_t  size;
+
+    if (hc->idle) {
+
+        /* the connection is already counted as idle */
+
+        return;
+    }
+
+    /*
+     * the memory held by nginx itself, the TLS library's per-connection
+     * state is not accounted; large allocations are released by now
+     */
+
+    size = sizeof(ngx_connection_t) + 2 * sizeof(ngx_event_t)
+           + ngx_pool_size(c->pool);
+
+    switch (protocol) {
+
+    case NGX_HTTP_IDLE_HTTP:
+        (void) ngx_atomic_fetch_add(ngx_stat_idle_http, 1);
+        (void) ngx_atomic_fetch_add(ngx_stat_idle_http_size, size);
+        break;
+
+    case NGX_HTTP_IDLE_HTTPS:
+        (void) ngx_atomic_fetch_add(ngx_stat_idle_https, 1);
+        (void) ngx_atomic_fetch_add(ngx_stat_idle_https_size, size);
+        break;
+
+    case NGX_HTTP_IDLE_HTTP2:
+        (void) ngx_atomic_fetch_add(ngx_stat_idle_http2, 1);
+        (void) ngx_atomic_fetch_add(ngx_stat_idle_http2_size, size);
+        break;
+
+    default:
+        return;
+    }
+
+    hc->idle = protocol;
+    hc->idle_size = size;
+}
+
+
+void
+ngx_http_stat_busy(ngx_http_connection_t *hc)
+{
+    ngx_atomic_int_t  size;
+
+    size = hc->idle_size;
+
+    switch (hc->idle) {
+
+    case 0:
+        return;
+
+    case NGX_HTTP_IDLE_HTTP:
+        (void) ngx_atomic_fetch_add(ngx_stat_idle_http, -1);
+        (void) ngx_atomic_fetch_add(ngx_stat_idle_http_size, -size);
+        break;
+
+    case NGX_HTTP_IDLE_HTTPS:
+        (void) ngx_atomic_fetch_add(ngx_stat_idle_https, -1);
+        (void) ngx_atomic_fetch_add(ngx_stat_idle_https_size, -size);
+        break;
+
+    default: /* NGX_HTTP_IDLE_HTTP2 */
+        (void) ngx_atomic_fetch_add(ngx_stat_idle_http2, -1);
+        (void) ngx_atomic_fetch_add(ngx_stat_idle_http2_size, -size);
+        break;
+    }
+
+    hc->idle = 0;
+}
+
+#endif
+
+
 static void
 ngx_http_set_lingering_close(ngx_http_request_t *r)
 {
@@ -3457,6 +3811,13 @@ ngx_http_close_request(ngx_http_request_t *r, ngx_int_t rc)
     }
 #endif
 
+    if (r->http_connection && r->http_connection->pipelined && !c->error) {
+
+        /* the postponed output is sent if it fits into the socket */
+
+        (void) ngx_http_send_pipelined(r->http_connection->pipelined);
+    }
+
     ngx_http_free_request(r, rc);
     ngx_http_close_connection(c);
 }
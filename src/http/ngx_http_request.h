@@ -69,6 +69,11 @@
 #define NGX_HTTP_LOG_UNSAFE                1
 
 
+#define NGX_HTTP_IDLE_HTTP                 1
+#define NGX_HTTP_IDLE_HTTPS                2
+#define NGX_HTTP_IDLE_HTTP2                3
+
+
 #define NGX_HTTP_CONTINUE                  100
 #define NGX_HTTP_SWITCHING_PROTOCOLS       101
 #define NGX_HTTP_PROCESSING                102
@@ -304,6 +309,8 @@ typedef struct {
 } ngx_http_request_body_t;
 
 
+typedef struct ngx_http_pipelined_output_s  ngx_http_pipelined_output_t;
+
 typedef struct ngx_http_addr_conf_s  ngx_http_addr_conf_t;
 
 typedef struct {
@@ -322,8 +329,13 @@ typedef struct {
 
     ngx_chain_t                      *free;
 
+    ngx_http_pipelined_output_t      *pipelined;
+
+    size_t                            idle_size;
+
     unsigned                          ssl:1;
     unsigned                          proxy_protocol:1;
+    unsigned                          idle:2;
 } ngx_http_connection_t;
 
 
@@ -543,6 +555,7 @@ struct ngx_http_request_s {
     unsigned                          allow_ranges:1;
     unsigned                          subrequest_ranges:1;
     unsigned                          single_range:1;
+    unsigned                          ordered_ranges:1;
     unsigned                          disable_not_modified:1;
     unsigned                          stat_reading:1;
     unsigned                          stat_writing:1;
@@ -25,6 +25,9 @@ static ngx_int_t
     ngx_http_script_add_full_name_code(ngx_http_script_compile_t *sc);
 static size_t ngx_http_script_full_name_len_code(ngx_http_script_engine_t *e);
 static void ngx_http_script_full_name_code(ngx_http_script_engine_t *e);
+static ngx_int_t ngx_http_script_run_parts(ngx_http_request_t *r,
+    ngx_http_script_part_t *parts, ngx_uint_t nparts, ngx_uint_t flushed,
+    ngx_uint_t escape, ngx_str_t *value);
 
 
 #define ngx_http_script_exit  (u_char *) &ngx_http_script_exit_code
@@ -70,6 +73,11 @@ ngx_http_complex_value(ngx_http_request_t *r, ngx_http_complex_value_t *val,
 
     ngx_http_script_flush_complex_value(r, val);
 
+    if (val->parts) {
+        return ngx_http_script_run_parts(r, val->parts, val->nparts, 1, 0,
+                                         value);
+    }
+
     ngx_memzero(&e, sizeof(ngx_http_script_engine_t));
 
     e.ip = val->lengths;
@@ -107,6 +115,7 @@ ngx_http_complex_value(ngx_http_request_t *r, ngx_http_complex_value_t *val,
 ngx_int_t
 ngx_http_compile_complex_value(ngx_http_compile_complex_value_t *ccv)
 {
+    ngx_int_t                   rc;
     ngx_str_t                  *v;
     ngx_uint_t                  i, n, nv, nc;
     ngx_array_t                 flushes, lengths, values, *pf, *pl, *pv;
@@ -143,6 +152,8 @@ ngx_http_compile_complex_value(ngx_http_compile_complex_value_t *ccv)
     ccv->complex_value->flushes = NULL;
     ccv->complex_value->lengths = NULL;
     ccv->complex_value->values = NULL;
+    ccv->complex_value->parts = NULL;
+    ccv->complex_value->nparts = 0;
 
     if (nv == 0 && nc == 0) {
         return NGX_OK;
@@ -204,6 +215,15 @@ ngx_http_compile_complex_value(ngx_http_compile_complex_value_t *ccv)
     ccv->complex_value->lengths = lengths.elts;
     ccv->complex_value->values = values.elts;
 
+    rc = ngx_http_script_compile_parts(ccv->cf, values.elts,
+                                       (u_char *) values.elts + values.nelts,
+                                       &ccv->complex_value->parts,
+                                       &ccv->complex_value->nparts);
+
+    if (rc == NGX_ERROR) {
+        return NGX_ERROR;
+    }
+
     return NGX_OK;
 }
 
@@ -551,6 +571,253 @@ ngx_http_script_flush_no_cacheable_variables(ngx_http_request_t *r,
 }
 
 
+ngx_int_t
+ngx_http_script_compile_parts(ngx_conf_t *cf, u_char *ip, u_char *last,
+    ngx_http_script_part_t **parts, ngx_uint_t *nparts)
+{
+    u_char                               *p, *data;
+    size_t                                len;
+    ngx_uint_t                            n;
+    ngx_http_script_part_t               *part, buf[NGX_HTTP_SCRIPT_MAX_PARTS];
+    ngx_http_script_code_pt               code;
+    ngx_http_script_var_code_t           *var;
+    ngx_http_script_copy_code_t          *copy;
+#if (NGX_PCRE)
+    ngx_http_script_copy_capture_code_t  *cap;
+#endif
+
+    /*
+     * the codes may be moved by a later array growth,
+     * so the constant strings are copied to the configuration pool
+     */
+
+    n = 0;
+    part = NULL;
+
+    while (ip < last && *(uintptr_t *) ip) {
+
+        code = *(ngx_http_script_code_pt *) ip;
+
+        if (code == ngx_http_script_copy_code) {
+            copy = (ngx_http_script_copy_code_t *) ip;
+            data = ip + sizeof(ngx_http_script_copy_code_t);
+            len = copy->len;
+
+            ip += sizeof(ngx_http_script_copy_code_t)
+                  + __builtin_align_up(len, sizeof(uintptr_t));
+
+            if (len == 0) {
+                continue;
+            }
+
+            if (part && part->type == NGX_HTTP_SCRIPT_PART_COPY) {
+
+                /* merge the adjacent constant strings */
+
+                p = ngx_pnalloc(cf->pool, part->len + len);
+                if (p == NULL) {
+                    return NGX_ERROR;
+                }
+
+                ngx_memcpy(p, part->data, part->len);
+                ngx_memcpy(p + part->len, data, len);
+
+                part->len += len;
+                part->data = p;
+
+                continue;
+            }
+
+            if (n == NGX_HTTP_SCRIPT_MAX_PARTS) {
+                return NGX_DECLINED;
+            }
+
+            p = ngx_pnalloc(cf->pool, len);
+            if (p == NULL) {
+                return NGX_ERROR;
+            }
+
+            ngx_memcpy(p, data, len);
+
+            part = &buf[n++];
+            part->type = NGX_HTTP_SCRIPT_PART_COPY;
+            part->len = len;
+            part->data = p;
+
+            continue;
+        }
+
+        if (n == NGX_HTTP_SCRIPT_MAX_PARTS) {
+            return NGX_DECLINED;
+        }
+
+        if (code == ngx_http_script_copy_var_code) {
+            var = (ngx_http_script_var_code_t *) ip;
+            ip += sizeof(ngx_http_script_var_code_t);
+
+            part = &buf[n++];
+            part->type = NGX_HTTP_SCRIPT_PART_VAR;
+            part->len = var->index;
+            part->data = NULL;
+
+            continue;
+        }
+
+#if (NGX_PCRE)
+        if (code == ngx_http_script_copy_capture_code) {
+            cap = (ngx_http_script_copy_capture_code_t *) ip;
+            ip += sizeof(ngx_http_script_copy_capture_code_t);
+
+            part = &buf[n++];
+            part->type = NGX_HTTP_SCRIPT_PART_CAPTURE;
+            part->len = cap->n;
+            part->data = NULL;
+
+            continue;
+        }
+#endif
+
+        /* arguments, full names and other codes need the engine */
+
+        return NGX_DECLINED;
+    }
+
+    if (n == 0) {
+        return NGX_DECLINED;
+    }
+
+    *parts = ngx_palloc(cf->pool, n * sizeof(ngx_http_script_part_t));
+    if (*parts == NULL) {
+        return NGX_ERROR;
+    }
+
+    ngx_memcpy(*parts, buf, n * sizeof(ngx_http_script_part_t));
+    *nparts = n;
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_http_script_run_parts(ngx_http_request_t *r, ngx_http_script_part_t *parts,
+    ngx_uint_t nparts, ngx_uint_t flushed, ngx_uint_t escape, ngx_str_t *value)
+{
+    u_char                     *p;
+    size_t                      len;
+    ngx_uint_t                  i;
+    ngx_http_variable_value_t  *vv[NGX_HTTP_SCRIPT_MAX_PARTS];
+#if (NGX_PCRE)
+    int                        *cap;
+    ngx_uint_t                  n;
+
+    cap = r->captures;
+    escape = escape && (r->quoted_uri || r->plus_in_uri);
+#endif
+
+    len = 0;
+
+    for (i = 0; i < nparts; i++) {
+
+        switch (parts[i].type) {
+
+        case NGX_HTTP_SCRIPT_PART_COPY:
+            len += parts[i].len;
+            break;
+
+        case NGX_HTTP_SCRIPT_PART_VAR:
+
+            if (flushed) {
+                vv[i] = ngx_http_get_indexed_variable(r, parts[i].len);
+
+            } else {
+                vv[i] = ngx_http_get_flushed_variable(r, parts[i].len);
+            }
+
+            if (vv[i] == NULL || vv[i]->not_found) {
+                vv[i] = NULL;
+                break;
+            }
+
+            len += vv[i]->len;
+            break;
+
+#if (NGX_PCRE)
+        case NGX_HTTP_SCRIPT_PART_CAPTURE:
+
+            n = parts[i].len;
+
+            if (n >= r->ncaptures) {
+                break;
+            }
+
+            len += cap[n + 1] - cap[n];
+
+            if (escape) {
+                len += 2 * ngx_escape_uri(NULL, &r->captures_data[cap[n]],
+                                          cap[n + 1] - cap[n],
+                                          NGX_ESCAPE_ARGS);
+            }
+
+            break;
+#endif
+        }
+    }
+
+    value->len = len;
+    value->data = ngx_pnalloc(r->pool, len);
+    if (value->data == NULL) {
+        return NGX_ERROR;
+    }
+
+    p = value->data;
+
+    for (i = 0; i < nparts; i++) {
+
+        switch (parts[i].type) {
+
+        case NGX_HTTP_SCRIPT_PART_COPY:
+            p = ngx_copy(p, parts[i].data, parts[i].len);
+            break;
+
+        case NGX_HTTP_SCRIPT_PART_VAR:
+
+            if (vv[i]) {
+                p = ngx_copy(p, vv[i]->data, vv[i]->len);
+            }
+
+            break;
+
+#if (NGX_PCRE)
+        case NGX_HTTP_SCRIPT_PART_CAPTURE:
+
+            n = parts[i].len;
+
+            if (n >= r->ncaptures) {
+                break;
+            }
+
+            if (escape) {
+                p = (u_char *) ngx_escape_uri(p, &r->captures_data[cap[n]],
+                                              cap[n + 1] - cap[n],
+                                              NGX_ESCAPE_ARGS);
+
+            } else {
+                p = ngx_copy(p, &r->captures_data[cap[n]],
+                             cap[n + 1] - cap[n]);
+            }
+
+            break;
+#endif
+        }
+    }
+
+    ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
+                   "http script parts: \"%V\"", value);
+
+    return NGX_OK;
+}
+
+
 static ngx_int_t
 ngx_http_script_init_arrays(ngx_http_script_compile_t *sc)
 {
@@ -1652,6 +1919,36 @@ ngx_http_script_complex_value_code(ngx_http_script_engine_t *e)
 }
 
 
+void
+ngx_http_script_parts_code(ngx_http_script_engine_t *e)
+{
+    ngx_http_script_parts_code_t  *code;
+
+    code = (ngx_http_script_parts_code_t *) e->ip;
+
+    e->ip += sizeof(ngx_http_script_parts_code_t);
+
+    ngx_log_debug0(NGX_LOG_DEBUG_HTTP, e->request->connection->log, 0,
+                   "http script complex value");
+
+    if (ngx_http_script_run_parts(e->request, code->parts, code->nparts,
+                                  e->flushed, e->quote || e->is_args,
+                                  &e->buf)
+        != NGX_OK)
+    {
+        e->ip = ngx_http_script_exit;
+        e->status = NGX_HTTP_INTERNAL_SERVER_ERROR;
+        return;
+    }
+
+    e->pos = e->buf.data + e->buf.len;
+
+    e->sp->len = e->buf.len;
+    e->sp->data = e->buf.data;
+    e->sp++;
+}
+
+
 void
 ngx_http_script_value_code(ngx_http_script_engine_t *e)
 {
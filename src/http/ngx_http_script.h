@@ -63,11 +63,33 @@ typedef struct {
 } ngx_http_script_compile_t;
 
 
+#define NGX_HTTP_SCRIPT_PART_COPY     0
+#define NGX_HTTP_SCRIPT_PART_VAR      1
+#define NGX_HTTP_SCRIPT_PART_CAPTURE  2
+
+#define NGX_HTTP_SCRIPT_MAX_PARTS     16
+
+
+/*
+ * a flat form of a compiled script that consists of constant strings,
+ * variables and captures only; it is evaluated in one pass without
+ * the code dispatch, each variable is looked up once
+ */
+
+typedef struct {
+    ngx_uint_t                  type;
+    ngx_uint_t                  len;     /* length, index, or 2 * capture */
+    u_char                     *data;
+} ngx_http_script_part_t;
+
+
 typedef struct {
     ngx_str_t                   value;
     ngx_uint_t                 *flushes;
     void                       *lengths;
     void                       *values;
+    ngx_http_script_part_t     *parts;
+    ngx_uint_t                  nparts;
 } ngx_http_complex_value_t;
 
 
@@ -195,6 +217,13 @@ typedef struct {
 } ngx_http_script_complex_value_code_t;
 
 
+typedef struct {
+    ngx_http_script_code_pt     code;
+    ngx_http_script_part_t     *parts;
+    uintptr_t                   nparts;
+} ngx_http_script_parts_code_t;
+
+
 typedef struct {
     ngx_http_script_code_pt     code;
     uintptr_t                   value;
@@ -219,6 +248,8 @@ char *ngx_http_set_predicate_slot(ngx_conf_t *cf, ngx_command_t *cmd,
 
 ngx_uint_t ngx_http_script_variables_count(ngx_str_t *value);
 ngx_int_t ngx_http_script_compile(ngx_http_script_compile_t *sc);
+ngx_int_t ngx_http_script_compile_parts(ngx_conf_t *cf, u_char *ip,
+    u_char *last, ngx_http_script_part_t **parts, ngx_uint_t *nparts);
 u_char *ngx_http_script_run(ngx_http_request_t *r, ngx_str_t *value,
     void *code_lengths, size_t reserved, void *code_values);
 void ngx_http_script_flush_no_cacheable_variables(ngx_http_request_t *r,
@@ -247,6 +278,7 @@ void ngx_http_script_equal_code(ngx_http_script_engine_t *e);
 void ngx_http_script_not_equal_code(ngx_http_script_engine_t *e);
 void ngx_http_script_file_code(ngx_http_script_engine_t *e);
 void ngx_http_script_complex_value_code(ngx_http_script_engine_t *e);
+void ngx_http_script_parts_code(ngx_http_script_engine_t *e);
 void ngx_http_script_value_code(ngx_http_script_engine_t *e);
 void ngx_http_script_set_var_code(ngx_http_script_engine_t *e);
 void ngx_http_script_var_set_handler_code(ngx_http_script_engine_t *e);
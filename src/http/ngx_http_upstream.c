@@ -10,6 +10,12 @@
 #include <ngx_http.h>
 
 
+typedef struct {
+    ngx_rbtree_node_t                node;
+    off_t                            length;
+} ngx_http_upstream_length_t;
+
+
 #if (NGX_HTTP_CACHE)
 static ngx_int_t ngx_http_upstream_cache(ngx_http_request_t *r,
     ngx_http_upstream_t *u);
@@ -85,6 +91,10 @@ static ngx_int_t ngx_http_upstream_thread_handler(ngx_thread_task_t *task,
     ngx_file_t *file);
 static void ngx_http_upstream_thread_event_handler(ngx_event_t *ev);
 #endif
+#if (NGX_HAVE_IO_URING)
+static void ngx_http_upstream_aio_handler(ngx_file_t *file);
+static void ngx_http_upstream_aio_event_handler(ngx_event_t *ev);
+#endif
 static ngx_int_t ngx_http_upstream_output_filter(void *data,
     ngx_chain_t *chain);
 static void ngx_http_upstream_process_downstream(ngx_http_request_t *r);
@@ -99,6 +109,8 @@ static void ngx_http_upstream_dummy_handler(ngx_http_request_t *r,
 static void ngx_http_upstream_next(ngx_http_request_t *r,
     ngx_http_upstream_t *u, ngx_uint_t ft_type);
 static void ngx_http_upstream_cleanup(void *data);
+static ngx_http_upstream_length_t *ngx_http_upstream_length(
+    ngx_http_request_t *r, ngx_http_upstream_conf_t *conf);
 static void ngx_http_upstream_finalize_request(ngx_http_request_t *r,
     ngx_http_upstream_t *u, ngx_int_t rc);
 
@@ -174,6 +186,8 @@ static ngx_int_t ngx_http_upstream_cookie_variable(ngx_http_request_t *r,
 static char *ngx_http_upstream(ngx_conf_t *cf, ngx_command_t *cmd, void *dummy);
 static char *ngx_http_upstream_server(ngx_conf_t *cf, ngx_command_t *cmd,
     void *conf);
+static char *ngx_http_upstream_buffers_arena(ngx_conf_t *cf,
+    ngx_command_t *cmd, void *conf);
 
 static ngx_int_t ngx_http_upstream_set_local(ngx_http_request_t *r,
   ngx_http_upstream_t *u, ngx_http_upstream_local_t *local);
@@ -343,6 +357,13 @@ static ngx_command_t  ngx_http_upstream_commands[] = {
       0,
       NULL },
 
+    { ngx_string("upstream_buffers_arena"),
+      NGX_HTTP_MAIN_CONF|NGX_CONF_TAKE1,
+      ngx_http_upstream_buffers_arena,
+      NGX_HTTP_MAIN_CONF_OFFSET,
+      0,
+      NULL },
+
       ngx_null_command
 };
 
@@ -457,6 +478,14 @@ ngx_conf_bitmask_t  ngx_http_upstream_cache_method_mask[] = {
 };
 
 
+ngx_conf_enum_t  ngx_http_upstream_cache_lock[] = {
+    { ngx_string("off"), 0 },
+    { ngx_string("on"), 1 },
+    { ngx_string("stream"), NGX_HTTP_UPSTREAM_CACHE_LOCK_STREAM },
+    { ngx_null_string, 0 }
+};
+
+
 ngx_conf_bitmask_t  ngx_http_upstream_ignore_headers_masks[] = {
     { ngx_string("X-Accel-Redirect"), NGX_HTTP_UPSTREAM_IGN_XA_REDIRECT },
     { ngx_string("X-Accel-Expires"), NGX_HTTP_UPSTREAM_IGN_XA_EXPIRES },
@@ -873,7 +902,9 @@ ngx_http_upstream_cache(ngx_http_request_t *r, ngx_http_upstream_t *u)
             break;
         }
 
-        c->lock = u->conf->cache_lock;
+        c->lock = u->conf->cache_lock ? 1 : 0;
+        c->stream = (u->conf->cache_lock == NGX_HTTP_UPSTREAM_CACHE_LOCK_STREAM
+                     && r == r->main);
         c->lock_timeout = u->conf->cache_lock_timeout;
         c->lock_age = u->conf->cache_lock_age;
 
@@ -1497,6 +1528,9 @@ ngx_http_upstream_connect(ngx_http_request_t *r, ngx_http_upstream_t *u)
 {
     ngx_int_t          rc;
     ngx_connection_t  *c;
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    ngx_str_t         *name;
+#endif
 
     r->connection->log->action = "connecting to upstream";
 
@@ -1528,6 +1562,30 @@ ngx_http_upstream_connect(ngx_http_request_t *r, ngx_http_upstream_t *u)
         return;
     }
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+
+    /*
+     * a peer resolved at run time may be removed and freed once released,
+     * while its name is still needed for logging
+     */
+
+    if (u->upstream && u->upstream->resolver && u->peer.name) {
+        name = ngx_palloc(r->pool, sizeof(ngx_str_t) + u->peer.name->len);
+        if (name == NULL) {
+            ngx_http_upstream_finalize_request(r, u,
+                                               NGX_HTTP_INTERNAL_SERVER_ERROR);
+            return;
+        }
+
+        name->len = u->peer.name->len;
+        name->data = (u_char *) name + sizeof(ngx_str_t);
+        ngx_memcpy(name->data, u->peer.name->data, name->len);
+
+        u->peer.name = name;
+    }
+
+#endif
+
     u->state->peer = u->peer.name;
 
     if (rc == NGX_BUSY) {
@@ -1545,6 +1603,8 @@ ngx_http_upstream_connect(ngx_http_request_t *r, ngx_http_upstream_t *u)
 
     c = u->peer.connection;
 
+    c->requests++;
+
     c->data = r;
 
     c->write->handler = ngx_http_upstream_handler;
@@ -2791,11 +2851,11 @@ ngx_http_upstream_process_headers(ngx_http_request_t *r, ngx_http_upstream_t *u)
 
     if (u->conf->force_ranges) {
         r->allow_ranges = 1;
-        r->single_range = 1;
+        r->ordered_ranges = 1;
 
 #if (NGX_HTTP_CACHE)
         if (r->cached) {
-            r->single_range = 0;
+            r->ordered_ranges = 0;
         }
 #endif
     }
@@ -2854,11 +2914,13 @@ ngx_http_upstream_process_trailers(ngx_http_request_t *r,
 static void
 ngx_http_upstream_send_response(ngx_http_request_t *r, ngx_http_upstream_t *u)
 {
-    ssize_t                    n;
-    ngx_int_t                  rc;
-    ngx_event_pipe_t          *p;
-    ngx_connection_t          *c;
-    ngx_http_core_loc_conf_t  *clcf;
+    ssize_t                         n;
+    ngx_int_t                       rc;
+    ngx_event_pipe_t               *p;
+    ngx_connection_t               *c;
+    ngx_http_core_loc_conf_t       *clcf;
+    ngx_http_upstream_length_t     *len;
+    ngx_http_upstream_main_conf_t  *umcf;
 
     rc = ngx_http_send_header(r);
 
@@ -3082,6 +3144,15 @@ ngx_http_upstream_send_response(ngx_http_request_t *r, ngx_http_upstream_t *u)
 
     p->cacheable = u->cacheable || u->store;
 
+    umcf = ngx_http_get_module_main_conf(r, ngx_http_upstream_module);
+
+    if (umcf->buffers_arena
+        && ngx_event_pipe_use_arena(p, umcf->buffers_arena) != NGX_OK)
+    {
+        ngx_http_upstream_finalize_request(r, u, NGX_ERROR);
+        return;
+    }
+
     p->temp_file = ngx_pcalloc(r->pool, sizeof(ngx_temp_file_t));
     if (p->temp_file == NULL) {
         ngx_http_upstream_finalize_request(r, u, NGX_ERROR);
@@ -3119,6 +3190,15 @@ ngx_http_upstream_send_response(ngx_http_request_t *r, ngx_http_upstream_t *u)
     }
 #endif
 
+#if (NGX_HAVE_IO_URING)
+    if (clcf->aio == NGX_HTTP_AIO_IO_URING && clcf->aio_write
+        && ngx_file_io_uring)
+    {
+        p->aio_handler = ngx_http_upstream_aio_handler;
+        p->aio_ctx = r;
+    }
+#endif
+
     p->preread_bufs = ngx_alloc_chain_link(r->pool);
     if (p->preread_bufs == NULL) {
         ngx_http_upstream_finalize_request(r, u, NGX_ERROR);
@@ -3179,6 +3259,29 @@ ngx_http_upstream_send_response(ngx_http_request_t *r, ngx_http_upstream_t *u)
     p->send_lowat = clcf->send_lowat;
 
     p->length = -1;
+    p->expected_length = -1;
+
+    if (u->conf->adaptive_buffers) {
+        p->adaptive_bufs = 1;
+
+        if (u->headers_in.content_length_n > 0) {
+            p->expected_length = u->headers_in.content_length_n;
+
+            if (r->method != NGX_HTTP_HEAD
+                && u->headers_in.status_n != NGX_HTTP_NO_CONTENT
+                && u->headers_in.status_n != NGX_HTTP_NOT_MODIFIED)
+            {
+                p->expected_min = 1;
+            }
+
+        } else {
+            len = ngx_http_upstream_length(r, u->conf);
+
+            if (len && len->length) {
+                p->expected_length = p->preread_size + len->length;
+            }
+        }
+    }
 
     if (u->input_filter_init
         && u->input_filter_init(p->input_ctx) != NGX_OK)
@@ -3765,6 +3868,57 @@ ngx_http_upstream_thread_event_handler(ngx_event_t *ev)
 #endif
 
 
+#if (NGX_HAVE_IO_URING)
+
+static void
+ngx_http_upstream_aio_handler(ngx_file_t *file)
+{
+    ngx_event_pipe_t    *p;
+    ngx_http_request_t  *r;
+
+    r = file->write_aio_ctx;
+    p = r->upstream->pipe;
+
+    file->write_aio->data = r;
+    file->write_aio->handler = ngx_http_upstream_aio_event_handler;
+
+    r->main->blocked++;
+    r->aio = 1;
+    p->aio = 1;
+}
+
+
+static void
+ngx_http_upstream_aio_event_handler(ngx_event_t *ev)
+{
+    ngx_event_aio_t     *aio;
+    ngx_connection_t    *c;
+    ngx_http_request_t  *r;
+
+    aio = ev->data;
+    r = aio->data;
+    c = r->connection;
+
+    ngx_http_set_log_request(c->log, r);
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "http upstream aio: \"%V?%V\"", &r->uri, &r->args);
+
+    r->main->blocked--;
+    r->aio = 0;
+
+    if (r->done) {
+        c->write->handler(c->write);
+
+    } else {
+        r->write_event_handler(r);
+        ngx_http_run_posted_requests(c);
+    }
+}
+
+#endif
+
+
 static ngx_int_t
 ngx_http_upstream_output_filter(void *data, ngx_chain_t *chain)
 {
@@ -3801,7 +3955,7 @@ ngx_http_upstream_process_downstream(ngx_http_request_t *r)
 
     c->log->action = "sending to client";
 
-#if (NGX_THREADS)
+#if (NGX_THREADS || NGX_HAVE_IO_URING)
     p->aio = r->aio;
 #endif
 
@@ -3890,7 +4044,7 @@ ngx_http_upstream_process_request(ngx_http_request_t *r,
 
     p = u->pipe;
 
-#if (NGX_THREADS)
+#if (NGX_THREADS || NGX_HAVE_IO_URING)
 
     if (p->writing && !p->aio) {
 
@@ -3953,6 +4107,9 @@ ngx_http_upstream_process_request(ngx_http_request_t *r,
 
             } else if (p->upstream_error) {
                 ngx_http_file_cache_free(r->cache, p->temp_file);
+
+            } else {
+                ngx_http_file_cache_progress(r, p->temp_file);
             }
         }
 
@@ -4243,11 +4400,57 @@ ngx_http_upstream_cleanup(void *data)
 }
 
 
+/*
+ * the lengths are kept by a worker apart from the configuration, which
+ * is shared by requests, in a tree of the cycle keyed by the conf address,
+ * so they are freed with the cycle along with the conf
+ */
+
+static ngx_http_upstream_length_t *
+ngx_http_upstream_length(ngx_http_request_t *r, ngx_http_upstream_conf_t *conf)
+{
+    ngx_rbtree_key_t                key;
+    ngx_rbtree_node_t              *node, *sentinel;
+    ngx_http_upstream_length_t     *len;
+    ngx_http_upstream_main_conf_t  *umcf;
+
+    umcf = ngx_http_get_module_main_conf(r, ngx_http_upstream_module);
+
+    key = (ngx_rbtree_key_t) (uintptr_t) conf;
+
+    node = umcf->lengths.root;
+    sentinel = umcf->lengths.sentinel;
+
+    while (node != sentinel) {
+
+        if (key == node->key) {
+            return (ngx_http_upstream_length_t *) node;
+        }
+
+        node = (key < node->key) ? node->left : node->right;
+    }
+
+    len = ngx_palloc(umcf->pool, sizeof(ngx_http_upstream_length_t));
+    if (len == NULL) {
+        return NULL;
+    }
+
+    len->node.key = key;
+    len->length = 0;
+
+    ngx_rbtree_insert(&umcf->lengths, &len->node);
+
+    return len;
+}
+
+
 static void
 ngx_http_upstream_finalize_request(ngx_http_request_t *r,
     ngx_http_upstream_t *u, ngx_int_t rc)
 {
-    ngx_uint_t  flush;
+    off_t                        length;
+    ngx_uint_t                   flush;
+    ngx_http_upstream_length_t  *len;
 
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, r->connection->log, 0,
                    "finalize http upstream request: %i", rc);
@@ -4276,6 +4479,25 @@ ngx_http_upstream_finalize_request(ngx_http_request_t *r,
         }
     }
 
+    if (u->pipe && u->pipe->adaptive_bufs
+        && (u->pipe->upstream_done || u->pipe->upstream_eof))
+    {
+        /* the pre-read part of a response is not read in the pipe bufs */
+
+        len = ngx_http_upstream_length(r, u->conf);
+
+        if (len) {
+            length = u->pipe->read_length - u->pipe->preread_size;
+
+            if (len->length == 0) {
+                len->length = length;
+
+            } else {
+                len->length += (length - len->length) / 8;
+            }
+        }
+    }
+
     u->finalize_request(r, rc);
 
     if (u->peer.free && u->peer.sockaddr) {
@@ -4283,6 +4505,10 @@ ngx_http_upstream_finalize_request(ngx_http_request_t *r,
         u->peer.sockaddr = NULL;
     }
 
+    if (u->pipe && u->pipe->arena) {
+        ngx_event_pipe_arena_unwait(u->pipe);
+    }
+
     if (u->peer.connection) {
 
 #if (NGX_HTTP_SSL)
@@ -5147,7 +5373,7 @@ ngx_http_upstream_copy_allow_ranges(ngx_http_request_t *r,
 
     if (r->upstream->cacheable) {
         r->allow_ranges = 1;
-        r->single_range = 1;
+        r->ordered_ranges = 1;
         return NGX_OK;
     }
 
@@ -5757,7 +5983,7 @@ ngx_http_upstream_server(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     ngx_str_t                   *value, s;
     ngx_url_t                    u;
     ngx_int_t                    weight, max_conns, max_fails;
-    ngx_uint_t                   i;
+    ngx_uint_t                   i, resolve;
     ngx_http_upstream_server_t  *us;
 
     us = ngx_array_push(uscf->servers);
@@ -5773,6 +5999,7 @@ ngx_http_upstream_server(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     max_conns = 0;
     max_fails = 1;
     fail_timeout = 10;
+    resolve = 0;
 
     for (i = 2; i < cf->args->nelts; i++) {
 
@@ -5861,6 +6088,13 @@ ngx_http_upstream_server(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
             continue;
         }
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+        if (ngx_strcmp(value[i].data, "resolve") == 0) {
+            resolve = 1;
+            continue;
+        }
+#endif
+
         goto invalid;
     }
 
@@ -5868,6 +6102,7 @@ ngx_http_upstream_server(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
 
     u.url = value[1];
     u.default_port = 80;
+    u.no_resolve = resolve;
 
     if (ngx_parse_url(cf->pool, &u) != NGX_OK) {
         if (u.err) {
@@ -5881,6 +6116,20 @@ ngx_http_upstream_server(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     us->name = u.url;
     us->addrs = u.addrs;
     us->naddrs = u.naddrs;
+
+#if (NGX_HTTP_UPSTREAM_ZONE)
+
+    /*
+     * a name is resolved by worker processes, starting with no addresses;
+     * addresses given literally are used as is
+     */
+
+    if (resolve && u.naddrs == 0) {
+        us->host = u.host;
+        us->port = u.port;
+    }
+
+#endif
     us->weight = weight;
     us->max_conns = max_conns;
     us->max_fails = max_fails;
@@ -5905,6 +6154,43 @@ not_supported:
 }
 
 
+static char *
+ngx_http_upstream_buffers_arena(ngx_conf_t *cf, ngx_command_t *cmd,
+    void *conf)
+{
+    ngx_http_upstream_main_conf_t  *umcf = conf;
+
+    ssize_t     size;
+    ngx_str_t  *value;
+
+    if (umcf->buffers_arena != NGX_CONF_UNSET_PTR) {
+        return "is duplicate";
+    }
+
+    value = cf->args->elts;
+
+    if (ngx_strcmp(value[1].data, "off") == 0) {
+        umcf->buffers_arena = NULL;
+        return NGX_CONF_OK;
+    }
+
+    size = ngx_parse_size(&value[1]);
+
+    if (size == NGX_ERROR || size == 0) {
+        ngx_conf_log_error(NGX_LOG_EMERG, cf, 0,
+                           "invalid arena size \"%V\"", &value[1]);
+        return NGX_CONF_ERROR;
+    }
+
+    umcf->buffers_arena = ngx_event_pipe_create_arena(cf->pool, size);
+    if (umcf->buffers_arena == NULL) {
+        return NGX_CONF_ERROR;
+    }
+
+    return NGX_CONF_OK;
+}
+
+
 ngx_http_upstream_srv_conf_t *
 ngx_http_upstream_add(ngx_conf_t *cf, ngx_url_t *u, ngx_uint_t flags)
 {
@@ -6353,6 +6639,13 @@ ngx_http_upstream_create_main_conf(ngx_conf_t *cf)
         return NULL;
     }
 
+    umcf->buffers_arena = NGX_CONF_UNSET_PTR;
+
+    ngx_rbtree_init(&umcf->lengths, &umcf->lengths_sentinel,
+                    ngx_rbtree_insert_value);
+
+    umcf->pool = cf->pool;
+
     return umcf;
 }
 
@@ -6370,6 +6663,8 @@ ngx_http_upstream_init_main_conf(ngx_conf_t *cf, void *conf)
     ngx_http_upstream_header_t     *header;
     ngx_http_upstream_srv_conf_t  **uscfp;
 
+    ngx_conf_init_ptr_value(umcf->buffers_arena, NULL);
+
     uscfp = umcf->upstreams.elts;
 
     for (i = 0; i < umcf->upstreams.nelts; i++) {
@@ -56,6 +56,9 @@
 #define NGX_HTTP_UPSTREAM_IGN_VARY           0x00000200
 
 
+#define NGX_HTTP_UPSTREAM_CACHE_LOCK_STREAM  2
+
+
 typedef struct {
     ngx_uint_t                       status;
     ngx_msec_t                       response_time;
@@ -73,6 +76,11 @@ typedef struct {
     ngx_hash_t                       headers_in_hash;
     ngx_array_t                      upstreams;
                                              /* ngx_http_upstream_srv_conf_t */
+    ngx_event_pipe_arena_t          *buffers_arena;
+
+    ngx_rbtree_t                     lengths;
+    ngx_rbtree_node_t                lengths_sentinel;
+    ngx_pool_t                      *pool;
 } ngx_http_upstream_main_conf_t;
 
 typedef struct ngx_http_upstream_srv_conf_s  ngx_http_upstream_srv_conf_t;
@@ -103,6 +111,12 @@ typedef struct {
 
     unsigned                         backup:1;
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    /* a name resolved at run time by the "resolve" parameter */
+    ngx_str_t                        host;
+    in_port_t                        port;
+#endif
+
     NGX_COMPAT_BEGIN(6)
     NGX_COMPAT_END
 } ngx_http_upstream_server_t;
@@ -132,6 +146,8 @@ struct ngx_http_upstream_srv_conf_s {
 
 #if (NGX_HTTP_UPSTREAM_ZONE)
     ngx_shm_zone_t                  *shm_zone;
+    ngx_resolver_t                  *resolver;
+    ngx_msec_t                       resolver_timeout;
 #endif
 };
 
@@ -173,6 +189,7 @@ typedef struct {
     ngx_uint_t                       next_upstream_tries;
     ngx_flag_t                       buffering;
     ngx_flag_t                       request_buffering;
+    ngx_flag_t                       adaptive_buffers;
     ngx_flag_t                       pass_request_headers;
     ngx_flag_t                       pass_request_body;
 
@@ -429,6 +446,7 @@ ngx_int_t ngx_http_upstream_hide_headers_hash(ngx_conf_t *cf,
 
 extern ngx_module_t        ngx_http_upstream_module;
 extern ngx_conf_bitmask_t  ngx_http_upstream_cache_method_mask[];
+extern ngx_conf_enum_t     ngx_http_upstream_cache_lock[];
 extern ngx_conf_bitmask_t  ngx_http_upstream_ignore_headers_masks[];
 
 
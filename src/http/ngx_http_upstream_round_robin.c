@@ -17,6 +17,11 @@
 static ngx_http_upstream_rr_peer_t *ngx_http_upstream_get_peer(
     ngx_http_upstream_rr_peer_data_t *rrp);
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+static ngx_int_t ngx_http_upstream_init_resolve(ngx_conf_t *cf,
+    ngx_http_upstream_srv_conf_t *us);
+#endif
+
 #if (NGX_HTTP_SSL)
 
 static ngx_int_t ngx_http_upstream_empty_set_session(ngx_peer_connection_t *pc,
@@ -32,7 +37,7 @@ ngx_http_upstream_init_round_robin(ngx_conf_t *cf,
     ngx_http_upstream_srv_conf_t *us)
 {
     ngx_url_t                      u;
-    ngx_uint_t                     i, j, n, w;
+    ngx_uint_t                     i, j, n, w, r;
     ngx_http_upstream_server_t    *server;
     ngx_http_upstream_rr_peer_t   *peer, **peerp;
     ngx_http_upstream_rr_peers_t  *peers, *backup;
@@ -44,23 +49,37 @@ ngx_http_upstream_init_round_robin(ngx_conf_t *cf,
 
         n = 0;
         w = 0;
+        r = 0;
 
         for (i = 0; i < us->servers->nelts; i++) {
             if (server[i].backup) {
                 continue;
             }
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+            if (server[i].host.len) {
+                r++;
+                continue;
+            }
+#endif
+
             n += server[i].naddrs;
             w += server[i].naddrs * server[i].weight;
         }
 
-        if (n == 0) {
+        if (n == 0 && r == 0) {
             ngx_log_error(NGX_LOG_EMERG, cf->log, 0,
                           "no servers in upstream \"%V\" in %s:%ui",
                           &us->host, us->file_name, us->line);
             return NGX_ERROR;
         }
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+        if (r && ngx_http_upstream_init_resolve(cf, us) != NGX_OK) {
+            return NGX_ERROR;
+        }
+#endif
+
         peers = ngx_pcalloc(cf->pool, sizeof(ngx_http_upstream_rr_peers_t));
         if (peers == NULL) {
             return NGX_ERROR;
@@ -71,7 +90,7 @@ ngx_http_upstream_init_round_robin(ngx_conf_t *cf,
             return NGX_ERROR;
         }
 
-        peers->single = (n == 1);
+        peers->single = (n == 1 && r == 0);
         peers->number = n;
         peers->weighted = (w != n);
         peers->total_weight = w;
@@ -110,20 +129,34 @@ ngx_http_upstream_init_round_robin(ngx_conf_t *cf,
 
         n = 0;
         w = 0;
+        r = 0;
 
         for (i = 0; i < us->servers->nelts; i++) {
             if (!server[i].backup) {
                 continue;
             }
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+            if (server[i].host.len) {
+                r++;
+                continue;
+            }
+#endif
+
             n += server[i].naddrs;
             w += server[i].naddrs * server[i].weight;
         }
 
-        if (n == 0) {
+        if (n == 0 && r == 0) {
             return NGX_OK;
         }
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+        if (r && ngx_http_upstream_init_resolve(cf, us) != NGX_OK) {
+            return NGX_ERROR;
+        }
+#endif
+
         backup = ngx_pcalloc(cf->pool, sizeof(ngx_http_upstream_rr_peers_t));
         if (backup == NULL) {
             return NGX_ERROR;
@@ -240,11 +273,51 @@ ngx_http_upstream_init_round_robin(ngx_conf_t *cf,
 }
 
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+
+static ngx_int_t
+ngx_http_upstream_init_resolve(ngx_conf_t *cf,
+    ngx_http_upstream_srv_conf_t *us)
+{
+    ngx_http_core_loc_conf_t  *clcf;
+
+    if (us->shm_zone == NULL) {
+        ngx_log_error(NGX_LOG_EMERG, cf->log, 0,
+                      "resolving names at run time requires \"zone\" "
+                      "in upstream \"%V\" in %s:%ui",
+                      &us->host, us->file_name, us->line);
+        return NGX_ERROR;
+    }
+
+    /* the resolver of the http{} block, a dummy one if not configured */
+
+    clcf = ngx_http_conf_get_module_loc_conf(cf, ngx_http_core_module);
+
+    if (clcf->resolver == NULL || clcf->resolver->connections.nelts == 0) {
+        ngx_log_error(NGX_LOG_EMERG, cf->log, 0,
+                      "no resolver defined to resolve names "
+                      "in upstream \"%V\" in %s:%ui",
+                      &us->host, us->file_name, us->line);
+        return NGX_ERROR;
+    }
+
+    us->resolver = clcf->resolver;
+    us->resolver_timeout = clcf->resolver_timeout;
+
+    ngx_conf_init_msec_value(us->resolver_timeout, 30000);
+
+    return NGX_OK;
+}
+
+#endif
+
+
 ngx_int_t
 ngx_http_upstream_init_round_robin_peer(ngx_http_request_t *r,
     ngx_http_upstream_srv_conf_t *us)
 {
-    ngx_uint_t                         n;
+    ngx_uint_t                         n, tries;
+    ngx_http_upstream_rr_peers_t      *peers;
     ngx_http_upstream_rr_peer_data_t  *rrp;
 
     rrp = r->upstream->peer.data;
@@ -258,16 +331,33 @@ ngx_http_upstream_init_round_robin_peer(ngx_http_request_t *r,
         r->upstream->peer.data = rrp;
     }
 
-    rrp->peers = us->peer.data;
+    peers = us->peer.data;
+
+    rrp->peers = peers;
     rrp->current = NULL;
     rrp->config = 0;
 
-    n = rrp->peers->number;
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    if (peers->config) {
+        ngx_http_upstream_rr_peers_rlock(peers);
+        rrp->config = *peers->config;
+    }
+#endif
 
-    if (rrp->peers->next && rrp->peers->next->number > n) {
-        n = rrp->peers->next->number;
+    n = peers->number;
+
+    if (peers->next && peers->next->number > n) {
+        n = peers->next->number;
     }
 
+    tries = ngx_http_upstream_tries(peers);
+
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    if (peers->config) {
+        ngx_http_upstream_rr_peers_unlock(peers);
+    }
+#endif
+
     if (n <= 8 * sizeof(uintptr_t)) {
         // FIXME: this is probably wrong
         rrp->tried = (ngx_vaddr_t*)&rrp->data;
@@ -284,7 +374,7 @@ ngx_http_upstream_init_round_robin_peer(ngx_http_request_t *r,
 
     r->upstream->peer.get = ngx_http_upstream_get_round_robin_peer;
     r->upstream->peer.free = ngx_http_upstream_free_round_robin_peer;
-    r->upstream->peer.tries = ngx_http_upstream_tries(rrp->peers);
+    r->upstream->peer.tries = tries;
 #if (NGX_HTTP_SSL)
     r->upstream->peer.set_session =
                                ngx_http_upstream_set_round_robin_peer_session;
@@ -434,6 +524,16 @@ ngx_http_upstream_get_round_robin_peer(ngx_peer_connection_t *pc, void *data)
     peers = rrp->peers;
     ngx_http_upstream_rr_peers_wlock(peers);
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+
+    /* the tried peers are not known anymore once the peers changed */
+
+    if (peers->config && rrp->config != *peers->config) {
+        goto busy;
+    }
+
+#endif
+
     if (peers->single) {
         peer = peers->peer;
 
@@ -498,6 +598,10 @@ failed:
         ngx_http_upstream_rr_peers_wlock(peers);
     }
 
+#if (NGX_HTTP_UPSTREAM_ZONE)
+busy:
+#endif
+
     ngx_http_upstream_rr_peers_unlock(peers);
 
     pc->name = peers->name;
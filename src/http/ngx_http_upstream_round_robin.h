@@ -14,6 +14,10 @@
 #include <ngx_http.h>
 
 
+/* the peer->down bit set by health checks, the "down" parameter sets 1 */
+#define NGX_HTTP_UPSTREAM_RR_CHECK_DOWN  0x02
+
+
 typedef struct ngx_http_upstream_rr_peer_s   ngx_http_upstream_rr_peer_t;
 
 struct ngx_http_upstream_rr_peer_s {
@@ -51,7 +55,19 @@ struct ngx_http_upstream_rr_peer_s {
 
     ngx_http_upstream_rr_peer_t    *next;
 
-    NGX_COMPAT_BEGIN(32)
+    ngx_uint_t                      ewma;
+    ngx_msec_t                      ewma_time;
+
+    ngx_msec_t                      check_time;
+    ngx_uint_t                      check_fails;
+    ngx_uint_t                      check_passes;
+
+#if (NGX_HTTP_UPSTREAM_ZONE)
+    /* the server whose name resolved to the peer at run time */
+    ngx_http_upstream_server_t     *host;
+#endif
+
+    NGX_COMPAT_BEGIN(27)
     NGX_COMPAT_END
 };
 
@@ -65,6 +81,12 @@ struct ngx_http_upstream_rr_peers_s {
     ngx_slab_pool_t                *shpool;
     ngx_atomic_t                    rwlock;
     ngx_http_upstream_rr_peers_t   *zone_next;
+
+    /* incremented on each change of the peers, shared with backup ones */
+    ngx_uint_t                     *config;
+
+    /* removed peers still in use, freed once released */
+    ngx_http_upstream_rr_peer_t    *zombies;
 #endif
 
     ngx_uint_t                      total_weight;
@@ -2379,12 +2379,23 @@ ngx_http_map_find(ngx_http_request_t *r, ngx_http_map_t *map, ngx_str_t *match)
     if (len && map->nregex) {
         ngx_int_t              n;
         ngx_uint_t             i;
+        uintptr_t             *candidates;
         ngx_http_map_regex_t  *reg;
 
         reg = map->regex;
 
+        /* the regular expressions which cannot match are skipped */
+
+        candidates = map->regex_set
+                     ? ngx_regex_set_match(map->regex_set, match)
+                     : NULL;
+
         for (i = 0; i < map->nregex; i++) {
 
+            if (!ngx_regex_set_candidate(candidates, i)) {
+                continue;
+            }
+
             n = ngx_http_regex_exec(r, reg[i].regex, match);
 
             if (n == NGX_OK) {
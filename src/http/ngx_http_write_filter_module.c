@@ -10,6 +10,10 @@
 #include <ngx_http.h>
 
 
+static ngx_int_t ngx_http_write_filter_pipelined(ngx_http_request_t *r,
+    off_t size);
+static void ngx_http_write_filter_flush_pipelined(ngx_event_t *ev);
+static void ngx_http_write_filter_pipelined_cleanup(void *data);
 static ngx_int_t ngx_http_write_filter_init(ngx_conf_t *cf);
 
 
@@ -47,12 +51,14 @@ ngx_module_t  ngx_http_write_filter_module = {
 ngx_int_t
 ngx_http_write_filter(ngx_http_request_t *r, ngx_chain_t *in)
 {
-    off_t                      size, sent, nsent, limit;
-    ngx_uint_t                 last, flush, sync;
-    ngx_msec_t                 delay;
-    ngx_chain_t               *cl, *ln, **ll, *chain;
-    ngx_connection_t          *c;
-    ngx_http_core_loc_conf_t  *clcf;
+    off_t                         size, sent, nsent, limit, pipelined;
+    ngx_int_t                     rc;
+    ngx_uint_t                    last, flush, sync;
+    ngx_msec_t                    delay;
+    ngx_chain_t                  *cl, *ln, **ll, *chain;
+    ngx_connection_t             *c;
+    ngx_http_core_loc_conf_t     *clcf;
+    ngx_http_pipelined_output_t  *po;
 
     c = r->connection;
 
@@ -193,6 +199,42 @@ ngx_http_write_filter(ngx_http_request_t *r, ngx_chain_t *in)
         return NGX_AGAIN;
     }
 
+    if (last && clcf->pipelined_output) {
+        rc = ngx_http_write_filter_pipelined(r, size);
+
+        if (rc != NGX_DECLINED) {
+            return rc;
+        }
+    }
+
+    /* the output postponed by the previous pipelined requests goes first */
+
+    po = r->http_connection ? r->http_connection->pipelined : NULL;
+
+    if (po && !po->busy && po->buf.pos != po->buf.last) {
+
+        cl = ngx_alloc_chain_link(r->pool);
+        if (cl == NULL) {
+            return NGX_ERROR;
+        }
+
+        cl->buf = &po->buf;
+        cl->next = r->out;
+        r->out = cl;
+
+        size += po->buf.last - po->buf.pos;
+
+        po->busy = 1;
+
+        if (po->armed) {
+            po->armed = 0;
+
+            if (c->write->timer_set) {
+                ngx_del_timer(c->write);
+            }
+        }
+    }
+
     if (size == 0
         && !(c->buffered & NGX_LOWLEVEL_BUFFERED)
         && !(last && c->need_last_buf))
@@ -246,6 +288,8 @@ ngx_http_write_filter(ngx_http_request_t *r, ngx_chain_t *in)
         limit = clcf->sendfile_max_chunk;
     }
 
+    pipelined = (po && po->busy) ? po->buf.last - po->buf.pos : 0;
+
     sent = c->sent;
 
     ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->log, 0,
@@ -261,6 +305,19 @@ ngx_http_write_filter(ngx_http_request_t *r, ngx_chain_t *in)
         return NGX_ERROR;
     }
 
+    if (pipelined) {
+
+        /* the postponed output was already accounted in its requests */
+
+        c->sent -= pipelined - (po->buf.last - po->buf.pos);
+
+        if (po->buf.pos == po->buf.last) {
+            po->buf.pos = po->buf.start;
+            po->buf.last = po->buf.start;
+            po->busy = 0;
+        }
+    }
+
     if (r->limit_rate) {
 
         nsent = c->sent;
@@ -318,6 +375,218 @@ ngx_http_write_filter(ngx_http_request_t *r, ngx_chain_t *in)
 }
 
 
+static ngx_int_t
+ngx_http_write_filter_pipelined(ngx_http_request_t *r, off_t size)
+{
+    ngx_chain_t                  *cl, *ln;
+    ngx_connection_t             *c;
+    ngx_pool_cleanup_t           *cln;
+    ngx_http_connection_t        *hc;
+    ngx_http_core_loc_conf_t     *clcf;
+    ngx_http_pipelined_output_t  *po;
+
+    /*
+     * the end of a small response is postponed if the next pipelined
+     * request is already read, so the responses to a batch of pipelined
+     * requests are sent together
+     */
+
+    c = r->connection;
+    hc = r->http_connection;
+
+    clcf = ngx_http_get_module_loc_conf(r, ngx_http_core_module);
+
+    if (r != r->main
+        || hc == NULL
+        || r->http_version >= NGX_HTTP_VERSION_20
+        || !r->keepalive
+        || r->limit_rate
+        || r->discard_body
+        || r->headers_in.content_length_n > 0
+        || r->headers_in.chunked
+        || r->header_in->pos == r->header_in->last
+        || (c->buffered & NGX_LOWLEVEL_BUFFERED)
+        || clcf->keepalive_timeout == 0
+        || ngx_terminate
+        || ngx_exiting)
+    {
+        return NGX_DECLINED;
+    }
+
+    for (cl = r->out; cl; cl = cl->next) {
+        if (!ngx_buf_in_memory_only(cl->buf) && !ngx_buf_special(cl->buf)) {
+            return NGX_DECLINED;
+        }
+    }
+
+    po = hc->pipelined;
+
+    if (po == NULL) {
+        po = ngx_pcalloc(c->pool, sizeof(ngx_http_pipelined_output_t));
+        if (po == NULL) {
+            return NGX_ERROR;
+        }
+
+        cln = ngx_pool_cleanup_add(c->pool, 0);
+        if (cln == NULL) {
+            return NGX_ERROR;
+        }
+
+        cln->handler = ngx_http_write_filter_pipelined_cleanup;
+        cln->data = po;
+
+        po->flush.handler = ngx_http_write_filter_flush_pipelined;
+        po->flush.data = po;
+        po->flush.log = c->log;
+        po->connection = c;
+
+        hc->pipelined = po;
+    }
+
+    if (po->busy) {
+        return NGX_DECLINED;
+    }
+
+    if (po->buf.start == NULL) {
+        po->buf.start = ngx_palloc(c->pool, clcf->pipelined_output);
+        if (po->buf.start == NULL) {
+            return NGX_ERROR;
+        }
+
+        po->buf.pos = po->buf.start;
+        po->buf.last = po->buf.start;
+        po->buf.end = po->buf.start + clcf->pipelined_output;
+        po->buf.temporary = 1;
+    }
+
+    if (size > po->buf.end - po->buf.last) {
+        return NGX_DECLINED;
+    }
+
+    for (cl = r->out; cl; /* void */) {
+        ln = cl;
+        cl = cl->next;
+
+        if (ngx_buf_in_memory(ln->buf)) {
+            po->buf.last = ngx_cpymem(po->buf.last, ln->buf->pos,
+                                      ln->buf->last - ln->buf->pos);
+            ln->buf->pos = ln->buf->last;
+        }
+
+        ngx_free_chain(r->pool, ln);
+    }
+
+    r->out = NULL;
+
+    po->send_timeout = clcf->send_timeout;
+
+    c->sent += size;
+    c->buffered &= ~NGX_HTTP_WRITE_BUFFERED;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                   "http write filter postponed pipelined %O, total %z",
+                   size, po->buf.last - po->buf.pos);
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_write_filter_flush_pipelined(ngx_event_t *ev)
+{
+    ngx_http_pipelined_output_t  *po;
+
+    po = ev->data;
+
+    (void) ngx_http_send_pipelined(po);
+}
+
+
+/*
+ * sends the postponed output on its own, when no response follows it
+ * right away; while it cannot be sent, the write event is armed with
+ * send_timeout, see ngx_http_request_handler(); the bytes were already
+ * counted in c->sent of the requests which produced them
+ */
+
+ngx_int_t
+ngx_http_send_pipelined(ngx_http_pipelined_output_t *po)
+{
+    ssize_t            n;
+    ngx_event_t       *wev;
+    ngx_connection_t  *c;
+
+    c = po->connection;
+    wev = c->write;
+
+    if (po->busy || (c->buffered & NGX_LOWLEVEL_BUFFERED)) {
+
+        /* it is sent by the writer of the current request */
+
+        return NGX_OK;
+    }
+
+    while (po->buf.pos != po->buf.last) {
+
+        if (c->error) {
+            return NGX_ERROR;
+        }
+
+        ngx_log_debug1(NGX_LOG_DEBUG_HTTP, c->log, 0,
+                       "http send pipelined %z",
+                       po->buf.last - po->buf.pos);
+
+        n = c->send(c, po->buf.pos, po->buf.last - po->buf.pos);
+
+        if (n == NGX_ERROR) {
+            c->error = 1;
+            return NGX_ERROR;
+        }
+
+        if (n == NGX_AGAIN) {
+            if (!po->armed) {
+                po->armed = 1;
+                ngx_add_timer(wev, po->send_timeout);
+            }
+
+            if (ngx_handle_write_event(wev, 0) != NGX_OK) {
+                c->error = 1;
+                return NGX_ERROR;
+            }
+
+            return NGX_AGAIN;
+        }
+
+        c->sent -= n;
+        po->buf.pos += n;
+    }
+
+    po->buf.pos = po->buf.start;
+    po->buf.last = po->buf.start;
+
+    if (po->armed) {
+        po->armed = 0;
+
+        if (wev->timer_set) {
+            ngx_del_timer(wev);
+        }
+    }
+
+    return NGX_OK;
+}
+
+
+static void
+ngx_http_write_filter_pipelined_cleanup(void *data)
+{
+    ngx_http_pipelined_output_t  *po = data;
+
+    if (po->flush.posted) {
+        ngx_delete_posted_event(&po->flush);
+    }
+}
+
+
 static ngx_int_t
 ngx_http_write_filter_init(ngx_conf_t *cf)
 {
@@ -682,6 +682,10 @@ ngx_http_v2_handle_connection(ngx_http_v2_connection_t *h2c)
         ngx_del_timer(c->write);
     }
 
+#if (NGX_STAT_STUB)
+    ngx_http_stat_idle(c, h2c->http_connection, NGX_HTTP_IDLE_HTTP2);
+#endif
+
     ngx_add_timer(c->read, h2scf->idle_timeout);
 }
 
@@ -4446,6 +4450,10 @@ ngx_http_v2_idle_handler(ngx_event_t *rev)
 
     ngx_log_debug0(NGX_LOG_DEBUG_HTTP, c->log, 0, "http2 idle handler");
 
+#if (NGX_STAT_STUB)
+    ngx_http_stat_busy(h2c->http_connection);
+#endif
+
     if (rev->timedout || c->close) {
         ngx_http_v2_finalize_connection(h2c, NGX_HTTP_V2_NO_ERROR);
         return;
@@ -15,9 +15,11 @@ static void ngx_thread_read_handler(void *data, ngx_log_t *log);
 static void ngx_thread_write_chain_to_file_handler(void *data, ngx_log_t *log);
 #endif
 
-static ngx_chain_t *ngx_chain_to_iovec(ngx_iovec_t *vec, ngx_chain_t *cl);
 static ssize_t ngx_writev_file(ngx_file_t *file, ngx_iovec_t *vec,
     off_t offset);
+#if (NGX_HAVE_PREADV2_NOWAIT)
+static ngx_int_t ngx_file_cached_page(ngx_file_t *file, off_t offset);
+#endif
 
 
 #if (NGX_HAVE_FILE_AIO)
@@ -26,6 +28,23 @@ ngx_uint_t  ngx_file_aio = 1;
 
 #endif
 
+#if (NGX_HAVE_PREADV2_NOWAIT)
+
+static ngx_uint_t  ngx_read_nowait = 1;
+
+#endif
+
+#if (NGX_STAT_STUB)
+
+/* moved to the shared stub status zone by the event module */
+
+static ngx_atomic_t   ngx_stat_file_inline0;
+ngx_atomic_t         *ngx_stat_file_inline = &ngx_stat_file_inline0;
+static ngx_atomic_t   ngx_stat_file_offloaded0;
+ngx_atomic_t         *ngx_stat_file_offloaded = &ngx_stat_file_offloaded0;
+
+#endif
+
 
 ssize_t
 ngx_read_file(ngx_file_t *file, u_char *buf, size_t size, off_t offset)
@@ -75,6 +94,127 @@ ngx_read_file(ngx_file_t *file, u_char *buf, size_t size, off_t offset)
 }
 
 
+#if (NGX_HAVE_PREADV2_NOWAIT)
+
+/*
+ * reads the data only if they are in the page cache, returns NGX_AGAIN
+ * if the read would block or the probe is not possible; other errors
+ * are left to be reported by the following blocking read
+ */
+
+ssize_t
+ngx_read_file_nowait(ngx_file_t *file, u_char *buf, size_t size, off_t offset)
+{
+    ssize_t       n;
+    ngx_err_t     err;
+    struct iovec  iov;
+
+    if (!ngx_read_nowait || file->directio) {
+        return NGX_AGAIN;
+    }
+
+    iov.iov_base = (void *) buf;
+    iov.iov_len = size;
+
+    n = preadv2(file->fd, &iov, 1, offset, RWF_NOWAIT);
+
+    if (n == -1) {
+        err = ngx_errno;
+
+        if (err == NGX_EOPNOTSUPP || err == NGX_ENOSYS) {
+            ngx_log_error(NGX_LOG_NOTICE, file->log, err,
+                          "preadv2(RWF_NOWAIT) is not supported, "
+                          "page cache probing is disabled");
+            ngx_read_nowait = 0;
+
+        } else {
+            ngx_log_debug1(NGX_LOG_DEBUG_CORE, file->log, err,
+                           "preadv2(RWF_NOWAIT) \"%s\" failed",
+                           file->name.data);
+        }
+
+        return NGX_AGAIN;
+    }
+
+    ngx_log_debug4(NGX_LOG_DEBUG_CORE, file->log, 0,
+                   "read nowait: %d, %z of %uz @%O",
+                   file->fd, n, size, offset);
+
+    return n;
+}
+
+
+/*
+ * returns the length of the range at the offset found in the page cache:
+ * only the first and the last pages of the range are probed, by reading
+ * a byte of each with RWF_NOWAIT, so no data are copied; the pages
+ * between them are assumed to be cached as well, hence the range should
+ * be small, see NGX_SENDFILE_NOWAIT_SIZE; if the last page is not cached,
+ * the range up to the end of the first page is returned
+ */
+
+size_t
+ngx_file_cached(ngx_file_t *file, size_t size, off_t offset)
+{
+    size_t  len;
+
+    if (!ngx_read_nowait || file->directio || size == 0) {
+        return 0;
+    }
+
+    if (ngx_file_cached_page(file, offset) != NGX_OK) {
+        return 0;
+    }
+
+    len = ngx_pagesize - (size_t) (offset % ngx_pagesize);
+
+    if (size > len
+        && ngx_file_cached_page(file, offset + size - 1) != NGX_OK)
+    {
+        size = len;
+    }
+
+    ngx_log_debug3(NGX_LOG_DEBUG_CORE, file->log, 0,
+                   "file cached: %d, %uz @%O", file->fd, size, offset);
+
+    return size;
+}
+
+
+static ngx_int_t
+ngx_file_cached_page(ngx_file_t *file, off_t offset)
+{
+    u_char        ch;
+    ssize_t       n;
+    ngx_err_t     err;
+    struct iovec  iov;
+
+    iov.iov_base = (void *) &ch;
+    iov.iov_len = 1;
+
+    n = preadv2(file->fd, &iov, 1, offset, RWF_NOWAIT);
+
+    if (n == 1) {
+        return NGX_OK;
+    }
+
+    if (n == -1) {
+        err = ngx_errno;
+
+        if (err == NGX_EOPNOTSUPP || err == NGX_ENOSYS) {
+            ngx_log_error(NGX_LOG_NOTICE, file->log, err,
+                          "preadv2(RWF_NOWAIT) is not supported, "
+                          "page cache probing is disabled");
+            ngx_read_nowait = 0;
+        }
+    }
+
+    return NGX_DECLINED;
+}
+
+#endif
+
+
 #if (NGX_THREADS)
 
 typedef struct {
@@ -95,6 +235,9 @@ ssize_t
 ngx_thread_read(ngx_file_t *file, u_char *buf, size_t size, off_t offset,
     ngx_pool_t *pool)
 {
+#if (NGX_HAVE_PREADV2_NOWAIT)
+    ssize_t                 n;
+#endif
     ngx_thread_task_t      *task;
     ngx_thread_file_ctx_t  *ctx;
 
@@ -104,6 +247,26 @@ ngx_thread_read(ngx_file_t *file, u_char *buf, size_t size, off_t offset,
 
     task = file->thread_task;
 
+#if (NGX_HAVE_PREADV2_NOWAIT)
+
+    if (task == NULL || !task->event.complete) {
+
+        /* the data already in the page cache are read without a thread */
+
+        n = ngx_read_file_nowait(file, buf, size, offset);
+
+        if (n >= 0 && (size_t) n == size) {
+
+#if (NGX_STAT_STUB)
+            (void) ngx_atomic_fetch_add(ngx_stat_file_inline, n);
+#endif
+
+            return n;
+        }
+    }
+
+#endif
+
     if (task == NULL) {
         task = ngx_thread_task_alloc(pool, sizeof(ngx_thread_file_ctx_t));
         if (task == NULL) {
@@ -130,6 +293,10 @@ ngx_thread_read(ngx_file_t *file, u_char *buf, size_t size, off_t offset,
             return NGX_ERROR;
         }
 
+#if (NGX_STAT_STUB)
+        (void) ngx_atomic_fetch_add(ngx_stat_file_offloaded, ctx->nbytes);
+#endif
+
         return ctx->nbytes;
     }
 
@@ -342,7 +509,7 @@ ngx_write_chain_to_file(ngx_file_t *file, ngx_chain_t *cl, off_t offset,
 }
 
 
-static ngx_chain_t *
+ngx_chain_t *
 ngx_chain_to_iovec(ngx_iovec_t *vec, ngx_chain_t *cl)
 {
     size_t         total, size;
@@ -653,6 +820,53 @@ failed:
 }
 
 
+ngx_int_t
+ngx_open_file_mapping(ngx_file_mapping_t *fm)
+{
+    ngx_file_info_t  fi;
+
+    fm->fd = ngx_open_file(fm->name, NGX_FILE_RDONLY|NGX_FILE_CLOEXEC,
+                           NGX_FILE_OPEN, 0);
+
+    if (fm->fd == NGX_INVALID_FILE) {
+        ngx_log_error(NGX_LOG_CRIT, fm->log, ngx_errno,
+                      ngx_open_file_n " \"%s\" failed", fm->name);
+        return NGX_ERROR;
+    }
+
+    if (ngx_fd_info(fm->fd, &fi) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_CRIT, fm->log, ngx_errno,
+                      ngx_fd_info_n " \"%s\" failed", fm->name);
+        goto failed;
+    }
+
+    fm->size = (size_t) ngx_file_size(&fi);
+
+    if (fm->size == 0) {
+        ngx_log_error(NGX_LOG_CRIT, fm->log, 0,
+                      "empty file mapping \"%s\"", fm->name);
+        goto failed;
+    }
+
+    fm->addr = mmap(NULL, fm->size, PROT_READ, MAP_SHARED, fm->fd, 0);
+    if (fm->addr != MAP_FAILED) {
+        return NGX_OK;
+    }
+
+    ngx_log_error(NGX_LOG_CRIT, fm->log, ngx_errno,
+                  "mmap(%uz) \"%s\" failed", fm->size, fm->name);
+
+failed:
+
+    if (ngx_close_file(fm->fd) == NGX_FILE_ERROR) {
+        ngx_log_error(NGX_LOG_ALERT, fm->log, ngx_errno,
+                      ngx_close_file_n " \"%s\" failed", fm->name);
+    }
+
+    return NGX_ERROR;
+}
+
+
 void
 ngx_close_file_mapping(ngx_file_mapping_t *fm)
 {
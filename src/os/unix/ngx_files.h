@@ -78,6 +78,12 @@ typedef struct {
 #define NGX_FILE_APPEND          (O_WRONLY|O_APPEND)
 #define NGX_FILE_NONBLOCK        O_NONBLOCK
 
+#if defined(O_CLOEXEC)
+#define NGX_FILE_CLOEXEC         O_CLOEXEC
+#else
+#define NGX_FILE_CLOEXEC         0
+#endif
+
 #if (NGX_HAVE_OPENAT)
 #define NGX_FILE_NOFOLLOW        O_NOFOLLOW
 
@@ -126,6 +132,12 @@ ssize_t ngx_read_file(ngx_file_t *file, u_char *buf, size_t size, off_t offset);
 #define ngx_read_file_n          "read()"
 #endif
 
+#if (NGX_HAVE_PREADV2_NOWAIT)
+ssize_t ngx_read_file_nowait(ngx_file_t *file, u_char *buf, size_t size,
+    off_t offset);
+size_t ngx_file_cached(ngx_file_t *file, size_t size, off_t offset);
+#endif
+
 ssize_t ngx_write_file(ngx_file_t *file, u_char *buf, size_t size,
     off_t offset);
 
@@ -191,6 +203,7 @@ ngx_int_t ngx_set_file_time(u_char *name, ngx_fd_t fd, time_t s);
 
 
 ngx_int_t ngx_create_file_mapping(ngx_file_mapping_t *fm);
+ngx_int_t ngx_open_file_mapping(ngx_file_mapping_t *fm);
 void ngx_close_file_mapping(ngx_file_mapping_t *fm);
 
 
@@ -384,6 +397,15 @@ extern ngx_uint_t  ngx_file_aio;
 
 #endif
 
+#if (NGX_HAVE_IO_URING)
+ssize_t ngx_file_io_uring_read(ngx_file_t *file, u_char *buf, size_t size,
+    off_t offset, ngx_pool_t *pool);
+ssize_t ngx_file_io_uring_write_chain(ngx_file_t *file, ngx_chain_t *cl,
+    off_t offset, ngx_pool_t *pool);
+
+extern ngx_uint_t  ngx_file_io_uring;
+#endif
+
 #if (NGX_THREADS)
 ssize_t ngx_thread_read(ngx_file_t *file, u_char *buf, size_t size,
     off_t offset, ngx_pool_t *pool);
@@ -391,5 +413,11 @@ ssize_t ngx_thread_write_chain_to_file(ngx_file_t *file, ngx_chain_t *cl,
     off_t offset, ngx_pool_t *pool);
 #endif
 
+#if (NGX_STAT_STUB)
+/* the bytes read or sent inline from the page cache and in threads */
+extern ngx_atomic_t  *ngx_stat_file_inline;
+extern ngx_atomic_t  *ngx_stat_file_offloaded;
+#endif
+
 
 #endif /* _NGX_FILES_H_INCLUDED_ */
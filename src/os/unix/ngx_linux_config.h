@@ -104,6 +104,11 @@ typedef struct iocb  ngx_aiocb_t;
 #endif
 
 
+#if (NGX_HAVE_INOTIFY)
+#include <sys/inotify.h>
+#endif
+
+
 #define NGX_LISTEN_BACKLOG        511
 
 
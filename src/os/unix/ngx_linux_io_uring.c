@@ -0,0 +1,603 @@
+
+/*
+ * Copyright (C) Igor Sysoev
+ * Copyright (C) Nginx, Inc.
+ */
+
+
+#include <ngx_config.h>
+#include <ngx_core.h>
+#include <ngx_event.h>
+#include <linux/io_uring.h>
+
+
+/*
+ * The ring is set up in a worker on the first request and is used for
+ * buffered reads and writes, which, unlike Linux AIO, do not require
+ * O_DIRECT.  Completions are signalled through an eventfd registered
+ * in the ring, so they are delivered by the event loop like any other
+ * event.
+ */
+
+
+#define NGX_IO_URING_ENTRIES  256
+
+
+typedef struct {
+    int                    fd;
+    int                    eventfd;
+
+    ngx_uint_t             entries;
+    ngx_uint_t             inflight;
+
+    unsigned              *sq_head;
+    unsigned              *sq_tail;
+    unsigned              *sq_mask;
+    unsigned              *sq_array;
+    struct io_uring_sqe   *sqes;
+
+    unsigned              *cq_head;
+    unsigned              *cq_tail;
+    unsigned              *cq_mask;
+    struct io_uring_cqe   *cqes;
+
+    unsigned               initialized:1;
+} ngx_io_uring_t;
+
+
+static ngx_uint_t ngx_io_uring_enabled(ngx_log_t *log);
+static ngx_int_t ngx_io_uring_init(ngx_log_t *log);
+static ngx_int_t ngx_io_uring_submit(ngx_event_aio_t *aio, u_char opcode,
+    void *addr, size_t len, off_t offset);
+static void ngx_io_uring_handler(ngx_event_t *ev);
+static void ngx_file_io_uring_event_handler(ngx_event_t *ev);
+
+
+ngx_uint_t                ngx_file_io_uring = 1;
+
+static ngx_io_uring_t     ngx_io_uring;
+static ngx_event_t        ngx_io_uring_event;
+static ngx_event_t        ngx_io_uring_dummy_event;
+static ngx_connection_t   ngx_io_uring_conn;
+
+
+/*
+ * We call io_uring_setup(), io_uring_enter(), and io_uring_register()
+ * directly as syscalls instead of liburing usage, as it is done for
+ * Linux AIO.
+ */
+
+static int
+io_uring_setup(u_int entries, struct io_uring_params *p)
+{
+    return syscall(SYS_io_uring_setup, entries, p);
+}
+
+
+static int
+io_uring_enter(int fd, u_int to_submit, u_int min_complete, u_int flags)
+{
+    return syscall(SYS_io_uring_enter, fd, to_submit, min_complete, flags,
+                   NULL, 0);
+}
+
+
+static int
+io_uring_register(int fd, u_int opcode, void *arg, u_int nr_args)
+{
+    return syscall(SYS_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+
+ssize_t
+ngx_file_io_uring_read(ngx_file_t *file, u_char *buf, size_t size,
+    off_t offset, ngx_pool_t *pool)
+{
+    ngx_int_t         rc;
+    ngx_event_t      *ev;
+    ngx_event_aio_t  *aio;
+
+    if (!ngx_io_uring_enabled(file->log)) {
+        return ngx_read_file(file, buf, size, offset);
+    }
+
+    if (file->aio == NULL && ngx_file_aio_init(file, pool) != NGX_OK) {
+        return NGX_ERROR;
+    }
+
+    aio = file->aio;
+    ev = &aio->event;
+
+    if (!ev->ready) {
+        ngx_log_error(NGX_LOG_ALERT, file->log, 0,
+                      "second io_uring post for \"%V\"", &file->name);
+        return NGX_AGAIN;
+    }
+
+    ngx_log_debug4(NGX_LOG_DEBUG_CORE, file->log, 0,
+                   "io_uring complete:%d @%O:%uz %V",
+                   ev->complete, offset, size, &file->name);
+
+    if (ev->complete) {
+        ev->active = 0;
+        ev->complete = 0;
+
+        if (aio->res >= 0) {
+            ngx_set_errno(0);
+            return aio->res;
+        }
+
+        ngx_set_errno(-aio->res);
+
+        ngx_log_error(NGX_LOG_CRIT, file->log, ngx_errno,
+                      "io_uring read \"%s\" failed", file->name.data);
+
+        return NGX_ERROR;
+    }
+
+    rc = ngx_io_uring_submit(aio, IORING_OP_READ, buf, size, offset);
+
+    if (rc == NGX_DECLINED) {
+        return ngx_read_file(file, buf, size, offset);
+    }
+
+    if (rc == NGX_ERROR) {
+        return NGX_ERROR;
+    }
+
+    return NGX_AGAIN;
+}
+
+
+/*
+ * The chain is written with one writev operation, the iovecs are kept
+ * with the file until it completes; a chain of more bufs than fit
+ * there is written synchronously.  As with ngx_write_chain_to_file(),
+ * a short write is an error.  Writes have their own aio, as a temp
+ * file being written may be read at the same time, and a completed
+ * read may wait there until the output is ready to take it.
+ */
+
+ssize_t
+ngx_file_io_uring_write_chain(ngx_file_t *file, ngx_chain_t *cl,
+    off_t offset, ngx_pool_t *pool)
+{
+    size_t            size;
+    ngx_int_t         rc;
+    ngx_iovec_t       vec;
+    ngx_event_t      *ev;
+    ngx_event_aio_t  *aio;
+
+    aio = file->write_aio;
+
+    if (aio == NULL) {
+
+        if (!ngx_io_uring_enabled(file->log)) {
+            return ngx_write_chain_to_file(file, cl, offset, pool);
+        }
+
+        aio = ngx_pcalloc(pool, sizeof(ngx_event_aio_t));
+        if (aio == NULL) {
+            return NGX_ERROR;
+        }
+
+        aio->file = file;
+        aio->fd = file->fd;
+        aio->event.data = aio;
+        aio->event.ready = 1;
+        aio->event.log = file->log;
+
+        aio->iovs = ngx_palloc(pool,
+                               NGX_IOVS_PREALLOCATE * sizeof(struct iovec));
+        if (aio->iovs == NULL) {
+            return NGX_ERROR;
+        }
+
+        file->write_aio = aio;
+    }
+
+    ev = &aio->event;
+
+    if (!ev->ready) {
+        ngx_log_error(NGX_LOG_ALERT, file->log, 0,
+                      "second io_uring post for \"%V\"", &file->name);
+        return NGX_AGAIN;
+    }
+
+    ngx_log_debug4(NGX_LOG_DEBUG_CORE, file->log, 0,
+                   "io_uring write complete:%d %p @%O %V",
+                   ev->complete, cl, offset, &file->name);
+
+    if (ev->complete) {
+        ev->active = 0;
+        ev->complete = 0;
+
+        size = aio->size;
+
+        if (aio->res < 0) {
+            ngx_set_errno(-aio->res);
+
+            ngx_log_error(NGX_LOG_CRIT, file->log, ngx_errno,
+                          "io_uring write \"%s\" failed", file->name.data);
+            return NGX_ERROR;
+        }
+
+        if ((size_t) aio->res != size) {
+            ngx_log_error(NGX_LOG_CRIT, file->log, 0,
+                          "io_uring write \"%s\" has written only %L of %uz",
+                          file->name.data, aio->res, size);
+            return NGX_ERROR;
+        }
+
+        file->offset += size;
+
+        return size;
+    }
+
+    if (!ngx_file_io_uring) {
+        return ngx_write_chain_to_file(file, cl, offset, pool);
+    }
+
+    vec.iovs = aio->iovs;
+    vec.nalloc = NGX_IOVS_PREALLOCATE;
+
+    if (ngx_chain_to_iovec(&vec, cl) != NULL || vec.size == 0) {
+        return ngx_write_chain_to_file(file, cl, offset, pool);
+    }
+
+    rc = ngx_io_uring_submit(aio, IORING_OP_WRITEV, vec.iovs, vec.count,
+                             offset);
+
+    if (rc == NGX_DECLINED) {
+        return ngx_write_chain_to_file(file, cl, offset, pool);
+    }
+
+    if (rc == NGX_ERROR) {
+        return NGX_ERROR;
+    }
+
+    aio->size = vec.size;
+
+    file->write_aio_handler(file);
+
+    return NGX_AGAIN;
+}
+
+
+/*
+ * the ring is set up on the first use only once, a failure disables
+ * io_uring in the worker, so the setup is not retried on each request
+ */
+
+static ngx_uint_t
+ngx_io_uring_enabled(ngx_log_t *log)
+{
+    if (ngx_io_uring.initialized) {
+        return 1;
+    }
+
+    if (!ngx_file_io_uring) {
+        return 0;
+    }
+
+    if (ngx_io_uring_init(log) != NGX_OK) {
+        ngx_file_io_uring = 0;
+        return 0;
+    }
+
+    return 1;
+}
+
+
+/*
+ * returns NGX_DECLINED if the operation is to be done synchronously,
+ * as the queue is full or the kernel is short of resources
+ */
+
+static ngx_int_t
+ngx_io_uring_submit(ngx_event_aio_t *aio, u_char opcode, void *addr,
+    size_t len, off_t offset)
+{
+    u_int                 tail, index;
+    ngx_err_t             err;
+    ngx_file_t           *file;
+    ngx_event_t          *ev;
+    struct io_uring_sqe  *sqe;
+
+    file = aio->file;
+    ev = &aio->event;
+
+    if (ngx_io_uring.inflight >= ngx_io_uring.entries) {
+        ngx_log_debug0(NGX_LOG_DEBUG_CORE, file->log, 0,
+                       "io_uring queue is full");
+        return NGX_DECLINED;
+    }
+
+    tail = *ngx_io_uring.sq_tail;
+    index = tail & *ngx_io_uring.sq_mask;
+
+    sqe = &ngx_io_uring.sqes[index];
+
+    ngx_memzero(sqe, sizeof(struct io_uring_sqe));
+
+    sqe->opcode = opcode;
+    sqe->fd = file->fd;
+    sqe->off = offset;
+    sqe->addr = (uint64_t) (uintptr_t) addr;
+    sqe->len = len;
+    sqe->user_data = (uint64_t) (uintptr_t) ev;
+
+    ngx_io_uring.sq_array[index] = index;
+
+    __atomic_store_n(ngx_io_uring.sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    if (io_uring_enter(ngx_io_uring.fd, 1, 0, 0) != 1) {
+        err = ngx_errno;
+
+        /* the entry was not consumed by the kernel, so it is taken back */
+
+        __atomic_store_n(ngx_io_uring.sq_tail, tail, __ATOMIC_RELEASE);
+
+        if (err == NGX_EAGAIN || err == NGX_EBUSY || err == NGX_EINTR) {
+            return NGX_DECLINED;
+        }
+
+        ngx_log_error(NGX_LOG_CRIT, file->log, err,
+                      "io_uring_enter(\"%V\") failed", &file->name);
+
+        return NGX_ERROR;
+    }
+
+    ev->handler = ngx_file_io_uring_event_handler;
+
+    ev->active = 1;
+    ev->ready = 0;
+    ev->complete = 0;
+
+    aio->start = ngx_current_msec;
+
+    ngx_io_uring.inflight++;
+
+#if (NGX_STAT_STUB)
+    (void) ngx_atomic_fetch_add(ngx_stat_io_uring_depth, 1);
+#endif
+
+    return NGX_OK;
+}
+
+
+static ngx_int_t
+ngx_io_uring_init(ngx_log_t *log)
+{
+    int                      fd, efd;
+    u_char                  *sq, *cq;
+    size_t                   sq_size, cq_size;
+    ngx_err_t                err;
+    struct io_uring_sqe     *sqes;
+    struct io_uring_params   p;
+
+    ngx_memzero(&p, sizeof(struct io_uring_params));
+
+    fd = io_uring_setup(NGX_IO_URING_ENTRIES, &p);
+
+    if (fd == -1) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      "io_uring_setup() failed, io_uring is disabled");
+        return NGX_ERROR;
+    }
+
+    sq = MAP_FAILED;
+    cq = MAP_FAILED;
+    sqes = MAP_FAILED;
+    efd = -1;
+
+    sq_size = p.sq_off.array + p.sq_entries * sizeof(u_int);
+    cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        sq_size = ngx_max(sq_size, cq_size);
+    }
+
+    sq = mmap(NULL, sq_size, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+              fd, IORING_OFF_SQ_RING);
+
+    if (sq == MAP_FAILED) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      "mmap(IORING_OFF_SQ_RING) failed");
+        goto failed;
+    }
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        cq = sq;
+
+    } else {
+        cq = mmap(NULL, cq_size, PROT_READ|PROT_WRITE,
+                  MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+
+        if (cq == MAP_FAILED) {
+            ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                          "mmap(IORING_OFF_CQ_RING) failed");
+            goto failed;
+        }
+    }
+
+    sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe),
+                PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+                fd, IORING_OFF_SQES);
+
+    if (sqes == MAP_FAILED) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      "mmap(IORING_OFF_SQES) failed");
+        goto failed;
+    }
+
+    efd = eventfd(0, 0);
+
+    if (efd == -1) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno, "eventfd() failed");
+        goto failed;
+    }
+
+    if (ngx_nonblocking(efd) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      ngx_nonblocking_n " eventfd failed");
+        goto failed;
+    }
+
+    if (io_uring_register(fd, IORING_REGISTER_EVENTFD, &efd, 1) == -1) {
+        ngx_log_error(NGX_LOG_ALERT, log, ngx_errno,
+                      "io_uring_register(IORING_REGISTER_EVENTFD) failed");
+        goto failed;
+    }
+
+    ngx_io_uring.fd = fd;
+    ngx_io_uring.eventfd = efd;
+
+    /* the completion queue is twice as large, so it cannot overflow */
+
+    ngx_io_uring.entries = p.sq_entries;
+    ngx_io_uring.inflight = 0;
+
+    ngx_io_uring.sq_head = (u_int *) (sq + p.sq_off.head);
+    ngx_io_uring.sq_tail = (u_int *) (sq + p.sq_off.tail);
+    ngx_io_uring.sq_mask = (u_int *) (sq + p.sq_off.ring_mask);
+    ngx_io_uring.sq_array = (u_int *) (sq + p.sq_off.array);
+    ngx_io_uring.sqes = sqes;
+
+    ngx_io_uring.cq_head = (u_int *) (cq + p.cq_off.head);
+    ngx_io_uring.cq_tail = (u_int *) (cq + p.cq_off.tail);
+    ngx_io_uring.cq_mask = (u_int *) (cq + p.cq_off.ring_mask);
+    ngx_io_uring.cqes = (struct io_uring_cqe *) (cq + p.cq_off.cqes);
+
+    ngx_io_uring_event.data = &ngx_io_uring_conn;
+    ngx_io_uring_event.handler = ngx_io_uring_handler;
+    ngx_io_uring_event.log = ngx_cycle->log;
+
+    ngx_io_uring_dummy_event.data = &ngx_io_uring_conn;
+    ngx_io_uring_dummy_event.write = 1;
+    ngx_io_uring_dummy_event.log = ngx_cycle->log;
+
+    ngx_io_uring_conn.fd = efd;
+    ngx_io_uring_conn.read = &ngx_io_uring_event;
+    ngx_io_uring_conn.write = &ngx_io_uring_dummy_event;
+    ngx_io_uring_conn.log = ngx_cycle->log;
+
+    if (ngx_add_event(&ngx_io_uring_event, NGX_READ_EVENT, NGX_CLEAR_EVENT)
+        == NGX_ERROR)
+    {
+        goto failed;
+    }
+
+    ngx_io_uring.initialized = 1;
+
+    ngx_log_debug3(NGX_LOG_DEBUG_EVENT, log, 0,
+                   "io_uring: %d entries:%ui eventfd:%d",
+                   fd, ngx_io_uring.entries, efd);
+
+    return NGX_OK;
+
+failed:
+
+    err = ngx_errno;
+
+    if (efd != -1) {
+        (void) close(efd);
+    }
+
+    if (sqes != MAP_FAILED) {
+        (void) munmap(sqes, p.sq_entries * sizeof(struct io_uring_sqe));
+    }
+
+    if (cq != MAP_FAILED && cq != sq) {
+        (void) munmap(cq, cq_size);
+    }
+
+    if (sq != MAP_FAILED) {
+        (void) munmap(sq, sq_size);
+    }
+
+    (void) close(fd);
+
+    ngx_set_errno(err);
+
+    ngx_memzero(&ngx_io_uring, sizeof(ngx_io_uring_t));
+
+    return NGX_ERROR;
+}
+
+
+static void
+ngx_io_uring_handler(ngx_event_t *ev)
+{
+    u_int                 head, tail;
+    ssize_t               n;
+    uint64_t              ready;
+    ngx_event_t          *e;
+    ngx_event_aio_t      *aio;
+    struct io_uring_cqe  *cqe;
+
+    n = read(ngx_io_uring.eventfd, &ready, 8);
+
+    ngx_log_debug1(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                   "io_uring eventfd: %z", n);
+
+    if (n == -1 && ngx_errno != NGX_EAGAIN) {
+        ngx_log_error(NGX_LOG_ALERT, ev->log, ngx_errno,
+                      "read(io_uring eventfd) failed");
+    }
+
+    head = *ngx_io_uring.cq_head;
+
+    for ( ;; ) {
+        tail = __atomic_load_n(ngx_io_uring.cq_tail, __ATOMIC_ACQUIRE);
+
+        if (head == tail) {
+            break;
+        }
+
+        cqe = &ngx_io_uring.cqes[head & *ngx_io_uring.cq_mask];
+
+        ngx_log_debug2(NGX_LOG_DEBUG_EVENT, ev->log, 0,
+                       "io_uring cqe: %XL %d",
+                       (uint64_t) cqe->user_data, cqe->res);
+
+        e = (ngx_event_t *) (uintptr_t) cqe->user_data;
+
+        e->complete = 1;
+        e->active = 0;
+        e->ready = 1;
+
+        aio = e->data;
+        aio->res = cqe->res;
+
+        ngx_io_uring.inflight--;
+
+#if (NGX_STAT_STUB)
+        (void) ngx_atomic_fetch_add(ngx_stat_io_uring_depth, -1);
+        (void) ngx_atomic_fetch_add(ngx_stat_io_uring_requests, 1);
+        (void) ngx_atomic_fetch_add(ngx_stat_io_uring_latency,
+                                    ngx_current_msec - aio->start);
+#endif
+
+        ngx_post_event(e, &ngx_posted_events);
+
+        head++;
+
+        __atomic_store_n(ngx_io_uring.cq_head, head, __ATOMIC_RELEASE);
+    }
+}
+
+
+static void
+ngx_file_io_uring_event_handler(ngx_event_t *ev)
+{
+    ngx_event_aio_t  *aio;
+
+    aio = ev->data;
+
+    ngx_log_debug2(NGX_LOG_DEBUG_CORE, ev->log, 0,
+                   "io_uring event handler fd:%d %V",
+                   aio->fd, &aio->file->name);
+
+    aio->handler(ev);
+}
@@ -20,6 +20,8 @@ static ssize_t ngx_linux_sendfile(ngx_connection_t *c, ngx_buf_t *file,
 #error sendfile64() is required!
 #endif
 
+static size_t ngx_linux_sendfile_cached(ngx_connection_t *c, ngx_buf_t *file,
+    size_t size);
 static ssize_t ngx_linux_sendfile_thread(ngx_connection_t *c, ngx_buf_t *file,
     size_t size);
 static void ngx_linux_sendfile_thread_handler(void *data, ngx_log_t *log);
@@ -43,6 +45,14 @@ static void ngx_linux_sendfile_thread_handler(void *data, ngx_log_t *log);
 #define NGX_SENDFILE_MAXSIZE  2147483647L
 
 
+/*
+ * with threads, the part of a range up to this size found in the page
+ * cache is sent inline, otherwise sendfile() is done in a thread
+ */
+
+#define NGX_SENDFILE_NOWAIT_SIZE  (256 * 1024)
+
+
 ngx_chain_t *
 ngx_linux_sendfile_chain(ngx_connection_t *c, ngx_chain_t *in, off_t limit)
 {
@@ -236,11 +246,22 @@ ngx_linux_sendfile(ngx_connection_t *c, ngx_buf_t *file, size_t size)
 #endif
     ssize_t    n;
     ngx_err_t  err;
+#if (NGX_THREADS)
+    size_t     cached;
+#endif
 
 #if (NGX_THREADS)
 
+    cached = 0;
+
     if (file->file->thread_handler) {
-        return ngx_linux_sendfile_thread(c, file, size);
+        cached = ngx_linux_sendfile_cached(c, file, size);
+
+        if (cached == 0) {
+            return ngx_linux_sendfile_thread(c, file, size);
+        }
+
+        size = cached;
     }
 
 #endif
@@ -295,12 +316,61 @@ eintr:
     ngx_log_debug3(NGX_LOG_DEBUG_EVENT, c->log, 0, "sendfile: %z of %uz @%O",
                    n, size, file->file_pos);
 
+#if (NGX_THREADS && NGX_STAT_STUB)
+
+    if (cached) {
+        (void) ngx_atomic_fetch_add(ngx_stat_file_inline, n);
+    }
+
+#endif
+
     return n;
 }
 
 
 #if (NGX_THREADS)
 
+static size_t
+ngx_linux_sendfile_cached(ngx_connection_t *c, ngx_buf_t *file, size_t size)
+{
+#if (NGX_HAVE_PREADV2_NOWAIT)
+    ngx_thread_task_t  *task;
+
+    task = c->sendfile_task;
+
+    if (task && (task->event.active || task->event.complete)) {
+        return 0;
+    }
+
+    if (size > NGX_SENDFILE_NOWAIT_SIZE) {
+        size = NGX_SENDFILE_NOWAIT_SIZE;
+    }
+
+    /*
+     * only the first and the last pages of the range are probed, a cold
+     * page in the middle blocks the worker in sendfile(), which is rare,
+     * as files are usually read and evicted sequentially
+     */
+
+    size = ngx_file_cached(file->file, size, file->file_pos);
+
+    if (size == 0) {
+        return 0;
+    }
+
+    ngx_log_debug2(NGX_LOG_DEBUG_EVENT, c->log, 0,
+                   "sendfile: %uz cached @%O", size, file->file_pos);
+
+    return size;
+
+#else
+
+    return 0;
+
+#endif
+}
+
+
 typedef struct {
     ngx_buf_t     *file;
     ngx_socket_t   socket;
@@ -374,6 +444,10 @@ ngx_linux_sendfile_thread(ngx_connection_t *c, ngx_buf_t *file, size_t size)
             return NGX_ERROR;
         }
 
+#if (NGX_STAT_STUB)
+        (void) ngx_atomic_fetch_add(ngx_stat_file_offloaded, ctx->sent);
+#endif
+
         return ctx->sent;
     }
 
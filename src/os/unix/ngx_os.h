@@ -70,6 +70,7 @@ typedef struct {
 
 ngx_chain_t *ngx_output_chain_to_iovec(ngx_iovec_t *vec, ngx_chain_t *in,
     size_t limit, ngx_log_t *log);
+ngx_chain_t *ngx_chain_to_iovec(ngx_iovec_t *vec, ngx_chain_t *cl);
 
 
 ssize_t ngx_writev(ngx_connection_t *c, ngx_iovec_t *vec);
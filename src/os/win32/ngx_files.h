@@ -169,6 +169,7 @@ ngx_int_t ngx_file_info(u_char *filename, ngx_file_info_t *fi);
                                           - 116444736000000000) / 10000000)
 
 ngx_int_t ngx_create_file_mapping(ngx_file_mapping_t *fm);
+ngx_int_t ngx_open_file_mapping(ngx_file_mapping_t *fm);
 void ngx_close_file_mapping(ngx_file_mapping_t *fm);
 
 
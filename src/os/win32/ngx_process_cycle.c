@@ -835,7 +835,7 @@ ngx_worker_process_exit(ngx_cycle_t *cycle)
 
     if (ngx_exiting) {
         c = cycle->connections;
-        for (i = 0; i < cycle->connection_n; i++) {
+        for (i = 0; i < cycle->init_connection_n; i++) {
             if (c[i].fd != (ngx_socket_t) -1
                 && c[i].read
                 && !c[i].read->accept
@@ -521,6 +521,16 @@ ngx_stream_geo_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
             goto failed;
         }
 #endif
+
+        if (ngx_radix_tree_compile(ctx.tree) != NGX_OK) {
+            goto failed;
+        }
+
+#if (NGX_HAVE_INET6)
+        if (ngx_radix_tree_compile(ctx.tree6) != NGX_OK) {
+            goto failed;
+        }
+#endif
     }
 
     ngx_destroy_pool(ctx.temp_pool);
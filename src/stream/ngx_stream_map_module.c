@@ -184,6 +184,10 @@ ngx_stream_map_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     ngx_stream_variable_t               *var;
     ngx_stream_map_conf_ctx_t            ctx;
     ngx_stream_compile_complex_value_t   ccv;
+#if (NGX_PCRE)
+    ngx_uint_t                           i;
+    ngx_regex_t                        **rep;
+#endif
 
     if (mcf->hash_max_size == NGX_CONF_UNSET_UINT) {
         mcf->hash_max_size = 2048;
@@ -354,6 +358,23 @@ ngx_stream_map_block(ngx_conf_t *cf, ngx_command_t *cmd, void *conf)
     if (ctx.regexes.nelts) {
         map->map.regex = ctx.regexes.elts;
         map->map.nregex = ctx.regexes.nelts;
+
+        rep = ngx_palloc(cf->pool, map->map.nregex * sizeof(ngx_regex_t *));
+        if (rep == NULL) {
+            ngx_destroy_pool(pool);
+            return NGX_CONF_ERROR;
+        }
+
+        for (i = 0; i < map->map.nregex; i++) {
+            rep[i] = map->map.regex[i].regex->regex;
+        }
+
+        map->map.regex_set = ngx_regex_set_create(cf->pool, rep,
+                                                  map->map.nregex);
+        if (map->map.regex_set == NULL) {
+            ngx_destroy_pool(pool);
+            return NGX_CONF_ERROR;
+        }
     }
 
 #endif
@@ -12,6 +12,7 @@
 
 typedef struct {
     ngx_array_t       *from;     /* array of ngx_cidr_t */
+    ngx_cidr_tree_t   *from_tree;
 } ngx_stream_realip_srv_conf_t;
 
 
@@ -112,7 +113,7 @@ ngx_stream_realip_handler(ngx_stream_session_t *s)
         return NGX_DECLINED;
     }
 
-    if (ngx_cidr_match(c->sockaddr, rscf->from) != NGX_OK) {
+    if (ngx_cidr_tree_match(c->sockaddr, rscf->from_tree) != NGX_OK) {
         return NGX_DECLINED;
     }
 
@@ -290,6 +291,7 @@ ngx_stream_realip_create_srv_conf(ngx_conf_t *cf)
      * set by ngx_pcalloc():
      *
      *     conf->from = NULL;
+     *     conf->from_tree = NULL;
      */
 
     return conf;
@@ -303,7 +305,24 @@ ngx_stream_realip_merge_srv_conf(ngx_conf_t *cf, void *parent, void *child)
     ngx_stream_realip_srv_conf_t *conf = child;
 
     if (conf->from == NULL) {
+
+        /* the main level is not merged, so its tree is built here */
+
+        if (prev->from && prev->from_tree == NULL) {
+            prev->from_tree = ngx_cidr_tree_create(cf->pool, prev->from);
+            if (prev->from_tree == NULL) {
+                return NGX_CONF_ERROR;
+            }
+        }
+
         conf->from = prev->from;
+        conf->from_tree = prev->from_tree;
+
+    } else if (conf->from_tree == NULL) {
+        conf->from_tree = ngx_cidr_tree_create(cf->pool, conf->from);
+        if (conf->from_tree == NULL) {
+            return NGX_CONF_ERROR;
+        }
     }
 
     return NGX_CONF_OK;
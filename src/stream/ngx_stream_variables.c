@@ -916,12 +916,23 @@ ngx_stream_map_find(ngx_stream_session_t *s, ngx_stream_map_t *map,
     if (len && map->nregex) {
         ngx_int_t                n;
         ngx_uint_t               i;
+        uintptr_t               *candidates;
         ngx_stream_map_regex_t  *reg;
 
         reg = map->regex;
 
+        /* the regular expressions which cannot match are skipped */
+
+        candidates = map->regex_set
+                     ? ngx_regex_set_match(map->regex_set, match)
+                     : NULL;
+
         for (i = 0; i < map->nregex; i++) {
 
+            if (!ngx_regex_set_candidate(candidates, i)) {
+                continue;
+            }
+
             n = ngx_stream_regex_exec(s, reg[i].regex, match);
 
             if (n == NGX_OK) {